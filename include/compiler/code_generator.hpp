@@ -22,6 +22,7 @@
 #include "linker/module.hpp"
 #include <vector>
 #include <string>
+#include <utility>
 
 
 namespace rho {
@@ -78,6 +79,7 @@ namespace rho {
     
   private:
     void add_reloc (int lbl);
+    void put_field_table (const std::vector<std::pair<std::string, int>>& tbl);
     
   public:
     code_generator ();
@@ -159,6 +161,7 @@ namespace rho {
     void emit_and ();
     void emit_or ();
     void emit_not ();
+    void emit_format (const std::string& prog);
     
     void emit_get_arg_pack ();
     void emit_mk_fn (int lbl);
@@ -194,6 +197,17 @@ namespace rho {
     void emit_car ();
     void emit_cdr ();
     
+    void emit_mk_promise ();
+    void emit_force (int lbl);
+    void emit_fulfil ();
+    
+    void emit_resume ();
+    void emit_yield ();
+    
+    void emit_memo_init (unsigned int cap, unsigned char flags);
+    void emit_memo_enter ();
+    void emit_memo_leave (unsigned char localc);
+    
     void emit_push_pvar (int pv);
     void emit_match (int loff);
     
@@ -211,6 +225,12 @@ namespace rho {
     void emit_vec_get_hard (unsigned short index);
     void emit_vec_get ();
     void emit_vec_set ();
+    void emit_mk_map (unsigned short count);
+    
+    // records are tagged by atoms; every tag is relocated by name.
+    void emit_mk_record (const std::string& tag, unsigned char count);
+    void emit_get_field (const std::vector<std::pair<std::string, int>>& tbl);
+    void emit_set_field (const std::vector<std::pair<std::string, int>>& tbl);
     
     void emit_alloc_globals (unsigned short page, unsigned short count, bool emit_reloc = true);
     void emit_get_global (unsigned short page, unsigned short idx, bool emit_reloc = true);
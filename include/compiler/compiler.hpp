@@ -31,6 +31,10 @@
 
 namespace rho {
   
+  // forward decs:
+  class virtual_machine;
+  
+  
   /* 
    * Used to implement tail-call optimizations.
    */
@@ -64,6 +68,7 @@ namespace rho {
   {
     code_generator cgen;
     std::stack<expr_frame> expr_frames;
+    std::stack<bool> memo_frames; // whether each enclosing function is `memo'
     error_list errs;
     std::shared_ptr<var_analysis> van;
     std::shared_ptr<ast_program> prg_ast;
@@ -93,6 +98,13 @@ namespace rho {
     std::unordered_set<std::string> atoms;
     std::unordered_set<std::string> known_atoms;
     std::unordered_set<std::shared_ptr<fun_prototype>> known_protos;
+    
+    // record types (qualified name -> field names)
+    std::unordered_map<std::string, std::vector<std::string>> records;
+    std::unordered_map<std::string, std::vector<std::string>> known_records;
+    
+    bool fusion_on;
+    virtual_machine *fold_vm; // evaluates foldable natives (lazily created)
   
   public:
     inline error_list& get_errors () { return this->errs; }
@@ -122,6 +134,12 @@ namespace rho {
      */
     void set_working_directory (const std::string& path);
     
+    /* 
+     * Enables or disables fusion of std:list/std:streams combinator chains
+     * (on by default).
+     */
+    inline void set_fusion (bool on) { this->fusion_on = on; }
+    
     
     
     // REPL stuff:
@@ -132,6 +150,9 @@ namespace rho {
     
     void add_known_atom (const std::string& name);
     
+    void add_known_record (const std::string& name,
+                           const std::vector<std::string>& fields);
+    
     void add_known_fun_proto (std::shared_ptr<fun_prototype> proto);
     
   private:
@@ -139,6 +160,8 @@ namespace rho {
     void pop_expr_frame ();
     bool can_perform_tail_call ();
     
+    void compile_memo_init (const ast_memo_opts& opts);
+    
     std::string qualify_name (const std::string& name,
                               std::shared_ptr<scope_frame> scope);
     std::string qualify_atom_name (const std::string& name,
@@ -149,6 +172,14 @@ namespace rho {
     void process_imports ();
     void process_import (std::shared_ptr<ast_import> stmt);
     
+    bool fuse_pipelines (std::shared_ptr<ast_program> program);
+    
+    void add_records (std::shared_ptr<ast_program> program);
+    const std::vector<std::string>* find_record (const std::string& name,
+                                                 std::string& qn);
+    bool find_field (std::shared_ptr<ast_field> expr,
+                     std::vector<std::pair<std::string, int>>& tbl);
+    
   private:
     void compile_program (std::shared_ptr<ast_program> program);
     
@@ -161,6 +192,7 @@ namespace rho {
     void compile_ret (std::shared_ptr<ast_ret> stmt);
     void compile_namespace (std::shared_ptr<ast_namespace> stmt);
     void compile_atom_def (std::shared_ptr<ast_atom_def> stmt);
+    void compile_record_def (std::shared_ptr<ast_record_def> stmt);
     void compile_stmt_block (std::shared_ptr<ast_stmt_block> stmt);
     void compile_using (std::shared_ptr<ast_using> stmt);
     void compile_fun_def (std::shared_ptr<ast_fun_def> stmt);
@@ -175,6 +207,7 @@ namespace rho {
     void compile_bool (std::shared_ptr<ast_bool> expr);
     void compile_unop (std::shared_ptr<ast_unop> expr);
     void compile_binop (std::shared_ptr<ast_binop> expr);
+    bool compile_format (std::shared_ptr<ast_binop> expr);
     void compile_fun (std::shared_ptr<ast_fun> expr);
     void compile_fun_call (std::shared_ptr<ast_fun_call> expr);
     void compile_if (std::shared_ptr<ast_if> expr);
@@ -182,10 +215,15 @@ namespace rho {
     void compile_list (std::shared_ptr<ast_list> expr);
     void compile_match (std::shared_ptr<ast_match> expr);
     void compile_vector (std::shared_ptr<ast_vector> expr);
+    void compile_map (std::shared_ptr<ast_map> expr);
+    void compile_field (std::shared_ptr<ast_field> expr);
+    bool try_compile_record_ctor (std::shared_ptr<ast_fun_call> expr);
     void compile_subscript (std::shared_ptr<ast_subscript> expr);
     void compile_expr_block (std::shared_ptr<ast_expr_block> expr);
     void compile_let (std::shared_ptr<ast_let> expr);
     void compile_n (std::shared_ptr<ast_n> expr);
+    void compile_delay (std::shared_ptr<ast_delay> expr);
+    void compile_yield (std::shared_ptr<ast_yield> expr);
     void compile_expr (std::shared_ptr<ast_expr> expr);
     
     void compile_assign (std::shared_ptr<ast_expr> lhs,
@@ -194,15 +232,21 @@ namespace rho {
                                   std::shared_ptr<ast_expr> rhs);
     void compile_assign_to_subscript (std::shared_ptr<ast_subscript> lhs,
                                       std::shared_ptr<ast_expr> rhs);
+    void compile_assign_to_field (std::shared_ptr<ast_field> lhs,
+                                  std::shared_ptr<ast_expr> rhs);
     
     
     bool compile_builtin (std::shared_ptr<ast_fun_call> expr);
+    void compile_pattern_fun_call (std::shared_ptr<ast_fun_call> expr);
     void compile_builtin_car (std::shared_ptr<ast_fun_call> expr);
     void compile_builtin_cdr (std::shared_ptr<ast_fun_call> expr);
     void compile_builtin_cons (std::shared_ptr<ast_fun_call> expr);
     void compile_builtin_breakpoint (std::shared_ptr<ast_fun_call> expr);
-    void compile_builtin_print (std::shared_ptr<ast_fun_call> expr);
-    void compile_builtin_len (std::shared_ptr<ast_fun_call> expr);
+    void compile_builtin_force (std::shared_ptr<ast_fun_call> expr);
+    void compile_builtin_resume (std::shared_ptr<ast_fun_call> expr);
+    void compile_builtin_native (std::shared_ptr<ast_fun_call> expr,
+                                 int index);
+    bool try_fold_native (std::shared_ptr<ast_fun_call> expr, int index);
   };
 }
 
@@ -84,6 +84,8 @@ namespace rho {
       { return this->nfrees; }
     
     std::vector<std::pair<std::string, int>> get_sorted_nfrees () const;
+    std::vector<std::string> get_own_nfrees () const;
+    int get_env_size () const;
     
     inline const std::unordered_set<std::string>&
     get_cfrees () const
@@ -103,7 +105,7 @@ namespace rho {
     void add_local ();
     int add_nfree (const std::string& name);
     void add_cfree (const std::string& name);
-    int get_nfree (const std::string& name);
+    int get_nfree (const std::string& name) const;
     
     /* 
      * Returns the index of the first local variable of the block at the
@@ -331,6 +333,7 @@ namespace rho {
     void analyze_ident (std::shared_ptr<ast_ident> node);
     void analyze_fun (std::shared_ptr<ast_fun> node);
     void analyze_vector (std::shared_ptr<ast_vector> node);
+    void analyze_map (std::shared_ptr<ast_map> node);
     void analyze_expr_stmt (std::shared_ptr<ast_expr_stmt> node);
     void analyze_unop (std::shared_ptr<ast_unop> node);
     void analyze_binop (std::shared_ptr<ast_binop> node);
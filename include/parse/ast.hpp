@@ -62,6 +62,11 @@ namespace rho {
     AST_LET,
     AST_N,
     AST_FUN_DEF,
+    AST_DELAY,
+    AST_YIELD,
+    AST_MAP,
+    AST_RECORD_DEF,
+    AST_FIELD,
   };
   
   
@@ -304,6 +309,37 @@ namespace rho {
   };
   
   
+  /* 
+   * Hash map literal: [k1 => v1, k2 => v2, ...]
+   */
+  class ast_map: public ast_expr
+  {
+    std::vector<std::pair<std::shared_ptr<ast_expr>,
+                          std::shared_ptr<ast_expr>>> entries;
+    
+  public:
+    inline std::vector<std::pair<std::shared_ptr<ast_expr>,
+      std::shared_ptr<ast_expr>>>& get_entries () { return this->entries; }
+    
+    virtual ast_node_type get_type () const override { return AST_MAP; }
+    
+  public:
+    void
+    add_entry (std::shared_ptr<ast_expr> key, std::shared_ptr<ast_expr> val)
+      { this->entries.emplace_back (key, val); }
+    
+    virtual std::shared_ptr<ast_node>
+    clone () const override
+    {
+      auto nc = std::shared_ptr<ast_map> (new ast_map ());
+      for (auto& e : this->entries)
+        nc->add_entry (std::static_pointer_cast<ast_expr> (e.first->clone ()),
+                       std::static_pointer_cast<ast_expr> (e.second->clone ()));
+      return nc;
+    }
+  };
+  
+  
   /* 
    * A sequence of statements.
    * A block's evaluation value is that of its last expression statement.
@@ -525,6 +561,18 @@ namespace rho {
   
   
   
+  /* 
+   * Options given to the `memo' annotation of a function.
+   */
+  struct ast_memo_opts
+  {
+    bool enabled = false;
+    long size = 0;        // 0 picks the default
+    bool weak = false;
+  };
+  
+  
+  
   /* 
    * Function literal of the form:
    *     fun (<params>) { <body> }
@@ -533,10 +581,12 @@ namespace rho {
   {
     std::vector<std::string> params;
     std::shared_ptr<ast_stmt_block> body;
+    ast_memo_opts memo;
     
   public:
     inline std::vector<std::string>& get_params () { return this->params; }
     inline std::shared_ptr<ast_stmt_block>& get_body () { return this->body; }
+    inline ast_memo_opts& get_memo () { return this->memo; }
     
     virtual ast_node_type get_type () const override { return AST_FUN; }
     
@@ -555,6 +605,7 @@ namespace rho {
       auto nc = std::shared_ptr<ast_fun> (new ast_fun ());
       nc->set_body (std::static_pointer_cast<ast_stmt_block> (this->body->clone ()));
       nc->params = this->params;
+      nc->memo = this->memo;
       return nc;
     }
   };
@@ -901,6 +952,39 @@ namespace rho {
   
   
   
+  /* 
+   * Record field access.
+   *     <expr>.<name>
+   */
+  class ast_field: public ast_expr
+  {
+    std::shared_ptr<ast_expr> expr;
+    std::string name;
+    
+  public:
+    inline std::shared_ptr<ast_expr> get_expr () { return this->expr; }
+    inline const std::string& get_name () const { return this->name; }
+    
+    virtual ast_node_type get_type () const override { return AST_FIELD; }
+    
+  public:
+    ast_field (std::shared_ptr<ast_expr> expr, const std::string& name)
+      : expr (expr), name (name)
+      { }
+    
+  public:
+    virtual std::shared_ptr<ast_node>
+    clone () const override
+    {
+      return std::shared_ptr<ast_node> (
+        new ast_field (
+          std::static_pointer_cast<ast_expr> (this->expr->clone ()),
+          this->name));
+    }
+  };
+  
+  
+  
   /* 
    * Atom.
    */
@@ -952,6 +1036,40 @@ namespace rho {
     }
   };
   
+  /* 
+   * Record type definition of the form:
+   *     record <name> (<fields>);
+   */
+  class ast_record_def: public ast_stmt
+  {
+    std::string name;
+    std::vector<std::string> fields;
+    
+  public:
+    inline const std::string& get_name () { return this->name; }
+    inline const std::vector<std::string>& get_fields () { return this->fields; }
+    
+    virtual ast_node_type get_type () const override { return AST_RECORD_DEF; }
+    
+  public:
+    ast_record_def (const std::string& name)
+      : name (name)
+      { }
+    
+  public:
+    void
+    add_field (const std::string& field)
+      { this->fields.push_back (field); }
+    
+    virtual std::shared_ptr<ast_node>
+    clone () const override
+    {
+      auto nc = std::shared_ptr<ast_record_def> (new ast_record_def (this->name));
+      nc->fields = this->fields;
+      return nc;
+    }
+  };
+  
   
   
   /* 
@@ -1093,6 +1211,68 @@ namespace rho {
   
   
   
+  /* 
+   * Delayed evaluation.
+   *     delay <expr>
+   * The expression is wrapped in a parameterless function that is stored in
+   * a promise and called the first time the promise is forced.
+   */
+  class ast_delay: public ast_expr
+  {
+    std::shared_ptr<ast_fun> fun;
+    
+  public:
+    inline std::shared_ptr<ast_fun>& get_fun () { return this->fun; }
+    
+    virtual ast_node_type get_type () const override { return AST_DELAY; }
+    
+  public:
+    ast_delay (std::shared_ptr<ast_fun> fun)
+      : fun (fun)
+      { }
+  
+  public:
+    virtual std::shared_ptr<ast_node>
+    clone () const override
+    {
+      return std::shared_ptr<ast_node> (new ast_delay (
+        std::static_pointer_cast<ast_fun> (this->fun->clone ())));
+    }
+  };
+  
+  
+  
+  /* 
+   * Suspends the running coroutine.
+   *     yield <expr>
+   * Evaluates to the value passed to the resume() call that continues the
+   * coroutine.
+   */
+  class ast_yield: public ast_expr
+  {
+    std::shared_ptr<ast_expr> expr;
+    
+  public:
+    inline std::shared_ptr<ast_expr>& get_expr () { return this->expr; }
+    
+    virtual ast_node_type get_type () const override { return AST_YIELD; }
+    
+  public:
+    ast_yield (std::shared_ptr<ast_expr> expr)
+      : expr (expr)
+      { }
+  
+  public:
+    virtual std::shared_ptr<ast_node>
+    clone () const override
+    {
+      return std::shared_ptr<ast_node> (new ast_yield (
+        std::static_pointer_cast<ast_expr> (this->expr->clone ())));
+    }
+  };
+  
+  
+  
   /* 
    * Named function definition statement.
    *     fun <name> (<params>...) { <body> } 
@@ -1103,12 +1283,14 @@ namespace rho {
     std::vector<std::string> params;
     std::shared_ptr<ast_stmt_block> body;
     std::shared_ptr<ast_expr> guard;
+    ast_memo_opts memo;
     
   public:
     inline const std::string& get_name () { return this->name; }
     inline std::vector<std::string>& get_params () { return this->params; }
     inline std::shared_ptr<ast_stmt_block>& get_body () { return this->body; }
     inline std::shared_ptr<ast_expr>& get_guard () { return this->guard; }
+    inline ast_memo_opts& get_memo () { return this->memo; }
     
     virtual ast_node_type get_type () const override { return AST_FUN_DEF; }
     
@@ -1139,6 +1321,7 @@ namespace rho {
         nc->set_guard (std::static_pointer_cast<ast_expr> (this->guard->clone ()));
       for (auto& p: this->params)
         nc->add_param (p);
+      nc->memo = this->memo;
       return nc;
     }
   };
@@ -84,6 +84,7 @@ namespace rho {
   {
     lexer_stream *strm;
     int ws_skipped;
+    token_type last_type; // type of the last token read
     
   public:
     class token_stream
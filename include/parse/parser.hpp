@@ -70,7 +70,10 @@ namespace rho {
     std::shared_ptr<ast_integer> parse_integer (lexer::token_stream& strm);
     std::shared_ptr<ast_float> parse_float (lexer::token_stream& strm);
     std::shared_ptr<ast_ident> parse_ident (lexer::token_stream& strm);
-    std::shared_ptr<ast_vector> parse_vector (lexer::token_stream& strm);
+    std::shared_ptr<ast_expr> parse_vector (lexer::token_stream& strm);
+    std::shared_ptr<ast_map> parse_map_rest (std::shared_ptr<ast_expr> first,
+                                             const token& ftok,
+                                             lexer::token_stream& strm);
     std::shared_ptr<ast_atom> parse_atom (lexer::token_stream& strm);
     std::shared_ptr<ast_string> parse_string (lexer::token_stream& strm);
     
@@ -91,8 +94,14 @@ namespace rho {
     std::shared_ptr<ast_match> parse_match (lexer::token_stream& strm);
     std::shared_ptr<ast_subscript> parse_subscript (std::shared_ptr<ast_expr> expr,
                                                     lexer::token_stream& strm);
+    std::shared_ptr<ast_expr> parse_field (std::shared_ptr<ast_expr> expr,
+                                           lexer::token_stream& strm);
     std::shared_ptr<ast_let> parse_let (lexer::token_stream& strm);
     std::shared_ptr<ast_n> parse_n (lexer::token_stream& strm);
+    std::shared_ptr<ast_delay> parse_delay (lexer::token_stream& strm);
+    std::shared_ptr<ast_yield> parse_yield (lexer::token_stream& strm);
+    ast_memo_opts parse_memo (lexer::token_stream& strm);
+    std::shared_ptr<ast_fun> parse_memo_fun (lexer::token_stream& strm);
     std::shared_ptr<ast_expr> parse_expr (lexer::token_stream& strm);
     
     std::shared_ptr<ast_expr_stmt> parse_expr_stmt (lexer::token_stream& strm,
@@ -111,6 +120,8 @@ namespace rho {
                                                   bool in_block = false);
     std::shared_ptr<ast_using> parse_using (lexer::token_stream& strm,
                                             bool in_block = false);
+    std::shared_ptr<ast_record_def> parse_record_def (lexer::token_stream& strm,
+                                                      bool in_block = false);
     std::shared_ptr<ast_fun_def> parse_fun_def (lexer::token_stream& strm);
     std::shared_ptr<ast_stmt> parse_stmt (lexer::token_stream& strm,
                                           bool in_block = false);
@@ -59,6 +59,7 @@ namespace rho {
     TOK_NOT,          // !
     TOK_COL,          // :
     TOK_DEF,          // :=
+    TOK_FIELD,        // . (field access, e.g. p.x)
     
     // datums:
     TOK_INTEGER,
@@ -88,6 +89,10 @@ namespace rho {
     TOK_LET,
     TOK_IN,
     TOK_N,
+    TOK_DELAY,
+    TOK_YIELD,
+    TOK_MEMO,
+    TOK_RECORD,
   };
   
   
@@ -19,6 +19,8 @@
 #ifndef _RHO__RUNTIME__BUILTINS__H_
 #define _RHO__RUNTIME__BUILTINS__H_
 
+#include <string>
+
 
 namespace rho {
   
@@ -27,9 +29,360 @@ namespace rho {
   struct rho_value;
   
   
-  rho_value rho_builtin_print (rho_value& p, virtual_machine& vm);
+  
+//------------------------------------------------------------------------------
+  // Native function registry:
+  
+  /* 
+   * The ABI shared by all natives callable through the builtin instruction.
+   * :args: points to the :argc: arguments on the VM's stack, first argument
+   * first.
+   * 
+   * A value allocated by the native must be returned GC-protected, and the
+   * VM unprotects it once it is on the stack.  Only the returned object
+   * itself is unprotected, so anything allocated along with it and stored
+   * inside it must have been unprotected (or otherwise made reachable) by
+   * the native.  Values that were already reachable (arguments, values
+   * stored elsewhere, results of vm.call()) are returned as they are.
+   */
+  typedef rho_value (*native_fn) (rho_value *args, int argc,
+                                  virtual_machine& vm);
+  
+  enum native_flags: unsigned
+  {
+    // no side effects, and the result depends only on the arguments.
+    NATIVE_PURE = 1,
+    
+    // pure and cheap enough to be evaluated by the compiler when all of its
+    // arguments are literals.
+    NATIVE_FOLDABLE = 2 | NATIVE_PURE,
+  };
+  
+  struct native_entry
+  {
+    const char *name;
+    native_fn fn;
+    int min_args;
+    int max_args; // -1 if variadic
+    unsigned flags;
+  };
+  
+  /* 
+   * Returns the native registered at the specified builtin index, or null
+   * if the index is out of range.
+   */
+  const native_entry* rho_native_get (int index);
+  
+  /* 
+   * Looks up a native by name.  Returns its builtin index, or -1 if there
+   * is no such native.
+   */
+  int rho_native_find (const std::string& name);
+  
+  
+  
+  rho_value rho_builtin_print (rho_value *args, int argc, virtual_machine& vm);
+  
+  rho_value rho_builtin_write (rho_value *args, int argc, virtual_machine& vm);
   
   rho_value rho_builtin_len (rho_value& p, virtual_machine& vm);
+  
+  
+  // 
+  // Packed arrays (f64vec/i64vec):
+  // 
+  
+  rho_value rho_builtin_f64vec (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_i64vec (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mmap_array (rho_value& path, rho_value& dtype,
+                                    virtual_machine& vm);
+  
+  rho_value rho_builtin_vadd (rho_value& a, rho_value& b, virtual_machine& vm);
+  
+  rho_value rho_builtin_vmul (rho_value& a, rho_value& b, virtual_machine& vm);
+  
+  rho_value rho_builtin_vfma (rho_value& a, rho_value& b, rho_value& c,
+                              virtual_machine& vm);
+  
+  rho_value rho_builtin_dot (rho_value& a, rho_value& b, virtual_machine& vm);
+  
+  rho_value rho_builtin_vsum (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_vmin (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_vmax (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_norm (rho_value& p, virtual_machine& vm);
+  
+  
+  rho_value rho_builtin_clock (virtual_machine& vm);
+  
+  
+  // 
+  // Matrices:
+  // 
+  
+  rho_value rho_builtin_mat_make (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_zeros (rho_value& rows, rho_value& cols,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_rows (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_cols (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_get (rho_value& m, rho_value& i, rho_value& j,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_set (rho_value& m, rho_value& i, rho_value& j,
+                                 rho_value& x, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_mul (rho_value& a, rho_value& b,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_transpose (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_lu (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_solve (rho_value& a, rho_value& b,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_mat_det (rho_value& p, virtual_machine& vm);
+  
+  
+  // 
+  // Polynomials:
+  // 
+  
+  rho_value rho_builtin_poly_make (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_coeffs (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_deg (rho_value& p, virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_add (rho_value& a, rho_value& b,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_sub (rho_value& a, rho_value& b,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_mul (rho_value& a, rho_value& b,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_divrem (rho_value& a, rho_value& b,
+                                     virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_gcd (rho_value& a, rho_value& b,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_poly_eval (rho_value& p, rho_value& x,
+                                   virtual_machine& vm);
+  
+  
+  // 
+  // Symbolic expressions:
+  // 
+  
+  rho_value rho_builtin_expr_sym (rho_value& name, virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_fn (rho_value& name, rho_value& args,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_simplify (rho_value& e, virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_diff (rho_value& e, rho_value& x,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_op (rho_value& e, virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_args (rho_value& e, virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_make (rho_value& op, rho_value& args,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_expr_nodes (virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Coroutines:
+  
+  rho_value rho_builtin_coroutine (rho_value& fn, virtual_machine& vm);
+  
+  rho_value rho_builtin_co_done (rho_value& co, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Miscellaneous:
+  
+  rho_value rho_builtin_gc_allocs (virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Lists (native versions of std:list):
+  
+  rho_value rho_builtin_list_range (rho_value& start, rho_value& end,
+                                    virtual_machine& vm);
+  
+  rho_value rho_builtin_list_map (rho_value& f, rho_value& lst,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_list_filter (rho_value& f, rho_value& lst,
+                                     virtual_machine& vm);
+  
+  rho_value rho_builtin_list_reverse (rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_len (rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_any (rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_all (rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_sort (rho_value& less, rho_value& lst,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_list_fold (rho_value& f, rho_value& init,
+                                   rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_fuse (rho_value& fns, rho_value& ops,
+                                   rho_value& lst, virtual_machine& vm);
+  
+  rho_value rho_builtin_list_fuse_range (rho_value& fns, rho_value& ops,
+                                         rho_value& start, rho_value& end,
+                                         virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Maps:
+  
+  rho_value rho_builtin_map_get (rho_value *args, int argc,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_map_has (rho_value& m, rho_value& key,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_map_del (rho_value& m, rho_value& key,
+                                 virtual_machine& vm);
+  
+  rho_value rho_builtin_map_keys (rho_value& m, virtual_machine& vm);
+  
+  rho_value rho_builtin_map_vals (rho_value& m, virtual_machine& vm);
+  
+  rho_value rho_builtin_map_items (rho_value& m, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Memoization:
+  
+  rho_value rho_builtin_memo_stats (rho_value& f, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Persistent vectors:
+  
+  rho_value rho_builtin_pvec (rho_value *args, int argc, virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_set (rho_value& v, rho_value& i, rho_value& x,
+                                  virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_push (rho_value& v, rho_value& x,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_pop (rho_value& v, virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_slice (rho_value& v, rho_value& start,
+                                    rho_value& end, virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_transient (rho_value& v, virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_persist (rho_value& v, virtual_machine& vm);
+  
+  rho_value rho_builtin_pvec_to_vec (rho_value& v, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Growable vectors:
+  
+  rho_value rho_builtin_push (rho_value& v, rho_value& x, virtual_machine& vm);
+  
+  rho_value rho_builtin_pop (rho_value& v, virtual_machine& vm);
+  
+  rho_value rho_builtin_extend (rho_value& v, rho_value& src,
+                                virtual_machine& vm);
+  
+  rho_value rho_builtin_slice (rho_value *args, int argc, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Strings:
+  
+  rho_value rho_builtin_substr (rho_value *args, int argc, virtual_machine& vm);
+  
+  rho_value rho_builtin_split (rho_value& s, rho_value& sep,
+                               virtual_machine& vm);
+  
+  rho_value rho_builtin_join (rho_value& seq, rho_value& sep,
+                              virtual_machine& vm);
+  
+  rho_value rho_builtin_find (rho_value *args, int argc, virtual_machine& vm);
+  
+  rho_value rho_builtin_str (rho_value& x, virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Files:
+  
+  rho_value rho_builtin_file_open (rho_value *args, int argc,
+                                   virtual_machine& vm);
+  
+  rho_value rho_builtin_file_print (rho_value *args, int argc,
+                                    virtual_machine& vm);
+  
+  rho_value rho_builtin_file_write (rho_value *args, int argc,
+                                    virtual_machine& vm);
+  
+  rho_value rho_builtin_file_close (rho_value& f, virtual_machine& vm);
+  
+  rho_value rho_builtin_flush (rho_value *args, int argc, virtual_machine& vm);
+  
+  rho_value rho_builtin_set_buffer_size (rho_value *args, int argc,
+                                         virtual_machine& vm);
+  
+  rho_value rho_builtin_set_print_limits (rho_value *args, int argc,
+                                          virtual_machine& vm);
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Serialization:
+  
+  rho_value rho_builtin_save (rho_value& path, rho_value& v,
+                              virtual_machine& vm);
+  
+  rho_value rho_builtin_load (rho_value& path, virtual_machine& vm);
+  
+  rho_value rho_builtin_save_image (rho_value& path, rho_value& fn,
+                                    virtual_machine& vm);
+  
+  
+//------------------------------------------------------------------------------
+  // Text input:
+  
+  rho_value rho_builtin_read_numbers (rho_value& path, rho_value& dtype,
+                                      virtual_machine& vm);
+  
+  rho_value rho_builtin_read_csv (rho_value *args, int argc,
+                                  virtual_machine& vm);
 }
 
 #endif
@@ -0,0 +1,68 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__COROUTINE__H_
+#define _RHO__RUNTIME__COROUTINE__H_
+
+#include "runtime/value.hpp"
+
+
+namespace rho {
+  
+#define VM_COROUTINE_STACK_SIZE 2048
+  
+  enum coroutine_state
+  {
+    CO_FRESH,       // not resumed yet
+    CO_SUSPENDED,   // stopped at a yield
+    CO_RUNNING,     // currently executing, or waiting for a coroutine it resumed
+    CO_DEAD,        // its function has returned
+  };
+  
+  /* 
+   * A coroutine runs a function on a stack segment of its own.  Resuming and
+   * yielding switch the VM between the segment and the resumer's stack by
+   * swapping the stack, base and instruction pointers; no frames are copied.
+   */
+  struct coroutine
+  {
+    coroutine_state state;
+    rho_value fn;
+    
+    // the coroutine's own stack segment, and its registers while it is not
+    // running.
+    rho_value *stack;
+    int sp;
+    int bp;
+    const unsigned char *ptr;
+    
+    // the registers of the resumer, valid while running.
+    rho_value *caller_stack;
+    int caller_sp;
+    int caller_bp;
+    const unsigned char *caller_ptr;
+    gc_value *caller; // resuming coroutine, or null for the main stack
+    
+    // native call depth (see virtual_machine::call_closure) at the time of
+    // the resume; yielding from any other depth is an error.
+    int depth;
+  };
+}
+
+#endif
+
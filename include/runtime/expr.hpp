@@ -0,0 +1,163 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__EXPR__H_
+#define _RHO__RUNTIME__EXPR__H_
+
+#include "runtime/value.hpp"
+#include <gmp.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+
+namespace rho {
+  
+  // forward decs:
+  class virtual_machine;
+  class expr_table;
+  
+  
+  enum expr_op: int
+  {
+    EXPR_NUM,   // integer constant
+    EXPR_SYM,   // symbol
+    EXPR_PVAR,  // pattern variable (only found in patterns)
+    EXPR_ADD,
+    EXPR_MUL,
+    EXPR_POW,
+    EXPR_FN,    // application of a named function
+  };
+  
+  
+  /* 
+   * A node in a symbolic expression DAG.
+   * Nodes are immutable and hash-consed: structurally equal expressions are
+   * always represented by the same node, so equality is a pointer compare.
+   */
+  struct expr_node
+  {
+    expr_op op;
+    int name;     // symbol/function name, or index of pattern variable
+    mpz_t num;    // only initialized for EXPR_NUM
+    std::vector<gc_value *> args;
+    
+    std::size_t hash;
+    int npvars;   // number of pattern variables in the expression
+    
+    // memoized results (these are kept alive by the node):
+    gc_value *simplified;
+    std::vector<std::pair<int, gc_value *>> derivs;
+    
+    expr_table *table;
+  };
+  
+  
+  /* 
+   * The hash-consing table through which all expression nodes are created.
+   * Entries are weak: the table does not keep nodes alive, and nodes remove
+   * themselves from it when reclaimed by the garbage collector.
+   * 
+   * Nodes are returned unprotected, so the GC must be kept disabled (see
+   * gc_disable_guard) until the returned node is rooted.
+   */
+  class expr_table
+  {
+    virtual_machine& vm;
+    std::unordered_multimap<std::size_t, gc_value *> nodes;
+    
+    std::unordered_map<std::string, int> name_ids;
+    std::vector<std::string> names;
+    
+  public:
+    inline long size () const { return (long)this->nodes.size (); }
+    inline const std::string& get_name (int id) const { return this->names[id]; }
+    
+  public:
+    expr_table (virtual_machine& vm);
+    ~expr_table ();
+    
+  public:
+    /* 
+     * Returns the unique identifier associated with the specified symbol or
+     * function name.
+     */
+    int intern (const std::string& name);
+    
+    gc_value* make_num (mpz_srcptr val);
+    gc_value* make_num (long val);
+    gc_value* make_sym (int name);
+    gc_value* make_pvar (int idx);
+    gc_value* make_op (expr_op op, const std::vector<gc_value *>& args);
+    gc_value* make_fn (int name, const std::vector<gc_value *>& args);
+    
+    /* 
+     * Called by the GC when a node is reclaimed.
+     */
+    void remove (gc_value *v);
+    
+  private:
+    gc_value* intern_node (expr_op op, int name, mpz_srcptr num,
+                           const std::vector<gc_value *>& args);
+  };
+  
+  
+  
+  /* 
+   * Converts integers (and pattern variables) into expressions.
+   * Expressions are returned as they are.
+   */
+  gc_value* expr_from_value (rho_value& v, virtual_machine& vm);
+  
+  /* 
+   * Arithmetic on expressions.  Subtraction and division are represented
+   * using addition, multiplication and negative powers.
+   */
+  rho_value expr_add (rho_value& lhs, rho_value& rhs, virtual_machine& vm);
+  rho_value expr_sub (rho_value& lhs, rho_value& rhs, virtual_machine& vm);
+  rho_value expr_mul (rho_value& lhs, rho_value& rhs, virtual_machine& vm);
+  rho_value expr_div (rho_value& lhs, rho_value& rhs, virtual_machine& vm);
+  rho_value expr_pow (rho_value& lhs, rho_value& rhs, virtual_machine& vm);
+  
+  /* 
+   * Brings the expression into canonical form: sums and products are
+   * flattened and sorted, like terms and powers are collected, and constants
+   * are folded.  Results are memoized on the node.
+   */
+  gc_value* expr_simplify (gc_value *e, virtual_machine& vm);
+  
+  /* 
+   * Differentiates the expression with respect to the symbol whose name
+   * identifier is :var:.  The result is simplified and memoized on the node.
+   */
+  gc_value* expr_diff (gc_value *e, int var, virtual_machine& vm);
+  
+  /* 
+   * Matches an expression against a pattern expression, binding pattern
+   * variables into :stack:.  A sum or product pattern with fewer terms than
+   * the value matches its last term against the remaining terms.
+   */
+  bool expr_match (gc_value *pat, gc_value *val, rho_value *stack,
+                   virtual_machine& vm);
+  
+  std::string expr_to_str (gc_value *e);
+}
+
+#endif
+
@@ -64,8 +64,14 @@ namespace rho {
     // gray objects.
     gc_object_ref *gray;
   
-    int t_alloc;
-    int t_free;
+    long t_alloc;
+    long t_free;
+    long t_collect;
+    
+    // number of objects in the object list, and the number of allocations
+    // that will trigger the next collection.
+    long n_objs;
+    long next_collect;
     
     std::list<gc_value *> upvals;
   
@@ -78,6 +84,7 @@ namespace rho {
      * Inserts an object into the gray set.
      */
     void paint_gray (rho_value& v);
+    void paint_gray (gc_value *v);
     
     /* 
      * Pops one value from the gray set.
@@ -94,11 +101,13 @@ namespace rho {
     
     virtual gc_value* alloc_upvalue_protected () override;
     
-    virtual const std::list<gc_value*>& get_upvalues () const override;
+    virtual std::list<gc_value*>& get_upvalues () override;
     
     virtual void step () override;
     
     virtual void collect () override;
+    
+    virtual gc_stats get_stats () const override;
   };
 }
 
@@ -29,6 +29,17 @@ namespace rho {
   class virtual_machine;
   
   
+  /* 
+   * Counters maintained by a garbage collector.
+   */
+  struct gc_stats
+  {
+    long allocs;        // objects allocated since startup
+    long frees;         // objects reclaimed since startup
+    long collections;   // completed collections
+  };
+  
+  
   /* 
    * Base class for all garbage collector implementations.
    * The garbage collector implements routines for allocating memory and
@@ -38,6 +49,7 @@ namespace rho {
   {
   protected:
     virtual_machine& vm;
+    int disable_count;
   
   public:
     garbage_collector (virtual_machine& vm);
@@ -62,7 +74,11 @@ namespace rho {
      */
     virtual gc_value* alloc_upvalue_protected () = 0;
     
-    virtual const std::list<gc_value*>& get_upvalues () const = 0;
+    /* 
+     * Returns the list of open upvalues.  Upvalues are removed from the list
+     * by the VM once they are closed.
+     */
+    virtual std::list<gc_value*>& get_upvalues () = 0;
     
     
     
@@ -75,6 +91,44 @@ namespace rho {
      * Performs a full collection (which may consist of several cycles of work).
      */
     virtual void collect () = 0;
+    
+    
+    
+    /* 
+     * Prevents collections from taking place until a matching call to
+     * enable().  Calls may be nested.
+     */
+    inline void disable () { ++ this->disable_count; }
+    inline void enable () { -- this->disable_count; }
+    
+    inline bool is_enabled () const { return this->disable_count == 0; }
+    
+    
+    
+    /* 
+     * Returns allocation and collection counters.
+     */
+    virtual gc_stats get_stats () const = 0;
+  };
+  
+  
+  
+  /* 
+   * Disables the garbage collector for the lifetime of the guard object.
+   * Used by native code that creates many intermediate objects without
+   * rooting them.
+   */
+  class gc_disable_guard
+  {
+    garbage_collector& gc;
+    
+  public:
+    gc_disable_guard (garbage_collector& gc)
+      : gc (gc)
+      { this->gc.disable (); }
+    
+    ~gc_disable_guard ()
+      { this->gc.enable (); }
   };
 }
 
@@ -0,0 +1,94 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _RHO__RUNTIME__IMAGE__H_
+#define _RHO__RUNTIME__IMAGE__H_
+
+#include "runtime/value.hpp"
+#include "runtime/verifier.hpp"
+#include <string>
+
+
+namespace rho {
+  
+  // forward decs:
+  class virtual_machine;
+  
+  
+  /* 
+   * Writes an image of the running program to the specified file: its code,
+   * its atom table, its global variables and everything reachable from them,
+   * plus :entry:, a function of no arguments that is called when the image
+   * is started (see rho_image).  Throws a vm_error if anything reachable
+   * cannot be saved (see rho_value_save).
+   */
+  void rho_image_save (const std::string& path, rho_value& entry,
+                       virtual_machine& vm);
+  
+  
+  /* 
+   * An image file opened for running.
+   * 
+   * The file is mapped into memory, and the code is executed directly out of
+   * the mapping; functions are stored as offsets into the code, and so point
+   * into the mapping once loaded.  The heap itself cannot be mapped (objects
+   * are allocated and freed individually by the garbage collector), and is
+   * decoded instead.  The image must outlive the virtual machine it is
+   * loaded into.
+   * 
+   * The code is verified when the image is opened, and the functions in the
+   * heap may only point at the entry points the verifier found.
+   */
+  class rho_image
+  {
+    std::string path;
+    unsigned char *data;
+    long size;
+    const unsigned char *code;
+    long code_size;
+    long state_off;
+    code_info info;
+    
+  public:
+    inline const unsigned char* get_code () const { return this->code; }
+    inline long get_code_size () const { return this->code_size; }
+    inline const code_info& get_code_info () const { return this->info; }
+    
+  public:
+    /* 
+     * Maps and verifies the specified image file.  Throws a vm_error on
+     * failure.
+     */
+    rho_image (const std::string& path);
+    ~rho_image ();
+    
+    rho_image (const rho_image&) = delete;
+    rho_image& operator= (const rho_image&) = delete;
+    
+  public:
+    /* 
+     * Restores the image's atoms and globals into the specified virtual
+     * machine, which must not have run anything yet, and returns the entry
+     * function (protected).
+     */
+    rho_value load (virtual_machine& vm);
+  };
+}
+
+#endif
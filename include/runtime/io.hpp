@@ -0,0 +1,163 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__IO__H_
+#define _RHO__RUNTIME__IO__H_
+
+#include <string>
+
+
+namespace rho {
+  
+#define OUTPUT_DEF_BUFFER_SIZE  65536
+  
+  /* 
+   * A buffered writer over a file descriptor.  Data is handed to the OS only
+   * when the buffer fills up, when flush() is called, and when the stream is
+   * closed or destroyed; streams writing to a terminal are additionally
+   * flushed at the end of every line.
+   * 
+   * This is what print() and write() go through (see the VM's output stream),
+   * and what RHO_FILE values hold.
+   */
+  class output_stream
+  {
+    int fd;
+    bool owns_fd; // whether to close the descriptor along with the stream
+    std::string path;
+    char *buf;
+    long cap;
+    long len;
+    bool line_buffered;
+    
+  public:
+    inline const std::string& get_path () const { return this->path; }
+    inline bool is_open () const { return this->fd != -1; }
+    inline long get_buffer_size () const { return this->cap; }
+    
+  public:
+    output_stream (int fd, bool owns_fd, const std::string& path,
+                   long cap = OUTPUT_DEF_BUFFER_SIZE);
+    ~output_stream ();
+    
+    output_stream (const output_stream&) = delete;
+    output_stream& operator= (const output_stream&) = delete;
+    
+    /* 
+     * Opens the specified file for writing, truncating it ("w") or appending
+     * to it ("a").  Throws a vm_error on failure.
+     */
+    static output_stream* open (const std::string& path,
+                                const std::string& mode);
+    
+  public:
+    void write (const char *data, long n);
+    
+    inline void write (const std::string& str)
+      { this->write (str.data (), (long)str.length ()); }
+    
+    inline void
+    put (char c)
+    {
+      if (this->len == this->cap)
+        this->flush_buffer ();
+      this->buf[this->len ++] = c;
+      if (c == '\n' && this->line_buffered)
+        this->flush ();
+    }
+    
+    void flush ();
+    
+    /* 
+     * Flushes the stream, then closes its descriptor if it owns it.  Writing
+     * to a closed stream is an error.
+     */
+    void close ();
+    
+    /* 
+     * Flushes the stream and changes the size of its buffer (to at least one
+     * byte).
+     */
+    void set_buffer_size (long cap);
+    
+  private:
+    void flush_buffer ();
+    void write_fully (const char *data, long n);
+  };
+  
+  
+  
+  /* 
+   * A buffered reader over a file descriptor, the input counterpart of
+   * output_stream.  Reading past the end of the file is an error.
+   * 
+   * A stream can also read from memory (e.g. a mapped file), in which case
+   * the memory serves as its buffer.
+   */
+  class input_stream
+  {
+    int fd; // -1 when reading from memory
+    std::string path;
+    char *buf;
+    long cap;
+    long pos;
+    long len;
+    
+  public:
+    inline const std::string& get_path () const { return this->path; }
+    
+  public:
+    input_stream (int fd, const std::string& path,
+                  long cap = OUTPUT_DEF_BUFFER_SIZE);
+    input_stream (const char *data, long len, const std::string& path);
+    ~input_stream ();
+    
+    input_stream (const input_stream&) = delete;
+    input_stream& operator= (const input_stream&) = delete;
+    
+    /* 
+     * Opens the specified file for reading.  Throws a vm_error on failure.
+     */
+    static input_stream* open (const std::string& path);
+    
+  public:
+    /* 
+     * Reads exactly :n: bytes into :data:.
+     */
+    void read (char *data, long n);
+    
+    /* 
+     * Reads up to :n: bytes into :data:, and returns the number of bytes
+     * read, which is zero only at the end of the file.
+     */
+    long read_some (char *data, long n);
+    
+    inline unsigned char
+    get ()
+    {
+      if (this->pos == this->len)
+        this->fill ();
+      return (unsigned char)this->buf[this->pos ++];
+    }
+    
+  private:
+    void fill ();
+  };
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__MAP__H_
+#define _RHO__RUNTIME__MAP__H_
+
+#include "runtime/value.hpp"
+#include <cstddef>
+
+
+namespace rho {
+  
+#define MAP_MIN_CAP   8
+  
+  // hashes of occupied slots are never below MAP_HASH_MIN, which leaves the
+  // values below free to mark empty and deleted slots.
+#define MAP_SLOT_EMPTY    0
+#define MAP_SLOT_DELETED  1
+#define MAP_HASH_MIN      2
+  
+  struct map_slot
+  {
+    std::size_t hash;
+    rho_value key;
+    rho_value val;
+  };
+  
+  
+  /* 
+   * Returns the hash of the specified map key.  Keys that compare equal under
+   * rho_map_key_eq() hash equally: numbers by value (so that 2 and 2.0 are
+   * the same key), strings and lists by contents, atoms by identity, and all
+   * other objects by reference.
+   */
+  std::size_t rho_map_hash (const rho_value& v);
+  
+  /* 
+   * Key equality used by maps.
+   */
+  bool rho_map_key_eq (const rho_value& a, const rho_value& b);
+  
+  /* 
+   * Stricter versions of the above, under which numbers only equal numbers
+   * of the same type: 2, 2.0 and a 2-valued float are three different keys.
+   * Used where a value found under a key must be exactly what that key
+   * would have produced (memo caches).
+   */
+  std::size_t rho_map_hash_exact (const rho_value& v);
+  bool rho_map_key_eq_exact (const rho_value& a, const rho_value& b);
+  
+  
+  /* 
+   * The table behind RHO_MAP values: open addressing with linear probing
+   * over a power-of-two number of slots, with the full hash of each key
+   * kept in its slot so that most mismatches are rejected without comparing
+   * keys.  Removed entries leave a tombstone until the next rehash.
+   * 
+   * Keys hashed by contents (strings, lists) must not be mutated while in
+   * the map.
+   */
+  class rho_map
+  {
+    map_slot *slots;
+    long cap;
+    long len;   // number of live entries
+    long used;  // live entries and tombstones
+    
+  public:
+    inline long size () const { return this->len; }
+    inline long capacity () const { return this->cap; }
+    
+    // iteration over slots (see is_live()):
+    inline map_slot& slot (long idx) { return this->slots[idx]; }
+    inline static bool is_live (const map_slot& s)
+      { return s.hash >= MAP_HASH_MIN; }
+    
+  public:
+    rho_map (long min_cap = 0);
+    ~rho_map ();
+    
+  public:
+    /* 
+     * Returns the value associated with the specified key, or null if the
+     * key is not in the map.
+     */
+    rho_value* find (const rho_value& key);
+    
+    /* 
+     * Associates a value with a key, replacing any previous value.
+     */
+    void set (const rho_value& key, const rho_value& val);
+    
+    /* 
+     * Returns true if the key was found (and removed).
+     */
+    bool remove (const rho_value& key);
+    
+  private:
+    long probe (const rho_value& key, std::size_t hash);
+    void rehash (long new_cap);
+  };
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__MEMO__H_
+#define _RHO__RUNTIME__MEMO__H_
+
+#include "runtime/value.hpp"
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+
+namespace rho {
+  
+#define MEMO_DEF_SIZE   4096
+  
+  enum memo_flags: unsigned char
+  {
+    // evict the least recently used half of the cache on every collection.
+    MEMO_WEAK = 1,
+  };
+  
+  struct memo_entry
+  {
+    rho_value key; // vector of the arguments, last argument first
+    rho_value val;
+    std::size_t hash;
+  };
+  
+  
+  /* 
+   * The result cache of a `memo' function, attached to its closure.
+   * Entries are keyed by the function's arguments, compared and hashed
+   * structurally, as map keys are, except that numbers only match numbers of
+   * the same type (see rho_map_key_eq_exact()).  The least recently used
+   * entry is evicted once the cache is full.
+   */
+  class memo_cache
+  {
+    std::list<memo_entry> lru; // most recently used first
+    std::unordered_multimap<std::size_t, std::list<memo_entry>::iterator> index;
+    long cap;
+    unsigned char flags;
+    
+  public:
+    long hits, misses, evictions;
+    
+  public:
+    inline long size () const { return (long)this->lru.size (); }
+    inline long capacity () const { return this->cap; }
+    inline unsigned char get_flags () const { return this->flags; }
+    inline bool is_weak () const { return this->flags & MEMO_WEAK; }
+    
+    inline std::list<memo_entry>::iterator begin () { return this->lru.begin (); }
+    inline std::list<memo_entry>::iterator end () { return this->lru.end (); }
+    
+  public:
+    memo_cache (long cap, unsigned char flags);
+    
+  public:
+    /* 
+     * Hashes the arguments of a call, laid out as in a call frame: the i-th
+     * argument is at args[-i].
+     */
+    static std::size_t hash_args (const rho_value *args, int argc);
+    
+    /* 
+     * Looks up the result of a call, and counts the hit or miss.
+     */
+    rho_value* find (const rho_value *args, int argc, std::size_t hash);
+    
+    /* 
+     * Records the result of a call.  :key: is a vector of the arguments in
+     * the order they appear on the stack (last argument first).
+     */
+    void insert (rho_value key, rho_value val);
+    
+    /* 
+     * Evicts least recently used entries until at most :count: remain.
+     */
+    void trim (long count);
+  };
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__PRINTER__H_
+#define _RHO__RUNTIME__PRINTER__H_
+
+#include "runtime/value.hpp"
+#include <string>
+
+
+namespace rho {
+  
+  // forward decs:
+  class virtual_machine;
+  class output_stream;
+  
+  
+  /* 
+   * Where printed values go: either an output stream or a string.
+   */
+  class print_sink
+  {
+    output_stream *out;
+    std::string *str;
+    
+  public:
+    print_sink (output_stream& out)
+      : out (&out), str (nullptr)
+      { }
+    
+    print_sink (std::string& str)
+      : out (nullptr), str (&str)
+      { }
+    
+  public:
+    void write (const char *data, long n);
+    
+    inline void write (const std::string& s)
+      { this->write (s.data (), (long)s.length ()); }
+    
+    void put (char c);
+  };
+  
+  
+  /* 
+   * Bounds on how much of a value gets printed.  Containers with more
+   * elements than :max_elems: are cut short with "...", and so are
+   * containers nested deeper than :max_depth:.  Zero means no limit.
+   */
+  struct print_limits
+  {
+    long max_elems;
+    int max_depth;
+  };
+  
+  
+  /* 
+   * Writes the textual representation of the specified value (the one
+   * returned by rho_value_str) to the given sink.
+   * 
+   * Nested values are printed using an explicit stack rather than by
+   * recursion, so arbitrarily deep structures can be printed, and the
+   * output is written out as it is produced.
+   */
+  void rho_value_print (rho_value& v, print_sink& out, virtual_machine& vm,
+                        const print_limits *lim = nullptr);
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__PVEC__H_
+#define _RHO__RUNTIME__PVEC__H_
+
+#include "runtime/value.hpp"
+
+
+namespace rho {
+  
+#define PVEC_BITS   5
+#define PVEC_WIDTH  (1 << PVEC_BITS)
+#define PVEC_MASK   (PVEC_WIDTH - 1)
+  
+  /*
+   * A node of the trie.  Leaves hold elements, and branches hold pointers to
+   * the nodes one level down; the level of a node is implied by its depth.
+   * Nodes are shared between vectors, and freed when their reference count
+   * drops to zero.
+   */
+  struct pvec_node
+  {
+    int refs;
+    unsigned mark; // number of the collection that last traced the node
+    union
+      {
+        pvec_node *kids[PVEC_WIDTH];
+        rho_value vals[PVEC_WIDTH];
+      };
+  };
+  
+  
+  /*
+   * The structure behind RHO_PVEC values: a persistent vector, stored as a
+   * 32-way trie of leaves plus a separate tail leaf that receives appends
+   * (the layout used by Clojure's vectors).
+   *
+   * Updates copy only the path from the root down to the modified leaf and
+   * share everything else with the original, so get, set, push and pop all
+   * take O(log32 n) time.  A slice keeps the trie's prefix up to its end and
+   * an offset to its start, which makes slicing O(log32 n) as well, at the
+   * cost of keeping the elements before the start alive.
+   *
+   * The update methods below modify the vector in place.  A node is only
+   * written to directly when nothing else references it (which is the case
+   * for nodes a transient created itself); any other node is copied first.
+   * Persistent updates are done by copying the vector (which only copies the
+   * reference to the root) and updating the copy.
+   */
+  class rho_pvec
+  {
+    long cnt;   // number of elements in the trie and tail
+    long off;   // index of the first element in view
+    int shift;
+    pvec_node *root; // null while every element fits in the tail
+    pvec_node *tail;
+    bool transient;
+  
+  public:
+    inline long size () const { return this->cnt - this->off; }
+    inline bool is_transient () const { return this->transient; }
+    inline void set_transient (bool transient) { this->transient = transient; }
+  
+  public:
+    rho_pvec ();
+    rho_pvec (const rho_pvec& other);
+    ~rho_pvec ();
+    
+    rho_pvec& operator= (const rho_pvec&) = delete;
+  
+  public:
+    /*
+     * Index must be in range.
+     */
+    const rho_value& get (long idx) const;
+    
+    void set (long idx, const rho_value& val);
+    
+    void push (const rho_value& val);
+    
+    /*
+     * Vector must not be empty.
+     */
+    void pop ();
+    
+    /*
+     * Narrows the vector down to the range [start, end), which must be
+     * contained in the vector.
+     */
+    void slice (long start, long end);
+  
+  public:
+    /*
+     * Calls the given function on every element, in order.
+     */
+    template<typename Fn>
+    void
+    each (Fn&& fn) const
+    {
+      long tail_off = this->tail_offset ();
+      long i = this->off;
+      while (i < tail_off)
+        {
+          auto leaf = this->leaf_for (i);
+          for (long j = i & PVEC_MASK; j < PVEC_WIDTH; ++j)
+            fn (leaf->vals[j]);
+          i = (i | PVEC_MASK) + 1;
+        }
+      for (; i < this->cnt; ++i)
+        fn (this->tail->vals[i - tail_off]);
+    }
+    
+    /*
+     * Calls the given function on every element held by the vector's nodes,
+     * skipping over nodes already traced with the same mark.  Used by the
+     * garbage collector so that nodes shared by many vectors are only
+     * scanned once per collection.
+     */
+    template<typename Fn>
+    void
+    trace (unsigned mark, Fn&& fn) const
+    {
+      if (this->root)
+        trace_node (this->root, this->shift, mark, fn);
+      if (this->tail)
+        trace_node (this->tail, 0, mark, fn);
+    }
+  
+  private:
+    inline long
+    tail_offset () const
+      { return (this->cnt == 0) ? 0 : ((this->cnt - 1) & ~(long)PVEC_MASK); }
+    
+    pvec_node* leaf_for (long idx) const;
+    
+    pvec_node* own (pvec_node *node, int level);
+    pvec_node* set_node (pvec_node *node, int level, long idx,
+                         const rho_value& val);
+    pvec_node* push_tail (pvec_node *node, int level, pvec_node *leaf);
+    pvec_node* take_node (pvec_node *node, int level, long count);
+    void take (long count);
+    void clear ();
+    
+    template<typename Fn>
+    static void
+    trace_node (pvec_node *node, int level, unsigned mark, Fn& fn)
+    {
+      if (node->mark == mark)
+        return;
+      node->mark = mark;
+      
+      if (level == 0)
+        for (int i = 0; i < PVEC_WIDTH; ++i)
+          fn (node->vals[i]);
+      else
+        for (int i = 0; i < PVEC_WIDTH && node->kids[i]; ++i)
+          trace_node (node->kids[i], level - PVEC_BITS, mark, fn);
+    }
+  };
+}
+
+#endif
@@ -34,6 +34,10 @@ namespace rho {
   class program;
   class linker;
   
+  // how much of each container values printed in the REPL show.
+#define REPL_PRINT_MAX_ELEMS    1000
+#define REPL_PRINT_MAX_DEPTH    100
+  
   
   /* 
    * Implements a REPL (Read-Eval-Print Loop) for Rho.
@@ -0,0 +1,77 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__RUNTIME__SERIAL__H_
+#define _RHO__RUNTIME__SERIAL__H_
+
+#include "runtime/value.hpp"
+#include <vector>
+
+
+namespace rho {
+  
+  // forward decs:
+  class virtual_machine;
+  class output_stream;
+  class input_stream;
+  
+  
+  /* 
+   * The bytecode that functions point into.  Functions (and the upvalues and
+   * promises they are reached through) can only be saved and loaded along
+   * with their code, and their code pointers are stored as offsets into it.
+   */
+  struct serial_code
+  {
+    const unsigned char *base;
+    long size;
+    
+    // if set, the verified entry points of the code's functions (in
+    // ascending order), the only offsets functions are loaded with.
+    const std::vector<long> *funs;
+  };
+  
+  
+  /* 
+   * Writes a compact binary encoding of the specified value to :out:.
+   * 
+   * Integers are stored as varints, or as their magnitude in bytes once they
+   * outgrow a machine word; floats keep their precision and are stored
+   * exactly; packed arrays and matrices are copied out as they are (in the
+   * machine's byte order); atoms and record tags are stored by name.
+   * Every object is written once, and referred back to by id after that, so
+   * shared structure is shared again when loaded, and cyclic structures
+   * come back with the same cycles.  Expressions are written node by node
+   * and interned again when loaded.
+   * 
+   * Functions can only be saved if :code: is given (their memo caches are
+   * saved empty, and their upvalues closed).  Coroutines and files cannot be
+   * saved (a vm_error is thrown).
+   */
+  void rho_value_save (rho_value& v, output_stream& out, virtual_machine& vm,
+                       const serial_code *code = nullptr);
+  
+  /* 
+   * Reads back a value written by rho_value_save.  Atoms must be known to
+   * the running program.  The result is protected.
+   */
+  rho_value rho_value_load (input_stream& in, virtual_machine& vm,
+                            const serial_code *code = nullptr);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _RHO__RUNTIME__TEXTREAD__H_
+#define _RHO__RUNTIME__TEXTREAD__H_
+
+#include "runtime/value.hpp"
+#include <string>
+
+
+namespace rho {
+  
+  // forward decs:
+  class virtual_machine;
+  
+  
+  /* 
+   * Readers for numeric data stored as text.  Files are streamed through a
+   * fixed-size buffer (which only grows to fit a single line or field that
+   * does not fit in it), and line breaks and separators are located with
+   * the SIMD kernels in util/simd.hpp.
+   * 
+   * Integers are parsed into machine words, and only fall back to GMP when
+   * they do not fit in one.
+   */
+  
+  /* 
+   * Reads all the numbers in the specified file into a packed array of the
+   * given type (RHO_F64VEC or RHO_I64VEC).  Numbers can be separated by any
+   * mix of commas, whitespace and line breaks.  The result is protected.
+   */
+  rho_value rho_read_numbers (const std::string& path, rho_type type,
+                              virtual_machine& vm);
+  
+  /* 
+   * Reads a file of rows whose fields are separated by :sep:.  Fields that
+   * are numbers become integers or doubles, empty fields become nil, and
+   * anything else is kept as a string (without the surrounding whitespace).
+   * Blank lines are skipped.
+   * 
+   * Fields can be quoted as in RFC 4180: a field that starts with a double
+   * quote runs up to the matching closing quote, and may contain separators,
+   * line breaks and quotes (written twice).  Quoted fields are always kept
+   * as strings, exactly as written.
+   * 
+   * If :fn: is null, the rows are returned as a vector of vectors.
+   * Otherwise, each row is passed to :fn: as soon as it has been read
+   * (and dropped afterwards, so memory use does not depend on the size of
+   * the file), and the number of rows is returned.
+   * 
+   * The result is protected.
+   */
+  rho_value rho_read_csv (const std::string& path, char sep, rho_value *fn,
+                          virtual_machine& vm);
+}
+
+#endif
@@ -46,6 +46,13 @@ namespace rho {
   // forward decs:
   class virtual_machine;
   class garbage_collector;
+  class zpoly;
+  struct expr_node;
+  struct coroutine;
+  class rho_map;
+  class rho_pvec;
+  class memo_cache;
+  class output_stream;
   
   
   enum rho_type: int
@@ -65,6 +72,18 @@ namespace rho {
     RHO_ATOM,
     RHO_STR,
     RHO_FLOAT,
+    RHO_DOUBLE, // unboxed double-precision float
+    RHO_F64VEC, // packed array of doubles
+    RHO_I64VEC, // packed array of 64-bit integers
+    RHO_MATRIX, // dense matrix of doubles
+    RHO_POLY,   // dense polynomial with integer coefficients
+    RHO_EXPR,   // hash-consed symbolic expression
+    RHO_PROMISE,
+    RHO_COROUTINE,
+    RHO_MAP,    // hash map (see runtime/map.hpp)
+    RHO_RECORD, // instance of a `record' type
+    RHO_PVEC,   // persistent vector (see runtime/pvec.hpp)
+    RHO_FILE,   // output file (see runtime/io.hpp)
   };
   
   bool rho_type_is_collectable (rho_type type);
@@ -84,10 +103,21 @@ namespace rho {
         bool b;
         int i32;
         long long i64;
+        double f64;
         gc_value *gc;
       } val;
   };
   
+  /* 
+   * The buffer of a vector that has been sliced, shared between the vector
+   * and its slices.
+   */
+  struct vec_store
+  {
+    long refs;
+    rho_value *data;
+  };
+  
   struct gc_value
   {
     rho_type type;
@@ -97,11 +127,14 @@ namespace rho {
         
         mpfr_t f; // float
         
-        // string
+        // string, or a rope (the concatenation of :left: and :right:) whose
+        // characters are only put together when first needed.
         struct
           {
-            char *str;
+            char *str; // null until a rope is flattened
             long len;
+            gc_value *left;
+            gc_value *right;
           } s;
         
         // vector
@@ -110,14 +143,57 @@ namespace rho {
             rho_value *vals;
             long len;
             long cap;
+            vec_store *store; // null unless the buffer is shared with slices
           } vec;
         
+        // packed array (f64vec/i64vec)
+        struct
+          {
+            union
+              {
+                double *f64;
+                long long *i64;
+              };
+            long len;
+            long mapped; // size of the file mapping holding the elements,
+                         // or 0 if they were allocated
+          } arr;
+        
+        // dense matrix (row-major)
+        struct
+          {
+            double *data;
+            int rows;
+            int cols;
+          } mat;
+        
+        zpoly *poly; // polynomial
+        
+        expr_node *expr; // symbolic expression
+        
+        coroutine *co;
+        
+        rho_map *map;
+        
+        rho_pvec *pvec;
+        
+        output_stream *file;
+        
+        // record
+        struct
+          {
+            rho_value *vals;
+            int len;
+            int tag; // atom naming the record type
+          } rec;
+        
         // function
         struct
           {
             const unsigned char *cp; // code pointer
             rho_value *env;
             int env_len;
+            memo_cache *memo; // null unless the function is `memo'
           } fn;
         
         // pair
@@ -132,7 +208,15 @@ namespace rho {
           {
             int sp;
             rho_value val;
+            gc_value *co; // owner of the stack sp refers to (null for main)
           } uv;
+        
+        // promise
+        struct
+          {
+            rho_value val; // delayed function until forced
+            bool forced;
+          } pr;
       } val;
     
     // gc stuff:
@@ -149,11 +233,6 @@ namespace rho {
   inline void
   gc_unprotect (rho_value& v)
     { if (rho_type_is_collectable (v.type) && v.val.gc) v.val.gc->gc_protected = 0; }
-   
-  /*
-   * Applies gc_unprotect() recursively.
-   */
-  void gc_unprotect_rec (rho_value& v);
   
   inline void
   gc_protect (gc_value *v)
@@ -181,12 +260,33 @@ namespace rho {
   
   
   
+  /* 
+   * Compiles a format string (the left operand of %) into a program that
+   * rho_format_run executes.  Throws a vm_error if the string is malformed.
+   */
+  void rho_format_compile (const char *str, long len, std::string& prog);
+  
+  /* 
+   * Checks that the :avail: bytes at :prog: start with a well-formed format
+   * program, and returns its length, or -1 if it is not.
+   */
+  long rho_format_check (const unsigned char *prog, long avail);
+  
+  /* 
+   * Runs a compiled format string on the specified arguments and returns the
+   * resulting string.  :prog: is advanced past the program.
+   */
+  rho_value rho_format_run (const unsigned char *& prog, rho_value& args,
+                            virtual_machine& vm);
+  
+  
+  
   //
   // Rho value construction functions:
   // 
   
   inline rho_value
-  rho_value_make_internal (int val)
+  rho_value_make_internal (long long val)
     { rho_value v; v.type = RHO_INTERNAL; v.val.i64 = val; return v; }
 
   inline rho_value
@@ -203,8 +303,18 @@ namespace rho {
   
   rho_value rho_value_make_int (const char *str, garbage_collector& gc);
   
+  rho_value rho_value_make_int64 (long long val, garbage_collector& gc);
+  
   rho_value rho_value_make_vec (long cap, garbage_collector& gc);
   
+  /* 
+   * Creates a vector that views the elements in the range [start, end) of the
+   * specified one, sharing its buffer.  Whichever of the two is written to
+   * first gets a copy of its own.
+   */
+  rho_value rho_value_make_vec_slice (rho_value& vec, long start, long end,
+                                      garbage_collector& gc);
+  
   rho_value rho_value_make_function (const unsigned char *cp, int env_len,
                                      garbage_collector& gc);
   
@@ -231,6 +341,48 @@ namespace rho {
   rho_value rho_value_make_float (double val, unsigned int prec,
                                   garbage_collector& gc);
   
+  inline rho_value
+  rho_value_make_double (double val)
+    { rho_value v; v.type = RHO_DOUBLE; v.val.f64 = val; return v; }
+  
+  rho_value rho_value_make_f64vec (long len, garbage_collector& gc);
+  
+  rho_value rho_value_make_i64vec (long len, garbage_collector& gc);
+  
+  /* 
+   * Creates a packed array of the specified type (RHO_F64VEC or RHO_I64VEC)
+   * whose elements are held by a file mapping of :size: bytes, which is
+   * unmapped along with the array.
+   */
+  rho_value rho_value_make_mapped_array (rho_type type, void *data, long len,
+                                         long size, garbage_collector& gc);
+  
+  rho_value rho_value_make_matrix (int rows, int cols, garbage_collector& gc);
+  
+  rho_value rho_value_make_poly (zpoly&& p, garbage_collector& gc);
+  
+  rho_value rho_value_make_promise (rho_value& fn, garbage_collector& gc);
+  
+  rho_value rho_value_make_map (long cap, garbage_collector& gc);
+  
+  /* 
+   * Creates a record of the type named by the atom :tag: with :len: fields,
+   * all initially nil.
+   */
+  rho_value rho_value_make_record (int tag, int len, garbage_collector& gc);
+  
+  /* 
+   * Wraps the given persistent vector, which the new value takes ownership
+   * of.
+   */
+  rho_value rho_value_make_pvec (rho_pvec *pv, garbage_collector& gc);
+  
+  /* 
+   * Wraps the given output stream, which is flushed and closed when the value
+   * is reclaimed.
+   */
+  rho_value rho_value_make_file (output_stream *file, garbage_collector& gc);
+  
   
   
   // 
@@ -256,6 +408,58 @@ namespace rho {
     virtual_machine& vm);
   
   
+  // 
+  // Strings:
+  // 
+  
+  /* 
+   * Puts together the characters of a rope, after which it is an ordinary
+   * string.
+   */
+  void rho_str_flatten (gc_value *s);
+  
+  /* 
+   * Returns the characters of the specified string (null-terminated).
+   */
+  inline const char*
+  rho_str_chars (gc_value *s)
+  {
+    if (!s->val.s.str)
+      rho_str_flatten (s);
+    return s->val.s.str;
+  }
+  
+  /* 
+   * Concatenates two strings.  Short results are copied out, and longer ones
+   * become ropes, which makes repeated concatenation linear overall.
+   */
+  rho_value rho_str_concat (rho_value& lhs, rho_value& rhs,
+                            garbage_collector& gc);
+  
+  
+  // 
+  // Vectors:
+  // 
+  
+  /* 
+   * Makes room for at least :cap: elements in the specified vector, and
+   * makes sure that its buffer is not shared with any slice.  The capacity
+   * at least doubles whenever the buffer has to grow.
+   */
+  void rho_vec_reserve (gc_value *v, long cap);
+  
+  /* 
+   * Must be called before writing to the elements of a vector whose buffer
+   * might be shared.
+   */
+  inline void
+  rho_vec_make_writable (gc_value *v)
+  {
+    if (v->val.vec.store && v->val.vec.store->refs > 1)
+      rho_vec_reserve (v, v->val.vec.len);
+  }
+  
+  
   // 
   // Comparison functions:
   // 
@@ -285,7 +489,8 @@ namespace rho {
   /* 
    * Attempts to match the specified value against the given pattern.
    */
-  bool rho_value_match (rho_value& pat, rho_value& val, rho_value *stack);
+  bool rho_value_match (rho_value& pat, rho_value& val, rho_value *stack,
+                        virtual_machine& vm);
 }
 
 #endif
@@ -0,0 +1,68 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _RHO__RUNTIME__VERIFIER__H_
+#define _RHO__RUNTIME__VERIFIER__H_
+
+#include <vector>
+
+
+namespace rho {
+  
+  /* 
+   * What the verifier learns about a piece of code.  Depths are counted in
+   * stack slots from the base pointer of a function's frame, and so include
+   * the six slots of the frame header.
+   */
+  struct code_info
+  {
+    int top_depth; // deepest the top-level code takes the stack
+    int max_frame; // largest of the depths below
+    
+    // the entry points of the functions the code creates, in ascending
+    // order, and how deep each one takes the stack.
+    std::vector<long> funs;
+    std::vector<int> depths;
+    
+    // for each page of global variables, one more than the highest index
+    // the code reads or writes (zero if it uses none).
+    std::vector<int> globals;
+  };
+  
+  
+  /* 
+   * Checks that the bytecode in :code: can be run without the VM reading or
+   * writing outside of it or outside of the stack: that every reachable
+   * instruction is known and complete, that jumps land inside the code,
+   * that instructions never pop more than the current frame holds, that the
+   * stack has the same depth (and the same micro-frames) whichever way an
+   * instruction is reached, and that builtins and their argument counts
+   * exist.  The top-level code starts at offset 0 with an empty stack, and
+   * functions are found by following mk_fn and mk_closure instructions.
+   * 
+   * Global variables are only reported, since pages are allocated at run
+   * time; the VM makes sure they exist before running the code.
+   * 
+   * Every instruction is decoded once, so the time taken is linear in the
+   * size of the code.  Throws a vm_error describing the first problem found.
+   */
+  code_info verify_code (const unsigned char *code, long size);
+}
+
+#endif
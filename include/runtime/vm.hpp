@@ -21,6 +21,9 @@
 
 #include "linker/program.hpp"
 #include "runtime/value.hpp"
+#include "runtime/printer.hpp"
+#include "runtime/coroutine.hpp"
+#include "runtime/verifier.hpp"
 #include <unordered_map>
 #include <vector>
 
@@ -33,6 +36,8 @@ namespace rho {
   // forward decs:
   class garbage_collector;
   class virtual_machine;
+  class expr_table;
+  class output_stream;
   
   
   
@@ -100,13 +105,37 @@ namespace rho {
     int bp; // base pointer
     garbage_collector *gc;
     
+    rho_value *main_stack;
+    int main_stack_size;
+    int stack_cap;     // size of the stack in use (main or coroutine)
+    
+    // the largest frame of any function verified so far.  Calls check that
+    // this much room is left on the stack, so functions need not check
+    // anything as they push.
+    int frame_reserve;
+    gc_value *curr_co; // running coroutine (null when on the main stack)
+    int native_depth;  // number of active call_closure() invocations
+    
+    // the code of the program being run (see run() and run_function()).
+    const unsigned char *code;
+    long code_size;
+    
     rho_value *ints; // pre-allocated small integers
     std::vector<glob_page> gpages;
+    std::vector<int> glob_need; // smallest size of each page (see admit())
     std::vector<std::string> atom_names;
+    expr_table *exprs;
+    output_stream *out; // standard output
+    print_limits plim;  // applied to values printed to standard output
     
   public:
     inline garbage_collector& get_gc () { return *this->gc; }
+    inline expr_table& get_exprs () { return *this->exprs; }
+    inline output_stream& get_output () { return *this->out; }
+    inline print_limits& get_print_limits () { return this->plim; }
     inline std::vector<glob_page>& get_globals () { return this->gpages; }
+    inline const unsigned char* get_code () const { return this->code; }
+    inline long get_code_size () const { return this->code_size; }
     
     inline std::vector<std::string>& get_atoms () { return this->atom_names; }
     inline const std::string& get_atom_name (int val) const { return this->atom_names[val]; }
@@ -115,6 +144,14 @@ namespace rho {
     
     int get_base10_prec () const;
     
+    inline gc_value* get_current_coroutine () { return this->curr_co; }
+    
+    /* 
+     * Creates a coroutine that will call the specified function when first
+     * resumed.
+     */
+    rho_value make_coroutine (rho_value& fn);
+    
   public:
     virtual_machine (int stack_size = VM_DEF_STACK_SIZE,
                      const char *gc_name = "basic");
@@ -122,21 +159,84 @@ namespace rho {
     
   public:
     /* 
-     * Executes the specified Rho program.
+     * Verifies and executes the specified Rho program.
      * Returns the top-most value in the VM's stack on completion.
      */
     rho_value run (program& prg);
     
+    /* 
+     * Calls the specified function with no arguments as though it were the
+     * top-level code of a program whose code is :code: (the function must
+     * point into it).  :info: is what verify_code() returned for the code.
+     * Used to start images (see runtime/image.hpp).
+     */
+    rho_value run_function (rho_value fn, const unsigned char *code,
+                            long code_size, const code_info& info);
+    
+    /* 
+     * Calls the Rho function :fn: with the specified arguments, and returns
+     * its result once it returns.  Used by builtins that take callbacks.
+     * Calls may nest (the callee may itself call builtins that call back).
+     * 
+     * The arguments are placed on the stack before anything is allocated,
+     * so they need not be reachable otherwise.  The result is not reachable
+     * by the collector, and should be stored somewhere reachable (see
+     * `vm_root') before the next allocation.
+     * 
+     * If the callee throws, the registers are restored to what they were at
+     * the time of the call before the exception is propagated.
+     */
+    rho_value call_closure (rho_value fn, int argc, const rho_value *args);
+    
+    /* 
+     * Convenience wrapper around call_closure():
+     *     vm.call (fn, x, y)
+     */
+    template<typename... Args>
+    rho_value
+    call (rho_value fn, Args... args)
+    {
+      rho_value argv[] = { args..., rho_value_make_nil () };
+      return this->call_closure (fn, sizeof... (args), argv);
+    }
+    
+    /* 
+     * Calls the native registered at the specified builtin index (see
+     * runtime/builtins.hpp) with the given arguments, which are pushed onto
+     * the stack for the duration of the call.  As with call_closure(), the
+     * result is not reachable by the collector.
+     */
+    rho_value call_native (int index, int argc, const rho_value *args);
+    
     /* 
      * Clears the VM's stack.
      */
     void reset ();
 
+    /* 
+     * Pushes a value onto the stack, which makes it part of the collector's
+     * root set until it is popped.
+     */
+    void push_value (rho_value v);
+    
     /* 
      * Pops the top-most value off the stack.
      */    
     void pop_value ();
     
+  private:
+    /* 
+     * Prepares the machine for running verified code: makes room on the
+     * stack for its functions' frames, and allocates the global variables it
+     * uses.
+     */
+    void admit (const code_info& info);
+    
+    /* 
+     * Runs bytecode starting at :code: until an exit instruction is reached.
+     */
+    rho_value exec (const unsigned char *code);
+    
   public:
     // 
     // GC support:
@@ -147,9 +247,53 @@ namespace rho {
      */
     stack_provider get_stack (bool refs_only = false);
     
+    /* 
+     * Returns the stack slot an open upvalue refers to.
+     */
     inline rho_value&
-    get_stack_at (int sp)
-      { return this->stack[sp]; }
+    get_upvalue_slot (gc_value *uv)
+    {
+      auto co = uv->val.uv.co;
+      return (co ? co->val.co->stack : this->main_stack)[uv->val.uv.sp];
+    }
+    
+    friend class vm_root;
+  };
+  
+  
+  
+  /* 
+   * Keeps a value reachable by the collector for the lifetime of the guard,
+   * by storing it in a slot on top of the VM's stack.  Native code uses this
+   * to hold on to intermediate results across allocations and calls back into
+   * Rho code.  Guards must be destroyed in the reverse order of creation,
+   * which scoping takes care of.
+   */
+  class vm_root
+  {
+    virtual_machine& vm;
+    rho_value *stack;
+    int idx;
+    
+  public:
+    inline rho_value& get () { return this->stack[this->idx]; }
+    inline void set (rho_value v) { this->stack[this->idx] = v; }
+    
+  public:
+    vm_root (virtual_machine& vm, rho_value v)
+      : vm (vm)
+    {
+      this->stack = vm.stack;
+      this->idx = vm.sp;
+      vm.stack[vm.sp ++] = v;
+    }
+    
+    ~vm_root ()
+    {
+      // the stack may have been reset by an error in the meantime.
+      if (this->vm.stack == this->stack && this->vm.sp > this->idx)
+        this->vm.sp = this->idx;
+    }
   };
 }
 
@@ -71,6 +71,13 @@ namespace rho {
      */
     std::vector<std::string> extract_atom_defs (std::shared_ptr<ast_program> node);
     
+    /* 
+     * Extracts top-level record definitions from the specified AST program,
+     * as pairs of qualified record names and field lists.
+     */
+    std::vector<std::pair<std::string, std::vector<std::string>>>
+    extract_record_defs (std::shared_ptr<ast_program> node);
+    
     
     
     /* 
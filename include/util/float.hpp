@@ -25,17 +25,39 @@
 
 namespace rho {
   
+  /* 
+   * Floats whose precision does not exceed FLOAT_DOUBLE_PREC bits are stored
+   * as unboxed doubles rather than as MPFR values.
+   * FLOAT_DOUBLE_DIGITS is the largest amount of decimal digits that is
+   * guaranteed to survive a round-trip through a double.
+   */
+#define FLOAT_DOUBLE_PREC     53
+#define FLOAT_DOUBLE_DIGITS   15
+  
   /* 
    * Computes how much bits are required to represent a floating point number
    * with at least :digits: decimal digits after the decimal point.
    */
   int prec_base10_to_bits (int digits);
   
+  /* 
+   * Returns the effective precision (in bits) of floating point numbers with
+   * :digits: decimal digits after the decimal point.
+   * Precisions of up to FLOAT_DOUBLE_DIGITS digits (the default of 10
+   * included) collapse into FLOAT_DOUBLE_PREC, and are computed with
+   * doubles.  A double carries about 15 significant digits in all, so the
+   * last requested digits of numbers with a large integer part are
+   * rounded; an `N:' block of more than FLOAT_DOUBLE_DIGITS digits switches
+   * to MPFR for exact results.
+   */
+  int prec_base10_to_effective_bits (int digits);
+  
   /* 
    * Converts the specified floating number into a string in base 10, with the
    * specified amount of digits after the decimal point.
    */
   std::string float_to_str (mpfr_t f, int prec10);
+  std::string float_to_str (double f, int prec10);
 }
 
 #endif
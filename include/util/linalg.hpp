@@ -0,0 +1,65 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__UTIL__LINALG__H_
+#define _RHO__UTIL__LINALG__H_
+
+
+namespace rho {
+  
+  /* 
+   * Dense linear algebra routines over row-major arrays of doubles.
+   * None of the routines below check their arguments' dimensions; that is
+   * left to the caller.
+   */
+  
+  /* 
+   * Computes C = A * B, where A is an (m x k) matrix, and B is a (k x n)
+   * matrix.  C is overwritten.
+   * Large products are computed in cache-sized blocks, and are split between
+   * several threads.
+   */
+  void linalg_gemm (const double *a, const double *b, double *c,
+                    int m, int k, int n);
+  
+  /* 
+   * Stores the transpose of the (rows x cols) matrix :src: in :dest:.
+   */
+  void linalg_transpose (const double *src, double *dest, int rows, int cols);
+  
+  /* 
+   * Computes the LU decomposition (with partial pivoting) of the (n x n)
+   * matrix :a: in-place, such that P*A = L*U.  The unit lower triangular
+   * matrix L is stored below the diagonal.
+   * 
+   * :perm: receives the row permutation, and :sign: its parity (1 or -1).
+   * Returns false if the matrix is singular.
+   */
+  bool linalg_lu (double *a, int n, int *perm, int& sign);
+  
+  /* 
+   * Solves A*X = B given the LU decomposition of A (as computed by
+   * linalg_lu()), where B is an (n x nrhs) matrix.  B is overwritten with the
+   * solution.
+   */
+  void linalg_lu_solve (const double *lu, const int *perm, int n,
+                        double *b, int nrhs);
+}
+
+#endif
+
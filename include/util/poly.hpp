@@ -0,0 +1,118 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__UTIL__POLY__H_
+#define _RHO__UTIL__POLY__H_
+
+#include <gmp.h>
+#include <string>
+
+
+namespace rho {
+  
+  /* 
+   * A dense polynomial with arbitrary-precision integer coefficients.
+   * Coefficient i belongs to x^i.  A normalized polynomial has a non-zero
+   * leading coefficient; the zero polynomial has no coefficients at all.
+   */
+  class zpoly
+  {
+    __mpz_struct *cs;
+    long n;
+    
+  public:
+    inline long size () const { return this->n; }
+    inline long degree () const { return this->n - 1; }
+    inline bool is_zero () const { return this->n == 0; }
+    
+    inline mpz_ptr operator[] (long i) { return this->cs + i; }
+    inline mpz_srcptr operator[] (long i) const { return this->cs + i; }
+    
+    inline mpz_ptr data () { return this->cs; }
+    inline mpz_srcptr data () const { return this->cs; }
+    
+    inline mpz_srcptr lc () const { return this->cs + (this->n - 1); }
+    
+  public:
+    zpoly ();
+    explicit zpoly (long len);
+    zpoly (const zpoly& other);
+    zpoly (zpoly&& other);
+    ~zpoly ();
+    
+    zpoly& operator= (zpoly other);
+    
+  public:
+    /* 
+     * Changes the amount of coefficients stored in the polynomial.
+     * New coefficients are set to zero.
+     */
+    void resize (long len);
+    
+    /* 
+     * Strips zero leading coefficients.
+     */
+    void normalize ();
+  };
+  
+  
+  
+  zpoly poly_add (const zpoly& a, const zpoly& b);
+  zpoly poly_sub (const zpoly& a, const zpoly& b);
+  
+  /* 
+   * Multiplies two polynomials.
+   * Depending on the sizes of the operands, this uses either schoolbook
+   * multiplication, Karatsuba's algorithm, or multi-modular NTT
+   * multiplication.
+   */
+  zpoly poly_mul (const zpoly& a, const zpoly& b);
+  
+  /* 
+   * Computes q and r such that a = q*b + r, deg(r) < deg(b).
+   * Returns false if the quotient does not have integer coefficients.
+   * Large divisions are carried out using a divide-and-conquer scheme on top
+   * of fast multiplication.
+   */
+  bool poly_divrem (const zpoly& a, const zpoly& b, zpoly& q, zpoly& r);
+  
+  /* 
+   * Computes the greatest common divisor of two polynomials, using the
+   * primitive PRS algorithm.  The result has a positive leading coefficient.
+   */
+  zpoly poly_gcd (const zpoly& a, const zpoly& b);
+  
+  /* 
+   * Stores the GCD of the polynomial's coefficients in :res:.
+   */
+  void poly_content (mpz_t res, const zpoly& p);
+  
+  /* 
+   * Evaluates the polynomial at :x:.
+   */
+  void poly_eval (mpz_t res, const zpoly& p, mpz_srcptr x);
+  double poly_eval (const zpoly& p, double x);
+  
+  /* 
+   * Returns a textual representation of the polynomial in terms of x.
+   */
+  std::string poly_to_str (const zpoly& p);
+}
+
+#endif
+
@@ -0,0 +1,71 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RHO__UTIL__SIMD__H_
+#define _RHO__UTIL__SIMD__H_
+
+
+namespace rho {
+  
+  /* 
+   * Vectorized kernels operating on packed arrays of doubles and 64-bit
+   * integers.
+   * 
+   * The best implementation available on the host CPU (AVX2+FMA, SSE2 or
+   * plain scalar code) is selected at runtime, the first time any of the
+   * kernels is invoked.
+   */
+  
+  void simd_f64_add (double *dest, const double *a, const double *b, long n);
+  void simd_f64_mul (double *dest, const double *a, const double *b, long n);
+  
+  // dest[i] = a[i] * b[i] + c[i]
+  void simd_f64_fma (double *dest, const double *a, const double *b,
+                     const double *c, long n);
+  
+  // y[i] += alpha * x[i]
+  void simd_f64_axpy (double *y, double alpha, const double *x, long n);
+  
+  double simd_f64_dot (const double *a, const double *b, long n);
+  double simd_f64_sum (const double *a, long n);
+  double simd_f64_min (const double *a, long n);
+  double simd_f64_max (const double *a, long n);
+  
+  
+  void simd_i64_add (long long *dest, const long long *a, const long long *b,
+                     long n);
+  void simd_i64_mul (long long *dest, const long long *a, const long long *b,
+                     long n);
+  void simd_i64_fma (long long *dest, const long long *a, const long long *b,
+                     const long long *c, long n);
+  
+  long long simd_i64_dot (const long long *a, const long long *b, long n);
+  long long simd_i64_sum (const long long *a, long n);
+  long long simd_i64_min (const long long *a, long n);
+  long long simd_i64_max (const long long *a, long n);
+  
+  
+  // index of the first occurrence of needle[0..m) in hay[0..n), or -1.
+  long simd_str_find (const char *hay, long n, const char *needle, long m);
+  
+  // index of the first byte in s[0..n) that is equal to :a: or :b:, or -1.
+  long simd_find_byte2 (const char *s, long n, char a, char b);
+}
+
+#endif
+
@@ -17,8 +17,12 @@
  */
 
 #include "compiler/compiler.hpp"
+#include "runtime/builtins.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/gc/gc.hpp"
 #include <unordered_map>
 #include <sstream>
+#include <gmp.h>
 
 
 namespace rho {
@@ -33,11 +37,18 @@ namespace rho {
       { "cdr", &compiler::compile_builtin_cdr },
       { "cons", &compiler::compile_builtin_cons },
       { "breakpoint", &compiler::compile_builtin_breakpoint },
-      { "print", &compiler::compile_builtin_print },
-      { "len", &compiler::compile_builtin_len },
+      { "force", &compiler::compile_builtin_force },
+      { "resume", &compiler::compile_builtin_resume },
     };
     
     auto name = std::static_pointer_cast<ast_ident> (expr->get_fun ())->get_value ();
+    int index = rho_native_find (name);
+    if (index != -1)
+      {
+        this->compile_builtin_native (expr, index);
+        return true;
+      }
+    
     auto itr = _map.find (name);
     if (itr == _map.end ())
       return false;
@@ -112,38 +123,243 @@ namespace rho {
   
   
   
+  /* 
+   * Forcing a promise may call its delayed function, so it is compiled into
+   * a loop around an ordinary call instruction:
+   * 
+   *   L:  force L_end   ; resolves chains of forced promises in-place, or
+   *                     ; pushes the first unforced promise and its function
+   *       call 0
+   *       fulfil        ; stores the result in the promise
+   *       jmp L
+   *   L_end:
+   */
   void
-  compiler::compile_builtin_print (std::shared_ptr<ast_fun_call> expr)
+  compiler::compile_builtin_force (std::shared_ptr<ast_fun_call> expr)
   {
     if (expr->get_args ().size () != 1)
       {
         this->errs.report (ERR_ERROR,
-          "builtin `print' expects exactly 1 argument",
+          "builtin `force' expects exactly 1 argument",
           expr->get_location ());
         return;
       }
     
-    for (auto a : expr->get_args ())
-      this->compile_expr (a);
-    this->cgen.emit_call_builtin (0, expr->get_args ().size ());
+    this->compile_expr (expr->get_args ()[0]);
+    
+    int lbl_loop = this->cgen.make_label ();
+    int lbl_end = this->cgen.make_label ();
+    
+    this->cgen.mark_label (lbl_loop);
+    this->cgen.emit_force (lbl_end);
+    this->cgen.emit_call (0);
+    this->cgen.emit_fulfil ();
+    this->cgen.emit_jmp (lbl_loop);
+    this->cgen.mark_label (lbl_end);
   }
   
   
   
+  /* 
+   * resume(co) or resume(co, val): continues a coroutine until it yields or
+   * returns.  :val: becomes the value of the yield expression the coroutine
+   * is stopped at.
+   */
   void
-  compiler::compile_builtin_len (std::shared_ptr<ast_fun_call> expr)
+  compiler::compile_builtin_resume (std::shared_ptr<ast_fun_call> expr)
   {
-    if (expr->get_args ().size () != 1)
+    auto& args = expr->get_args ();
+    if (args.size () != 1 && args.size () != 2)
       {
         this->errs.report (ERR_ERROR,
-          "builtin `len' expects exactly 1 argument",
+          "builtin `resume' expects 1 or 2 arguments",
           expr->get_location ());
         return;
       }
     
+    if (args.size () == 2)
+      this->compile_expr (args[1]);
+    else
+      this->cgen.emit_push_nil ();
+    this->compile_expr (args[0]);
+    this->cgen.emit_resume ();
+  }
+  
+  
+  
+  /* 
+   * Natives from the registry (runtime/builtins.hpp) are handed their
+   * arguments on the stack by the builtin instruction.
+   */
+  void
+  compiler::compile_builtin_native (std::shared_ptr<ast_fun_call> expr,
+                                    int index)
+  {
+    auto native = rho_native_get (index);
+    int argc = (int)expr->get_args ().size ();
+    if (argc < native->min_args
+      || (native->max_args != -1 && argc > native->max_args))
+      {
+        std::ostringstream ss;
+        ss << "builtin `" << native->name << "' expects ";
+        if (native->max_args == native->min_args)
+          ss << "exactly " << native->min_args;
+        else if (native->max_args == -1)
+          ss << "at least " << native->min_args;
+        else
+          ss << native->min_args << " to " << native->max_args;
+        int shown = (native->max_args == native->min_args
+          || native->max_args == -1) ? native->min_args : native->max_args;
+        ss << ((shown == 1) ? " argument" : " arguments");
+        this->errs.report (ERR_ERROR, ss.str (), expr->get_location ());
+        return;
+      }
+    else if (argc > 255)
+      {
+        this->errs.report (ERR_ERROR, "too many arguments in builtin call",
+          expr->get_location ());
+        return;
+      }
+    
+    if ((native->flags & NATIVE_FOLDABLE) == NATIVE_FOLDABLE
+      && this->try_fold_native (expr, index))
+      return;
+    
     for (auto a : expr->get_args ())
       this->compile_expr (a);
-    this->cgen.emit_call_builtin (1, expr->get_args ().size ());
+    this->cgen.emit_call_builtin (index, argc);
+  }
+  
+  /* 
+   * If all arguments of the specified call to a foldable native are
+   * literals, evaluates the call at compile time and emits its result as a
+   * constant.  Only results that have a literal form are folded.
+   * Returns false (emitting nothing) if the call was not folded.
+   */
+  bool
+  compiler::try_fold_native (std::shared_ptr<ast_fun_call> expr, int index)
+  {
+    for (auto a : expr->get_args ())
+      switch (a->get_type ())
+        {
+        case AST_INTEGER:
+        case AST_STRING:
+        case AST_BOOL:
+        case AST_NIL:
+          break;
+        
+        default:
+          return false;
+        }
+    
+    if (!this->fold_vm)
+      this->fold_vm = new virtual_machine ();
+    auto& vm = *this->fold_vm;
+    auto& gc = vm.get_gc ();
+    
+    std::vector<rho_value> args;
+    for (auto a : expr->get_args ())
+      switch (a->get_type ())
+        {
+        case AST_INTEGER:
+          args.push_back (rho_value_make_int (
+            std::static_pointer_cast<ast_integer> (a)->get_value ().c_str (),
+            gc));
+          break;
+        
+        case AST_STRING:
+          {
+            auto& str = std::static_pointer_cast<ast_string> (a)->get_value ();
+            args.push_back (rho_value_make_string (str.c_str (),
+              str.length (), gc));
+          }
+          break;
+        
+        case AST_BOOL:
+          args.push_back (rho_value_make_bool (
+            std::static_pointer_cast<ast_bool> (a)->get_value ()));
+          break;
+        
+        default:
+          args.push_back (rho_value_make_nil ());
+          break;
+        }
+    
+    bool folded = false;
+    try
+      {
+        auto res = vm.call_native (index, (int)args.size (), args.data ());
+        switch (res.type)
+          {
+          case RHO_INTEGER:
+            // push_int32 is the widest integer constant available.
+            if (mpz_cmp_si (res.val.gc->val.i, 2147483647) <= 0
+              && mpz_cmp_si (res.val.gc->val.i, -2147483648) >= 0)
+              {
+                int n = (int)mpz_get_si (res.val.gc->val.i);
+                if (n >= 0 && n <= 10)
+                  this->cgen.emit_push_sint (n);
+                else
+                  this->cgen.emit_push_int32 (n);
+                folded = true;
+              }
+            break;
+          
+          case RHO_STR:
+            this->cgen.emit_push_cstr (std::string (rho_str_chars (res.val.gc),
+              res.val.gc->val.s.len));
+            folded = true;
+            break;
+          
+          case RHO_BOOL:
+            if (res.val.b)
+              this->cgen.emit_push_true ();
+            else
+              this->cgen.emit_push_false ();
+            folded = true;
+            break;
+          
+          case RHO_NIL:
+            this->cgen.emit_push_nil ();
+            folded = true;
+            break;
+          
+          default: ;
+          }
+      }
+    catch (const vm_error&)
+      {
+        // leave the error to be raised at run-time.
+      }
+    
+    for (auto& v : args)
+      gc_unprotect (v);
+    return folded;
+  }
+  
+  
+  
+  /* 
+   * Inside a pattern, a call such as `sin(u)' stands for the symbolic
+   * application of the named function, and is compiled into a call to the
+   * expr_fn builtin.  Calls to record constructors match records instead.
+   */
+  void
+  compiler::compile_pattern_fun_call (std::shared_ptr<ast_fun_call> expr)
+  {
+    if (this->try_compile_record_ctor (expr))
+      return;
+    
+    auto name = std::static_pointer_cast<ast_ident> (expr->get_fun ())->get_value ();
+    this->cgen.emit_push_cstr (name);
+    
+    auto& args = expr->get_args ();
+    for (auto a : args)
+      this->compile_expr (a);
+    this->cgen.emit_push_empty_list ();
+    for (int i = 0; i < (int)args.size (); ++i)
+      this->cgen.emit_cons ();
+    
+    this->cgen.emit_call_builtin (rho_native_find ("expr_fn"), 2);
   }
 }
-
@@ -367,6 +367,17 @@ namespace rho {
     this->put_byte (0x18);
   }
   
+  /* 
+   * The format program (see rho_format_compile) is stored inline, right
+   * after the opcode.
+   */
+  void
+  code_generator::emit_format (const std::string& prog)
+  {
+    this->put_byte (0x19);
+    this->put_bytes (prog.data (), prog.length ());
+  }
+  
   
   
   void
@@ -574,6 +585,64 @@ namespace rho {
   
   
   
+  void
+  code_generator::emit_mk_promise ()
+  {
+    this->put_byte (0x58);
+  }
+  
+  void
+  code_generator::emit_force (int lbl)
+  {
+    this->put_byte (0x59);
+    this->put_label (lbl, 4, false);
+  }
+  
+  void
+  code_generator::emit_fulfil ()
+  {
+    this->put_byte (0x5A);
+  }
+  
+  
+  
+  void
+  code_generator::emit_resume ()
+  {
+    this->put_byte (0xC0);
+  }
+  
+  void
+  code_generator::emit_yield ()
+  {
+    this->put_byte (0xC1);
+  }
+  
+  
+  
+  void
+  code_generator::emit_memo_init (unsigned int cap, unsigned char flags)
+  {
+    this->put_byte (0xD0);
+    this->put_int (cap);
+    this->put_byte (flags);
+  }
+  
+  void
+  code_generator::emit_memo_enter ()
+  {
+    this->put_byte (0xD1);
+  }
+  
+  void
+  code_generator::emit_memo_leave (unsigned char localc)
+  {
+    this->put_byte (0xD2);
+    this->put_byte (localc);
+  }
+  
+  
+  
   void 
   code_generator::emit_push_pvar (int pv)
   {
@@ -678,6 +747,65 @@ namespace rho {
     this->put_byte (0x93);
   }
   
+  void
+  code_generator::emit_mk_map (unsigned short count)
+  {
+    this->put_byte (0x94);
+    this->put_short (count);
+  }
+  
+  
+  
+  void
+  code_generator::emit_mk_record (const std::string& tag, unsigned char count)
+  {
+    this->put_byte (0xE0);
+    int lbl = this->make_and_mark_label ();
+    this->put_int (0);
+    this->put_byte (count);
+    
+    this->rel_set_type (REL_A);
+    this->rel_set_val (tag);
+    this->add_reloc (lbl);
+  }
+  
+  /* 
+   * Emits the table of (tag, field index) pairs that follows get_field and
+   * set_field instructions.
+   */
+  void
+  code_generator::put_field_table (
+    const std::vector<std::pair<std::string, int>>& tbl)
+  {
+    this->put_byte ((unsigned char)tbl.size ());
+    for (auto& p : tbl)
+      {
+        int lbl = this->make_and_mark_label ();
+        this->put_int (0);
+        this->put_byte ((unsigned char)p.second);
+        
+        this->rel_set_type (REL_A);
+        this->rel_set_val (p.first);
+        this->add_reloc (lbl);
+      }
+  }
+  
+  void
+  code_generator::emit_get_field (
+    const std::vector<std::pair<std::string, int>>& tbl)
+  {
+    this->put_byte (0xE1);
+    this->put_field_table (tbl);
+  }
+  
+  void
+  code_generator::emit_set_field (
+    const std::vector<std::pair<std::string, int>>& tbl)
+  {
+    this->put_byte (0xE2);
+    this->put_field_table (tbl);
+  }
+  
   
   
   void
@@ -19,6 +19,8 @@
 #include "compiler/compiler.hpp"
 #include "util/ast_tools.hpp"
 #include "util/module_tools.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/memo.hpp"
 #include <stdexcept>
 #include <gmp.h>
 #include <sstream>
@@ -38,11 +40,14 @@ namespace rho {
     this->alloc_globs = true;
     this->glob_count = -1;
     this->next_glob_idx = 0;
+    
+    this->fusion_on = true;
+    this->fold_vm = nullptr;
   }
   
   compiler::~compiler ()
   {
-    
+    delete this->fold_vm;
   }
   
   
@@ -118,11 +123,27 @@ namespace rho {
   bool
   compiler::can_perform_tail_call ()
   {
+    // a memoized function must get control back to record its result.
+    if (!this->memo_frames.empty () && this->memo_frames.top ())
+      return false;
     return !this->expr_frames.empty () && this->expr_frames.top ().is_last ();
   }
   
   
   
+  /* 
+   * Emits code that attaches a result cache to the closure on top of the
+   * stack.
+   */
+  void
+  compiler::compile_memo_init (const ast_memo_opts& opts)
+  {
+    unsigned int cap = opts.size ? (unsigned int)opts.size : MEMO_DEF_SIZE;
+    this->cgen.emit_memo_init (cap, opts.weak ? MEMO_WEAK : 0);
+  }
+  
+  
+  
   std::string
   compiler::qualify_name (const std::string& name,
                           std::shared_ptr<scope_frame> scope)
@@ -189,6 +210,7 @@ namespace rho {
     this->curr_ns = "";
     this->mident = mident;
     this->atoms.clear ();
+    this->records.clear ();
     this->van.reset ();
     
     this->compile_program (program);
@@ -220,9 +242,13 @@ namespace rho {
     this->mod->set_name (this->mident);
     
     this->process_imports ();
+    this->add_records (program);
+    
+    // rewriting the tree invalidates any earlier analysis of it.
+    bool fused = this->fusion_on && this->fuse_pipelines (program);
     
     auto& ent = this->mstore.retrieve (this->mident);
-    if (ent.van && ent.van->get_analysis_level () == ANL_FULL)
+    if (!fused && ent.van && ent.van->get_analysis_level () == ANL_FULL)
       this->van = ent.van;
     if (!this->van)
       {
@@ -417,6 +443,7 @@ namespace rho {
     auto atoms = ast_tools::extract_atom_defs (ent.ast);
     for (auto& atom : atoms)
       this->atoms.insert (atom);
+    this->add_records (ent.ast);
   }
   
   void
@@ -449,6 +476,8 @@ namespace rho {
     
     if (close_needed)
       this->cgen.emit_close (fun_f->get_local_count ());
+    if (!this->memo_frames.empty () && this->memo_frames.top ())
+      this->cgen.emit_memo_leave (fun_f->get_local_count ());
     
     this->cgen.emit_ret ();
   }
@@ -542,6 +571,11 @@ namespace rho {
             }
         }
       
+      bool memo = stmt->get_memo ().enabled;
+      if (memo)
+        this->cgen.emit_memo_enter ();
+      this->memo_frames.push (memo);
+      
       auto& stmts = stmt->get_body ()->get_stmts ();
       if (stmts.empty ())
         this->cgen.emit_push_nil ();
@@ -565,10 +599,14 @@ namespace rho {
           
           if (!fun_f->get_cfrees ().empty ())
             this->cgen.emit_close (fun_f->get_local_count ());
+          if (memo)
+            this->cgen.emit_memo_leave (fun_f->get_local_count ());
           
           this->cgen.emit_ret ();
           this->pop_expr_frame ();
         }
+      
+      this->memo_frames.pop ();
     }
     
     this->cgen.mark_label (lbl_cfn);
@@ -609,6 +647,9 @@ namespace rho {
           }
       }
     
+    if (stmt->get_memo ().enabled)
+      this->compile_memo_init (stmt->get_memo ());
+    
     auto proto = this->van->get_fun_proto (stmt);
     auto var = scope->get_var (proto->mname);
     switch (var.type)
@@ -670,6 +711,10 @@ namespace rho {
         this->compile_atom_def (std::static_pointer_cast<ast_atom_def> (stmt));
         break;
       
+      case AST_RECORD_DEF:
+        this->compile_record_def (std::static_pointer_cast<ast_record_def> (stmt));
+        break;
+      
       case AST_STMT_BLOCK:
         this->compile_stmt_block (std::static_pointer_cast<ast_stmt_block> (stmt));
         break;
@@ -868,6 +913,10 @@ namespace rho {
         this->compile_assign (expr->get_lhs (), expr->get_rhs ());
         return;
       }
+    else if (expr->get_op () == AST_BINOP_MOD
+      && expr->get_lhs ()->get_type () == AST_STRING
+      && this->compile_format (expr))
+      return;
     
     this->push_expr_frame (false);
     this->compile_expr (expr->get_lhs ());
@@ -898,6 +947,36 @@ namespace rho {
       }
   }
   
+  /* 
+   * Compiles `fmt % args' where :fmt: is a string literal: the format string
+   * is parsed here, once, and the resulting program is run by a format
+   * instruction.  Returns false (emitting nothing) if the format string is
+   * malformed, in which case the error is left to be raised at runtime.
+   */
+  bool
+  compiler::compile_format (std::shared_ptr<ast_binop> expr)
+  {
+    auto& fmt = std::static_pointer_cast<ast_string> (expr->get_lhs ())
+      ->get_value ();
+    
+    std::string prog;
+    try
+      {
+        rho_format_compile (fmt.c_str (), fmt.length (), prog);
+      }
+    catch (const vm_error&)
+      {
+        return false;
+      }
+    
+    this->push_expr_frame (false);
+    this->compile_expr (expr->get_rhs ());
+    this->pop_expr_frame ();
+    
+    this->cgen.emit_format (prog);
+    return true;
+  }
+  
   void
   compiler::compile_fun (std::shared_ptr<ast_fun> expr)
   {
@@ -935,6 +1014,11 @@ namespace rho {
             }
         }
       
+      bool memo = expr->get_memo ().enabled;
+      if (memo)
+        this->cgen.emit_memo_enter ();
+      this->memo_frames.push (memo);
+      
       auto& stmts = expr->get_body ()->get_stmts ();
       if (stmts.empty ())
         this->cgen.emit_push_nil ();
@@ -958,10 +1042,14 @@ namespace rho {
           
           if (!fun_f->get_cfrees ().empty ())
             this->cgen.emit_close (fun_f->get_local_count ());
+          if (memo)
+            this->cgen.emit_memo_leave (fun_f->get_local_count ());
           
           this->cgen.emit_ret ();
           this->pop_expr_frame ();
         }
+      
+      this->memo_frames.pop ();
     }
     
     this->cgen.mark_label (lbl_cfn);
@@ -1001,6 +1089,9 @@ namespace rho {
             throw std::runtime_error ("compile_fun(): shouldn't happen");
           }
       }
+    
+    if (expr->get_memo ().enabled)
+      this->compile_memo_init (expr->get_memo ());
   }
   
   
@@ -1028,6 +1119,9 @@ namespace rho {
     
     if (mprotos.empty ())
       return false;
+    
+    // arguments and guards are never in tail position
+    this->push_expr_frame (false);
 
     auto gscopes = this->van->get_guard_scopes (
       std::static_pointer_cast<ast_ident> (expr->get_fun ()));
@@ -1161,6 +1255,7 @@ namespace rho {
     
     this->cgen.mark_label (lbl_end);
     
+    this->pop_expr_frame ();
     return true;
   }
   
@@ -1171,6 +1266,12 @@ namespace rho {
     bool tail = this->can_perform_tail_call ();
     if (expr->get_fun ()->get_type () == AST_IDENT)
       {
+        if (this->pat_on)
+          {
+            this->compile_pattern_fun_call (expr);
+            return;
+          }
+        
         auto& name = std::static_pointer_cast<ast_ident> (expr->get_fun ())->get_value ();
         if (name == "$")
           ;
@@ -1183,7 +1284,13 @@ namespace rho {
             auto var = scope->get_var (qn);
             if (var.type == VAR_UNDEF && this->name_imps.find (qn) == this->name_imps.end ())
               {
-                if (this->compile_builtin (expr))
+                if (this->try_compile_record_ctor (expr))
+                  return;
+                
+                this->push_expr_frame (false);
+                bool builtin = this->compile_builtin (expr);
+                this->pop_expr_frame ();
+                if (builtin)
                   return;
               }
           }
@@ -1197,12 +1304,14 @@ namespace rho {
       }
     
     // push arguments (in reverse order)
+    this->push_expr_frame (false);
     auto& args = expr->get_args ();
     for (auto itr = args.rbegin(); itr != args.rend (); ++itr)
       this->compile_expr (*itr);
     
     // push function
     this->compile_expr (expr->get_fun ());
+    this->pop_expr_frame ();
     
     if (tail)
       {
@@ -1334,6 +1443,9 @@ namespace rho {
     if (lbl_prev != -1)
       this->cgen.mark_label (lbl_prev);
     
+    // no case matched; the subject is still on the stack.
+    this->cgen.emit_pop ();
+    
     if (expr->get_else_body ())
       this->compile_expr (expr->get_else_body ());
     else
@@ -1359,6 +1471,28 @@ namespace rho {
     this->cgen.emit_mk_vec (elems.size ());
   }
   
+  void
+  compiler::compile_map (std::shared_ptr<ast_map> expr)
+  {
+    auto& entries = expr->get_entries ();
+    if (entries.size () > 0xFFFF)
+      {
+        this->errs.report (ERR_ERROR, "too many entries in map literal",
+          expr->get_location ());
+        return;
+      }
+    
+    for (auto& e : entries)
+      {
+        this->push_expr_frame (false);
+        this->compile_expr (e.first);
+        this->compile_expr (e.second);
+        this->pop_expr_frame ();
+      }
+    
+    this->cgen.emit_mk_map (entries.size ());
+  }
+  
   
   
   void
@@ -1467,6 +1601,10 @@ namespace rho {
         this->compile_assign_to_subscript (std::static_pointer_cast<ast_subscript> (lhs), rhs);
         break;
       
+      case AST_FIELD:
+        this->compile_assign_to_field (std::static_pointer_cast<ast_field> (lhs), rhs);
+        break;
+      
       default:
         this->errs.report (ERR_ERROR, "invalid left-hand side type in assignment",
           lhs->get_location ());
@@ -1531,6 +1669,24 @@ namespace rho {
   
   
   
+  void
+  compiler::compile_delay (std::shared_ptr<ast_delay> expr)
+  {
+    this->compile_fun (expr->get_fun ());
+    this->cgen.emit_mk_promise ();
+  }
+  
+  void
+  compiler::compile_yield (std::shared_ptr<ast_yield> expr)
+  {
+    this->push_expr_frame (false);
+    this->compile_expr (expr->get_expr ());
+    this->pop_expr_frame ();
+    this->cgen.emit_yield ();
+  }
+  
+  
+  
   void
   compiler::compile_expr (std::shared_ptr<ast_expr> expr)
   {
@@ -1600,10 +1756,18 @@ namespace rho {
         this->compile_vector (std::static_pointer_cast<ast_vector> (expr));
         break;
       
+      case AST_MAP:
+        this->compile_map (std::static_pointer_cast<ast_map> (expr));
+        break;
+      
       case AST_SUBSCRIPT:
         this->compile_subscript (std::static_pointer_cast<ast_subscript> (expr));
         break;
       
+      case AST_FIELD:
+        this->compile_field (std::static_pointer_cast<ast_field> (expr));
+        break;
+      
       case AST_EXPR_BLOCK:
         this->compile_expr_block (std::static_pointer_cast<ast_expr_block> (expr));
         break;
@@ -1616,6 +1780,14 @@ namespace rho {
         this->compile_n (std::static_pointer_cast<ast_n> (expr));
         break;
       
+      case AST_DELAY:
+        this->compile_delay (std::static_pointer_cast<ast_delay> (expr));
+        break;
+      
+      case AST_YIELD:
+        this->compile_yield (std::static_pointer_cast<ast_yield> (expr));
+        break;
+      
       default:
         throw std::runtime_error ("unhandled expression type");
       }
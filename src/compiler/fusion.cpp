@@ -0,0 +1,454 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compiler/compiler.hpp"
+#include "util/ast_tools.hpp"
+#include <unordered_set>
+#include <string>
+
+
+/*
+ * Pipeline fusion.
+ *
+ * Chains such as map(f, filter(g, range(a, b))) that use the combinators of
+ * std:list build (and reverse) a complete intermediate list at every stage.
+ * This pass rewrites such chains, before variable analysis takes place, into
+ * a call to the list_fuse builtin, which walks the source once and conses up
+ * only the final list.  Chains of ls:map from std:streams are collapsed
+ * into a single ls:map of the composed function.
+ *
+ * Since the calls of the stage functions get interleaved, only stages whose
+ * function is a literal that makes no calls and stores nothing are fused.
+ * The pass can be disabled with compiler::set_fusion().
+ */
+
+namespace rho {
+
+  // list_fuse takes the filter stages as a bit mask.
+#define FUSE_MAX_STAGES   63
+
+  namespace {
+
+    enum fuse_op
+    {
+      FUSE_NONE,
+      FUSE_LIST_MAP,
+      FUSE_LIST_FILTER,
+      FUSE_LIST_RANGE,
+      FUSE_STREAM_MAP,
+    };
+
+    struct fuse_stage
+    {
+      fuse_op op;
+      std::shared_ptr<ast_expr> fn;
+    };
+  }
+
+
+
+  static bool
+  _ends_with (const std::string& str, const std::string& suffix)
+  {
+    return str.length () >= suffix.length ()
+      && str.compare (str.length () - suffix.length (), suffix.length (),
+                      suffix) == 0;
+  }
+
+  /*
+   * Returns the unqualified part of the specified name.
+   */
+  static std::string
+  _base_name (const std::string& name)
+  {
+    auto idx = name.rfind (':');
+    return (idx == std::string::npos) ? name : name.substr (idx + 1);
+  }
+
+  /*
+   * Collects the names of all variables, parameters, functions and pattern
+   * variables defined anywhere in the specified program.  An identifier that
+   * shares its name with one of these might not refer to the imported
+   * combinator, so it is never fused.
+   */
+  static void
+  _collect_bound_names (std::shared_ptr<ast_program> program,
+                        std::unordered_set<std::string>& bound,
+                        bool& has_using)
+  {
+    ast_tools::traverse_fn visit = [&] (std::shared_ptr<ast_node> node) {
+      switch (node->get_type ())
+        {
+        case AST_VAR_DEF:
+          bound.insert (std::static_pointer_cast<ast_var_def> (node)
+            ->get_var ()->get_value ());
+          break;
+
+        case AST_FUN:
+          for (auto& p : std::static_pointer_cast<ast_fun> (node)->get_params ())
+            bound.insert (p);
+          break;
+
+        case AST_FUN_DEF:
+          {
+            auto fd = std::static_pointer_cast<ast_fun_def> (node);
+            bound.insert (fd->get_name ());
+            for (auto& p : fd->get_params ())
+              bound.insert (p);
+          }
+          break;
+
+        case AST_LET:
+          for (auto& d : std::static_pointer_cast<ast_let> (node)->get_defs ())
+            bound.insert (d.first);
+          break;
+
+        case AST_MATCH:
+          for (auto& c : std::static_pointer_cast<ast_match> (node)->get_cases ())
+            for (auto& name : ast_tools::extract_idents (c.pat))
+              bound.insert (name);
+          break;
+
+        case AST_USING:
+          has_using = true;
+          break;
+
+        default: ;
+        }
+
+      return TR_CONTINUE;
+    };
+
+    ast_tools::traverse_dfs (program, ast_tools::traverse_fn (visit));
+  }
+
+  /*
+   * Returns true if evaluating the specified expression has no side effects,
+   * and so it does not matter when (or whether) it is evaluated relative to
+   * the rest of the pipeline.
+   */
+  static bool
+  _is_simple_expr (std::shared_ptr<ast_expr> expr)
+  {
+    switch (expr->get_type ())
+      {
+      case AST_INTEGER:
+      case AST_FLOAT:
+      case AST_IDENT:
+      case AST_NIL:
+      case AST_BOOL:
+      case AST_ATOM:
+      case AST_STRING:
+      case AST_FUN:
+        return true;
+
+      default:
+        return false;
+      }
+  }
+
+  /*
+   * Returns true if the specified expression is a function literal whose body
+   * makes no calls and stores nothing, so that calls to it can be reordered
+   * freely.  A named function could be bound to anything, so it never
+   * qualifies.
+   */
+  static bool
+  _is_pure_fun (std::shared_ptr<ast_expr> expr)
+  {
+    if (expr->get_type () != AST_FUN)
+      return false;
+    
+    bool pure = true;
+    ast_tools::traverse_fn visit = [&] (std::shared_ptr<ast_node> node) {
+      switch (node->get_type ())
+        {
+        case AST_INTEGER:
+        case AST_FLOAT:
+        case AST_IDENT:
+        case AST_NIL:
+        case AST_BOOL:
+        case AST_ATOM:
+        case AST_STRING:
+        case AST_VECTOR:
+        case AST_MAP:
+        case AST_LIST:
+        case AST_CONS:
+        case AST_UNOP:
+        case AST_IF:
+        case AST_MATCH:
+        case AST_LET:
+        case AST_N:
+        case AST_SUBSCRIPT:
+        case AST_FIELD:
+        case AST_FUN:
+        case AST_VAR_DEF:
+        case AST_RET:
+        case AST_EMPTY_STMT:
+        case AST_EXPR_STMT:
+        case AST_EXPR_BLOCK:
+        case AST_STMT_BLOCK:
+          return TR_CONTINUE;
+        
+        case AST_BINOP:
+          {
+            auto op = std::static_pointer_cast<ast_binop> (node)->get_op ();
+            if (op != AST_BINOP_ASSIGN && op != AST_BINOP_DEF)
+              return TR_CONTINUE;
+          }
+          break;
+        
+        default: ;
+        }
+      
+      pure = false;
+      return TR_SKIP;
+    };
+    
+    ast_tools::traverse_dfs (expr, ast_tools::traverse_fn (visit));
+    return pure;
+  }
+
+
+  
+  static std::shared_ptr<ast_ident>
+  _make_ident (const std::string& name, const ast_node::location& loc)
+  {
+    auto ident = std::make_shared<ast_ident> (name);
+    ident->set_location (loc);
+    return ident;
+  }
+  
+  /*
+   * Builds a function literal that returns the specified expression.
+   */
+  static std::shared_ptr<ast_fun>
+  _make_fun (const std::vector<std::string>& params,
+             std::shared_ptr<ast_expr> expr, const ast_node::location& loc)
+  {
+    auto ret = std::make_shared<ast_ret> (expr);
+    ret->set_location (loc);
+    auto body = std::make_shared<ast_stmt_block> ();
+    body->set_location (loc);
+    body->push_back (ret);
+
+    auto fn = std::make_shared<ast_fun> ();
+    fn->set_location (loc);
+    for (auto& p : params)
+      fn->add_param (p);
+    fn->set_body (body);
+    return fn;
+  }
+
+  /*
+   * Builds a call to the list_fuse (or list_fuse_range) builtin, which runs
+   * all list stages natively in a single pass over the source.
+   */
+  static std::shared_ptr<ast_fun_call>
+  _make_list_fuse (const std::vector<fuse_stage>& stages, bool range,
+                   const ast_node::location& loc)
+  {
+    auto fn = std::make_shared<ast_ident> (range ? "list_fuse_range"
+                                                 : "list_fuse");
+    fn->set_location (loc);
+    auto call = std::make_shared<ast_fun_call> (fn);
+    call->set_location (loc);
+
+    auto fns = std::make_shared<ast_vector> ();
+    fns->set_location (loc);
+    long ops = 0;
+    for (size_t i = 0; i < stages.size (); ++i)
+      {
+        fns->push_back (stages[i].fn);
+        if (stages[i].op == FUSE_LIST_FILTER)
+          ops |= 1L << i;
+      }
+
+    auto mask = std::make_shared<ast_integer> (std::to_string (ops));
+    mask->set_location (loc);
+
+    call->add_arg (fns);
+    call->add_arg (mask);
+    return call;
+  }
+
+  /*
+   * Generates a function that takes ls:map, the stage functions (outermost
+   * first) and the source stream, and maps the composition of the stage
+   * functions over the stream.
+   */
+  static std::shared_ptr<ast_fun>
+  _make_stream_map (const std::vector<fuse_stage>& stages,
+                    const ast_node::location& loc)
+  {
+    // fun (__fz_v) { ret __fz_fN(... __fz_f0(__fz_v) ...); }
+    std::shared_ptr<ast_expr> val = _make_ident ("__fz_v", loc);
+    for (size_t i = 0; i < stages.size (); ++i)
+      {
+        auto call = std::make_shared<ast_fun_call> (
+          _make_ident ("__fz_f" + std::to_string (i), loc));
+        call->set_location (loc);
+        call->add_arg (val);
+        val = call;
+      }
+    auto composed = _make_fun ({ "__fz_v" }, val, loc);
+
+    // fun (__fz_map, __fz_fN, ..., __fz_f0, __fz_src) {
+    //   ret __fz_map(<composed>, __fz_src); }
+    std::vector<std::string> params { "__fz_map" };
+    for (int i = (int)stages.size () - 1; i >= 0; --i)
+      params.push_back ("__fz_f" + std::to_string (i));
+    params.push_back ("__fz_src");
+
+    auto call = std::make_shared<ast_fun_call> (_make_ident ("__fz_map", loc));
+    call->set_location (loc);
+    call->add_arg (composed);
+    call->add_arg (_make_ident ("__fz_src", loc));
+    return _make_fun (params, call, loc);
+  }
+
+
+
+  /*
+   * Rewrites fusable combinator chains in the specified program.
+   * Returns true if anything was changed.
+   */
+  bool
+  compiler::fuse_pipelines (std::shared_ptr<ast_program> program)
+  {
+    std::unordered_set<std::string> bound;
+    bool has_using = false;
+    _collect_bound_names (program, bound, has_using);
+    bool fuse_builtins_visible = bound.find ("list_fuse") == bound.end ()
+      && bound.find ("list_fuse_range") == bound.end ();
+
+    // determines which std combinator (if any) is being called.
+    auto classify = [&] (std::shared_ptr<ast_expr> expr) -> fuse_op {
+      if (expr->get_type () != AST_FUN_CALL)
+        return FUSE_NONE;
+      auto call = std::static_pointer_cast<ast_fun_call> (expr);
+      if (call->get_fun ()->get_type () != AST_IDENT
+        || call->get_args ().size () != 2)
+        return FUSE_NONE;
+
+      auto& name = std::static_pointer_cast<ast_ident> (call->get_fun ())
+        ->get_value ();
+      if (bound.find (_base_name (name)) != bound.end ())
+        return FUSE_NONE;
+      if (has_using && name.find (':') == std::string::npos)
+        return FUSE_NONE;
+
+      auto itr = this->name_imps.find (name);
+      if (itr == this->name_imps.end ())
+        return FUSE_NONE;
+      auto& mident = itr->second.mident;
+
+      if (_ends_with (mident, "std/list.rho"))
+        {
+          if (name == "map") return FUSE_LIST_MAP;
+          if (name == "filter") return FUSE_LIST_FILTER;
+          if (name == "range") return FUSE_LIST_RANGE;
+        }
+      else if (_ends_with (mident, "std/streams.rho"))
+        {
+          if (name == "ls:map") return FUSE_STREAM_MAP;
+        }
+
+      return FUSE_NONE;
+    };
+
+    bool changed = false;
+    ast_tools::traverse_fn visit = [&] (std::shared_ptr<ast_node> node) {
+      if (node->get_type () != AST_FUN_CALL)
+        return TR_CONTINUE;
+
+      auto call = std::static_pointer_cast<ast_fun_call> (node);
+      auto op = classify (call);
+      if (op != FUSE_LIST_MAP && op != FUSE_LIST_FILTER
+        && op != FUSE_STREAM_MAP)
+        return TR_CONTINUE;
+
+      // collect stages, innermost first.
+      std::vector<fuse_stage> stages;
+      std::shared_ptr<ast_expr> src = call;
+      for (;;)
+        {
+          auto sop = classify (src);
+          bool ok = (op == FUSE_STREAM_MAP)
+            ? (sop == FUSE_STREAM_MAP)
+            : (sop == FUSE_LIST_MAP || sop == FUSE_LIST_FILTER);
+          if (!ok)
+            break;
+
+          auto scall = std::static_pointer_cast<ast_fun_call> (src);
+          if (!_is_pure_fun (scall->get_args ()[0])
+            || stages.size () == FUSE_MAX_STAGES)
+            break;
+          stages.insert (stages.begin (), { sop, scall->get_args ()[0] });
+          src = scall->get_args ()[1];
+        }
+
+      bool range = false;
+      if (op != FUSE_STREAM_MAP && classify (src) == FUSE_LIST_RANGE)
+        {
+          auto& rargs = std::static_pointer_cast<ast_fun_call> (src)->get_args ();
+          range = _is_simple_expr (rargs[0]) && _is_simple_expr (rargs[1]);
+        }
+
+      // nothing to gain from a single stage over a plain list.
+      if (stages.empty () || (stages.size () == 1 && !range))
+        return TR_CONTINUE;
+      if (op != FUSE_STREAM_MAP && !fuse_builtins_visible)
+        return TR_CONTINUE;
+
+      // arguments are evaluated last-to-first, so the source goes last to
+      // keep it evaluated before the stage functions, as it was before.
+      if (op == FUSE_STREAM_MAP)
+        {
+          std::vector<std::shared_ptr<ast_expr>> args;
+          args.push_back (call->get_fun ());
+          for (auto itr = stages.rbegin (); itr != stages.rend (); ++itr)
+            args.push_back (itr->fn);
+          args.push_back (src);
+          
+          call->get_fun () = _make_stream_map (stages, call->get_location ());
+          call->get_args () = args;
+          changed = true;
+          return TR_CONTINUE;
+        }
+
+      auto fused = _make_list_fuse (stages, range, call->get_location ());
+      if (range)
+        {
+          auto& rargs = std::static_pointer_cast<ast_fun_call> (src)->get_args ();
+          fused->add_arg (rargs[0]);
+          fused->add_arg (rargs[1]);
+        }
+      else
+        fused->add_arg (src);
+
+      call->get_fun () = fused->get_fun ();
+      call->get_args () = fused->get_args ();
+      changed = true;
+      return TR_CONTINUE;
+    };
+
+    ast_tools::traverse_dfs (program, ast_tools::traverse_fn (visit));
+    return changed;
+  }
+}
@@ -0,0 +1,240 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compiler/compiler.hpp"
+#include "util/ast_tools.hpp"
+
+
+/*
+ * Record types.
+ *
+ * A definition such as `record point (x, y);' declares a type whose instances
+ * hold their fields in a single flat array.  The type is identified at
+ * run-time by an atom named after it (#point), which the constructor call
+ * point(1, 2) stores in the record.  A field access p.x compiles to a table
+ * of (tag, index) pairs, one for every known record type that has a field
+ * named x, so the VM resolves the access with a single tag comparison in the
+ * common case.
+ */
+
+namespace rho {
+  
+#define RECORD_MAX_FIELDS   255
+  
+  /* 
+   * Returns the name of the atom that tags records of the specified type,
+   * e.g. geo:#point for the record geo:point.
+   */
+  static std::string
+  _record_tag (const std::string& qn)
+  {
+    auto idx = qn.rfind (':');
+    if (idx == std::string::npos)
+      return "#" + qn;
+    return qn.substr (0, idx + 1) + "#" + qn.substr (idx + 1);
+  }
+  
+  
+  
+  void
+  compiler::add_known_record (const std::string& name,
+                              const std::vector<std::string>& fields)
+  {
+    this->known_records[name] = fields;
+  }
+  
+  /* 
+   * Registers all record types defined in the specified program, so that
+   * they can be used before (or outside of) the module that defines them.
+   */
+  void
+  compiler::add_records (std::shared_ptr<ast_program> program)
+  {
+    for (auto& p : ast_tools::extract_record_defs (program))
+      this->records[p.first] = p.second;
+  }
+  
+  /* 
+   * Looks up the record type with the specified name, as seen from the
+   * current namespace.  Stores its qualified name in :qn:.
+   */
+  const std::vector<std::string>*
+  compiler::find_record (const std::string& name, std::string& qn)
+  {
+    std::string ns = this->curr_ns;
+    for (;;)
+      {
+        qn = ns.empty () ? name : (ns + ":" + name);
+        
+        auto itr = this->records.find (qn);
+        if (itr != this->records.end ())
+          return &itr->second;
+        itr = this->known_records.find (qn);
+        if (itr != this->known_records.end ())
+          return &itr->second;
+        
+        if (ns.empty ())
+          return nullptr;
+        auto idx = ns.rfind (':');
+        ns = (idx == std::string::npos) ? "" : ns.substr (0, idx);
+      }
+  }
+  
+  /* 
+   * Builds the (tag, index) table of all record types that have the field
+   * accessed by the specified expression.
+   */
+  bool
+  compiler::find_field (std::shared_ptr<ast_field> expr,
+                        std::vector<std::pair<std::string, int>>& tbl)
+  {
+    auto& name = expr->get_name ();
+    auto search = [&] (
+      const std::unordered_map<std::string, std::vector<std::string>>& recs) {
+      for (auto& p : recs)
+        {
+          auto& fields = p.second;
+          for (size_t i = 0; i < fields.size (); ++i)
+            if (fields[i] == name)
+              {
+                tbl.emplace_back (_record_tag (p.first), (int)i);
+                break;
+              }
+        }
+    };
+    
+    search (this->records);
+    search (this->known_records);
+    if (tbl.empty ())
+      {
+        this->errs.report (ERR_ERROR,
+          "no record type has a field named '" + name + "'",
+          expr->get_location ());
+        return false;
+      }
+    if (tbl.size () > RECORD_MAX_FIELDS)
+      {
+        this->errs.report (ERR_ERROR,
+          "too many record types have a field named '" + name + "'",
+          expr->get_location ());
+        return false;
+      }
+    
+    return true;
+  }
+  
+  
+  
+  void
+  compiler::compile_record_def (std::shared_ptr<ast_record_def> stmt)
+  {
+    auto& fields = stmt->get_fields ();
+    if (fields.size () > RECORD_MAX_FIELDS)
+      {
+        this->errs.report (ERR_ERROR, "too many fields in record type",
+          stmt->get_location ());
+        return;
+      }
+    for (size_t i = 0; i < fields.size (); ++i)
+      for (size_t j = 0; j < i; ++j)
+        if (fields[i] == fields[j])
+          {
+            this->errs.report (ERR_ERROR,
+              "duplicate field '" + fields[i] + "' in record type",
+              stmt->get_location ());
+            return;
+          }
+    
+    auto qn = this->curr_ns.empty () ? stmt->get_name ()
+                                     : (this->curr_ns + ":" + stmt->get_name ());
+    auto tag = _record_tag (qn);
+    this->atoms.insert (tag);
+    this->mod->add_atom (tag);
+    
+    this->cgen.rel_set_type (REL_A);
+    this->cgen.rel_set_val (tag);
+    this->cgen.emit_def_atom (0, tag);
+  }
+  
+  
+  
+  /* 
+   * Compiles a call to the constructor of a record type, if the called name
+   * refers to one.  Fields are evaluated in order, which pattern variables
+   * in record patterns rely on.
+   */
+  bool
+  compiler::try_compile_record_ctor (std::shared_ptr<ast_fun_call> expr)
+  {
+    auto& name = std::static_pointer_cast<ast_ident> (expr->get_fun ())->get_value ();
+    std::string qn;
+    auto fields = this->find_record (name, qn);
+    if (!fields)
+      return false;
+    
+    auto& args = expr->get_args ();
+    if (args.size () != fields->size ())
+      {
+        this->errs.report (ERR_ERROR,
+          "record type '" + name + "' has " + std::to_string (fields->size ())
+            + " field(s), but " + std::to_string (args.size ())
+            + " were given",
+          expr->get_location ());
+        return true;
+      }
+    
+    this->push_expr_frame (false);
+    for (auto a : args)
+      this->compile_expr (a);
+    this->pop_expr_frame ();
+    
+    this->cgen.emit_mk_record (_record_tag (qn), (unsigned char)args.size ());
+    return true;
+  }
+  
+  void
+  compiler::compile_field (std::shared_ptr<ast_field> expr)
+  {
+    std::vector<std::pair<std::string, int>> tbl;
+    if (!this->find_field (expr, tbl))
+      return;
+    
+    this->push_expr_frame (false);
+    this->compile_expr (expr->get_expr ());
+    this->pop_expr_frame ();
+    
+    this->cgen.emit_get_field (tbl);
+  }
+  
+  void
+  compiler::compile_assign_to_field (std::shared_ptr<ast_field> lhs,
+                                     std::shared_ptr<ast_expr> rhs)
+  {
+    std::vector<std::pair<std::string, int>> tbl;
+    if (!this->find_field (lhs, tbl))
+      return;
+    
+    this->push_expr_frame (false);
+    this->compile_expr (rhs);
+    this->compile_expr (lhs->get_expr ());
+    this->pop_expr_frame ();
+    
+    this->cgen.emit_dup_n (2);
+    this->cgen.emit_set_field (tbl);
+  }
+}
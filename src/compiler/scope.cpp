@@ -130,6 +130,7 @@ namespace rho {
       case AST_IMPORT:
       case AST_EXPORT:
       case AST_ATOM_DEF:
+      case AST_RECORD_DEF:
       case AST_FLOAT:
         break;
       
@@ -161,6 +162,10 @@ namespace rho {
         this->analyze_vector (std::static_pointer_cast<ast_vector> (node));
         break;
       
+      case AST_MAP:
+        this->analyze_map (std::static_pointer_cast<ast_map> (node));
+        break;
+      
       case AST_EXPR_STMT:
         this->analyze_expr_stmt (std::static_pointer_cast<ast_expr_stmt> (node));
         break;
@@ -201,6 +206,10 @@ namespace rho {
         this->analyze_subscript (std::static_pointer_cast<ast_subscript> (node));
         break;
       
+      case AST_FIELD:
+        this->analyze_node (std::static_pointer_cast<ast_field> (node)->get_expr ());
+        break;
+      
       case AST_USING:
         this->analyze_using (std::static_pointer_cast<ast_using> (node));
         break;
@@ -216,6 +225,14 @@ namespace rho {
       case AST_FUN_DEF:
         this->analyze_fun_def (std::static_pointer_cast<ast_fun_def> (node));
         break;
+      
+      case AST_DELAY:
+        this->analyze_node (std::static_pointer_cast<ast_delay> (node)->get_fun ());
+        break;
+      
+      case AST_YIELD:
+        this->analyze_node (std::static_pointer_cast<ast_yield> (node)->get_expr ());
+        break;
       }
   }
   
@@ -406,6 +423,16 @@ namespace rho {
       this->analyze_node (e);
   }
   
+  void
+  var_analyzer::analyze_map (std::shared_ptr<ast_map> node)
+  {
+    for (auto& e : node->get_entries ())
+      {
+        this->analyze_node (e.first);
+        this->analyze_node (e.second);
+      }
+  }
+  
   void
   var_analyzer::analyze_expr_stmt (std::shared_ptr<ast_expr_stmt> node)
   {
@@ -510,9 +537,20 @@ namespace rho {
     std::vector<std::string> pvars;
     std::unordered_set<std::string> pvar_set;
     
-    ast_tools::traverse_dfs (pexpr,
-      [&] (std::shared_ptr<ast_node> node) -> traverse_result {
-        if (node->get_type () == AST_IDENT)
+    ast_tools::traverse_fn visit = [&] (std::shared_ptr<ast_node> node) -> traverse_result {
+        if (node->get_type () == AST_FUN_CALL)
+          {
+            // the function named by a call inside a pattern is not a pattern
+            // variable (see compiler::compile_pattern_fun_call).
+            auto call = std::static_pointer_cast<ast_fun_call> (node);
+            if (call->get_fun ()->get_type () != AST_IDENT)
+              return TR_CONTINUE;
+            
+            for (auto a : call->get_args ())
+              ast_tools::traverse_dfs (a, ast_tools::traverse_fn (visit));
+            return TR_SKIP;
+          }
+        else if (node->get_type () == AST_IDENT)
           {
             auto name = std::static_pointer_cast<ast_ident> (node)->get_value ();
             if (pvar_set.find (name) == pvar_set.end ())
@@ -523,7 +561,8 @@ namespace rho {
           }
         
         return TR_CONTINUE;
-      });
+      };
+    ast_tools::traverse_dfs (pexpr, ast_tools::traverse_fn (visit));
     
     for (auto& pvar : pvars)
       scope->add_local (pvar);
@@ -931,9 +970,9 @@ namespace rho {
       return { .type = VAR_ARG_PACK, .idx = 0 };
     
     {
-      auto itr = this->fun->get_nfrees ().find (name);
-      if (itr != this->fun->get_nfrees ().end ())
-        return { .type = VAR_UPVAL, .idx = itr->second };
+      int idx = this->fun->get_nfree (name);
+      if (idx != -1)
+        return { .type = VAR_UPVAL, .idx = idx };
     }
     
     itr = this->globs.find (name);
@@ -1090,8 +1129,10 @@ namespace rho {
     if (itr != this->nfrees.end ())
       return itr->second;
     
+    // the value stored here only determines the order in which names were
+    // borrowed; see get_nfree() for the actual environment index.
     this->nfrees[name] = this->next_nfree_idx++;
-    return this->next_nfree_idx - 1;
+    return this->nfrees[name];
   }
   
   void
@@ -1100,23 +1141,79 @@ namespace rho {
     this->cfrees.insert (name);
   }
   
-  int
-  func_frame::get_nfree (const std::string& name)
+  /* 
+   * Returns the names this function borrows that are not already borrowed by
+   * its parent, in the order they were first encountered.
+   */
+  std::vector<std::string>
+  func_frame::get_own_nfrees () const
   {
-    auto itr = this->nfrees.find (name);
-    if (itr != this->nfrees.end ())
-      return itr->second;
-    return -1;
+    std::vector<std::pair<std::string, int>> ps;
+    for (auto& p : this->nfrees)
+      if (!this->parent || this->parent->nfrees.find (p.first) == this->parent->nfrees.end ())
+        ps.push_back (p);
+    
+    std::sort (ps.begin (), ps.end (),
+      [] (const std::pair<std::string, int>& lhs,
+          const std::pair<std::string, int>& rhs) {
+        return lhs.second < rhs.second;
+      });
+    
+    std::vector<std::string> names;
+    for (auto& p : ps)
+      names.push_back (p.first);
+    return names;
   }
   
+  /* 
+   * Returns the number of values stored in the environment of closures
+   * created for this function.
+   * 
+   * A closure's environment begins with a copy of its parent's environment,
+   * followed by the values the function captures from its parent's locals and
+   * arguments.
+   */
+  int
+  func_frame::get_env_size () const
+  {
+    int base = this->parent ? this->parent->get_env_size () : 0;
+    return base + (int)this->get_own_nfrees ().size ();
+  }
   
+  /* 
+   * Returns the index of the specified borrowed name in the function's
+   * environment, or -1 if the function does not borrow the name.
+   * 
+   * NOTE: Indices are only final once analysis of the enclosing functions is
+   *       complete, since a parent may borrow more names after a child has
+   *       been analyzed.
+   */
+  int
+  func_frame::get_nfree (const std::string& name) const
+  {
+    if (this->nfrees.find (name) == this->nfrees.end ())
+      return -1;
+    
+    if (this->parent && this->parent->nfrees.find (name) != this->parent->nfrees.end ())
+      return this->parent->get_nfree (name);
+    
+    int idx = this->parent ? this->parent->get_env_size () : 0;
+    for (auto& n : this->get_own_nfrees ())
+      {
+        if (n == name)
+          return idx;
+        ++ idx;
+      }
+    
+    return -1;
+  }
   
   std::vector<std::pair<std::string, int>>
   func_frame::get_sorted_nfrees () const
   {
     std::vector<std::pair<std::string, int>> ps;
     for (auto& p : this->nfrees)
-      ps.push_back (p);
+      ps.push_back (std::make_pair (p.first, this->get_nfree (p.first)));
     
     std::sort (ps.begin (), ps.end (),
       [] (const std::pair<std::string, int>& lhs,
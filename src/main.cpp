@@ -26,6 +26,8 @@
 #include "util/ast_tools.hpp"
 #include "util/module_tools.hpp"
 #include "runtime/repl.hpp"
+#include "runtime/io.hpp"
+#include "runtime/image.hpp"
 #include <iostream>
 #include <fstream>
 #include <boost/program_options.hpp>
@@ -67,6 +69,39 @@ _run_repl ()
   return 0;
 }
 
+static int
+_run_image (const std::string& path, long output_buffer)
+{
+  try
+    {
+      // the image holds the code, and so must outlive the machine.
+      rho::rho_image img (path);
+      rho::virtual_machine vm;
+      if (output_buffer > 0)
+        vm.get_output ().set_buffer_size (output_buffer);
+      try
+        {
+          // the entry function is rooted by its frame once it is called.
+          auto entry = img.load (vm);
+          rho::gc_unprotect (entry);
+          vm.run_function (entry, img.get_code (), img.get_code_size (),
+                           img.get_code_info ());
+        }
+      catch (const rho::vm_error&)
+        {
+          vm.get_output ().flush ();
+          throw;
+        }
+    }
+  catch (const rho::vm_error& ex)
+    {
+      std::cout << "rho: runtime error: " << ex.what () << std::endl;
+      return -1;
+    }
+  
+  return 0;
+}
+
 
 
 int
@@ -76,6 +111,11 @@ main (int argc, char *argv[])
   desc.add_options ()
     ("help", "produce help message")
     ("input-file", po::value<std::vector<std::string>> (), "input file")
+    ("no-fusion", "do not fuse std:list/std:streams combinator chains")
+    ("output-buffer", po::value<long> (),
+      "size of the standard output buffer, in bytes")
+    ("image", po::value<std::string> (),
+      "run an image written by save_image() instead of source files")
   ;
   
   po::positional_options_description p;
@@ -101,6 +141,10 @@ main (int argc, char *argv[])
       return 1;
     }
   
+  if (vmap.count ("image"))
+    return _run_image (vmap["image"].as<std::string> (),
+      vmap.count ("output-buffer") ? vmap["output-buffer"].as<long> () : 0);
+  
   if (!vmap.count ("input-file"))
     return _run_repl ();
   
@@ -108,6 +152,8 @@ main (int argc, char *argv[])
   
   rho::module_store mstore;
   rho::compiler compiler (mstore);
+  if (vmap.count ("no-fusion"))
+    compiler.set_fusion (false);
   std::vector<std::shared_ptr<rho::module>> mods;
   
   // include directories
@@ -239,7 +285,19 @@ main (int argc, char *argv[])
   
   // run
   rho::virtual_machine vm;
-  vm.run (*prg.get ());
+  if (vmap.count ("output-buffer"))
+    vm.get_output ().set_buffer_size (vmap["output-buffer"].as<long> ());
+  try
+    {
+      vm.run (*prg.get ());
+    }
+  catch (const rho::vm_error& ex)
+    {
+      // keep whatever the program printed before failing.
+      vm.get_output ().flush ();
+      std::cout << "rho: runtime error: " << ex.what () << std::endl;
+      return -1;
+    }
   
   return 0;
 }
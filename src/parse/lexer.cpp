@@ -144,6 +144,7 @@ namespace rho {
   {
     this->strm = nullptr;
     this->ws_skipped = 0;
+    this->last_type = TOK_INVALID;
   }
   
   lexer::~lexer ()
@@ -164,10 +165,13 @@ namespace rho {
     
     delete this->strm;
     this->strm = new lexer_stream (strm);
+    this->ws_skipped = 0;
+    this->last_type = TOK_INVALID;
     
     for (;;)
       {
         auto tok = this->read_token ();
+        this->last_type = tok.type;
         if (tok.type == TOK_EOF)
           {
             ts.toks->push_back (tok);
@@ -231,6 +235,15 @@ namespace rho {
   
   
   
+  static inline bool
+  _is_ident_first_char (int c)
+    { return std::isalpha (c) || c == '_' || c == '$'; }
+  
+  static inline bool
+  _is_ident_char (int c)
+    { return _is_ident_first_char (c) || std::isdigit (c) || c == '?' || c == '!'; }
+  
+  
   bool
   lexer::try_read_punctuation (token& tok)
   {
@@ -246,7 +259,17 @@ namespace rho {
       case ']': this->strm->get (); tok.type = TOK_RBRACKET; return true;
       case ';': this->strm->get (); tok.type = TOK_SCOL; return true;
       case ',': this->strm->get (); tok.type = TOK_COMMA; return true;
-      case '.': this->strm->get (); tok.type = TOK_DOT; return true;
+      case '.':
+        this->strm->get ();
+        tok.type = TOK_DOT;
+        
+        // a dot with no whitespace around it, as in `p.x', is a field access
+        // rather than the dot of a dotted pair: '(a . b)
+        if (this->ws_skipped == 0 && _is_ident_first_char (this->strm->peek ())
+          && (this->last_type == TOK_IDENT || this->last_type == TOK_RPAREN
+            || this->last_type == TOK_RBRACKET))
+          tok.type = TOK_FIELD;
+        return true;
       
       case '+': this->strm->get (); tok.type = TOK_ADD; return true;
       case '-': this->strm->get (); tok.type = TOK_SUB; return true;
@@ -399,15 +422,6 @@ namespace rho {
   
   
   
-  static inline bool
-  _is_ident_first_char (int c)
-    { return std::isalpha (c) || c == '_' || c == '$'; }
-  
-  static inline bool
-  _is_ident_char (int c)
-    { return _is_ident_first_char (c) || std::isdigit (c) || c == '?' || c == '!'; }
-  
-  
   static token_type
   _check_keyword (const std::string& str)
   {
@@ -432,6 +446,10 @@ namespace rho {
       { "let", TOK_LET },
       { "in", TOK_IN },
       { "N", TOK_N },
+      { "delay", TOK_DELAY },
+      { "yield", TOK_YIELD },
+      { "memo", TOK_MEMO },
+      { "record", TOK_RECORD },
     };
     
     auto itr = _map.find (str);
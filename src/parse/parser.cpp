@@ -20,6 +20,7 @@
 #include "util/ast_tools.hpp"
 #include <unordered_map>
 #include <sstream>
+#include <cstring>
 
 #include <iostream> // DEBUG
 
@@ -154,22 +155,40 @@ namespace rho {
     return ast;
   }
   
-  std::shared_ptr<ast_vector>
+  /* 
+   * Parses either a vector literal, or a map literal if the first element
+   * is followed by `=>' (`[=>]' being the empty map).
+   */
+  std::shared_ptr<ast_expr>
   parser::parse_vector (lexer::token_stream& strm)
   {
-    std::shared_ptr<ast_vector> vec { new ast_vector () };
-    _set_ast_location (vec.get (), strm.peek_next (), this->path);
+    auto ftok = strm.peek_next ();
     
     // [
     this->expect (TOK_LBRACKET, strm);
     
+    std::shared_ptr<ast_vector> vec { new ast_vector () };
+    _set_ast_location (vec.get (), ftok, this->path);
+    
+    auto tok = strm.peek_next ();
+    if (tok.type == TOK_RDARROW)
+      {
+        strm.next ();
+        this->expect (TOK_RBRACKET, strm);
+        return this->parse_map_rest (nullptr, ftok, strm);
+      }
+    
     for (;;)
       {
         auto tok = strm.peek_next ();
         if (tok.type == TOK_RBRACKET)
           { strm.next (); break; }
         
-        vec->push_back (this->parse_expr (strm));
+        auto e = this->parse_expr (strm);
+        if (vec->get_exprs ().empty ()
+          && strm.peek_next ().type == TOK_RDARROW)
+          return this->parse_map_rest (e, ftok, strm);
+        vec->push_back (e);
         
         tok = strm.peek_next ();
         if (tok.type == TOK_COMMA)
@@ -182,6 +201,44 @@ namespace rho {
     return vec;
   }
   
+  /* 
+   * Parses the remainder of a map literal whose first key (null for the
+   * empty map, whose closing bracket has already been consumed) has been
+   * parsed.
+   */
+  std::shared_ptr<ast_map>
+  parser::parse_map_rest (std::shared_ptr<ast_expr> first, const token& ftok,
+                          lexer::token_stream& strm)
+  {
+    std::shared_ptr<ast_map> map { new ast_map () };
+    _set_ast_location (map.get (), ftok, this->path);
+    if (!first)
+      return map;
+    
+    auto key = first;
+    for (;;)
+      {
+        // =>
+        this->expect (TOK_RDARROW, strm);
+        map->add_entry (key, this->parse_expr (strm));
+        
+        auto tok = strm.peek_next ();
+        if (tok.type == TOK_RBRACKET)
+          { strm.next (); break; }
+        else if (tok.type != TOK_COMMA)
+          throw parse_error ("expected ',' or ']' in map literal",
+            tok.ln, tok.col);
+        strm.next ();
+        
+        // allow a trailing comma, as in vector literals
+        if (strm.peek_next ().type == TOK_RBRACKET)
+          { strm.next (); break; }
+        key = this->parse_expr (strm);
+      }
+    
+    return map;
+  }
+  
   
   
   std::shared_ptr<ast_fun>
@@ -436,6 +493,26 @@ namespace rho {
   
   
   
+  std::shared_ptr<ast_expr>
+  parser::parse_field (std::shared_ptr<ast_expr> expr,
+                       lexer::token_stream& strm)
+  {
+    auto ftok = strm.peek_next ();
+    
+    // .
+    this->expect (TOK_FIELD, strm);
+    
+    auto name = this->parse_ident (strm)->get_value ();
+    
+    std::shared_ptr<ast_field> ast { new ast_field (expr, name) };
+    _set_ast_location (ast.get (), ftok, this->path);
+    
+    // allow chains such as p.x.y
+    return this->parse_expr_atom_rest (ast, strm);
+  }
+  
+  
+  
   std::shared_ptr<ast_unop>
   parser::parse_unary (lexer::token_stream& strm)
   {
@@ -515,6 +592,102 @@ namespace rho {
   
   
   
+  std::shared_ptr<ast_delay>
+  parser::parse_delay (lexer::token_stream& strm)
+  {
+    auto ftok = strm.peek_next ();
+    this->expect (TOK_DELAY, strm);
+    
+    auto expr = this->parse_expr_atom (strm);
+    
+    std::shared_ptr<ast_stmt_block> body { new ast_stmt_block () };
+    body->push_back (std::shared_ptr<ast_expr_stmt> (new ast_expr_stmt (expr)));
+    
+    std::shared_ptr<ast_fun> fun { new ast_fun () };
+    _set_ast_location (fun.get (), ftok, this->path);
+    fun->set_body (body);
+    
+    std::shared_ptr<ast_delay> ast { new ast_delay (fun) };
+    _set_ast_location (ast.get (), ftok, this->path);
+    return ast;
+  }
+  
+  
+  
+  std::shared_ptr<ast_yield>
+  parser::parse_yield (lexer::token_stream& strm)
+  {
+    auto ftok = strm.peek_next ();
+    this->expect (TOK_YIELD, strm);
+    
+    std::shared_ptr<ast_yield> ast { new ast_yield (this->parse_expr (strm)) };
+    _set_ast_location (ast.get (), ftok, this->path);
+    return ast;
+  }
+  
+  
+  
+  /* 
+   * Parses a memoization annotation of the form:
+   *     memo [ ( <size> [, weak] ) ]
+   */
+  ast_memo_opts
+  parser::parse_memo (lexer::token_stream& strm)
+  {
+    this->expect (TOK_MEMO, strm);
+    
+    ast_memo_opts opts;
+    opts.enabled = true;
+    
+    auto tok = strm.peek_next ();
+    if (tok.type != TOK_LPAREN)
+      return opts;
+    strm.next ();
+    
+    tok = strm.peek_next ();
+    if (tok.type != TOK_INTEGER)
+      throw parse_error ("expected cache size in memo annotation",
+        tok.ln, tok.col);
+    strm.next ();
+    try
+      {
+        opts.size = std::stol (tok.val.str);
+      }
+    catch (const std::exception&)
+      {
+        opts.size = 0;
+      }
+    if (opts.size <= 0 || opts.size > 0x7FFFFFFF)
+      throw parse_error ("invalid cache size in memo annotation",
+        tok.ln, tok.col);
+    
+    tok = strm.peek_next ();
+    if (tok.type == TOK_COMMA)
+      {
+        strm.next ();
+        tok = strm.peek_next ();
+        if (tok.type != TOK_IDENT || std::strcmp (tok.val.str, "weak") != 0)
+          throw parse_error ("expected 'weak' in memo annotation",
+            tok.ln, tok.col);
+        strm.next ();
+        opts.weak = true;
+      }
+    
+    this->expect (TOK_RPAREN, strm);
+    return opts;
+  }
+  
+  std::shared_ptr<ast_fun>
+  parser::parse_memo_fun (lexer::token_stream& strm)
+  {
+    auto opts = this->parse_memo (strm);
+    auto fun = this->parse_fun (strm);
+    fun->get_memo () = opts;
+    return fun;
+  }
+  
+  
+  
   std::shared_ptr<ast_expr>
   parser::parse_expr_atom_main (lexer::token_stream& strm)
   {
@@ -569,6 +742,9 @@ namespace rho {
       case TOK_FUN:
         return this->parse_fun (strm);
       
+      case TOK_MEMO:
+        return this->parse_memo_fun (strm);
+      
       case TOK_IF:
         return this->parse_if (strm);
       
@@ -584,6 +760,12 @@ namespace rho {
       case TOK_N:
         return this->parse_n (strm);
       
+      case TOK_DELAY:
+        return this->parse_delay (strm);
+      
+      case TOK_YIELD:
+        return this->parse_yield (strm);
+      
       
       case TOK_NOT:
         return this->parse_unary (strm);
@@ -607,6 +789,9 @@ namespace rho {
       case TOK_LBRACKET:
         return this->parse_subscript (expr, strm);
       
+      case TOK_FIELD:
+        return this->parse_field (expr, strm);
+      
       default:
         return expr;
       }
@@ -946,6 +1131,40 @@ namespace rho {
   
   
   
+  std::shared_ptr<ast_record_def>
+  parser::parse_record_def (lexer::token_stream& strm, bool in_block)
+  {
+    auto ftok = strm.peek_next ();
+    this->expect (TOK_RECORD, strm);
+    
+    auto tok = strm.peek_next ();
+    if (tok.type != TOK_IDENT)
+      throw parse_error ("expected record name after 'record'", tok.ln, tok.col);
+    std::shared_ptr<ast_record_def> ast {
+      new ast_record_def (this->parse_ident (strm)->get_value ()) };
+    _set_ast_location (ast.get (), ftok, this->path);
+    
+    // fields
+    this->expect (TOK_LPAREN, strm);
+    while ((tok = strm.peek_next ()).type != TOK_EOF && tok.type != TOK_RPAREN)
+      {
+        ast->add_field (this->parse_ident (strm)->get_value ());
+        
+        tok = strm.peek_next ();
+        if (tok.type == TOK_COMMA)
+          strm.next ();
+        else if (tok.type != TOK_RPAREN)
+          throw parse_error ("expected ',' or ')' in record field list",
+            tok.ln, tok.col);
+      }
+    this->expect (TOK_RPAREN, strm);
+    
+    this->consume_scol (strm, in_block);
+    return ast;
+  }
+  
+  
+  
   std::shared_ptr<ast_using>
   parser::parse_using (lexer::token_stream& strm, bool in_block)
   {
@@ -1236,6 +1455,9 @@ namespace rho {
       case TOK_ATOMK:
         return this->parse_atom_def (strm);
       
+      case TOK_RECORD:
+        return this->parse_record_def (strm, in_block);
+      
       case TOK_USING:
         return this->parse_using (strm, in_block);
       
@@ -1249,6 +1471,26 @@ namespace rho {
           return this->parse_expr_stmt (strm, in_block);
         }
       
+      case TOK_MEMO:
+        {
+          int start = strm.available ();
+          auto opts = this->parse_memo (strm);
+          if (strm.peek_next ().type == TOK_FUN)
+            {
+              auto ast = this->parse_fun_def (strm);
+              if (ast)
+                {
+                  ast->get_memo () = opts;
+                  return ast;
+                }
+            }
+          
+          // anonymous function, parse it again as an expression.
+          while (strm.available () < start)
+            strm.prev ();
+          return this->parse_expr_stmt (strm, in_block);
+        }
+      
       default:
         {
           auto es = this->parse_expr_stmt (strm, in_block);
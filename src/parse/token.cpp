@@ -83,6 +83,7 @@ namespace rho {
       case TOK_NOT:             return "!";
       case TOK_COL:             return ":";
       case TOK_DEF:             return ":=";
+      case TOK_FIELD:           return ".";
       
       case TOK_INTEGER:         return "<integer>";
       case TOK_IDENT:           return "<ident>";
@@ -110,6 +111,10 @@ namespace rho {
       case TOK_LET:             return "let";
       case TOK_IN:              return "in";
       case TOK_N:               return "N";
+      case TOK_DELAY:           return "delay";
+      case TOK_YIELD:           return "yield";
+      case TOK_MEMO:            return "memo";
+      case TOK_RECORD:          return "record";
       }
     
     return "";
@@ -20,19 +20,85 @@
 #include "runtime/vm.hpp"
 #include "runtime/gc/gc.hpp"
 #include "runtime/value.hpp"
+#include "util/simd.hpp"
+#include "util/linalg.hpp"
+#include "util/poly.hpp"
+#include "runtime/expr.hpp"
+#include "runtime/map.hpp"
+#include "runtime/pvec.hpp"
+#include "runtime/memo.hpp"
+#include "runtime/io.hpp"
+#include "runtime/serial.hpp"
+#include "runtime/image.hpp"
+#include "runtime/textread.hpp"
 #include <iostream>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 namespace rho {
   
+  static std::string
+  _get_str (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_STR)
+      throw vm_error (std::string (fn) + ": expected a string");
+    return std::string (rho_str_chars (v.val.gc), v.val.gc->val.s.len);
+  }
+  
+  /* 
+   * Writes the specified values to the given stream, separated by :sep:
+   * (unless it is null).  Strings are written as they are, without quotes.
+   */
+  static void
+  _write_values (output_stream& out, rho_value *args, int argc,
+                 const char *sep, const print_limits *lim,
+                 virtual_machine& vm)
+  {
+    print_sink sink { out };
+    for (int i = 0; i < argc; ++i)
+      {
+        if (i > 0 && sep)
+          out.write (sep, std::strlen (sep));
+        
+        rho_value& p = args[i];
+        if (p.type == RHO_STR)
+          out.write (rho_str_chars (p.val.gc), p.val.gc->val.s.len);
+        else
+          rho_value_print (p, sink, vm, lim);
+      }
+  }
+  
+  /* 
+   * Prints its arguments on a single line, separated by spaces.
+   */
   rho_value
-  rho_builtin_print (rho_value& p, virtual_machine& vm)
+  rho_builtin_print (rho_value *args, int argc, virtual_machine& vm)
   {
-    if (p.type == RHO_STR)
-      std::cout << p.val.gc->val.s.str << std::endl;
-    else
-      std::cout << rho_value_str (p, vm) << std::endl;
-    
+    auto& out = vm.get_output ();
+    _write_values (out, args, argc, " ", &vm.get_print_limits (), vm);
+    out.put ('\n');
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * Writes its arguments one after another, with nothing in between and no
+   * newline at the end.
+   */
+  rho_value
+  rho_builtin_write (rho_value *args, int argc, virtual_machine& vm)
+  {
+    _write_values (vm.get_output (), args, argc, nullptr,
+                   &vm.get_print_limits (), vm);
     return rho_value_make_nil ();
   }
   
@@ -71,6 +137,16 @@ namespace rho {
           return rho_value_make_int (len, vm.get_gc ());
         }
       
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+        {
+          long len = p.val.gc->val.arr.len;
+          if (len <= VM_SMALL_INT_MAX)
+            return vm.get_prealloced_int (len);
+          
+          return rho_value_make_int (len, vm.get_gc ());
+        }
+      
       case RHO_CONS:
         {
           long len = _list_len (p);
@@ -80,9 +156,2351 @@ namespace rho {
           return rho_value_make_int (len, vm.get_gc ());
         }
       
+      case RHO_MAP:
+        {
+          long len = p.val.gc->val.map->size ();
+          if (len <= VM_SMALL_INT_MAX)
+            return vm.get_prealloced_int (len);
+          
+          return rho_value_make_int (len, vm.get_gc ());
+        }
+      
+      case RHO_PVEC:
+        {
+          long len = p.val.gc->val.pvec->size ();
+          if (len <= VM_SMALL_INT_MAX)
+            return vm.get_prealloced_int (len);
+          
+          return rho_value_make_int (len, vm.get_gc ());
+        }
+      
+      case RHO_STR:
+        {
+          long len = p.val.gc->val.s.len;
+          if (len <= VM_SMALL_INT_MAX)
+            return vm.get_prealloced_int (len);
+          
+          return rho_value_make_int (len, vm.get_gc ());
+        }
+      
       default:
         return vm.get_prealloced_int (0);
       }
   }
-}
-
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  static double
+  _to_double (rho_value& v, const char *fn)
+  {
+    switch (v.type)
+      {
+      case RHO_DOUBLE:
+        return v.val.f64;
+      
+      case RHO_INTEGER:
+        return mpz_get_d (v.val.gc->val.i);
+      
+      case RHO_FLOAT:
+        return mpfr_get_d (v.val.gc->val.f, MPFR_RNDN);
+      
+      default:
+        throw vm_error (std::string (fn) + ": elements must be numbers");
+      }
+  }
+  
+  static long long
+  _to_i64 (rho_value& v)
+  {
+    switch (v.type)
+      {
+      case RHO_INTEGER:
+        if (!mpz_fits_slong_p (v.val.gc->val.i))
+          throw vm_error ("i64vec: element does not fit in 64 bits");
+        return mpz_get_si (v.val.gc->val.i);
+      
+      default:
+        throw vm_error ("i64vec: elements must be integers");
+      }
+  }
+  
+  static rho_value
+  _make_i64 (long long val, virtual_machine& vm)
+  {
+    if (val >= 0 && val <= VM_SMALL_INT_MAX)
+      return vm.get_prealloced_int ((int)val);
+    return rho_value_make_int64 (val, vm.get_gc ());
+  }
+  
+  /* 
+   * Creates a packed array of type :type: out of the specified value, which
+   * can either be a length (in which case the array is zero-filled), a vector,
+   * a list, or another packed array.
+   */
+  static rho_value
+  _make_packed (rho_type type, rho_value& p, virtual_machine& vm)
+  {
+    bool f64 = (type == RHO_F64VEC);
+    auto mk = [&] (long len) {
+      return f64 ? rho_value_make_f64vec (len, vm.get_gc ())
+                 : rho_value_make_i64vec (len, vm.get_gc ());
+    };
+    
+    switch (p.type)
+      {
+      case RHO_INTEGER:
+        {
+          long len = mpz_get_si (p.val.gc->val.i);
+          if (len < 0)
+            throw vm_error ("packed array length must be non-negative");
+          return mk (len);
+        }
+      
+      case RHO_VEC:
+        {
+          auto& vec = p.val.gc->val.vec;
+          auto res = mk (vec.len);
+          auto& arr = res.val.gc->val.arr;
+          for (long i = 0; i < vec.len; ++i)
+            {
+              if (f64)
+                arr.f64[i] = _to_double (vec.vals[i], "f64vec");
+              else
+                arr.i64[i] = _to_i64 (vec.vals[i]);
+            }
+          return res;
+        }
+      
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        {
+          auto res = mk (_list_len (p));
+          auto& arr = res.val.gc->val.arr;
+          
+          long i = 0;
+          for (rho_value cur = p; cur.type == RHO_CONS && i < arr.len;
+               cur = cur.val.gc->val.p.snd, ++i)
+            {
+              if (f64)
+                arr.f64[i] = _to_double (cur.val.gc->val.p.fst, "f64vec");
+              else
+                arr.i64[i] = _to_i64 (cur.val.gc->val.p.fst);
+            }
+          return res;
+        }
+      
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+        {
+          auto& src = p.val.gc->val.arr;
+          auto res = mk (src.len);
+          auto& arr = res.val.gc->val.arr;
+          for (long i = 0; i < src.len; ++i)
+            {
+              if (f64)
+                arr.f64[i] = (p.type == RHO_F64VEC) ? src.f64[i]
+                                                    : (double)src.i64[i];
+              else
+                arr.i64[i] = (p.type == RHO_I64VEC) ? src.i64[i]
+                                                    : (long long)src.f64[i];
+            }
+          return res;
+        }
+      
+      default:
+        throw vm_error ("cannot create a packed array out of the given value");
+      }
+  }
+  
+  rho_value
+  rho_builtin_f64vec (rho_value& p, virtual_machine& vm)
+  {
+    return _make_packed (RHO_F64VEC, p, vm);
+  }
+  
+  rho_value
+  rho_builtin_i64vec (rho_value& p, virtual_machine& vm)
+  {
+    return _make_packed (RHO_I64VEC, p, vm);
+  }
+  
+  /* 
+   * mmap_array(path, dtype): maps a file of raw 64-bit elements ("f64" or
+   * "i64", in the machine's byte order) as a packed array, without reading
+   * it in.  The mapping is private: stores to the array are not written back
+   * to the file.
+   */
+  rho_value
+  rho_builtin_mmap_array (rho_value& path, rho_value& dtype,
+                          virtual_machine& vm)
+  {
+    std::string fpath = _get_str (path, "mmap_array");
+    std::string type = _get_str (dtype, "mmap_array");
+    rho_type t;
+    if (type == "f64")
+      t = RHO_F64VEC;
+    else if (type == "i64")
+      t = RHO_I64VEC;
+    else
+      throw vm_error ("mmap_array: unknown element type `" + type + "'");
+    
+    int fd = ::open (fpath.c_str (), O_RDONLY);
+    if (fd == -1)
+      throw vm_error ("mmap_array: cannot open `" + fpath + "': "
+        + std::strerror (errno));
+    
+    struct stat st;
+    if (fstat (fd, &st) == -1)
+      {
+        int err = errno;
+        ::close (fd);
+        throw vm_error ("mmap_array: cannot open `" + fpath + "': "
+          + std::strerror (err));
+      }
+    
+    long size = (long)st.st_size;
+    if (size % 8 != 0)
+      {
+        ::close (fd);
+        throw vm_error ("mmap_array: size of `" + fpath
+          + "' is not a multiple of the element size");
+      }
+    if (size == 0)
+      {
+        // empty mappings are not allowed.
+        ::close (fd);
+        return (t == RHO_F64VEC) ? rho_value_make_f64vec (0, vm.get_gc ())
+                                 : rho_value_make_i64vec (0, vm.get_gc ());
+      }
+    
+    void *data = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+    int err = errno;
+    ::close (fd);
+    if (data == MAP_FAILED)
+      throw vm_error ("mmap_array: cannot map `" + fpath + "': "
+        + std::strerror (err));
+    
+    return rho_value_make_mapped_array (t, data, size / 8, size, vm.get_gc ());
+  }
+  
+  
+  
+  static void
+  _check_packed (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_F64VEC && v.type != RHO_I64VEC)
+      throw vm_error (std::string (fn) + ": expected a packed array");
+  }
+  
+  static void
+  _check_same_shape (rho_value& a, rho_value& b, const char *fn)
+  {
+    _check_packed (a, fn);
+    if (a.type != b.type)
+      throw vm_error (std::string (fn) + ": packed array types do not match");
+    if (a.val.gc->val.arr.len != b.val.gc->val.arr.len)
+      throw vm_error (std::string (fn) + ": packed array lengths do not match");
+  }
+  
+  rho_value
+  rho_builtin_vadd (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    _check_same_shape (a, b, "vadd");
+    
+    auto& x = a.val.gc->val.arr;
+    auto& y = b.val.gc->val.arr;
+    if (a.type == RHO_F64VEC)
+      {
+        auto res = rho_value_make_f64vec (x.len, vm.get_gc ());
+        simd_f64_add (res.val.gc->val.arr.f64, x.f64, y.f64, x.len);
+        return res;
+      }
+    
+    auto res = rho_value_make_i64vec (x.len, vm.get_gc ());
+    simd_i64_add (res.val.gc->val.arr.i64, x.i64, y.i64, x.len);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_vmul (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    _check_same_shape (a, b, "vmul");
+    
+    auto& x = a.val.gc->val.arr;
+    auto& y = b.val.gc->val.arr;
+    if (a.type == RHO_F64VEC)
+      {
+        auto res = rho_value_make_f64vec (x.len, vm.get_gc ());
+        simd_f64_mul (res.val.gc->val.arr.f64, x.f64, y.f64, x.len);
+        return res;
+      }
+    
+    auto res = rho_value_make_i64vec (x.len, vm.get_gc ());
+    simd_i64_mul (res.val.gc->val.arr.i64, x.i64, y.i64, x.len);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_vfma (rho_value& a, rho_value& b, rho_value& c,
+                    virtual_machine& vm)
+  {
+    _check_same_shape (a, b, "vfma");
+    _check_same_shape (a, c, "vfma");
+    
+    auto& x = a.val.gc->val.arr;
+    auto& y = b.val.gc->val.arr;
+    auto& z = c.val.gc->val.arr;
+    if (a.type == RHO_F64VEC)
+      {
+        auto res = rho_value_make_f64vec (x.len, vm.get_gc ());
+        simd_f64_fma (res.val.gc->val.arr.f64, x.f64, y.f64, z.f64, x.len);
+        return res;
+      }
+    
+    auto res = rho_value_make_i64vec (x.len, vm.get_gc ());
+    simd_i64_fma (res.val.gc->val.arr.i64, x.i64, y.i64, z.i64, x.len);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_dot (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    _check_same_shape (a, b, "dot");
+    
+    auto& x = a.val.gc->val.arr;
+    auto& y = b.val.gc->val.arr;
+    if (a.type == RHO_F64VEC)
+      return rho_value_make_double (simd_f64_dot (x.f64, y.f64, x.len));
+    return _make_i64 (simd_i64_dot (x.i64, y.i64, x.len), vm);
+  }
+  
+  rho_value
+  rho_builtin_vsum (rho_value& p, virtual_machine& vm)
+  {
+    _check_packed (p, "vsum");
+    
+    auto& x = p.val.gc->val.arr;
+    if (p.type == RHO_F64VEC)
+      return rho_value_make_double (simd_f64_sum (x.f64, x.len));
+    return _make_i64 (simd_i64_sum (x.i64, x.len), vm);
+  }
+  
+  rho_value
+  rho_builtin_vmin (rho_value& p, virtual_machine& vm)
+  {
+    _check_packed (p, "vmin");
+    
+    auto& x = p.val.gc->val.arr;
+    if (x.len == 0)
+      return rho_value_make_nil ();
+    
+    if (p.type == RHO_F64VEC)
+      return rho_value_make_double (simd_f64_min (x.f64, x.len));
+    return _make_i64 (simd_i64_min (x.i64, x.len), vm);
+  }
+  
+  rho_value
+  rho_builtin_vmax (rho_value& p, virtual_machine& vm)
+  {
+    _check_packed (p, "vmax");
+    
+    auto& x = p.val.gc->val.arr;
+    if (x.len == 0)
+      return rho_value_make_nil ();
+    
+    if (p.type == RHO_F64VEC)
+      return rho_value_make_double (simd_f64_max (x.f64, x.len));
+    return _make_i64 (simd_i64_max (x.i64, x.len), vm);
+  }
+  
+  /* 
+   * Euclidean norm.  Always returns a double.
+   */
+  rho_value
+  rho_builtin_norm (rho_value& p, virtual_machine& vm)
+  {
+    _check_packed (p, "norm");
+    
+    auto& x = p.val.gc->val.arr;
+    if (p.type == RHO_F64VEC)
+      return rho_value_make_double (std::sqrt (simd_f64_dot (x.f64, x.f64, x.len)));
+    
+    double r = 0.0;
+    for (long i = 0; i < x.len; ++i)
+      r += (double)x.i64[i] * (double)x.i64[i];
+    return rho_value_make_double (std::sqrt (r));
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Returns the amount of seconds elapsed since some fixed point in time, as a
+   * double.  Useful for timing code.
+   */
+  rho_value
+  rho_builtin_clock (virtual_machine& vm)
+  {
+    auto now = std::chrono::steady_clock::now ().time_since_epoch ();
+    return rho_value_make_double (
+      std::chrono::duration_cast<std::chrono::duration<double>> (now).count ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  static void
+  _check_matrix (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_MATRIX)
+      throw vm_error (std::string (fn) + ": expected a matrix");
+  }
+  
+  static long
+  _get_index (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_INTEGER)
+      throw vm_error (std::string (fn) + ": index must be an integer");
+    return mpz_get_si (v.val.gc->val.i);
+  }
+  
+  /* 
+   * Appends the elements of the specified matrix row (a vector, a list or a
+   * packed array) to :out:.
+   */
+  static void
+  _read_row (rho_value& row, std::vector<double>& out)
+  {
+    switch (row.type)
+      {
+      case RHO_VEC:
+        {
+          auto& vec = row.val.gc->val.vec;
+          for (long i = 0; i < vec.len; ++i)
+            out.push_back (_to_double (vec.vals[i], "mat_make"));
+        }
+        break;
+      
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        for (rho_value cur = row; cur.type == RHO_CONS;
+             cur = cur.val.gc->val.p.snd)
+          out.push_back (_to_double (cur.val.gc->val.p.fst, "mat_make"));
+        break;
+      
+      case RHO_F64VEC:
+        {
+          auto& arr = row.val.gc->val.arr;
+          out.insert (out.end (), arr.f64, arr.f64 + arr.len);
+        }
+        break;
+      
+      case RHO_I64VEC:
+        {
+          auto& arr = row.val.gc->val.arr;
+          for (long i = 0; i < arr.len; ++i)
+            out.push_back ((double)arr.i64[i]);
+        }
+        break;
+      
+      default:
+        throw vm_error ("mat_make: rows must be vectors, lists or packed arrays");
+      }
+  }
+  
+  /* 
+   * Creates a matrix out of a vector or a list of rows.
+   */
+  rho_value
+  rho_builtin_mat_make (rho_value& p, virtual_machine& vm)
+  {
+    std::vector<rho_value> rows;
+    switch (p.type)
+      {
+      case RHO_VEC:
+        {
+          auto& vec = p.val.gc->val.vec;
+          rows.assign (vec.vals, vec.vals + vec.len);
+        }
+        break;
+      
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        for (rho_value cur = p; cur.type == RHO_CONS;
+             cur = cur.val.gc->val.p.snd)
+          rows.push_back (cur.val.gc->val.p.fst);
+        break;
+      
+      case RHO_MATRIX:
+        {
+          auto& src = p.val.gc->val.mat;
+          auto res = rho_value_make_matrix (src.rows, src.cols, vm.get_gc ());
+          std::copy (src.data, src.data + (long)src.rows * src.cols,
+                     res.val.gc->val.mat.data);
+          return res;
+        }
+      
+      default:
+        throw vm_error ("mat_make: expected a vector or a list of rows");
+      }
+    
+    std::vector<double> data;
+    long cols = -1;
+    for (auto& row : rows)
+      {
+        auto prev = data.size ();
+        _read_row (row, data);
+        long len = (long)(data.size () - prev);
+        if (cols == -1)
+          cols = len;
+        else if (len != cols)
+          throw vm_error ("mat_make: all rows must be of the same length");
+      }
+    if (cols == -1)
+      cols = 0;
+    
+    auto res = rho_value_make_matrix ((int)rows.size (), (int)cols, vm.get_gc ());
+    std::copy (data.begin (), data.end (), res.val.gc->val.mat.data);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_mat_zeros (rho_value& rows, rho_value& cols, virtual_machine& vm)
+  {
+    long r = _get_index (rows, "mat_zeros");
+    long c = _get_index (cols, "mat_zeros");
+    if (r < 0 || c < 0)
+      throw vm_error ("mat_zeros: dimensions must be non-negative");
+    
+    return rho_value_make_matrix ((int)r, (int)c, vm.get_gc ());
+  }
+  
+  rho_value
+  rho_builtin_mat_rows (rho_value& p, virtual_machine& vm)
+  {
+    _check_matrix (p, "mat_rows");
+    return _make_i64 (p.val.gc->val.mat.rows, vm);
+  }
+  
+  rho_value
+  rho_builtin_mat_cols (rho_value& p, virtual_machine& vm)
+  {
+    _check_matrix (p, "mat_cols");
+    return _make_i64 (p.val.gc->val.mat.cols, vm);
+  }
+  
+  rho_value
+  rho_builtin_mat_get (rho_value& m, rho_value& i, rho_value& j,
+                       virtual_machine& vm)
+  {
+    _check_matrix (m, "mat_get");
+    auto& mat = m.val.gc->val.mat;
+    long r = _get_index (i, "mat_get");
+    long c = _get_index (j, "mat_get");
+    if (r < 0 || r >= mat.rows || c < 0 || c >= mat.cols)
+      throw vm_error ("mat_get: index out of range");
+    
+    return rho_value_make_double (mat.data[r * mat.cols + c]);
+  }
+  
+  rho_value
+  rho_builtin_mat_set (rho_value& m, rho_value& i, rho_value& j, rho_value& x,
+                       virtual_machine& vm)
+  {
+    _check_matrix (m, "mat_set");
+    auto& mat = m.val.gc->val.mat;
+    long r = _get_index (i, "mat_set");
+    long c = _get_index (j, "mat_set");
+    if (r < 0 || r >= mat.rows || c < 0 || c >= mat.cols)
+      throw vm_error ("mat_set: index out of range");
+    
+    mat.data[r * mat.cols + c] = _to_double (x, "mat_set");
+    return x;
+  }
+  
+  /* 
+   * Multiplies a matrix by either a matrix or a column vector (f64vec).
+   */
+  rho_value
+  rho_builtin_mat_mul (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    _check_matrix (a, "mat_mul");
+    auto& x = a.val.gc->val.mat;
+    
+    switch (b.type)
+      {
+      case RHO_MATRIX:
+        {
+          auto& y = b.val.gc->val.mat;
+          if (x.cols != y.rows)
+            throw vm_error ("mat_mul: matrix dimensions do not match");
+          
+          auto res = rho_value_make_matrix (x.rows, y.cols, vm.get_gc ());
+          linalg_gemm (x.data, y.data, res.val.gc->val.mat.data,
+                       x.rows, x.cols, y.cols);
+          return res;
+        }
+      
+      case RHO_F64VEC:
+        {
+          auto& y = b.val.gc->val.arr;
+          if (x.cols != y.len)
+            throw vm_error ("mat_mul: matrix and vector dimensions do not match");
+          
+          auto res = rho_value_make_f64vec (x.rows, vm.get_gc ());
+          auto out = res.val.gc->val.arr.f64;
+          for (int i = 0; i < x.rows; ++i)
+            out[i] = simd_f64_dot (x.data + (long)i * x.cols, y.f64, x.cols);
+          return res;
+        }
+      
+      default:
+        throw vm_error ("mat_mul: expected a matrix or an f64vec");
+      }
+  }
+  
+  rho_value
+  rho_builtin_mat_transpose (rho_value& p, virtual_machine& vm)
+  {
+    _check_matrix (p, "mat_transpose");
+    auto& x = p.val.gc->val.mat;
+    
+    auto res = rho_value_make_matrix (x.cols, x.rows, vm.get_gc ());
+    linalg_transpose (x.data, res.val.gc->val.mat.data, x.rows, x.cols);
+    return res;
+  }
+  
+  static void
+  _check_square (rho_value& p, const char *fn)
+  {
+    _check_matrix (p, fn);
+    if (p.val.gc->val.mat.rows != p.val.gc->val.mat.cols)
+      throw vm_error (std::string (fn) + ": expected a square matrix");
+  }
+  
+  /* 
+   * Returns the list '(L U P), where P is the row permutation (as an i64vec)
+   * such that A[P] = L*U.
+   */
+  rho_value
+  rho_builtin_mat_lu (rho_value& p, virtual_machine& vm)
+  {
+    _check_square (p, "mat_lu");
+    auto& a = p.val.gc->val.mat;
+    int n = a.rows;
+    
+    std::vector<double> lu (a.data, a.data + (long)n * n);
+    std::vector<int> perm (n);
+    int sign;
+    if (!linalg_lu (lu.data (), n, perm.data (), sign))
+      throw vm_error ("mat_lu: matrix is singular");
+    
+    auto& gc = vm.get_gc ();
+    gc_disable_guard guard (gc);
+    auto lv = rho_value_make_matrix (n, n, gc);
+    auto uv = rho_value_make_matrix (n, n, gc);
+    auto pv = rho_value_make_i64vec (n, gc);
+    
+    auto l = lv.val.gc->val.mat.data;
+    auto u = uv.val.gc->val.mat.data;
+    for (int i = 0; i < n; ++i)
+      {
+        for (int j = 0; j < n; ++j)
+          {
+            double v = lu[(long)i * n + j];
+            if (j < i)
+              l[(long)i * n + j] = v;
+            else
+              u[(long)i * n + j] = v;
+          }
+        l[(long)i * n + i] = 1.0;
+        pv.val.gc->val.arr.i64[i] = perm[i];
+      }
+    
+    auto nil = rho_value_make_empty_list (gc);
+    auto c3 = rho_value_make_cons (pv, nil, gc);
+    auto c2 = rho_value_make_cons (uv, c3, gc);
+    auto res = rho_value_make_cons (lv, c2, gc);
+    for (auto v : { lv, uv, pv, nil, c3, c2 })
+      gc_unprotect (v);
+    return res;
+  }
+  
+  /* 
+   * Solves A*X = B, where B is either a matrix or an f64vec.
+   */
+  rho_value
+  rho_builtin_mat_solve (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    _check_square (a, "mat_solve");
+    auto& x = a.val.gc->val.mat;
+    int n = x.rows;
+    
+    rho_value res;
+    double *rhs;
+    int nrhs;
+    switch (b.type)
+      {
+      case RHO_MATRIX:
+        {
+          auto& y = b.val.gc->val.mat;
+          if (y.rows != n)
+            throw vm_error ("mat_solve: matrix dimensions do not match");
+          res = rho_builtin_mat_make (b, vm);
+          rhs = res.val.gc->val.mat.data;
+          nrhs = y.cols;
+        }
+        break;
+      
+      case RHO_F64VEC:
+        {
+          auto& y = b.val.gc->val.arr;
+          if (y.len != n)
+            throw vm_error ("mat_solve: matrix and vector dimensions do not match");
+          res = rho_builtin_f64vec (b, vm);
+          rhs = res.val.gc->val.arr.f64;
+          nrhs = 1;
+        }
+        break;
+      
+      default:
+        throw vm_error ("mat_solve: expected a matrix or an f64vec");
+      }
+    
+    std::vector<double> lu (x.data, x.data + (long)n * n);
+    std::vector<int> perm (n);
+    int sign;
+    if (!linalg_lu (lu.data (), n, perm.data (), sign))
+      {
+        gc_unprotect (res);
+        throw vm_error ("mat_solve: matrix is singular");
+      }
+    
+    linalg_lu_solve (lu.data (), perm.data (), n, rhs, nrhs);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_mat_det (rho_value& p, virtual_machine& vm)
+  {
+    _check_square (p, "mat_det");
+    auto& a = p.val.gc->val.mat;
+    int n = a.rows;
+    
+    std::vector<double> lu (a.data, a.data + (long)n * n);
+    std::vector<int> perm (n);
+    int sign;
+    if (!linalg_lu (lu.data (), n, perm.data (), sign))
+      return rho_value_make_double (0.0);
+    
+    double det = sign;
+    for (int i = 0; i < n; ++i)
+      det *= lu[(long)i * n + i];
+    return rho_value_make_double (det);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  static rho_value
+  _make_int (mpz_srcptr val, virtual_machine& vm)
+  {
+    if (mpz_sgn (val) >= 0 && mpz_cmp_ui (val, VM_SMALL_INT_MAX) <= 0)
+      return vm.get_prealloced_int ((int)mpz_get_ui (val));
+    
+    auto res = rho_value_make_int (vm.get_gc ());
+    mpz_set (res.val.gc->val.i, val);
+    return res;
+  }
+  
+  /* 
+   * Returns the polynomial stored in the specified value.  Integers are
+   * treated as constant polynomials, in which case :tmp: is used as storage.
+   */
+  static const zpoly&
+  _get_poly (rho_value& v, zpoly& tmp, const char *fn)
+  {
+    switch (v.type)
+      {
+      case RHO_POLY:
+        return *v.val.gc->val.poly;
+      
+      case RHO_INTEGER:
+        tmp = zpoly (1);
+        mpz_set (tmp[0], v.val.gc->val.i);
+        tmp.normalize ();
+        return tmp;
+      
+      default:
+        throw vm_error (std::string (fn) + ": expected a polynomial");
+      }
+  }
+  
+  static void
+  _set_coeff (zpoly& p, long i, rho_value& v)
+  {
+    if (v.type != RHO_INTEGER)
+      throw vm_error ("poly_make: coefficients must be integers");
+    mpz_set (p[i], v.val.gc->val.i);
+  }
+  
+  /* 
+   * Creates a polynomial out of a list, vector or i64vec of integer
+   * coefficients, starting with the constant term.
+   */
+  rho_value
+  rho_builtin_poly_make (rho_value& p, virtual_machine& vm)
+  {
+    zpoly res;
+    switch (p.type)
+      {
+      case RHO_INTEGER:
+        {
+          zpoly tmp;
+          res = _get_poly (p, tmp, "poly_make");
+        }
+        break;
+      
+      case RHO_VEC:
+        {
+          auto& vec = p.val.gc->val.vec;
+          res = zpoly (vec.len);
+          for (long i = 0; i < vec.len; ++i)
+            _set_coeff (res, i, vec.vals[i]);
+        }
+        break;
+      
+      case RHO_I64VEC:
+        {
+          auto& arr = p.val.gc->val.arr;
+          res = zpoly (arr.len);
+          for (long i = 0; i < arr.len; ++i)
+            mpz_set_si (res[i], arr.i64[i]);
+        }
+        break;
+      
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        {
+          res = zpoly (_list_len (p));
+          long i = 0;
+          for (rho_value cur = p; cur.type == RHO_CONS && i < res.size ();
+               cur = cur.val.gc->val.p.snd, ++i)
+            _set_coeff (res, i, cur.val.gc->val.p.fst);
+        }
+        break;
+      
+      default:
+        throw vm_error ("poly_make: expected a list of coefficients");
+      }
+    
+    res.normalize ();
+    return rho_value_make_poly (std::move (res), vm.get_gc ());
+  }
+  
+  /* 
+   * Returns the list of coefficients of a polynomial, starting with the
+   * constant term.
+   */
+  rho_value
+  rho_builtin_poly_coeffs (rho_value& p, virtual_machine& vm)
+  {
+    zpoly tmp;
+    auto& x = _get_poly (p, tmp, "poly_coeffs");
+    
+    // the cells are unprotected as soon as they are linked in, which is safe
+    // as long as nothing is collected before the list reaches the VM.
+    auto& gc = vm.get_gc ();
+    gc_disable_guard guard (gc);
+    auto lst = rho_value_make_empty_list (gc);
+    for (long i = x.size () - 1; i >= 0; --i)
+      {
+        auto c = _make_int (x[i], vm);
+        auto cell = rho_value_make_cons (c, lst, gc);
+        gc_unprotect (c);
+        gc_unprotect (lst);
+        lst = cell;
+      }
+    
+    return lst;
+  }
+  
+  rho_value
+  rho_builtin_poly_deg (rho_value& p, virtual_machine& vm)
+  {
+    zpoly tmp;
+    auto& x = _get_poly (p, tmp, "poly_deg");
+    if (x.is_zero ())
+      throw vm_error ("poly_deg: the zero polynomial has no degree");
+    return _make_i64 (x.degree (), vm);
+  }
+  
+  rho_value
+  rho_builtin_poly_add (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    zpoly ta, tb;
+    return rho_value_make_poly (
+      poly_add (_get_poly (a, ta, "poly_add"), _get_poly (b, tb, "poly_add")),
+      vm.get_gc ());
+  }
+  
+  rho_value
+  rho_builtin_poly_sub (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    zpoly ta, tb;
+    return rho_value_make_poly (
+      poly_sub (_get_poly (a, ta, "poly_sub"), _get_poly (b, tb, "poly_sub")),
+      vm.get_gc ());
+  }
+  
+  rho_value
+  rho_builtin_poly_mul (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    zpoly ta, tb;
+    return rho_value_make_poly (
+      poly_mul (_get_poly (a, ta, "poly_mul"), _get_poly (b, tb, "poly_mul")),
+      vm.get_gc ());
+  }
+  
+  /* 
+   * Returns a list of the form '(q r), where a = q*b + r.
+   * The quotient must have integer coefficients.
+   */
+  rho_value
+  rho_builtin_poly_divrem (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    zpoly ta, tb;
+    auto& x = _get_poly (a, ta, "poly_divrem");
+    auto& y = _get_poly (b, tb, "poly_divrem");
+    if (y.is_zero ())
+      throw vm_error ("poly_divrem: division by zero");
+    
+    zpoly q, r;
+    if (!poly_divrem (x, y, q, r))
+      throw vm_error ("poly_divrem: quotient does not have integer coefficients");
+    
+    auto& gc = vm.get_gc ();
+    gc_disable_guard guard (gc);
+    auto qv = rho_value_make_poly (std::move (q), gc);
+    auto rv = rho_value_make_poly (std::move (r), gc);
+    
+    auto nil = rho_value_make_empty_list (gc);
+    auto c2 = rho_value_make_cons (rv, nil, gc);
+    auto res = rho_value_make_cons (qv, c2, gc);
+    for (auto v : { qv, rv, nil, c2 })
+      gc_unprotect (v);
+    return res;
+  }
+  
+  rho_value
+  rho_builtin_poly_gcd (rho_value& a, rho_value& b, virtual_machine& vm)
+  {
+    zpoly ta, tb;
+    return rho_value_make_poly (
+      poly_gcd (_get_poly (a, ta, "poly_gcd"), _get_poly (b, tb, "poly_gcd")),
+      vm.get_gc ());
+  }
+  
+  /* 
+   * Evaluates a polynomial at an integer, float or double.
+   */
+  rho_value
+  rho_builtin_poly_eval (rho_value& p, rho_value& x, virtual_machine& vm)
+  {
+    zpoly tmp;
+    auto& f = _get_poly (p, tmp, "poly_eval");
+    
+    switch (x.type)
+      {
+      case RHO_INTEGER:
+        {
+          auto res = rho_value_make_int (vm.get_gc ());
+          poly_eval (res.val.gc->val.i, f, x.val.gc->val.i);
+          return res;
+        }
+      
+      case RHO_DOUBLE:
+        return rho_value_make_double (poly_eval (f, x.val.f64));
+      
+      case RHO_FLOAT:
+        {
+          auto& xf = x.val.gc->val.f;
+          auto res = rho_value_make_float (mpfr_get_prec (xf), vm.get_gc ());
+          auto& r = res.val.gc->val.f;
+          mpfr_set_ui (r, 0, MPFR_RNDN);
+          for (long i = f.size () - 1; i >= 0; --i)
+            {
+              mpfr_mul (r, r, xf, MPFR_RNDN);
+              mpfr_add_z (r, r, f[i], MPFR_RNDN);
+            }
+          return res;
+        }
+      
+      default:
+        throw vm_error ("poly_eval: expected a number");
+      }
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  static inline rho_value
+  _expr_value (gc_value *e)
+  {
+    rho_value v;
+    v.type = RHO_EXPR;
+    v.val.gc = e;
+    return v;
+  }
+  
+  static gc_value*
+  _get_expr (rho_value& v, const char *fn, virtual_machine& vm)
+  {
+    if (v.type != RHO_EXPR && v.type != RHO_INTEGER && v.type != RHO_PVAR)
+      throw vm_error (std::string (fn) + ": expected an expression");
+    return expr_from_value (v, vm);
+  }
+  
+  /* 
+   * Converts a list of integers and expressions into a vector of expressions.
+   */
+  static std::vector<gc_value *>
+  _expr_list (rho_value& lst, virtual_machine& vm, const char *fn)
+  {
+    if (lst.type != RHO_CONS && lst.type != RHO_EMPTY_LIST)
+      throw vm_error (std::string (fn) + ": expected a list of arguments");
+    
+    std::vector<gc_value *> args;
+    for (rho_value cur = lst; cur.type == RHO_CONS;
+         cur = cur.val.gc->val.p.snd)
+      args.push_back (_get_expr (cur.val.gc->val.p.fst, fn, vm));
+    return args;
+  }
+  
+  /* 
+   * Returns the symbol with the specified name.
+   */
+  rho_value
+  rho_builtin_expr_sym (rho_value& name, virtual_machine& vm)
+  {
+    auto str = _get_str (name, "expr_sym");
+    
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    return _expr_value (tbl.make_sym (tbl.intern (str)));
+  }
+  
+  /* 
+   * Returns the application of the named function to a list of arguments.
+   */
+  rho_value
+  rho_builtin_expr_fn (rho_value& name, rho_value& args, virtual_machine& vm)
+  {
+    auto str = _get_str (name, "expr_fn");
+    
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    return _expr_value (tbl.make_fn (tbl.intern (str),
+                                     _expr_list (args, vm, "expr_fn")));
+  }
+  
+  rho_value
+  rho_builtin_expr_simplify (rho_value& e, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    return _expr_value (expr_simplify (_get_expr (e, "expr_simplify", vm), vm));
+  }
+  
+  /* 
+   * Differentiates :e: with respect to the symbol :x:.
+   */
+  rho_value
+  rho_builtin_expr_diff (rho_value& e, rho_value& x, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto v = _get_expr (x, "expr_diff", vm);
+    if (v->val.expr->op != EXPR_SYM)
+      throw vm_error ("expr_diff: can only differentiate with respect to a symbol");
+    
+    return _expr_value (
+      expr_diff (_get_expr (e, "expr_diff", vm), v->val.expr->name, vm));
+  }
+  
+  /* 
+   * Returns the operator of an expression as a string: "+", "*", "^", "num",
+   * "sym", or the name of the applied function.
+   */
+  rho_value
+  rho_builtin_expr_op (rho_value& e, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto n = _get_expr (e, "expr_op", vm)->val.expr;
+    
+    std::string str;
+    switch (n->op)
+      {
+      case EXPR_NUM: str = "num"; break;
+      case EXPR_SYM: str = "sym"; break;
+      case EXPR_PVAR: str = "pvar"; break;
+      case EXPR_ADD: str = "+"; break;
+      case EXPR_MUL: str = "*"; break;
+      case EXPR_POW: str = "^"; break;
+      case EXPR_FN: str = vm.get_exprs ().get_name (n->name); break;
+      }
+    
+    return rho_value_make_string (str.c_str (), str.length (), vm.get_gc ());
+  }
+  
+  /* 
+   * Returns the list of operands of an expression.  Numbers and symbols
+   * have no operands.
+   */
+  rho_value
+  rho_builtin_expr_args (rho_value& e, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto g = _get_expr (e, "expr_args", vm);
+    
+    auto& args = g->val.expr->args;
+    auto& gc = vm.get_gc ();
+    auto lst = rho_value_make_empty_list (gc);
+    for (auto itr = args.rbegin (); itr != args.rend (); ++itr)
+      {
+        auto a = _expr_value (*itr);
+        auto cell = rho_value_make_cons (a, lst, gc);
+        gc_unprotect (lst);
+        lst = cell;
+      }
+    
+    return lst;
+  }
+  
+  /* 
+   * Builds an expression out of an operator (as returned by expr_op) and a
+   * list of operands.
+   */
+  rho_value
+  rho_builtin_expr_make (rho_value& op, rho_value& args, virtual_machine& vm)
+  {
+    auto str = _get_str (op, "expr_make");
+    
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    auto vec = _expr_list (args, vm, "expr_make");
+    if (str == "+")
+      return _expr_value (tbl.make_op (EXPR_ADD, vec));
+    else if (str == "*")
+      return _expr_value (tbl.make_op (EXPR_MUL, vec));
+    else if (str == "^")
+      {
+        if (vec.size () != 2)
+          throw vm_error ("expr_make: `^' expects exactly 2 operands");
+        return _expr_value (tbl.make_op (EXPR_POW, vec));
+      }
+    else if (str == "num" || str == "sym" || str == "pvar")
+      throw vm_error ("expr_make: cannot make a `" + str + "' expression");
+    
+    return _expr_value (tbl.make_fn (tbl.intern (str), vec));
+  }
+  
+  /* 
+   * Returns the number of live expression nodes.
+   */
+  rho_value
+  rho_builtin_expr_nodes (virtual_machine& vm)
+  {
+    return _make_i64 (vm.get_exprs ().size (), vm);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  rho_value
+  rho_builtin_coroutine (rho_value& fn, virtual_machine& vm)
+  {
+    return vm.make_coroutine (fn);
+  }
+  
+  /* 
+   * Returns true if the specified coroutine has returned (and so can no
+   * longer be resumed).
+   */
+  rho_value
+  rho_builtin_co_done (rho_value& co, virtual_machine& vm)
+  {
+    if (co.type != RHO_COROUTINE)
+      throw vm_error ("co_done: expected a coroutine");
+    return rho_value_make_bool (co.val.gc->val.co->state == CO_DEAD);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Returns the number of heap objects allocated since the VM started.
+   */
+  rho_value
+  rho_builtin_gc_allocs (virtual_machine& vm)
+  {
+    auto stats = vm.get_gc ().get_stats ();
+    return _make_i64 (stats.allocs, vm);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  namespace {
+    
+    /* 
+     * Builds a list front-to-back.
+     * The list hangs off a dummy head cell kept on the VM's stack, so the
+     * cells built so far (and whatever they hold) stay reachable while
+     * callbacks into Rho code trigger collections.
+     */
+    class list_builder
+    {
+      virtual_machine& vm;
+      gc_value *head;
+      gc_value *tail;
+      
+    public:
+      list_builder (virtual_machine& vm)
+        : vm (vm)
+      {
+        auto nil = rho_value_make_nil ();
+        auto h = rho_value_make_cons (nil, nil, vm.get_gc ());
+        vm.push_value (h);
+        gc_unprotect (h);
+        this->head = this->tail = h.val.gc;
+      }
+      
+    public:
+      /* 
+       * Returns a reachable slot in which a single intermediate value can be
+       * kept (the head cell's car).
+       */
+      inline rho_value& scratch () { return this->head->val.p.fst; }
+      
+      /* 
+       * Appends a cell holding :v: to the list, and returns a reference to the
+       * cell's value.  :v: must be reachable, since this allocates.
+       */
+      rho_value&
+      append (rho_value v)
+      {
+        auto nil = rho_value_make_nil ();
+        auto c = rho_value_make_cons (v, nil, this->vm.get_gc ());
+        this->tail->val.p.snd = c;
+        gc_unprotect (c);
+        this->tail = c.val.gc;
+        return this->tail->val.p.fst;
+      }
+      
+      /* 
+       * Terminates the list, pops the head cell off the stack and returns
+       * the list, protected (see native_fn).
+       */
+      rho_value
+      finish ()
+      {
+        auto e = rho_value_make_empty_list (this->vm.get_gc ());
+        this->tail->val.p.snd = e;
+        gc_unprotect (e);
+        
+        auto res = this->head->val.p.snd;
+        gc_protect (res);
+        this->vm.pop_value ();
+        return res;
+      }
+    };
+  }
+  
+  
+  
+  /* 
+   * Returns the integers from :start: to :end: (exclusive).
+   * Like the std:list version, this counts down from :end: - 1, so the list is
+   * built back-to-front in a single pass.
+   */
+  rho_value
+  rho_builtin_list_range (rho_value& start, rho_value& end,
+                          virtual_machine& vm)
+  {
+    auto& gc = vm.get_gc ();
+    
+    // values are unprotected as soon as they are linked into the list, so
+    // nothing may be collected until the list reaches the VM.
+    gc_disable_guard guard (gc);
+    rho_value one = vm.get_prealloced_int (1);
+    rho_value acc = rho_value_make_empty_list (gc);
+    rho_value i = rho_value_sub (end, one, vm);
+    while (!rho_value_cmp_lt (i, start))
+      {
+        auto cell = rho_value_make_cons (i, acc, gc);
+        gc_unprotect (acc);
+        acc = cell;
+        auto next = rho_value_sub (i, one, vm);
+        gc_unprotect (i);
+        i = next;
+      }
+    gc_unprotect (i);
+    
+    return acc;
+  }
+  
+  rho_value
+  rho_builtin_list_map (rho_value& f, rho_value& lst, virtual_machine& vm)
+  {
+    list_builder res { vm };
+    
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        auto& x = cur.val.gc->val.p.fst;
+        auto& slot = res.append (rho_value_make_nil ());
+        slot = vm.call (f, x);
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("map: expected a list");
+    
+    return res.finish ();
+  }
+  
+  rho_value
+  rho_builtin_list_filter (rho_value& f, rho_value& lst, virtual_machine& vm)
+  {
+    list_builder res { vm };
+    
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        auto& x = cur.val.gc->val.p.fst;
+        auto keep = vm.call (f, x);
+        if (!rho_value_cmp_zero (keep))
+          res.append (x);
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("filter: expected a list");
+    
+    return res.finish ();
+  }
+  
+  /* 
+   * Passes :x: through the stages of a fused pipeline, and appends the result
+   * to :res: unless a filter stage rejects it.
+   */
+  static void
+  _fuse_one (list_builder& res, rho_value x, rho_value *fns, int count,
+             long ops, virtual_machine& vm)
+  {
+    auto& v = res.scratch ();
+    v = x;
+    for (int i = 0; i < count; ++i)
+      {
+        auto r = vm.call (fns[i], v);
+        if (ops & (1L << i))
+          {
+            if (rho_value_cmp_zero (r))
+              return;
+          }
+        else
+          v = r;
+      }
+    
+    auto& slot = res.append (rho_value_make_nil ());
+    slot = res.scratch ();
+  }
+  
+  static long
+  _fuse_ops (rho_value& fns, rho_value& ops)
+  {
+    if (fns.type != RHO_VEC || ops.type != RHO_INTEGER
+      || fns.val.gc->val.vec.len > 63)
+      throw vm_error ("list_fuse: invalid pipeline");
+    return mpz_get_si (ops.val.gc->val.i);
+  }
+  
+  /* 
+   * Fused map/filter pipeline over a list.
+   * :fns: holds the stage functions innermost first, and bit i of :ops: is
+   * set if stage i is a filter (otherwise it is a map).
+   */
+  rho_value
+  rho_builtin_list_fuse (rho_value& fns, rho_value& ops, rho_value& lst,
+                         virtual_machine& vm)
+  {
+    long mask = _fuse_ops (fns, ops);
+    auto& vec = fns.val.gc->val.vec;
+    list_builder res { vm };
+    
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        _fuse_one (res, cur.val.gc->val.p.fst, vec.vals, vec.len, mask, vm);
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("map: expected a list");
+    
+    return res.finish ();
+  }
+  
+  /* 
+   * Same as list_fuse, with range(:start:, :end:) as the source.
+   */
+  rho_value
+  rho_builtin_list_fuse_range (rho_value& fns, rho_value& ops,
+                               rho_value& start, rho_value& end,
+                               virtual_machine& vm)
+  {
+    if (start.type != RHO_INTEGER || end.type != RHO_INTEGER)
+      {
+        // range() counts down from the end, which yields different elements
+        // for non-integral bounds; just build the list.
+        auto lst = rho_builtin_list_range (start, end, vm);
+        vm.push_value (lst);
+        gc_unprotect (lst);
+        auto res = rho_builtin_list_fuse (fns, ops, lst, vm);
+        vm.pop_value ();
+        return res;
+      }
+    
+    long mask = _fuse_ops (fns, ops);
+    auto& vec = fns.val.gc->val.vec;
+    list_builder res { vm };
+    
+    rho_value one = vm.get_prealloced_int (1);
+    rho_value i = start;
+    while (rho_value_cmp_lt (i, end))
+      {
+        _fuse_one (res, i, vec.vals, vec.len, mask, vm);
+        
+        // :i: is kept alive by its protection until it is replaced.
+        auto next = rho_value_add (i, one, vm);
+        if (i.val.gc != start.val.gc)
+          gc_unprotect (i);
+        i = next;
+      }
+    if (i.val.gc != start.val.gc)
+      gc_unprotect (i);
+    
+    return res.finish ();
+  }
+  
+  /* 
+   * Returns a sorted copy of :lst:, where :less: is a function that returns
+   * true if its first argument should come before its second.  The sort is
+   * stable.
+   */
+  rho_value
+  rho_builtin_list_sort (rho_value& less, rho_value& lst, virtual_machine& vm)
+  {
+    // the elements stay reachable through :lst:.
+    std::vector<rho_value> elems;
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        elems.push_back (cur.val.gc->val.p.fst);
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("sort: expected a list");
+    
+    std::stable_sort (elems.begin (), elems.end (),
+      [&] (const rho_value& a, const rho_value& b) {
+        auto r = vm.call (less, a, b);
+        return !rho_value_cmp_zero (r);
+      });
+    
+    auto& gc = vm.get_gc ();
+    gc_disable_guard guard (gc);
+    rho_value acc = rho_value_make_empty_list (gc);
+    for (auto itr = elems.rbegin (); itr != elems.rend (); ++itr)
+      {
+        auto cell = rho_value_make_cons (*itr, acc, gc);
+        gc_unprotect (acc);
+        acc = cell;
+      }
+    return acc;
+  }
+  
+  /* 
+   * Left fold: f(...f(f(init, x1), x2)..., xn).
+   */
+  rho_value
+  rho_builtin_list_fold (rho_value& f, rho_value& init, rho_value& lst,
+                         virtual_machine& vm)
+  {
+    vm_root acc { vm, init };
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        acc.set (vm.call (f, acc.get (), cur.val.gc->val.p.fst));
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("fold: expected a list");
+    
+    return acc.get ();
+  }
+  
+  rho_value
+  rho_builtin_list_reverse (rho_value& lst, virtual_machine& vm)
+  {
+    auto& gc = vm.get_gc ();
+    gc_disable_guard guard (gc);
+    
+    rho_value acc = rho_value_make_empty_list (gc);
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        auto cell = rho_value_make_cons (cur.val.gc->val.p.fst, acc, gc);
+        gc_unprotect (acc);
+        acc = cell;
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      {
+        gc_unprotect (acc);
+        throw vm_error ("reverse: expected a list");
+      }
+    
+    return acc;
+  }
+  
+  rho_value
+  rho_builtin_list_len (rho_value& lst, virtual_machine& vm)
+  {
+    long long len = 0;
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        ++ len;
+        cur = cur.val.gc->val.p.snd;
+      }
+    if (cur.type != RHO_EMPTY_LIST)
+      throw vm_error ("len: expected a list");
+    
+    return _make_i64 (len, vm);
+  }
+  
+  rho_value
+  rho_builtin_list_any (rho_value& lst, virtual_machine& vm)
+  {
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        if (!rho_value_cmp_zero (cur.val.gc->val.p.fst))
+          return rho_value_make_bool (true);
+        cur = cur.val.gc->val.p.snd;
+      }
+    
+    return rho_value_make_bool (false);
+  }
+  
+  rho_value
+  rho_builtin_list_all (rho_value& lst, virtual_machine& vm)
+  {
+    rho_value cur = lst;
+    while (cur.type == RHO_CONS)
+      {
+        if (rho_value_cmp_zero (cur.val.gc->val.p.fst))
+          return rho_value_make_bool (false);
+        cur = cur.val.gc->val.p.snd;
+      }
+    
+    return rho_value_make_bool (true);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Maps:
+  
+  static rho_map&
+  _get_map (rho_value& v, const char *fname)
+  {
+    if (v.type != RHO_MAP)
+      throw vm_error (std::string (fname) + ": expected a map");
+    return *v.val.gc->val.map;
+  }
+  
+  /* 
+   * map_get(m, key[, default]): returns the value associated with :key:, or
+   * the default (nil if not given) if there is none.
+   */
+  rho_value
+  rho_builtin_map_get (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto val = _get_map (args[0], "map_get").find (args[1]);
+    if (val)
+      return *val;
+    return (argc > 2) ? args[2] : rho_value_make_nil ();
+  }
+  
+  rho_value
+  rho_builtin_map_has (rho_value& m, rho_value& key, virtual_machine& vm)
+  {
+    return rho_value_make_bool (_get_map (m, "map_has").find (key) != nullptr);
+  }
+  
+  /* 
+   * Removes :key: from the map.  Returns true if it was there.
+   */
+  rho_value
+  rho_builtin_map_del (rho_value& m, rho_value& key, virtual_machine& vm)
+  {
+    return rho_value_make_bool (_get_map (m, "map_del").remove (key));
+  }
+  
+  
+  
+  enum map_part
+  {
+    MAP_KEYS,
+    MAP_VALS,
+    MAP_ITEMS,
+  };
+  
+  /* 
+   * Lists the keys, values or (key . value) pairs of the specified map, in
+   * table order.  The map itself keeps the listed values reachable.
+   */
+  static rho_value
+  _map_list (rho_value& mv, map_part part, const char *fname,
+             virtual_machine& vm)
+  {
+    auto& m = _get_map (mv, fname);
+    
+    list_builder lb (vm);
+    for (long i = 0; i < m.capacity (); ++i)
+      {
+        auto& s = m.slot (i);
+        if (!rho_map::is_live (s))
+          continue;
+        
+        switch (part)
+          {
+          case MAP_KEYS: lb.append (s.key); break;
+          case MAP_VALS: lb.append (s.val); break;
+          
+          case MAP_ITEMS:
+            {
+              auto p = rho_value_make_cons (s.key, s.val, vm.get_gc ());
+              lb.append (p);
+              gc_unprotect (p);
+            }
+            break;
+          }
+      }
+    
+    return lb.finish ();
+  }
+  
+  rho_value
+  rho_builtin_map_keys (rho_value& m, virtual_machine& vm)
+  {
+    return _map_list (m, MAP_KEYS, "map_keys", vm);
+  }
+  
+  rho_value
+  rho_builtin_map_vals (rho_value& m, virtual_machine& vm)
+  {
+    return _map_list (m, MAP_VALS, "map_vals", vm);
+  }
+  
+  rho_value
+  rho_builtin_map_items (rho_value& m, virtual_machine& vm)
+  {
+    return _map_list (m, MAP_ITEMS, "map_items", vm);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Memoization:
+  
+  /* 
+   * Returns a map holding the cache statistics of a `memo' function:
+   * hits, misses, evictions, size and hit_rate.
+   */
+  rho_value
+  rho_builtin_memo_stats (rho_value& f, virtual_machine& vm)
+  {
+    if (f.type != RHO_FUN || !f.val.gc->val.fn.memo)
+      throw vm_error ("memo_stats: expected a memo function");
+    auto& memo = *f.val.gc->val.fn.memo;
+    auto& gc = vm.get_gc ();
+    
+    // the map is rooted (and unprotected) before anything is put in it, so
+    // that the keys and values it holds are traced from then on.  It is
+    // protected again once filled (see native_fn).
+    vm_root res { vm, rho_value_make_map (8, gc) };
+    gc_unprotect (res.get ());
+    auto& m = *res.get ().val.gc->val.map;
+    auto add = [&] (const char *name, rho_value val) {
+      auto key = rho_value_make_string (name, std::strlen (name), gc);
+      m.set (key, val);
+      gc_unprotect (key);
+      gc_unprotect (val);
+    };
+    
+    long lookups = memo.hits + memo.misses;
+    add ("hits", rho_value_make_int64 (memo.hits, gc));
+    add ("misses", rho_value_make_int64 (memo.misses, gc));
+    add ("evictions", rho_value_make_int64 (memo.evictions, gc));
+    add ("size", rho_value_make_int64 (memo.size (), gc));
+    add ("hit_rate", rho_value_make_double (
+      lookups ? (double)memo.hits / lookups : 0.0));
+    gc_protect (res.get ());
+    return res.get ();
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Persistent vectors:
+  
+  static rho_pvec&
+  _get_pvec (rho_value& v, const char *fname)
+  {
+    if (v.type != RHO_PVEC)
+      throw vm_error (std::string (fname) + ": expected a persistent vector");
+    return *v.val.gc->val.pvec;
+  }
+  
+  /* 
+   * Applies an update to the specified vector.  Transients are updated in
+   * place and returned as they are; otherwise, the update is applied to a
+   * new version of the vector, which shares all untouched nodes with the
+   * original.
+   */
+  template<typename Fn>
+  static rho_value
+  _pvec_update (rho_value& v, const char *fname, virtual_machine& vm, Fn&& fn)
+  {
+    auto& pv = _get_pvec (v, fname);
+    if (pv.is_transient ())
+      {
+        fn (pv);
+        return v;
+      }
+    
+    auto res = new rho_pvec (pv);
+    try
+      {
+        fn (*res);
+      }
+    catch (...)
+      {
+        delete res;
+        throw;
+      }
+    
+    return rho_value_make_pvec (res, vm.get_gc ());
+  }
+  
+  /* 
+   * pvec([src]): creates a persistent vector out of a vector, a list or
+   * another persistent vector, or an empty one.
+   */
+  rho_value
+  rho_builtin_pvec (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto pv = new rho_pvec ();
+    if (argc > 0)
+      {
+        auto& src = args[0];
+        switch (src.type)
+          {
+          case RHO_VEC:
+            {
+              auto& vec = src.val.gc->val.vec;
+              for (long i = 0; i < vec.len; ++i)
+                pv->push (vec.vals[i]);
+            }
+            break;
+          
+          case RHO_CONS:
+          case RHO_EMPTY_LIST:
+            for (rho_value cur = src; cur.type == RHO_CONS;
+                 cur = cur.val.gc->val.p.snd)
+              pv->push (cur.val.gc->val.p.fst);
+            break;
+          
+          case RHO_PVEC:
+            delete pv;
+            pv = new rho_pvec (*src.val.gc->val.pvec);
+            break;
+          
+          default:
+            delete pv;
+            throw vm_error ("pvec: expected a vector or a list");
+          }
+      }
+    
+    return rho_value_make_pvec (pv, vm.get_gc ());
+  }
+  
+  rho_value
+  rho_builtin_pvec_set (rho_value& v, rho_value& i, rho_value& x,
+                        virtual_machine& vm)
+  {
+    long idx = _get_index (i, "pvec_set");
+    return _pvec_update (v, "pvec_set", vm, [&] (rho_pvec& pv) {
+        if (idx < 0 || idx >= pv.size ())
+          throw vm_error ("pvec_set: index out of range");
+        pv.set (idx, x);
+      });
+  }
+  
+  rho_value
+  rho_builtin_pvec_push (rho_value& v, rho_value& x, virtual_machine& vm)
+  {
+    return _pvec_update (v, "pvec_push", vm, [&] (rho_pvec& pv) {
+        pv.push (x);
+      });
+  }
+  
+  rho_value
+  rho_builtin_pvec_pop (rho_value& v, virtual_machine& vm)
+  {
+    return _pvec_update (v, "pvec_pop", vm, [&] (rho_pvec& pv) {
+        if (pv.size () == 0)
+          throw vm_error ("pvec_pop: vector is empty");
+        pv.pop ();
+      });
+  }
+  
+  /* 
+   * pvec_slice(v, start, end): the elements in the range [start, end).
+   */
+  rho_value
+  rho_builtin_pvec_slice (rho_value& v, rho_value& start, rho_value& end,
+                          virtual_machine& vm)
+  {
+    long s = _get_index (start, "pvec_slice");
+    long e = _get_index (end, "pvec_slice");
+    return _pvec_update (v, "pvec_slice", vm, [&] (rho_pvec& pv) {
+        if (s < 0 || e > pv.size () || s > e)
+          throw vm_error ("pvec_slice: invalid range");
+        pv.slice (s, e);
+      });
+  }
+  
+  /* 
+   * Returns a transient copy of the specified vector, which pvec_set,
+   * pvec_push, pvec_pop, pvec_slice and element assignment update in place.
+   * Nodes are still copied the first time they are written to, but only
+   * once, so batches of updates are cheap.
+   */
+  rho_value
+  rho_builtin_pvec_transient (rho_value& v, virtual_machine& vm)
+  {
+    auto pv = new rho_pvec (_get_pvec (v, "pvec_transient"));
+    pv->set_transient (true);
+    return rho_value_make_pvec (pv, vm.get_gc ());
+  }
+  
+  /* 
+   * Returns a persistent snapshot of a transient in O(1).  The transient can
+   * still be used afterwards; it will simply have to copy the nodes it
+   * shares with the snapshot before writing to them.
+   */
+  rho_value
+  rho_builtin_pvec_persist (rho_value& v, virtual_machine& vm)
+  {
+    auto& pv = _get_pvec (v, "pvec_persist");
+    if (!pv.is_transient ())
+      return v;
+    return rho_value_make_pvec (new rho_pvec (pv), vm.get_gc ());
+  }
+  
+  /* 
+   * Copies the elements of a persistent vector into a new plain vector.
+   */
+  rho_value
+  rho_builtin_pvec_to_vec (rho_value& v, virtual_machine& vm)
+  {
+    auto& pv = _get_pvec (v, "pvec_to_vec");
+    auto res = rho_value_make_vec (pv.size (), vm.get_gc ());
+    auto& vec = res.val.gc->val.vec;
+    pv.each ([&] (rho_value& x) {
+        vec.vals[vec.len ++] = x;
+      });
+    
+    return res;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Growable vectors:
+  
+  static gc_value*
+  _get_vec (rho_value& v, const char *fname)
+  {
+    if (v.type != RHO_VEC)
+      throw vm_error (std::string (fname) + ": expected a vector");
+    return v.val.gc;
+  }
+  
+  /* 
+   * push(v, x): appends :x: to the vector in place, and returns the vector.
+   */
+  rho_value
+  rho_builtin_push (rho_value& v, rho_value& x, virtual_machine& vm)
+  {
+    auto g = _get_vec (v, "push");
+    auto& vec = g->val.vec;
+    rho_vec_reserve (g, vec.len + 1);
+    vec.vals[vec.len ++] = x;
+    return v;
+  }
+  
+  /* 
+   * pop(v): removes the last element of the vector and returns it.
+   */
+  rho_value
+  rho_builtin_pop (rho_value& v, virtual_machine& vm)
+  {
+    auto& vec = _get_vec (v, "pop")->val.vec;
+    if (vec.len == 0)
+      throw vm_error ("pop: vector is empty");
+    
+    // the element is left in the buffer, but the collector only looks at
+    // the first :len: ones.
+    return vec.vals[-- vec.len];
+  }
+  
+  /* 
+   * extend(v, src): appends the elements of another vector, a list or a
+   * persistent vector to :v:, in place.  Returns :v:.
+   */
+  rho_value
+  rho_builtin_extend (rho_value& v, rho_value& src, virtual_machine& vm)
+  {
+    auto g = _get_vec (v, "extend");
+    auto& vec = g->val.vec;
+    switch (src.type)
+      {
+      case RHO_VEC:
+        {
+          // :src: may be :v: itself.
+          auto& sv = src.val.gc->val.vec;
+          long n = sv.len;
+          rho_vec_reserve (g, vec.len + n);
+          std::copy (sv.vals, sv.vals + n, vec.vals + vec.len);
+          vec.len += n;
+        }
+        break;
+      
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        for (rho_value cur = src; cur.type == RHO_CONS;
+             cur = cur.val.gc->val.p.snd)
+          {
+            rho_vec_reserve (g, vec.len + 1);
+            vec.vals[vec.len ++] = cur.val.gc->val.p.fst;
+          }
+        break;
+      
+      case RHO_PVEC:
+        {
+          auto& pv = *src.val.gc->val.pvec;
+          rho_vec_reserve (g, vec.len + pv.size ());
+          pv.each ([&] (rho_value& x) {
+              vec.vals[vec.len ++] = x;
+            });
+        }
+        break;
+      
+      default:
+        throw vm_error ("extend: expected a vector or a list");
+      }
+    
+    return v;
+  }
+  
+  /* 
+   * slice(v, start[, end]): a vector viewing the elements of :v: in the
+   * range [start, end) without copying them.  Both vectors copy the shared
+   * buffer before they are first written to.
+   */
+  rho_value
+  rho_builtin_slice (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto& vec = _get_vec (args[0], "slice")->val.vec;
+    long start = _get_index (args[1], "slice");
+    long end = (argc > 2) ? _get_index (args[2], "slice") : vec.len;
+    if (start < 0 || end > vec.len || start > end)
+      throw vm_error ("slice: invalid range");
+    
+    return rho_value_make_vec_slice (args[0], start, end, vm.get_gc ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Strings:
+  
+  static gc_value*
+  _get_str_val (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_STR)
+      throw vm_error (std::string (fn) + ": expected a string");
+    return v.val.gc;
+  }
+  
+  static rho_value
+  _make_index (long idx, virtual_machine& vm)
+  {
+    if (idx >= 0 && idx <= VM_SMALL_INT_MAX)
+      return vm.get_prealloced_int (idx);
+    return rho_value_make_int (idx, vm.get_gc ());
+  }
+  
+  /* 
+   * substr(s, start[, end]): the characters of :s: in the range [start, end).
+   */
+  rho_value
+  rho_builtin_substr (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto g = _get_str_val (args[0], "substr");
+    long len = g->val.s.len;
+    long start = _get_index (args[1], "substr");
+    long end = (argc > 2) ? _get_index (args[2], "substr") : len;
+    if (start < 0 || end > len || start > end)
+      throw vm_error ("substr: invalid range");
+    
+    return rho_value_make_string (rho_str_chars (g) + start, end - start,
+                                  vm.get_gc ());
+  }
+  
+  /* 
+   * split(s, sep): the list of pieces of :s: between occurrences of :sep:.
+   */
+  rho_value
+  rho_builtin_split (rho_value& s, rho_value& sep, virtual_machine& vm)
+  {
+    auto g = _get_str_val (s, "split");
+    auto gs = _get_str_val (sep, "split");
+    long n = g->val.s.len, m = gs->val.s.len;
+    if (m == 0)
+      throw vm_error ("split: empty separator");
+    
+    const char *str = rho_str_chars (g);
+    const char *needle = rho_str_chars (gs);
+    
+    list_builder res { vm };
+    long pos = 0;
+    for (;;)
+      {
+        long idx = simd_str_find (str + pos, n - pos, needle, m);
+        long end = (idx == -1) ? n : (pos + idx);
+        
+        auto piece = rho_value_make_string (str + pos, end - pos,
+                                            vm.get_gc ());
+        res.append (piece);
+        gc_unprotect (piece);
+        
+        if (idx == -1)
+          break;
+        pos = end + m;
+      }
+    
+    return res.finish ();
+  }
+  
+  /* 
+   * join(seq, sep): the elements of a list or vector, converted to strings
+   * and separated by :sep:.
+   */
+  rho_value
+  rho_builtin_join (rho_value& seq, rho_value& sep, virtual_machine& vm)
+  {
+    auto gs = _get_str_val (sep, "join");
+    std::string res;
+    bool first = true;
+    auto add = [&] (rho_value& x) {
+        if (!first)
+          res.append (rho_str_chars (gs), gs->val.s.len);
+        first = false;
+        
+        if (x.type == RHO_STR)
+          res.append (rho_str_chars (x.val.gc), x.val.gc->val.s.len);
+        else
+          res.append (rho_value_str (x, vm));
+      };
+    
+    switch (seq.type)
+      {
+      case RHO_CONS:
+      case RHO_EMPTY_LIST:
+        for (rho_value cur = seq; cur.type == RHO_CONS;
+             cur = cur.val.gc->val.p.snd)
+          add (cur.val.gc->val.p.fst);
+        break;
+      
+      case RHO_VEC:
+        {
+          auto& vec = seq.val.gc->val.vec;
+          for (long i = 0; i < vec.len; ++i)
+            add (vec.vals[i]);
+        }
+        break;
+      
+      case RHO_PVEC:
+        seq.val.gc->val.pvec->each (add);
+        break;
+      
+      default:
+        throw vm_error ("join: expected a list or a vector");
+      }
+    
+    return rho_value_make_string (res.c_str (), res.length (), vm.get_gc ());
+  }
+  
+  /* 
+   * find(s, needle[, start]): the index of the first occurrence of :needle:
+   * in :s: at or after :start:, or nil.
+   */
+  rho_value
+  rho_builtin_find (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto g = _get_str_val (args[0], "find");
+    auto gn = _get_str_val (args[1], "find");
+    long len = g->val.s.len;
+    long start = (argc > 2) ? _get_index (args[2], "find") : 0;
+    if (start < 0 || start > len)
+      throw vm_error ("find: invalid start index");
+    
+    long idx = simd_str_find (rho_str_chars (g) + start, len - start,
+                              rho_str_chars (gn), gn->val.s.len);
+    if (idx == -1)
+      return rho_value_make_nil ();
+    return _make_index (start + idx, vm);
+  }
+  
+  /* 
+   * str(x): the printed form of :x:, or :x: itself if it is a string.
+   */
+  rho_value
+  rho_builtin_str (rho_value& x, virtual_machine& vm)
+  {
+    if (x.type == RHO_STR)
+      return x;
+    
+    auto s = rho_value_str (x, vm);
+    return rho_value_make_string (s.c_str (), s.length (), vm.get_gc ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Files:
+  
+  static output_stream&
+  _get_file (rho_value& v, const char *fn)
+  {
+    if (v.type != RHO_FILE)
+      throw vm_error (std::string (fn) + ": expected a file");
+    return *v.val.gc->val.file;
+  }
+  
+  /* 
+   * file_open(path[, mode]): opens a file for writing, either truncating it
+   * ("w", the default) or appending to it ("a").
+   */
+  rho_value
+  rho_builtin_file_open (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto path = _get_str (args[0], "file_open");
+    auto mode = (argc > 1) ? _get_str (args[1], "file_open") : "w";
+    return rho_value_make_file (output_stream::open (path, mode),
+                                vm.get_gc ());
+  }
+  
+  /* 
+   * file_print(f, ...): like print(), but writes to the specified file.
+   */
+  rho_value
+  rho_builtin_file_print (rho_value *args, int argc, virtual_machine& vm)
+  {
+    auto& out = _get_file (args[0], "file_print");
+    _write_values (out, args + 1, argc - 1, " ", nullptr, vm);
+    out.put ('\n');
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * file_write(f, ...): like write(), but writes to the specified file.
+   */
+  rho_value
+  rho_builtin_file_write (rho_value *args, int argc, virtual_machine& vm)
+  {
+    _write_values (_get_file (args[0], "file_write"), args + 1, argc - 1,
+                   nullptr, nullptr, vm);
+    return rho_value_make_nil ();
+  }
+  
+  rho_value
+  rho_builtin_file_close (rho_value& f, virtual_machine& vm)
+  {
+    _get_file (f, "file_close").close ();
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * flush([f]): hands whatever is buffered for standard output (or the given
+   * file) to the OS.
+   */
+  rho_value
+  rho_builtin_flush (rho_value *args, int argc, virtual_machine& vm)
+  {
+    if (argc == 0)
+      vm.get_output ().flush ();
+    else
+      _get_file (args[0], "flush").flush ();
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * set_buffer_size(size[, f]): changes the size of the output buffer of
+   * standard output (or the given file), flushing it first.
+   */
+  rho_value
+  rho_builtin_set_buffer_size (rho_value *args, int argc, virtual_machine& vm)
+  {
+    long size = _get_index (args[0], "set_buffer_size");
+    if (size < 1)
+      throw vm_error ("set_buffer_size: size must be positive");
+    
+    auto& out = (argc > 1) ? _get_file (args[1], "set_buffer_size")
+                           : vm.get_output ();
+    out.set_buffer_size (size);
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * set_print_limits(max_elems[, max_depth]): bounds how much of each
+   * container print() and write() show; zero means no limit.
+   */
+  rho_value
+  rho_builtin_set_print_limits (rho_value *args, int argc, virtual_machine& vm)
+  {
+    long elems = _get_index (args[0], "set_print_limits");
+    long depth = (argc > 1) ? _get_index (args[1], "set_print_limits") : 0;
+    if (elems < 0 || depth < 0)
+      throw vm_error ("set_print_limits: limits must not be negative");
+    
+    auto& lim = vm.get_print_limits ();
+    lim.max_elems = elems;
+    lim.max_depth = (int)depth;
+    return rho_value_make_nil ();
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Serialization:
+  
+  /* 
+   * save(path, v): writes the value to the specified file, in a binary form
+   * that load() reads back (see runtime/serial.hpp).
+   */
+  rho_value
+  rho_builtin_save (rho_value& path, rho_value& v, virtual_machine& vm)
+  {
+    std::unique_ptr<output_stream> out {
+      output_stream::open (_get_str (path, "save"), "w") };
+    rho_value_save (v, *out, vm);
+    out->close ();
+    return rho_value_make_nil ();
+  }
+  
+  /* 
+   * load(path): reads back a value written by save().
+   */
+  rho_value
+  rho_builtin_load (rho_value& path, virtual_machine& vm)
+  {
+    std::unique_ptr<input_stream> in {
+      input_stream::open (_get_str (path, "load")) };
+    return rho_value_load (*in, vm);
+  }
+  
+  /* 
+   * save_image(path, fn): writes an image of the running program, whose
+   * globals are restored and fn called when it is started with --image.
+   */
+  rho_value
+  rho_builtin_save_image (rho_value& path, rho_value& fn, virtual_machine& vm)
+  {
+    rho_image_save (_get_str (path, "save_image"), fn, vm);
+    return rho_value_make_nil ();
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  // Text input:
+  
+  /* 
+   * read_numbers(path, dtype): reads the numbers in a text file into an
+   * f64vec ("f64") or an i64vec ("i64").
+   */
+  rho_value
+  rho_builtin_read_numbers (rho_value& path, rho_value& dtype,
+                            virtual_machine& vm)
+  {
+    std::string fpath = _get_str (path, "read_numbers");
+    std::string type = _get_str (dtype, "read_numbers");
+    if (type == "f64")
+      return rho_read_numbers (fpath, RHO_F64VEC, vm);
+    else if (type == "i64")
+      return rho_read_numbers (fpath, RHO_I64VEC, vm);
+    throw vm_error ("read_numbers: unknown element type `" + type + "'");
+  }
+  
+  /* 
+   * read_csv(path, [sep, [fn]]): reads a file of rows of comma-separated (or
+   * :sep:-separated) fields.  Returns a vector of rows, or, if :fn: is given,
+   * calls it on every row instead and returns the number of rows.
+   */
+  rho_value
+  rho_builtin_read_csv (rho_value *args, int argc, virtual_machine& vm)
+  {
+    std::string path = _get_str (args[0], "read_csv");
+    char sep = ',';
+    if (argc > 1)
+      {
+        std::string s = _get_str (args[1], "read_csv");
+        if (s.length () != 1 || s[0] == '\n')
+          throw vm_error ("read_csv: separator must be a single character");
+        sep = s[0];
+      }
+    
+    rho_value *fn = nullptr;
+    if (argc > 2)
+      {
+        if (args[2].type != RHO_FUN)
+          throw vm_error ("read_csv: expected a function");
+        fn = &args[2];
+      }
+    
+    return rho_read_csv (path, sep, fn, vm);
+  }
+}
@@ -0,0 +1,1069 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/expr.hpp"
+#include "runtime/gc/gc.hpp"
+#include "runtime/vm.hpp"
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <unordered_map>
+
+
+namespace rho {
+  
+  expr_table::expr_table (virtual_machine& vm)
+    : vm (vm)
+    { }
+  
+  expr_table::~expr_table ()
+  {
+    // nodes that outlive the table must not try to unregister themselves.
+    for (auto& p : this->nodes)
+      p.second->val.expr->table = nullptr;
+  }
+  
+  
+  
+  /* 
+   * Returns the unique identifier associated with the specified symbol or
+   * function name.
+   */
+  int
+  expr_table::intern (const std::string& name)
+  {
+    auto itr = this->name_ids.find (name);
+    if (itr != this->name_ids.end ())
+      return itr->second;
+    
+    int id = (int)this->names.size ();
+    this->names.push_back (name);
+    this->name_ids[name] = id;
+    return id;
+  }
+  
+  
+  
+  static inline std::size_t
+  _hash_combine (std::size_t h, std::size_t v)
+    { return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)); }
+  
+  static std::size_t
+  _hash_mpz (mpz_srcptr x)
+  {
+    std::size_t h = (std::size_t)mpz_sgn (x);
+    for (std::size_t i = 0; i < mpz_size (x); ++i)
+      h = _hash_combine (h, (std::size_t)mpz_getlimbn (x, i));
+    return h;
+  }
+  
+  gc_value*
+  expr_table::intern_node (expr_op op, int name, mpz_srcptr num,
+                           const std::vector<gc_value *>& args)
+  {
+    std::size_t h = _hash_combine ((std::size_t)op, (std::size_t)name);
+    if (op == EXPR_NUM)
+      h = _hash_combine (h, _hash_mpz (num));
+    for (auto a : args)
+      h = _hash_combine (h, std::hash<gc_value *> () (a));
+    
+    auto range = this->nodes.equal_range (h);
+    for (auto itr = range.first; itr != range.second; ++itr)
+      {
+        auto n = itr->second->val.expr;
+        if (n->op == op && n->name == name && n->args == args &&
+            (op != EXPR_NUM || mpz_cmp (n->num, num) == 0))
+          return itr->second;
+      }
+    
+    auto g = this->vm.get_gc ().alloc_protected ();
+    gc_unprotect (g);
+    
+    auto n = new expr_node ();
+    n->op = op;
+    n->name = name;
+    if (op == EXPR_NUM)
+      mpz_init_set (n->num, num);
+    n->args = args;
+    n->hash = h;
+    n->npvars = (op == EXPR_PVAR) ? 1 : 0;
+    for (auto a : args)
+      n->npvars += a->val.expr->npvars;
+    n->simplified = nullptr;
+    n->table = this;
+    
+    g->type = RHO_EXPR;
+    g->val.expr = n;
+    
+    this->nodes.emplace (h, g);
+    return g;
+  }
+  
+  /* 
+   * Called by the GC when a node is reclaimed.
+   */
+  void
+  expr_table::remove (gc_value *v)
+  {
+    auto range = this->nodes.equal_range (v->val.expr->hash);
+    for (auto itr = range.first; itr != range.second; ++itr)
+      if (itr->second == v)
+        {
+          this->nodes.erase (itr);
+          return;
+        }
+  }
+  
+  
+  
+  gc_value*
+  expr_table::make_num (mpz_srcptr val)
+  {
+    return this->intern_node (EXPR_NUM, -1, val, {});
+  }
+  
+  gc_value*
+  expr_table::make_num (long val)
+  {
+    mpz_t num;
+    mpz_init_set_si (num, val);
+    auto res = this->make_num (num);
+    mpz_clear (num);
+    return res;
+  }
+  
+  gc_value*
+  expr_table::make_sym (int name)
+  {
+    return this->intern_node (EXPR_SYM, name, nullptr, {});
+  }
+  
+  gc_value*
+  expr_table::make_pvar (int idx)
+  {
+    return this->intern_node (EXPR_PVAR, idx, nullptr, {});
+  }
+  
+  /* 
+   * Sums and products with less than two operands are reduced to their
+   * operand or to the identity element.
+   */
+  gc_value*
+  expr_table::make_op (expr_op op, const std::vector<gc_value *>& args)
+  {
+    if (op == EXPR_ADD || op == EXPR_MUL)
+      {
+        if (args.empty ())
+          return this->make_num ((op == EXPR_ADD) ? 0 : 1);
+        else if (args.size () == 1)
+          return args[0];
+      }
+    
+    return this->intern_node (op, -1, nullptr, args);
+  }
+  
+  gc_value*
+  expr_table::make_fn (int name, const std::vector<gc_value *>& args)
+  {
+    return this->intern_node (EXPR_FN, name, nullptr, args);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// construction
+//------------------------------------------------------------------------------
+  
+  static inline rho_value
+  _value (gc_value *e)
+  {
+    rho_value v;
+    v.type = RHO_EXPR;
+    v.val.gc = e;
+    return v;
+  }
+  
+  /* 
+   * Converts integers (and pattern variables) into expressions.
+   * Expressions are returned as they are.
+   */
+  gc_value*
+  expr_from_value (rho_value& v, virtual_machine& vm)
+  {
+    switch (v.type)
+      {
+      case RHO_EXPR:
+        return v.val.gc;
+      
+      case RHO_INTEGER:
+        return vm.get_exprs ().make_num (v.val.gc->val.i);
+      
+      case RHO_PVAR:
+        return vm.get_exprs ().make_pvar (v.val.i32);
+      
+      default:
+        throw vm_error ("expected an expression or an integer");
+      }
+  }
+  
+  rho_value
+  expr_add (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    return _value (tbl.make_op (EXPR_ADD,
+      { expr_from_value (lhs, vm), expr_from_value (rhs, vm) }));
+  }
+  
+  rho_value
+  expr_sub (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    auto neg = tbl.make_op (EXPR_MUL,
+      { tbl.make_num (-1), expr_from_value (rhs, vm) });
+    return _value (tbl.make_op (EXPR_ADD, { expr_from_value (lhs, vm), neg }));
+  }
+  
+  rho_value
+  expr_mul (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    return _value (tbl.make_op (EXPR_MUL,
+      { expr_from_value (lhs, vm), expr_from_value (rhs, vm) }));
+  }
+  
+  rho_value
+  expr_div (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    auto inv = tbl.make_op (EXPR_POW,
+      { expr_from_value (rhs, vm), tbl.make_num (-1) });
+    return _value (tbl.make_op (EXPR_MUL, { expr_from_value (lhs, vm), inv }));
+  }
+  
+  rho_value
+  expr_pow (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    auto& tbl = vm.get_exprs ();
+    return _value (tbl.make_op (EXPR_POW,
+      { expr_from_value (lhs, vm), expr_from_value (rhs, vm) }));
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// simplification
+//------------------------------------------------------------------------------
+  
+  static inline bool
+  _is_num (gc_value *e)
+    { return e->val.expr->op == EXPR_NUM; }
+  
+  static inline bool
+  _is_num (gc_value *e, long val)
+    { return _is_num (e) && mpz_cmp_si (e->val.expr->num, val) == 0; }
+  
+  static inline mpz_srcptr
+  _num (gc_value *e)
+    { return e->val.expr->num; }
+  
+  
+  static int
+  _rank (expr_op op)
+  {
+    switch (op)
+      {
+      case EXPR_NUM: return 0;
+      case EXPR_SYM: return 1;
+      case EXPR_PVAR: return 2;
+      case EXPR_FN: return 3;
+      case EXPR_POW: return 4;
+      case EXPR_MUL: return 5;
+      case EXPR_ADD: return 6;
+      }
+    return 7;
+  }
+  
+  /* 
+   * The total order used to sort the operands of sums and products.
+   */
+  static int
+  _cmp (gc_value *a, gc_value *b)
+  {
+    if (a == b)
+      return 0;
+    
+    auto x = a->val.expr;
+    auto y = b->val.expr;
+    if (x->op != y->op)
+      return (_rank (x->op) < _rank (y->op)) ? -1 : 1;
+    
+    switch (x->op)
+      {
+      case EXPR_NUM:
+        {
+          int c = mpz_cmp (x->num, y->num);
+          return (c < 0) ? -1 : ((c > 0) ? 1 : 0);
+        }
+      
+      case EXPR_PVAR:
+        return (x->name < y->name) ? -1 : ((x->name > y->name) ? 1 : 0);
+      
+      case EXPR_SYM:
+      case EXPR_FN:
+        if (x->name != y->name)
+          {
+            int c = x->table->get_name (x->name).compare (
+              y->table->get_name (y->name));
+            return (c < 0) ? -1 : 1;
+          }
+        break;
+      
+      default:
+        break;
+      }
+    
+    std::size_t n = std::min (x->args.size (), y->args.size ());
+    for (std::size_t i = 0; i < n; ++i)
+      {
+        int c = _cmp (x->args[i], y->args[i]);
+        if (c != 0)
+          return c;
+      }
+    
+    if (x->args.size () == y->args.size ())
+      return 0;
+    return (x->args.size () < y->args.size ()) ? -1 : 1;
+  }
+  
+  static void
+  _sort (std::vector<gc_value *>& vec)
+  {
+    std::sort (vec.begin (), vec.end (),
+      [] (gc_value *a, gc_value *b) { return _cmp (a, b) < 0; });
+  }
+  
+  
+  /* 
+   * An mpz_t that can be stored in standard containers.
+   */
+  struct _mpz
+  {
+    mpz_t v;
+    
+    _mpz () { mpz_init (this->v); }
+    _mpz (const _mpz& other) { mpz_init_set (this->v, other.v); }
+    ~_mpz () { mpz_clear (this->v); }
+    
+    _mpz& operator= (const _mpz& other)
+      { mpz_set (this->v, other.v); return *this; }
+  };
+  
+  
+  static gc_value* _simplify (gc_value *e, expr_table& tbl);
+  static gc_value* _simplify_add (const std::vector<gc_value *>& args,
+                                  expr_table& tbl);
+  static gc_value* _simplify_mul (const std::vector<gc_value *>& args,
+                                  expr_table& tbl);
+  static gc_value* _simplify_pow (gc_value *b, gc_value *x, expr_table& tbl);
+  
+  
+  /* 
+   * Sums are flattened, numeric terms are added together, and like terms
+   * (terms that differ only by a numeric coefficient) are collected.
+   */
+  static gc_value*
+  _simplify_add (const std::vector<gc_value *>& args, expr_table& tbl)
+  {
+    std::vector<gc_value *> terms;
+    for (auto a : args)
+      {
+        auto s = _simplify (a, tbl);
+        if (s->val.expr->op == EXPR_ADD)
+          terms.insert (terms.end (), s->val.expr->args.begin (),
+                        s->val.expr->args.end ());
+        else
+          terms.push_back (s);
+      }
+    
+    _mpz c;
+    std::vector<gc_value *> keys;
+    std::vector<_mpz> coeffs;
+    std::unordered_map<gc_value *, std::size_t> idx;
+    for (auto t : terms)
+      {
+        if (_is_num (t))
+          {
+            mpz_add (c.v, c.v, _num (t));
+            continue;
+          }
+        
+        // split into coefficient * rest
+        gc_value *rest = t;
+        mpz_srcptr coeff = nullptr;
+        auto& targs = t->val.expr->args;
+        if (t->val.expr->op == EXPR_MUL && _is_num (targs[0]))
+          {
+            coeff = _num (targs[0]);
+            rest = tbl.make_op (EXPR_MUL,
+              std::vector<gc_value *> (targs.begin () + 1, targs.end ()));
+          }
+        
+        auto itr = idx.find (rest);
+        std::size_t i;
+        if (itr == idx.end ())
+          {
+            i = keys.size ();
+            idx[rest] = i;
+            keys.push_back (rest);
+            coeffs.emplace_back ();
+          }
+        else
+          i = itr->second;
+        
+        if (coeff)
+          mpz_add (coeffs[i].v, coeffs[i].v, coeff);
+        else
+          mpz_add_ui (coeffs[i].v, coeffs[i].v, 1);
+      }
+    
+    std::vector<gc_value *> res;
+    for (std::size_t i = 0; i < keys.size (); ++i)
+      {
+        auto k = keys[i];
+        auto& coeff = coeffs[i].v;
+        if (mpz_sgn (coeff) == 0)
+          continue;
+        else if (mpz_cmp_ui (coeff, 1) == 0)
+          res.push_back (k);
+        else
+          {
+            std::vector<gc_value *> fs { tbl.make_num (coeff) };
+            if (k->val.expr->op == EXPR_MUL)
+              fs.insert (fs.end (), k->val.expr->args.begin (),
+                         k->val.expr->args.end ());
+            else
+              fs.push_back (k);
+            res.push_back (tbl.make_op (EXPR_MUL, fs));
+          }
+      }
+    
+    _sort (res);
+    if (mpz_sgn (c.v) != 0)
+      res.insert (res.begin (), tbl.make_num (c.v));
+    return tbl.make_op (EXPR_ADD, res);
+  }
+  
+  /* 
+   * Products are flattened, numeric factors are multiplied together, and
+   * powers of the same base are collected.
+   */
+  static gc_value*
+  _simplify_mul (const std::vector<gc_value *>& args, expr_table& tbl)
+  {
+    std::vector<gc_value *> factors;
+    for (auto a : args)
+      {
+        auto s = _simplify (a, tbl);
+        if (s->val.expr->op == EXPR_MUL)
+          factors.insert (factors.end (), s->val.expr->args.begin (),
+                          s->val.expr->args.end ());
+        else
+          factors.push_back (s);
+      }
+    
+    _mpz c;
+    mpz_set_ui (c.v, 1);
+    std::vector<gc_value *> bases;
+    std::vector<std::vector<gc_value *>> exps;
+    std::unordered_map<gc_value *, std::size_t> idx;
+    for (auto f : factors)
+      {
+        if (_is_num (f))
+          {
+            mpz_mul (c.v, c.v, _num (f));
+            continue;
+          }
+        
+        gc_value *base = f, *exp;
+        if (f->val.expr->op == EXPR_POW)
+          {
+            base = f->val.expr->args[0];
+            exp = f->val.expr->args[1];
+          }
+        else
+          exp = tbl.make_num (1);
+        
+        auto itr = idx.find (base);
+        if (itr == idx.end ())
+          {
+            idx[base] = bases.size ();
+            bases.push_back (base);
+            exps.push_back ({ exp });
+          }
+        else
+          exps[itr->second].push_back (exp);
+      }
+    
+    if (mpz_sgn (c.v) == 0)
+      return tbl.make_num (0L);
+    
+    std::vector<gc_value *> res;
+    for (std::size_t i = 0; i < bases.size (); ++i)
+      {
+        auto base = bases[i];
+        auto exp = (exps[i].size () == 1) ? exps[i][0]
+                                          : _simplify_add (exps[i], tbl);
+        
+        // cancel negative powers of integers against the coefficient
+        if (_is_num (base) && _is_num (exp) && mpz_sgn (_num (exp)) < 0 &&
+            mpz_fits_slong_p (_num (exp)) && mpz_sgn (_num (base)) != 0)
+          {
+            long e = mpz_get_si (_num (exp));
+            while (e < 0 && mpz_divisible_p (c.v, _num (base)))
+              {
+                mpz_divexact (c.v, c.v, _num (base));
+                ++ e;
+              }
+            exp = tbl.make_num (e);
+          }
+        
+        auto p = _simplify_pow (base, exp, tbl);
+        if (_is_num (p))
+          mpz_mul (c.v, c.v, _num (p));
+        else if (p->val.expr->op == EXPR_MUL)
+          {
+            for (auto f : p->val.expr->args)
+              {
+                if (_is_num (f))
+                  mpz_mul (c.v, c.v, _num (f));
+                else
+                  res.push_back (f);
+              }
+          }
+        else
+          res.push_back (p);
+      }
+    
+    if (mpz_sgn (c.v) == 0)
+      return tbl.make_num (0L);
+    
+    _sort (res);
+    if (mpz_cmp_ui (c.v, 1) != 0)
+      res.insert (res.begin (), tbl.make_num (c.v));
+    return tbl.make_op (EXPR_MUL, res);
+  }
+  
+  // powers of integers whose result would be larger than this (in bits) are
+  // left unevaluated.
+#define EXPR_MAX_POW_BITS   (1 << 20)
+  
+  /* 
+   * Folds integer powers, and distributes integer exponents over products
+   * and powers, since (a*b)^n = a^n * b^n and (a^m)^n = a^(m*n) hold for
+   * integer n.
+   */
+  static gc_value*
+  _simplify_pow (gc_value *b, gc_value *x, expr_table& tbl)
+  {
+    if (_is_num (x))
+      {
+        if (mpz_sgn (_num (x)) == 0)
+          return tbl.make_num (1);
+        else if (_is_num (x, 1))
+          return b;
+        
+        auto bn = b->val.expr;
+        switch (bn->op)
+          {
+          case EXPR_NUM:
+            if (_is_num (b, 0) || _is_num (b, 1))
+              {
+                if (mpz_sgn (_num (x)) > 0 || _is_num (b, 1))
+                  return b;
+              }
+            else if (_is_num (b, -1))
+              return tbl.make_num (mpz_odd_p (_num (x)) ? -1 : 1);
+            else if (mpz_sgn (_num (x)) > 0 && mpz_fits_ulong_p (_num (x)) &&
+                     mpz_sizeinbase (_num (b), 2) * mpz_get_ui (_num (x))
+                       <= EXPR_MAX_POW_BITS)
+              {
+                _mpz r;
+                mpz_pow_ui (r.v, _num (b), mpz_get_ui (_num (x)));
+                return tbl.make_num (r.v);
+              }
+            break;
+          
+          case EXPR_POW:
+            return _simplify_pow (bn->args[0],
+              _simplify_mul ({ bn->args[1], x }, tbl), tbl);
+          
+          case EXPR_MUL:
+            {
+              std::vector<gc_value *> fs;
+              for (auto f : bn->args)
+                fs.push_back (_simplify_pow (f, x, tbl));
+              return _simplify_mul (fs, tbl);
+            }
+          
+          default:
+            break;
+          }
+      }
+    else if (_is_num (b, 1))
+      return b;
+    
+    return tbl.make_op (EXPR_POW, { b, x });
+  }
+  
+  static gc_value*
+  _simplify_fn (int name, const std::vector<gc_value *>& args,
+                expr_table& tbl)
+  {
+    if (args.size () == 1)
+      {
+        auto& fn = tbl.get_name (name);
+        auto u = args[0];
+        
+        if (_is_num (u, 0))
+          {
+            if (fn == "sin" || fn == "tan" || fn == "sqrt")
+              return u;
+            else if (fn == "cos" || fn == "exp")
+              return tbl.make_num (1);
+          }
+        else if (_is_num (u, 1))
+          {
+            if (fn == "log")
+              return tbl.make_num (0L);
+            else if (fn == "sqrt")
+              return u;
+          }
+        else if (u->val.expr->op == EXPR_FN)
+          {
+            // exp(log(u)) = u, log(exp(u)) = u
+            auto& inner = tbl.get_name (u->val.expr->name);
+            if ((fn == "exp" && inner == "log") ||
+                (fn == "log" && inner == "exp"))
+              return u->val.expr->args[0];
+          }
+      }
+    
+    return tbl.make_fn (name, args);
+  }
+  
+  static gc_value*
+  _simplify (gc_value *e, expr_table& tbl)
+  {
+    auto n = e->val.expr;
+    if (n->simplified)
+      return n->simplified;
+    
+    gc_value *res = e;
+    switch (n->op)
+      {
+      case EXPR_NUM:
+      case EXPR_SYM:
+      case EXPR_PVAR:
+        break;
+      
+      case EXPR_ADD:
+        res = _simplify_add (n->args, tbl);
+        break;
+      
+      case EXPR_MUL:
+        res = _simplify_mul (n->args, tbl);
+        break;
+      
+      case EXPR_POW:
+        res = _simplify_pow (_simplify (n->args[0], tbl),
+                             _simplify (n->args[1], tbl), tbl);
+        break;
+      
+      case EXPR_FN:
+        {
+          std::vector<gc_value *> args;
+          for (auto a : n->args)
+            args.push_back (_simplify (a, tbl));
+          res = _simplify_fn (n->name, args, tbl);
+        }
+        break;
+      }
+    
+    n->simplified = res;
+    res->val.expr->simplified = res;
+    return res;
+  }
+  
+  /* 
+   * Brings the expression into canonical form: sums and products are
+   * flattened and sorted, like terms and powers are collected, and constants
+   * are folded.  Results are memoized on the node.
+   */
+  gc_value*
+  expr_simplify (gc_value *e, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    return _simplify (e, vm.get_exprs ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// differentiation
+//------------------------------------------------------------------------------
+  
+  static gc_value*
+  _diff (gc_value *e, int var, expr_table& tbl)
+  {
+    auto n = e->val.expr;
+    for (auto& d : n->derivs)
+      if (d.first == var)
+        return d.second;
+    
+    gc_value *res = nullptr;
+    switch (n->op)
+      {
+      case EXPR_NUM:
+        res = tbl.make_num (0L);
+        break;
+      
+      case EXPR_SYM:
+        res = tbl.make_num ((n->name == var) ? 1 : 0);
+        break;
+      
+      case EXPR_PVAR:
+        throw vm_error ("expr_diff: cannot differentiate a pattern");
+      
+      case EXPR_ADD:
+        {
+          std::vector<gc_value *> terms;
+          for (auto a : n->args)
+            terms.push_back (_diff (a, var, tbl));
+          res = tbl.make_op (EXPR_ADD, terms);
+        }
+        break;
+      
+      case EXPR_MUL:
+        {
+          // product rule
+          std::vector<gc_value *> terms;
+          for (std::size_t i = 0; i < n->args.size (); ++i)
+            {
+              auto d = _diff (n->args[i], var, tbl);
+              if (_is_num (d, 0))
+                continue;
+              
+              auto fs = n->args;
+              fs[i] = d;
+              terms.push_back (tbl.make_op (EXPR_MUL, fs));
+            }
+          res = tbl.make_op (EXPR_ADD, terms);
+        }
+        break;
+      
+      case EXPR_POW:
+        {
+          auto b = n->args[0], x = n->args[1];
+          auto db = _diff (b, var, tbl);
+          auto dx = _diff (x, var, tbl);
+          if (_is_num (dx, 0))
+            {
+              // d(b^x) = x * b^(x - 1) * db
+              auto xm1 = tbl.make_op (EXPR_ADD, { x, tbl.make_num (-1) });
+              res = tbl.make_op (EXPR_MUL,
+                { x, tbl.make_op (EXPR_POW, { b, xm1 }), db });
+            }
+          else
+            {
+              // d(b^x) = b^x * (dx * log(b) + x * db / b)
+              auto log_b = tbl.make_fn (tbl.intern ("log"), { b });
+              auto inv_b = tbl.make_op (EXPR_POW, { b, tbl.make_num (-1) });
+              auto t = tbl.make_op (EXPR_ADD, {
+                tbl.make_op (EXPR_MUL, { dx, log_b }),
+                tbl.make_op (EXPR_MUL, { x, db, inv_b }) });
+              res = tbl.make_op (EXPR_MUL, { e, t });
+            }
+        }
+        break;
+      
+      case EXPR_FN:
+        {
+          auto& fn = tbl.get_name (n->name);
+          if (n->args.size () != 1)
+            throw vm_error ("expr_diff: don't know how to differentiate `"
+              + fn + "'");
+          
+          auto u = n->args[0];
+          auto du = _diff (u, var, tbl);
+          
+          gc_value *d;
+          if (fn == "sin")
+            d = tbl.make_fn (tbl.intern ("cos"), { u });
+          else if (fn == "cos")
+            d = tbl.make_op (EXPR_MUL,
+              { tbl.make_num (-1), tbl.make_fn (tbl.intern ("sin"), { u }) });
+          else if (fn == "tan")
+            d = tbl.make_op (EXPR_ADD,
+              { tbl.make_num (1), tbl.make_op (EXPR_POW, { e, tbl.make_num (2) }) });
+          else if (fn == "exp")
+            d = e;
+          else if (fn == "log")
+            d = tbl.make_op (EXPR_POW, { u, tbl.make_num (-1) });
+          else if (fn == "sqrt")
+            d = tbl.make_op (EXPR_POW,
+              { tbl.make_op (EXPR_MUL, { tbl.make_num (2), e }), tbl.make_num (-1) });
+          else
+            throw vm_error ("expr_diff: don't know how to differentiate `"
+              + fn + "'");
+          
+          res = tbl.make_op (EXPR_MUL, { d, du });
+        }
+        break;
+      }
+    
+    res = _simplify (res, tbl);
+    n->derivs.emplace_back (var, res);
+    return res;
+  }
+  
+  /* 
+   * Differentiates the expression with respect to the symbol whose name
+   * identifier is :var:.  The result is simplified and memoized on the node.
+   */
+  gc_value*
+  expr_diff (gc_value *e, int var, virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    return _diff (e, var, vm.get_exprs ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// pattern matching
+//------------------------------------------------------------------------------
+  
+  static bool
+  _match (gc_value *pat, gc_value *val, rho_value *stack, expr_table& tbl)
+  {
+    auto p = pat->val.expr;
+    if (p->npvars == 0)
+      return pat == val;
+    else if (p->op == EXPR_PVAR)
+      {
+        stack[p->name] = _value (val);
+        return true;
+      }
+    
+    auto v = val->val.expr;
+    if (p->op != v->op || p->name != v->name)
+      return false;
+    
+    auto& pa = p->args;
+    auto& va = v->args;
+    if (pa.size () == va.size ())
+      {
+        for (std::size_t i = 0; i < pa.size (); ++i)
+          if (!_match (pa[i], va[i], stack, tbl))
+            return false;
+        return true;
+      }
+    else if ((p->op == EXPR_ADD || p->op == EXPR_MUL) &&
+             !pa.empty () && pa.size () < va.size ())
+      {
+        // the last operand of the pattern matches the rest of the terms
+        std::size_t k = pa.size () - 1;
+        for (std::size_t i = 0; i < k; ++i)
+          if (!_match (pa[i], va[i], stack, tbl))
+            return false;
+        
+        auto rest = tbl.make_op (p->op,
+          std::vector<gc_value *> (va.begin () + k, va.end ()));
+        return _match (pa[k], rest, stack, tbl);
+      }
+    
+    return false;
+  }
+  
+  /* 
+   * Matches an expression against a pattern expression, binding pattern
+   * variables into :stack:.  A sum or product pattern with fewer terms than
+   * the value matches its last term against the remaining terms.
+   */
+  bool
+  expr_match (gc_value *pat, gc_value *val, rho_value *stack,
+              virtual_machine& vm)
+  {
+    gc_disable_guard guard (vm.get_gc ());
+    return _match (pat, val, stack, vm.get_exprs ());
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// printing
+//------------------------------------------------------------------------------
+  
+  static bool
+  _is_negative (gc_value *e)
+  {
+    return _is_num (e) && mpz_sgn (_num (e)) < 0;
+  }
+  
+  static void _print (std::ostringstream& ss, gc_value *e);
+  
+  static void
+  _print_mpz (std::ostringstream& ss, mpz_srcptr x)
+  {
+    char *str = mpz_get_str (NULL, 10, x);
+    ss << str;
+    
+    void (*freefunc) (void *, size_t);
+    mp_get_memory_functions (NULL, NULL, &freefunc);
+    freefunc (str, std::char_traits<char>::length (str) + 1);
+  }
+  
+  static void
+  _print_operand (std::ostringstream& ss, gc_value *e, bool paren)
+  {
+    if (paren)
+      ss << "(";
+    _print (ss, e);
+    if (paren)
+      ss << ")";
+  }
+  
+  /* 
+   * Prints the product of the specified factors, starting at :from:.
+   */
+  static void
+  _print_product (std::ostringstream& ss, const std::vector<gc_value *>& fs,
+                  std::size_t from)
+  {
+    for (std::size_t i = from; i < fs.size (); ++i)
+      {
+        if (i != from)
+          ss << "*";
+        auto op = fs[i]->val.expr->op;
+        _print_operand (ss, fs[i], op == EXPR_ADD ||
+          (i != from && _is_negative (fs[i])));
+      }
+  }
+  
+  static void
+  _print (std::ostringstream& ss, gc_value *e)
+  {
+    auto n = e->val.expr;
+    switch (n->op)
+      {
+      case EXPR_NUM:
+        _print_mpz (ss, n->num);
+        break;
+      
+      case EXPR_SYM:
+        ss << (n->table ? n->table->get_name (n->name) : "?");
+        break;
+      
+      case EXPR_PVAR:
+        ss << "?" << n->name;
+        break;
+      
+      case EXPR_FN:
+        ss << (n->table ? n->table->get_name (n->name) : "?") << "(";
+        for (std::size_t i = 0; i < n->args.size (); ++i)
+          {
+            if (i != 0)
+              ss << ", ";
+            _print (ss, n->args[i]);
+          }
+        ss << ")";
+        break;
+      
+      case EXPR_ADD:
+        for (std::size_t i = 0; i < n->args.size (); ++i)
+          {
+            auto t = n->args[i];
+            auto tn = t->val.expr;
+            
+            // print terms with a negative coefficient as subtractions
+            if (i != 0 && tn->op == EXPR_MUL && _is_negative (tn->args[0]))
+              {
+                ss << " - ";
+                if (!_is_num (tn->args[0], -1))
+                  {
+                    _mpz c;
+                    mpz_neg (c.v, _num (tn->args[0]));
+                    _print_mpz (ss, c.v);
+                    ss << "*";
+                  }
+                _print_product (ss, tn->args, 1);
+              }
+            else if (i != 0 && _is_negative (t))
+              {
+                _mpz c;
+                mpz_neg (c.v, _num (t));
+                ss << " - ";
+                _print_mpz (ss, c.v);
+              }
+            else
+              {
+                if (i != 0)
+                  ss << " + ";
+                _print (ss, t);
+              }
+          }
+        break;
+      
+      case EXPR_MUL:
+        if (_is_num (n->args[0], -1))
+          {
+            ss << "-";
+            _print_product (ss, n->args, 1);
+          }
+        else
+          _print_product (ss, n->args, 0);
+        break;
+      
+      case EXPR_POW:
+        {
+          auto b = n->args[0], x = n->args[1];
+          auto bop = b->val.expr->op, xop = x->val.expr->op;
+          _print_operand (ss, b, bop == EXPR_ADD || bop == EXPR_MUL ||
+                                 bop == EXPR_POW || _is_negative (b));
+          ss << "^";
+          _print_operand (ss, x, xop == EXPR_ADD || xop == EXPR_MUL ||
+                                 xop == EXPR_POW || _is_negative (x));
+        }
+        break;
+      }
+  }
+  
+  std::string
+  expr_to_str (gc_value *e)
+  {
+    std::ostringstream ss;
+    _print (ss, e);
+    return ss.str ();
+  }
+}
+
@@ -18,9 +18,12 @@
 
 #include "runtime/gc/basic/gc.hpp"
 #include "runtime/vm.hpp"
+#include "runtime/expr.hpp"
+#include "runtime/map.hpp"
+#include "runtime/memo.hpp"
+#include "runtime/pvec.hpp"
 #include <stdexcept>
-
-#include <iostream> // DEBUG
+#include <algorithm>
 
 
 namespace rho {
@@ -34,6 +37,9 @@ namespace rho {
     this->gray = nullptr;
     this->t_alloc = 0;
     this->t_free = 0;
+    this->t_collect = 0;
+    this->n_objs = 0;
+    this->next_collect = ALLOCS_PER_COLLECTION;
   }
   
   basic_gc::~basic_gc ()
@@ -46,10 +52,12 @@ namespace rho {
   gc_value*
   basic_gc::alloc_protected ()
   {
-    if (this->t_alloc++ % ALLOCS_PER_COLLECTION == 0)
+    ++ this->t_alloc;
+    if (-- this->next_collect <= 0 && this->is_enabled ())
       this->collect ();
     
     gc_object *obj = new gc_object;
+    ++ this->n_objs;
     gc_value *val = &obj->val;
     val->gc_state = GC_WHITE;
     
@@ -67,14 +75,15 @@ namespace rho {
     auto val = this->alloc_protected ();
     val->type = RHO_UPVAL;
     val->val.uv.val.type = RHO_NIL;
+    val->val.uv.co = nullptr;
     
     this->upvals.push_back (val);
     
     return val;
   }
   
-  const std::list<gc_value*>&
-  basic_gc::get_upvalues () const
+  std::list<gc_value*>&
+  basic_gc::get_upvalues ()
   {
     return this->upvals;
   }
@@ -103,6 +112,15 @@ namespace rho {
     this->gray = ref;
   }
   
+  void
+  basic_gc::paint_gray (gc_value *v)
+  {
+    rho_value r;
+    r.type = v->type;
+    r.val.gc = v;
+    this->paint_gray (r);
+  }
+  
   /* 
    * Pops one value from the gray set.
    */
@@ -138,8 +156,36 @@ namespace rho {
       case RHO_PVAR:
       case RHO_INTERNAL:
       case RHO_ATOM:
-      case RHO_STR:
       case RHO_FLOAT:
+      case RHO_DOUBLE:
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+      case RHO_MATRIX:
+      case RHO_POLY:
+      case RHO_FILE:
+        break;
+      
+      case RHO_STR:
+        // the two halves of a rope that has not been flattened yet.
+        if (!v->val.s.str)
+          {
+            this->paint_gray (v->val.s.left);
+            this->paint_gray (v->val.s.right);
+          }
+        break;
+      
+      case RHO_EXPR:
+        {
+          // the hash-consing table is weak, but the operands and memoized
+          // results of a live node are not.
+          auto n = v->val.expr;
+          for (auto a : n->args)
+            this->paint_gray (a);
+          if (n->simplified)
+            this->paint_gray (n->simplified);
+          for (auto& d : n->derivs)
+            this->paint_gray (d.second);
+        }
         break;
       
       case RHO_VEC:
@@ -147,11 +193,22 @@ namespace rho {
           this->paint_gray (v->val.vec.vals[i]);
         break;
       
+      case RHO_RECORD:
+        for (int i = 0; i < v->val.rec.len; ++i)
+          this->paint_gray (v->val.rec.vals[i]);
+        break;
+      
+      case RHO_PVEC:
+        // nodes shared between versions of a vector are traced only once.
+        v->val.pvec->trace ((unsigned)this->t_collect + 1,
+          [this] (rho_value& x) { this->paint_gray (x); });
+        break;
+      
       case RHO_UPVAL:
         if (v->val.uv.sp == -1)
           this->paint_gray (v->val.uv.val);
         else
-          this->paint_gray (this->vm.get_stack_at (v->val.uv.sp));
+          this->paint_gray (this->vm.get_upvalue_slot (v));
         break;
       
       case RHO_FUN:
@@ -159,6 +216,19 @@ namespace rho {
           auto env = v->val.fn;
           for (int i = 0; i < env.env_len; ++i)
             this->paint_gray (env.env[i]);
+          
+          if (env.memo)
+            {
+              // weak caches give up half of their entries on every
+              // collection.
+              if (env.memo->is_weak ())
+                env.memo->trim (env.memo->size () / 2);
+              for (auto& e : *env.memo)
+                {
+                  this->paint_gray (e.key);
+                  this->paint_gray (e.val);
+                }
+            }
         }
         break;
       
@@ -166,6 +236,36 @@ namespace rho {
         this->paint_gray (v->val.p.fst);
         this->paint_gray (v->val.p.snd);
         break;
+      
+      case RHO_PROMISE:
+        this->paint_gray (v->val.pr.val);
+        break;
+      
+      case RHO_MAP:
+        {
+          auto& m = *v->val.map;
+          for (long i = 0; i < m.capacity (); ++i)
+            {
+              auto& s = m.slot (i);
+              if (rho_map::is_live (s))
+                {
+                  this->paint_gray (s.key);
+                  this->paint_gray (s.val);
+                }
+            }
+        }
+        break;
+      
+      case RHO_COROUTINE:
+        {
+          // the stacks of running coroutines are part of the root set
+          auto& co = *v->val.co;
+          this->paint_gray (co.fn);
+          if (co.state == CO_FRESH || co.state == CO_SUSPENDED)
+            for (int i = 0; i < co.sp; ++i)
+              this->paint_gray (co.stack[i]);
+        }
+        break;
       }
   }
   
@@ -190,7 +290,6 @@ namespace rho {
     
     // place all references in the root set into the gray set.
     auto stk = this->vm.get_stack (true);
-    //std::cout << "GC collect: sp=" << stk.get_sp () << std::endl;
     for (rho_value v : stk)
       this->paint_gray (v);
     for (auto& gp : this->vm.get_globals ())
@@ -198,6 +297,21 @@ namespace rho {
         for (int i = 0; i < gp.size; ++i)
           this->paint_gray (gp.vals[i]);
       }
+    for (int i = 0; i <= VM_SMALL_INT_MAX; ++i)
+      {
+        auto v = this->vm.get_prealloced_int (i);
+        this->paint_gray (v);
+      }
+    
+    // the running coroutine, and the stacks of the coroutines (or the main
+    // stack) waiting for it to yield.
+    for (auto co = this->vm.get_current_coroutine (); co; co = co->val.co->caller)
+      {
+        this->paint_gray (co);
+        auto& c = *co->val.co;
+        for (int i = 0; i < c.caller_sp; ++i)
+          this->paint_gray (c.caller_stack[i]);
+      }
     
     while (this->gray)
       {
@@ -211,12 +325,21 @@ namespace rho {
         this->mark_children (v);
       }
     
-    // remove white upvalues
+    // remove white upvalues, and close upvalues that point into the stacks
+    // of coroutines that are about to be reclaimed.
     for (auto itr = this->upvals.begin (); itr != this->upvals.end (); )
       {
         auto uv = *itr;
+        auto co = uv->val.uv.co;
         if (uv->gc_state == GC_WHITE && !uv->gc_protected)
           itr = this->upvals.erase (itr);
+        else if (co && co->gc_state == GC_WHITE && !co->gc_protected)
+          {
+            uv->val.uv.val = this->vm.get_upvalue_slot (uv);
+            uv->val.uv.sp = -1;
+            uv->val.uv.co = nullptr;
+            itr = this->upvals.erase (itr);
+          }
         else
           ++ itr;
       }
@@ -237,6 +360,7 @@ namespace rho {
             destroy_gc_value (&obj->val);
             delete obj;
             ++ t_free;
+            -- this->n_objs;
             
             if (this->head == obj)
               this->head = next;
@@ -249,6 +373,23 @@ namespace rho {
             obj = next;
           }
       }
+    
+    // the cost of a collection is proportional to the size of the heap, so
+    // wait for the heap to double in size before collecting again.
+    this->next_collect = std::max ((long)ALLOCS_PER_COLLECTION, this->n_objs);
+    ++ this->t_collect;
+  }
+  
+  
+  
+  gc_stats
+  basic_gc::get_stats () const
+  {
+    gc_stats stats;
+    stats.allocs = this->t_alloc;
+    stats.frees = this->t_free;
+    stats.collections = this->t_collect;
+    return stats;
   }
 }
 
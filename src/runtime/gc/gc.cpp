@@ -30,7 +30,7 @@ namespace rho {
   garbage_collector::garbage_collector (virtual_machine& vm)
     : vm (vm)
   {
-    
+    this->disable_count = 0;
   }
   
   
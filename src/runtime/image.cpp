@@ -0,0 +1,294 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/image.hpp"
+#include "runtime/serial.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/gc/gc.hpp"
+#include "runtime/io.hpp"
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace rho {
+  
+#define IMAGE_MAGIC         "RHOI"
+#define IMAGE_VERSION       1
+#define IMAGE_HEADER_SIZE   32
+  
+  /* 
+   * Layout of an image file:
+   * 
+   *   header: magic, u32 version, u64 code size, u64 offset of the state,
+   *           and 8 reserved bytes
+   *   code:   the program's bytecode, right after the header
+   *   state:  (aligned to 8 bytes) the atom table (u32 count, then a u32
+   *           length and the name of every atom), followed by a serialized
+   *           vector that holds the entry function and every globals page
+   *           (nil for pages that were never allocated).
+   * 
+   * Numbers are stored least significant byte first.
+   */
+  
+  static void
+  _put_uint (output_stream& out, uint64_t v, int n)
+  {
+    for (int i = 0; i < n; ++i)
+      out.put ((char)((v >> (i * 8)) & 0xFF));
+  }
+  
+  static uint64_t
+  _get_uint (const unsigned char *p, int n)
+  {
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; --i)
+      v = (v << 8) | p[i];
+    return v;
+  }
+  
+  static uint64_t
+  _read_uint (input_stream& in, int n)
+  {
+    unsigned char buf[8];
+    in.read ((char *)buf, n);
+    return _get_uint (buf, n);
+  }
+  
+  
+  
+  void
+  rho_image_save (const std::string& path, rho_value& entry,
+                  virtual_machine& vm)
+  {
+    if (entry.type != RHO_FUN)
+      throw vm_error ("save_image: expected a function");
+    
+    serial_code code { vm.get_code (), vm.get_code_size (), nullptr };
+    if (!code.base)
+      throw vm_error ("save_image: no program is running");
+    
+    // gather the entry function and the globals into one vector, so that
+    // anything they share is only written once.  The page vectors stay
+    // protected until the end, since the collector does not look inside
+    // protected objects.
+    auto& gc = vm.get_gc ();
+    auto& pages = vm.get_globals ();
+    rho_value root = rho_value_make_vec ((long)pages.size () + 1, gc);
+    auto& rv = root.val.gc->val.vec;
+    rv.vals[rv.len ++] = entry;
+    for (auto& gp : pages)
+      {
+        if (!gp.vals)
+          {
+            rv.vals[rv.len ++] = rho_value_make_nil ();
+            continue;
+          }
+        
+        rho_value page = rho_value_make_vec (gp.size, gc);
+        auto& pv = page.val.gc->val.vec;
+        for (int i = 0; i < gp.size; ++i)
+          pv.vals[pv.len ++] = gp.vals[i];
+        rv.vals[rv.len ++] = page;
+      }
+    
+    auto release = [&root] () {
+      auto& rv = root.val.gc->val.vec;
+      for (long i = 1; i < rv.len; ++i)
+        gc_unprotect (rv.vals[i]);
+      gc_unprotect (root);
+    };
+    
+    try
+      {
+        std::unique_ptr<output_stream> out {
+          output_stream::open (path, "w") };
+        
+        long state_off = (IMAGE_HEADER_SIZE + code.size + 7) & ~7L;
+        out->write (IMAGE_MAGIC, 4);
+        _put_uint (*out, IMAGE_VERSION, 4);
+        _put_uint (*out, code.size, 8);
+        _put_uint (*out, state_off, 8);
+        _put_uint (*out, 0, 8);
+        
+        out->write ((const char *)code.base, code.size);
+        for (long i = IMAGE_HEADER_SIZE + code.size; i < state_off; ++i)
+          out->put (0);
+        
+        auto& atoms = vm.get_atoms ();
+        _put_uint (*out, atoms.size (), 4);
+        for (auto& name : atoms)
+          {
+            _put_uint (*out, name.length (), 4);
+            out->write (name);
+          }
+        
+        rho_value_save (root, *out, vm, &code);
+        out->close ();
+      }
+    catch (...)
+      {
+        release ();
+        throw;
+      }
+    
+    release ();
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  rho_image::rho_image (const std::string& path)
+    : path (path)
+  {
+    int fd = ::open (path.c_str (), O_RDONLY);
+    if (fd == -1)
+      throw vm_error ("cannot open image `" + path + "': "
+        + std::strerror (errno));
+    
+    struct stat st;
+    if (fstat (fd, &st) == -1)
+      {
+        int err = errno;
+        ::close (fd);
+        throw vm_error ("cannot open image `" + path + "': "
+          + std::strerror (err));
+      }
+    
+    this->size = (long)st.st_size;
+    if (this->size < IMAGE_HEADER_SIZE)
+      {
+        ::close (fd);
+        throw vm_error ("`" + path + "' is not an image");
+      }
+    
+    void *p = mmap (nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close (fd);
+    if (p == MAP_FAILED)
+      throw vm_error ("cannot map image `" + path + "': "
+        + std::strerror (err));
+    this->data = (unsigned char *)p;
+    
+    uint64_t version = _get_uint (this->data + 4, 4);
+    uint64_t code_size = _get_uint (this->data + 8, 8);
+    uint64_t state_off = _get_uint (this->data + 16, 8);
+    if (std::memcmp (this->data, IMAGE_MAGIC, 4) != 0
+        || version != IMAGE_VERSION
+        || code_size > (uint64_t)this->size
+        || state_off < IMAGE_HEADER_SIZE + code_size
+        || state_off > (uint64_t)this->size)
+      {
+        munmap (this->data, this->size);
+        throw vm_error ("`" + path + "' is not an image");
+      }
+    
+    this->code = this->data + IMAGE_HEADER_SIZE;
+    this->code_size = (long)code_size;
+    this->state_off = (long)state_off;
+    
+    try
+      {
+        this->info = verify_code (this->code, this->code_size);
+      }
+    catch (const vm_error& ex)
+      {
+        munmap (this->data, this->size);
+        throw vm_error ("`" + path + "': " + ex.what ());
+      }
+  }
+  
+  rho_image::~rho_image ()
+  {
+    munmap (this->data, this->size);
+  }
+  
+  
+  
+  rho_value
+  rho_image::load (virtual_machine& vm)
+  {
+    if (!vm.get_globals ().empty ())
+      throw vm_error ("images can only be loaded into a fresh virtual machine");
+    
+    long state_len = this->size - this->state_off;
+    input_stream in ((const char *)this->data + this->state_off, state_len,
+                     this->path);
+    
+    std::vector<std::string> atoms;
+    long count = (long)_read_uint (in, 4);
+    for (long i = 0; i < count; ++i)
+      {
+        long len = (long)_read_uint (in, 4);
+        if (len > state_len)
+          throw vm_error ("load: corrupt image `" + this->path + "'");
+        
+        std::string name (len, '\0');
+        in.read (&name[0], len);
+        atoms.push_back (std::move (name));
+      }
+    vm.get_atoms () = std::move (atoms);
+    
+    serial_code code { this->code, this->code_size, &this->info.funs };
+    rho_value root = rho_value_load (in, vm, &code);
+    
+    // validate everything before installing the globals, so that a corrupt
+    // image leaves the machine as it was.
+    bool valid = (root.type == RHO_VEC && root.val.gc->val.vec.len >= 1
+      && root.val.gc->val.vec.vals[0].type == RHO_FUN);
+    for (long i = 1; valid && i < root.val.gc->val.vec.len; ++i)
+      {
+        auto t = root.val.gc->val.vec.vals[i].type;
+        valid = (t == RHO_NIL || t == RHO_VEC);
+      }
+    if (!valid)
+      {
+        gc_unprotect (root);
+        throw vm_error ("load: corrupt image `" + this->path + "'");
+      }
+    
+    auto& rv = root.val.gc->val.vec;
+    auto& pages = vm.get_globals ();
+    for (long i = 1; i < rv.len; ++i)
+      {
+        glob_page page { nullptr, 0 };
+        if (rv.vals[i].type == RHO_VEC)
+          {
+            auto& pv = rv.vals[i].val.gc->val.vec;
+            page.vals = new rho_value[pv.len];
+            page.size = (int)pv.len;
+            for (long j = 0; j < pv.len; ++j)
+              page.vals[j] = pv.vals[j];
+          }
+        pages.push_back (page);
+      }
+    
+    rho_value entry = rv.vals[0];
+    gc_protect (entry);
+    gc_unprotect (root);
+    return entry;
+  }
+}
+
@@ -0,0 +1,310 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/io.hpp"
+#include "runtime/value.hpp"
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace rho {
+  
+  output_stream::output_stream (int fd, bool owns_fd, const std::string& path,
+                                long cap)
+    : path (path)
+  {
+    this->fd = fd;
+    this->owns_fd = owns_fd;
+    this->cap = (cap < 1) ? 1 : cap;
+    this->buf = new char [this->cap];
+    this->len = 0;
+    this->line_buffered = isatty (fd);
+  }
+  
+  output_stream::~output_stream ()
+  {
+    // errors can't be reported from here.
+    try
+      {
+        this->close ();
+      }
+    catch (const vm_error&)
+      { }
+    
+    delete[] this->buf;
+  }
+  
+  
+  
+  output_stream*
+  output_stream::open (const std::string& path, const std::string& mode)
+  {
+    int flags = O_WRONLY | O_CREAT;
+    if (mode == "w")
+      flags |= O_TRUNC;
+    else if (mode == "a")
+      flags |= O_APPEND;
+    else
+      throw vm_error ("invalid file mode `" + mode + "'");
+    
+    int fd = ::open (path.c_str (), flags, 0644);
+    if (fd == -1)
+      throw vm_error ("cannot open `" + path + "' for writing: "
+        + std::strerror (errno));
+    
+    return new output_stream (fd, true, path);
+  }
+  
+  
+  
+  void
+  output_stream::write_fully (const char *data, long n)
+  {
+    if (this->fd == -1)
+      throw vm_error ("writing to a closed file");
+    
+    while (n > 0)
+      {
+        auto r = ::write (this->fd, data, n);
+        if (r == -1)
+          {
+            if (errno == EINTR)
+              continue;
+            throw vm_error ("cannot write to `" + this->path + "': "
+              + std::strerror (errno));
+          }
+        
+        data += r;
+        n -= r;
+      }
+  }
+  
+  void
+  output_stream::flush_buffer ()
+  {
+    // the buffer is emptied even if the write fails, so that a stream that
+    // has gone bad does not report the same error forever.
+    long n = this->len;
+    this->len = 0;
+    this->write_fully (this->buf, n);
+  }
+  
+  void
+  output_stream::write (const char *data, long n)
+  {
+    if (this->len + n > this->cap)
+      {
+        this->flush_buffer ();
+        
+        // too big to be worth copying into the buffer.
+        if (n >= this->cap)
+          {
+            this->write_fully (data, n);
+            return;
+          }
+      }
+    
+    std::memcpy (this->buf + this->len, data, n);
+    this->len += n;
+    
+    if (this->line_buffered && std::memchr (data, '\n', n))
+      this->flush ();
+  }
+  
+  void
+  output_stream::flush ()
+  {
+    if (this->len > 0)
+      this->flush_buffer ();
+  }
+  
+  void
+  output_stream::close ()
+  {
+    if (this->fd == -1)
+      return;
+    
+    try
+      {
+        this->flush ();
+      }
+    catch (const vm_error&)
+      {
+        if (this->owns_fd)
+          ::close (this->fd);
+        this->fd = -1;
+        throw;
+      }
+    
+    if (this->owns_fd)
+      ::close (this->fd);
+    this->fd = -1;
+  }
+  
+  void
+  output_stream::set_buffer_size (long cap)
+  {
+    this->flush ();
+    if (cap < 1)
+      cap = 1;
+    
+    delete[] this->buf;
+    this->buf = new char [cap];
+    this->cap = cap;
+  }
+  
+  
+  
+  input_stream::input_stream (int fd, const std::string& path, long cap)
+    : path (path)
+  {
+    this->fd = fd;
+    this->cap = (cap < 1) ? 1 : cap;
+    this->buf = new char [this->cap];
+    this->pos = 0;
+    this->len = 0;
+  }
+  
+  input_stream::input_stream (const char *data, long len,
+                              const std::string& path)
+    : path (path)
+  {
+    this->fd = -1;
+    this->buf = const_cast<char *> (data);
+    this->cap = len;
+    this->pos = 0;
+    this->len = len;
+  }
+  
+  input_stream::~input_stream ()
+  {
+    if (this->fd != -1)
+      {
+        ::close (this->fd);
+        delete[] this->buf;
+      }
+  }
+  
+  
+  
+  input_stream*
+  input_stream::open (const std::string& path)
+  {
+    int fd = ::open (path.c_str (), O_RDONLY);
+    if (fd == -1)
+      throw vm_error ("cannot open `" + path + "' for reading: "
+        + std::strerror (errno));
+    
+    return new input_stream (fd, path);
+  }
+  
+  
+  
+  void
+  input_stream::fill ()
+  {
+    if (this->fd == -1)
+      throw vm_error ("unexpected end of file in `" + this->path + "'");
+    
+    for (;;)
+      {
+        auto r = ::read (this->fd, this->buf, this->cap);
+        if (r == -1)
+          {
+            if (errno == EINTR)
+              continue;
+            throw vm_error ("cannot read from `" + this->path + "': "
+              + std::strerror (errno));
+          }
+        if (r == 0)
+          throw vm_error ("unexpected end of file in `" + this->path + "'");
+        
+        this->pos = 0;
+        this->len = r;
+        return;
+      }
+  }
+  
+  void
+  input_stream::read (char *data, long n)
+  {
+    while (n > 0)
+      {
+        if (this->pos == this->len)
+          {
+            // large reads go straight into the destination.
+            if (n >= this->cap && this->fd != -1)
+              {
+                auto r = ::read (this->fd, data, n);
+                if (r == -1 && errno == EINTR)
+                  continue;
+                if (r == -1)
+                  throw vm_error ("cannot read from `" + this->path + "': "
+                    + std::strerror (errno));
+                if (r == 0)
+                  throw vm_error ("unexpected end of file in `"
+                    + this->path + "'");
+                
+                data += r;
+                n -= r;
+                continue;
+              }
+            
+            this->fill ();
+          }
+        
+        long c = std::min (n, this->len - this->pos);
+        std::memcpy (data, this->buf + this->pos, c);
+        this->pos += c;
+        data += c;
+        n -= c;
+      }
+  }
+  
+  long
+  input_stream::read_some (char *data, long n)
+  {
+    if (this->pos == this->len)
+      {
+        if (this->fd == -1)
+          return 0;
+        
+        // nothing is buffered, so read straight into the destination.
+        for (;;)
+          {
+            auto r = ::read (this->fd, data, n);
+            if (r == -1)
+              {
+                if (errno == EINTR)
+                  continue;
+                throw vm_error ("cannot read from `" + this->path + "': "
+                  + std::strerror (errno));
+              }
+            return (long)r;
+          }
+      }
+    
+    long c = std::min (n, this->len - this->pos);
+    std::memcpy (data, this->buf + this->pos, c);
+    this->pos += c;
+    return c;
+  }
+}
@@ -0,0 +1,420 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/map.hpp"
+#include <gmp.h>
+#include <mpfr.h>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+
+namespace rho {
+  
+  // lists are hashed by (at most) this many leading elements, and nested
+  // structure down to this depth.
+#define MAP_HASH_LIST_MAX   32
+#define MAP_HASH_DEPTH_MAX  8
+  
+  static inline std::uint64_t
+  _mix (std::uint64_t x)
+  {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+  
+  static inline std::uint64_t
+  _hash_long (long x)
+  {
+    return _mix ((std::uint64_t)x);
+  }
+  
+  /* 
+   * Integers that fit in a long hash the same as the long itself, so that
+   * small integers never touch their limbs.
+   */
+  static std::uint64_t
+  _hash_mpz (mpz_srcptr x)
+  {
+    if (mpz_fits_slong_p (x))
+      return _hash_long (mpz_get_si (x));
+    
+    std::uint64_t h = (std::uint64_t)mpz_sgn (x);
+    size_t n = mpz_size (x);
+    for (size_t i = 0; i < n; ++i)
+      h = _mix (h ^ (std::uint64_t)mpz_getlimbn (x, i));
+    return h;
+  }
+  
+  static std::uint64_t
+  _hash_double (double d)
+  {
+    if (std::isfinite (d) && std::floor (d) == d)
+      {
+        if (d >= -9.2e18 && d <= 9.2e18)
+          return _hash_long ((long)d);
+        
+        mpz_t z;
+        mpz_init_set_d (z, d);
+        auto h = _hash_mpz (z);
+        mpz_clear (z);
+        return h;
+      }
+    
+    std::uint64_t bits;
+    std::memcpy (&bits, &d, sizeof bits);
+    return _mix (bits);
+  }
+  
+  static std::uint64_t
+  _hash_mpfr (mpfr_srcptr f)
+  {
+    if (mpfr_integer_p (f))
+      {
+        if (mpfr_fits_slong_p (f, MPFR_RNDN))
+          return _hash_long (mpfr_get_si (f, MPFR_RNDN));
+        
+        mpz_t z;
+        mpz_init (z);
+        mpfr_get_z (z, f, MPFR_RNDN);
+        auto h = _hash_mpz (z);
+        mpz_clear (z);
+        return h;
+      }
+    
+    // a non-integral float can only equal a double if it has the same value.
+    return _hash_double (mpfr_get_d (f, MPFR_RNDN));
+  }
+  
+  /* 
+   * Hashes strings eight bytes at a time.
+   */
+  static std::uint64_t
+  _hash_bytes (const char *str, long len)
+  {
+    std::uint64_t h = 0x9e3779b97f4a7c15ULL ^ (std::uint64_t)len;
+    
+    long i = 0;
+    for (; i + 8 <= len; i += 8)
+      {
+        std::uint64_t w;
+        std::memcpy (&w, str + i, 8);
+        h = (h ^ (w * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+        h ^= h >> 29;
+      }
+    
+    if (i < len)
+      {
+        std::uint64_t w = 0;
+        std::memcpy (&w, str + i, len - i);
+        h = (h ^ (w * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+      }
+    
+    return _mix (h);
+  }
+  
+  /* 
+   * If :exact: is true, numbers of different types hash apart.
+   */
+  static std::uint64_t
+  _hash (const rho_value& v, int depth, bool exact)
+  {
+    std::uint64_t salt = exact ? (std::uint64_t)v.type << 56 : 0;
+    switch (v.type)
+      {
+      case RHO_NIL:         return 0x6e696cULL;
+      case RHO_EMPTY_LIST:  return 0x28290000ULL;
+      case RHO_BOOL:        return v.val.b ? 0x74727565ULL : 0x66616c73ULL;
+      case RHO_ATOM:        return _mix (0xa70a70ULL ^ (std::uint64_t)v.val.i32);
+      case RHO_INTEGER:     return _hash_mpz (v.val.gc->val.i) ^ salt;
+      case RHO_DOUBLE:      return _hash_double (v.val.f64) ^ salt;
+      case RHO_FLOAT:       return _hash_mpfr (v.val.gc->val.f) ^ salt;
+      
+      case RHO_STR:
+        return _hash_bytes (rho_str_chars (v.val.gc), v.val.gc->val.s.len);
+      
+      case RHO_CONS:
+        {
+          if (depth >= MAP_HASH_DEPTH_MAX)
+            return 0xc0c0ULL;
+          
+          std::uint64_t h = 0xc0ULL;
+          const rho_value *cur = &v;
+          for (int n = 0; cur->type == RHO_CONS && n < MAP_HASH_LIST_MAX; ++n)
+            {
+              h = _mix (h ^ _hash (cur->val.gc->val.p.fst, depth + 1, exact));
+              cur = &cur->val.gc->val.p.snd;
+            }
+          if (cur->type != RHO_CONS)
+            h = _mix (h ^ _hash (*cur, depth + 1, exact));
+          return h;
+        }
+      
+      default:
+        if (rho_type_is_collectable (v.type))
+          return _mix ((std::uint64_t)(std::uintptr_t)v.val.gc);
+        return _mix ((std::uint64_t)v.val.i64);
+      }
+  }
+  
+  std::size_t
+  rho_map_hash (const rho_value& v)
+  {
+    std::size_t h = (std::size_t)_hash (v, 0, false);
+    return (h < MAP_HASH_MIN) ? h + MAP_HASH_MIN : h;
+  }
+  
+  std::size_t
+  rho_map_hash_exact (const rho_value& v)
+  {
+    std::size_t h = (std::size_t)_hash (v, 0, true);
+    return (h < MAP_HASH_MIN) ? h + MAP_HASH_MIN : h;
+  }
+  
+  
+  
+  static inline bool
+  _is_number (const rho_value& v)
+  {
+    return v.type == RHO_INTEGER || v.type == RHO_DOUBLE
+      || v.type == RHO_FLOAT;
+  }
+  
+  /* 
+   * If :exact: is true, numbers are only equal to numbers of the same type
+   * (and precision) with the same value, and zeroes of different signs are
+   * told apart.
+   */
+  static bool
+  _key_eq (const rho_value& a, const rho_value& b, bool exact)
+  {
+    if (!exact && _is_number (a) && _is_number (b))
+      return rho_value_cmp_eq (const_cast<rho_value&> (a),
+                               const_cast<rho_value&> (b));
+    if (a.type != b.type)
+      return false;
+    
+    switch (a.type)
+      {
+      case RHO_NIL:
+      case RHO_EMPTY_LIST:
+        return true;
+      
+      case RHO_INTEGER:
+        return mpz_cmp (a.val.gc->val.i, b.val.gc->val.i) == 0;
+      
+      case RHO_DOUBLE:
+        return std::memcmp (&a.val.f64, &b.val.f64, sizeof (double)) == 0;
+      
+      case RHO_FLOAT:
+        {
+          auto x = a.val.gc->val.f;
+          auto y = b.val.gc->val.f;
+          if (mpfr_nan_p (x) || mpfr_nan_p (y))
+            return false;
+          return mpfr_get_prec (x) == mpfr_get_prec (y)
+            && mpfr_cmp (x, y) == 0 && mpfr_signbit (x) == mpfr_signbit (y);
+        }
+      
+      case RHO_BOOL:
+        return a.val.b == b.val.b;
+      
+      case RHO_ATOM:
+        return a.val.i32 == b.val.i32;
+      
+      case RHO_STR:
+        {
+          auto& s1 = a.val.gc->val.s;
+          auto& s2 = b.val.gc->val.s;
+          return s1.len == s2.len
+            && std::memcmp (rho_str_chars (a.val.gc),
+                            rho_str_chars (b.val.gc), s1.len) == 0;
+        }
+      
+      case RHO_CONS:
+        {
+          const rho_value *x = &a, *y = &b;
+          while (x->type == RHO_CONS && y->type == RHO_CONS)
+            {
+              if (x->val.gc == y->val.gc)
+                return true;
+              if (!_key_eq (x->val.gc->val.p.fst, y->val.gc->val.p.fst, exact))
+                return false;
+              x = &x->val.gc->val.p.snd;
+              y = &y->val.gc->val.p.snd;
+            }
+          return _key_eq (*x, *y, exact);
+        }
+      
+      default:
+        if (rho_type_is_collectable (a.type))
+          return a.val.gc == b.val.gc;
+        return a.val.i64 == b.val.i64;
+      }
+  }
+  
+  bool
+  rho_map_key_eq (const rho_value& a, const rho_value& b)
+  {
+    return _key_eq (a, b, false);
+  }
+  
+  bool
+  rho_map_key_eq_exact (const rho_value& a, const rho_value& b)
+  {
+    return _key_eq (a, b, true);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  rho_map::rho_map (long min_cap)
+  {
+    long cap = MAP_MIN_CAP;
+    while (cap * 3 < min_cap * 4)
+      cap <<= 1;
+    
+    this->slots = new map_slot [cap] ();
+    this->cap = cap;
+    this->len = 0;
+    this->used = 0;
+  }
+  
+  rho_map::~rho_map ()
+  {
+    delete[] this->slots;
+  }
+  
+  
+  
+  /* 
+   * Returns the index of the slot holding the specified key, or -1.
+   */
+  long
+  rho_map::probe (const rho_value& key, std::size_t hash)
+  {
+    long mask = this->cap - 1;
+    for (long i = (long)(hash & mask); ; i = (i + 1) & mask)
+      {
+        auto& s = this->slots[i];
+        if (s.hash == MAP_SLOT_EMPTY)
+          return -1;
+        if (s.hash == hash && rho_map_key_eq (s.key, key))
+          return i;
+      }
+  }
+  
+  rho_value*
+  rho_map::find (const rho_value& key)
+  {
+    if (this->len == 0)
+      return nullptr;
+    
+    long idx = this->probe (key, rho_map_hash (key));
+    return (idx == -1) ? nullptr : &this->slots[idx].val;
+  }
+  
+  void
+  rho_map::set (const rho_value& key, const rho_value& val)
+  {
+    // keep the load factor (tombstones included) at or below 3/4.
+    if ((this->used + 1) * 4 > this->cap * 3)
+      this->rehash ((this->len + 1) * 2 > this->cap ? this->cap * 2
+                                                    : this->cap);
+    
+    auto hash = rho_map_hash (key);
+    long mask = this->cap - 1;
+    long tomb = -1;
+    for (long i = (long)(hash & mask); ; i = (i + 1) & mask)
+      {
+        auto& s = this->slots[i];
+        if (s.hash == MAP_SLOT_EMPTY)
+          {
+            if (tomb == -1)
+              {
+                tomb = i;
+                ++ this->used;
+              }
+            break;
+          }
+        else if (s.hash == MAP_SLOT_DELETED)
+          {
+            if (tomb == -1)
+              tomb = i;
+          }
+        else if (s.hash == hash && rho_map_key_eq (s.key, key))
+          {
+            s.val = val;
+            return;
+          }
+      }
+    
+    auto& s = this->slots[tomb];
+    s.hash = hash;
+    s.key = key;
+    s.val = val;
+    ++ this->len;
+  }
+  
+  bool
+  rho_map::remove (const rho_value& key)
+  {
+    if (this->len == 0)
+      return false;
+    
+    long idx = this->probe (key, rho_map_hash (key));
+    if (idx == -1)
+      return false;
+    
+    auto& s = this->slots[idx];
+    s.hash = MAP_SLOT_DELETED;
+    s.key = rho_value_make_nil ();
+    s.val = rho_value_make_nil ();
+    -- this->len;
+    return true;
+  }
+  
+  void
+  rho_map::rehash (long new_cap)
+  {
+    auto old = this->slots;
+    long old_cap = this->cap;
+    
+    this->slots = new map_slot [new_cap] ();
+    this->cap = new_cap;
+    this->used = this->len;
+    
+    long mask = new_cap - 1;
+    for (long i = 0; i < old_cap; ++i)
+      if (is_live (old[i]))
+        {
+          long j = (long)(old[i].hash & mask);
+          while (this->slots[j].hash != MAP_SLOT_EMPTY)
+            j = (j + 1) & mask;
+          this->slots[j] = old[i];
+        }
+    
+    delete[] old;
+  }
+}
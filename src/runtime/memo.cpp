@@ -0,0 +1,103 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/memo.hpp"
+#include "runtime/map.hpp"
+
+
+namespace rho {
+  
+  memo_cache::memo_cache (long cap, unsigned char flags)
+  {
+    this->cap = (cap > 0) ? cap : 1;
+    this->flags = flags;
+    this->hits = this->misses = this->evictions = 0;
+  }
+  
+  
+  
+  std::size_t
+  memo_cache::hash_args (const rho_value *args, int argc)
+  {
+    std::size_t h = (std::size_t)argc;
+    for (int i = 0; i < argc; ++i)
+      h = (h ^ rho_map_hash_exact (args[-i])) * 0x9e3779b97f4a7c15ULL;
+    return h;
+  }
+  
+  rho_value*
+  memo_cache::find (const rho_value *args, int argc, std::size_t hash)
+  {
+    auto range = this->index.equal_range (hash);
+    for (auto itr = range.first; itr != range.second; ++itr)
+      {
+        auto ent = itr->second;
+        auto& key = ent->key.val.gc->val.vec;
+        if (key.len != argc)
+          continue;
+        
+        // keys are stored in frame order too
+        auto kargs = key.vals + key.len - 1;
+        int i = 0;
+        while (i < argc && rho_map_key_eq_exact (kargs[-i], args[-i]))
+          ++ i;
+        if (i == argc)
+          {
+            ++ this->hits;
+            this->lru.splice (this->lru.begin (), this->lru, ent);
+            return &ent->val;
+          }
+      }
+    
+    ++ this->misses;
+    return nullptr;
+  }
+  
+  void
+  memo_cache::insert (rho_value key, rho_value val)
+  {
+    auto& vec = key.val.gc->val.vec;
+    std::size_t hash = hash_args (vec.vals + vec.len - 1, (int)vec.len);
+    
+    if (this->size () >= this->cap)
+      this->trim (this->cap - 1);
+    
+    this->lru.push_front ({ key, val, hash });
+    this->index.emplace (hash, this->lru.begin ());
+  }
+  
+  void
+  memo_cache::trim (long count)
+  {
+    while (this->size () > count)
+      {
+        auto last = std::prev (this->lru.end ());
+        auto range = this->index.equal_range (last->hash);
+        for (auto itr = range.first; itr != range.second; ++itr)
+          if (itr->second == last)
+            {
+              this->index.erase (itr);
+              break;
+            }
+        
+        this->lru.erase (last);
+        ++ this->evictions;
+      }
+  }
+}
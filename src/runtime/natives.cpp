@@ -0,0 +1,223 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/builtins.hpp"
+#include "runtime/value.hpp"
+#include <unordered_map>
+
+
+/*
+ * The native function registry.
+ *
+ * The builtin instruction (0x70) carries a 16-bit index into the table
+ * below, and calls the native through its function pointer.  Adding a
+ * native only takes an entry at the end of the table (indices are baked
+ * into compiled modules, so existing entries must not move).
+ */
+
+namespace rho {
+  
+  namespace {
+    
+    // adapters for the builtins that take their arguments individually:
+    
+    typedef rho_value (*builtin0_fn) (virtual_machine&);
+    typedef rho_value (*builtin1_fn) (rho_value&, virtual_machine&);
+    typedef rho_value (*builtin2_fn) (rho_value&, rho_value&,
+                                      virtual_machine&);
+    typedef rho_value (*builtin3_fn) (rho_value&, rho_value&, rho_value&,
+                                      virtual_machine&);
+    typedef rho_value (*builtin4_fn) (rho_value&, rho_value&, rho_value&,
+                                      rho_value&, virtual_machine&);
+    
+    template<builtin0_fn F> rho_value
+    native0 (rho_value *, int, virtual_machine& vm)
+      { return F (vm); }
+    
+    template<builtin1_fn F> rho_value
+    native1 (rho_value *a, int, virtual_machine& vm)
+      { return F (a[0], vm); }
+    
+    template<builtin2_fn F> rho_value
+    native2 (rho_value *a, int, virtual_machine& vm)
+      { return F (a[0], a[1], vm); }
+    
+    template<builtin3_fn F> rho_value
+    native3 (rho_value *a, int, virtual_machine& vm)
+      { return F (a[0], a[1], a[2], vm); }
+    
+    template<builtin4_fn F> rho_value
+    native4 (rho_value *a, int, virtual_machine& vm)
+      { return F (a[0], a[1], a[2], a[3], vm); }
+  }
+  
+  
+  
+#define PURE      NATIVE_PURE
+#define FOLDABLE  NATIVE_FOLDABLE
+  
+  static const native_entry _natives[] = {
+    { "print", &rho_builtin_print, 1, -1, 0 },
+    { "len", &native1<rho_builtin_len>, 1, 1, FOLDABLE },
+    
+    // packed arrays:
+    { "f64vec", &native1<rho_builtin_f64vec>, 1, 1, PURE },
+    { "i64vec", &native1<rho_builtin_i64vec>, 1, 1, PURE },
+    { "vadd", &native2<rho_builtin_vadd>, 2, 2, PURE },
+    { "vmul", &native2<rho_builtin_vmul>, 2, 2, PURE },
+    { "vfma", &native3<rho_builtin_vfma>, 3, 3, PURE },
+    { "dot", &native2<rho_builtin_dot>, 2, 2, PURE },
+    { "vsum", &native1<rho_builtin_vsum>, 1, 1, PURE },
+    { "vmin", &native1<rho_builtin_vmin>, 1, 1, PURE },
+    { "vmax", &native1<rho_builtin_vmax>, 1, 1, PURE },
+    { "norm", &native1<rho_builtin_norm>, 1, 1, PURE },
+    { "clock", &native0<rho_builtin_clock>, 0, 0, 0 },
+    
+    // matrices:
+    { "mat_make", &native1<rho_builtin_mat_make>, 1, 1, PURE },
+    { "mat_zeros", &native2<rho_builtin_mat_zeros>, 2, 2, PURE },
+    { "mat_rows", &native1<rho_builtin_mat_rows>, 1, 1, PURE },
+    { "mat_cols", &native1<rho_builtin_mat_cols>, 1, 1, PURE },
+    { "mat_get", &native3<rho_builtin_mat_get>, 3, 3, PURE },
+    { "mat_set", &native4<rho_builtin_mat_set>, 4, 4, 0 },
+    { "mat_mul", &native2<rho_builtin_mat_mul>, 2, 2, PURE },
+    { "mat_transpose", &native1<rho_builtin_mat_transpose>, 1, 1, PURE },
+    { "mat_lu", &native1<rho_builtin_mat_lu>, 1, 1, PURE },
+    { "mat_solve", &native2<rho_builtin_mat_solve>, 2, 2, PURE },
+    { "mat_det", &native1<rho_builtin_mat_det>, 1, 1, PURE },
+    
+    // polynomials:
+    { "poly_make", &native1<rho_builtin_poly_make>, 1, 1, PURE },
+    { "poly_coeffs", &native1<rho_builtin_poly_coeffs>, 1, 1, PURE },
+    { "poly_deg", &native1<rho_builtin_poly_deg>, 1, 1, PURE },
+    { "poly_add", &native2<rho_builtin_poly_add>, 2, 2, PURE },
+    { "poly_sub", &native2<rho_builtin_poly_sub>, 2, 2, PURE },
+    { "poly_mul", &native2<rho_builtin_poly_mul>, 2, 2, PURE },
+    { "poly_divrem", &native2<rho_builtin_poly_divrem>, 2, 2, PURE },
+    { "poly_gcd", &native2<rho_builtin_poly_gcd>, 2, 2, PURE },
+    { "poly_eval", &native2<rho_builtin_poly_eval>, 2, 2, PURE },
+    
+    // symbolic expressions (these intern nodes in the VM's expression table,
+    // which is not observable from Rho code):
+    { "expr_sym", &native1<rho_builtin_expr_sym>, 1, 1, PURE },
+    { "expr_fn", &native2<rho_builtin_expr_fn>, 2, 2, PURE },
+    { "expr_simplify", &native1<rho_builtin_expr_simplify>, 1, 1, PURE },
+    { "expr_diff", &native2<rho_builtin_expr_diff>, 2, 2, PURE },
+    { "expr_op", &native1<rho_builtin_expr_op>, 1, 1, PURE },
+    { "expr_args", &native1<rho_builtin_expr_args>, 1, 1, PURE },
+    { "expr_make", &native2<rho_builtin_expr_make>, 2, 2, PURE },
+    { "expr_nodes", &native0<rho_builtin_expr_nodes>, 0, 0, 0 },
+    
+    // coroutines:
+    { "coroutine", &native1<rho_builtin_coroutine>, 1, 1, 0 },
+    { "co_done", &native1<rho_builtin_co_done>, 1, 1, 0 },
+    
+    { "gc_allocs", &native0<rho_builtin_gc_allocs>, 0, 0, 0 },
+    
+    // lists (those that take callbacks are only as pure as the callbacks):
+    { "list_range", &native2<rho_builtin_list_range>, 2, 2, PURE },
+    { "list_map", &native2<rho_builtin_list_map>, 2, 2, 0 },
+    { "list_filter", &native2<rho_builtin_list_filter>, 2, 2, 0 },
+    { "list_reverse", &native1<rho_builtin_list_reverse>, 1, 1, PURE },
+    { "list_len", &native1<rho_builtin_list_len>, 1, 1, FOLDABLE },
+    { "list_any", &native1<rho_builtin_list_any>, 1, 1, PURE },
+    { "list_all", &native1<rho_builtin_list_all>, 1, 1, PURE },
+    { "list_fuse", &native3<rho_builtin_list_fuse>, 3, 3, 0 },
+    { "list_fuse_range", &native4<rho_builtin_list_fuse_range>, 4, 4, 0 },
+    { "list_sort", &native2<rho_builtin_list_sort>, 2, 2, 0 },
+    { "list_fold", &native3<rho_builtin_list_fold>, 3, 3, 0 },
+    
+    // maps:
+    { "map_get", &rho_builtin_map_get, 2, 3, 0 },
+    { "map_has", &native2<rho_builtin_map_has>, 2, 2, 0 },
+    { "map_del", &native2<rho_builtin_map_del>, 2, 2, 0 },
+    { "map_keys", &native1<rho_builtin_map_keys>, 1, 1, 0 },
+    { "map_vals", &native1<rho_builtin_map_vals>, 1, 1, 0 },
+    { "map_items", &native1<rho_builtin_map_items>, 1, 1, 0 },
+    
+    { "memo_stats", &native1<rho_builtin_memo_stats>, 1, 1, 0 },
+    
+    // persistent vectors (updates to transients happen in place):
+    { "pvec", &rho_builtin_pvec, 0, 1, PURE },
+    { "pvec_set", &native3<rho_builtin_pvec_set>, 3, 3, 0 },
+    { "pvec_push", &native2<rho_builtin_pvec_push>, 2, 2, 0 },
+    { "pvec_pop", &native1<rho_builtin_pvec_pop>, 1, 1, 0 },
+    { "pvec_slice", &native3<rho_builtin_pvec_slice>, 3, 3, 0 },
+    { "pvec_transient", &native1<rho_builtin_pvec_transient>, 1, 1, 0 },
+    { "pvec_persist", &native1<rho_builtin_pvec_persist>, 1, 1, 0 },
+    { "pvec_to_vec", &native1<rho_builtin_pvec_to_vec>, 1, 1, PURE },
+    
+    // growable vectors (slices share their buffer until written to):
+    { "push", &native2<rho_builtin_push>, 2, 2, 0 },
+    { "pop", &native1<rho_builtin_pop>, 1, 1, 0 },
+    { "extend", &native2<rho_builtin_extend>, 2, 2, 0 },
+    { "slice", &rho_builtin_slice, 2, 3, 0 },
+    
+    // strings:
+    { "substr", &rho_builtin_substr, 2, 3, PURE },
+    { "split", &native2<rho_builtin_split>, 2, 2, PURE },
+    { "join", &native2<rho_builtin_join>, 2, 2, 0 },
+    { "find", &rho_builtin_find, 2, 3, PURE },
+    { "str", &native1<rho_builtin_str>, 1, 1, 0 },
+    
+    // output (print() is buffered as well):
+    { "write", &rho_builtin_write, 1, -1, 0 },
+    { "flush", &rho_builtin_flush, 0, 1, 0 },
+    { "set_buffer_size", &rho_builtin_set_buffer_size, 1, 2, 0 },
+    { "file_open", &rho_builtin_file_open, 1, 2, 0 },
+    { "file_print", &rho_builtin_file_print, 1, -1, 0 },
+    { "file_write", &rho_builtin_file_write, 2, -1, 0 },
+    { "file_close", &native1<rho_builtin_file_close>, 1, 1, 0 },
+    
+    { "set_print_limits", &rho_builtin_set_print_limits, 1, 2, 0 },
+    { "save", &native2<rho_builtin_save>, 2, 2, 0 },
+    { "load", &native1<rho_builtin_load>, 1, 1, 0 },
+    { "save_image", &native2<rho_builtin_save_image>, 2, 2, 0 },
+    { "mmap_array", &native2<rho_builtin_mmap_array>, 2, 2, 0 },
+    { "read_numbers", &native2<rho_builtin_read_numbers>, 2, 2, 0 },
+    { "read_csv", &rho_builtin_read_csv, 1, 3, 0 },
+  };
+  
+#undef PURE
+#undef FOLDABLE
+  
+  
+  
+  const native_entry*
+  rho_native_get (int index)
+  {
+    if (index < 0 || index >= (int)(sizeof _natives / sizeof _natives[0]))
+      return nullptr;
+    return &_natives[index];
+  }
+  
+  int
+  rho_native_find (const std::string& name)
+  {
+    static const std::unordered_map<std::string, int> _index = [] {
+        std::unordered_map<std::string, int> index;
+        for (int i = 0; i < (int)(sizeof _natives / sizeof _natives[0]); ++i)
+          index[_natives[i].name] = i;
+        return index;
+      } ();
+    
+    auto itr = _index.find (name);
+    return (itr == _index.end ()) ? -1 : itr->second;
+  }
+}
@@ -0,0 +1,538 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/printer.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/io.hpp"
+#include "runtime/expr.hpp"
+#include "runtime/map.hpp"
+#include "runtime/pvec.hpp"
+#include "util/float.hpp"
+#include "util/poly.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+
+namespace rho {
+  
+  void
+  print_sink::write (const char *data, long n)
+  {
+    if (this->out)
+      this->out->write (data, n);
+    else
+      this->str->append (data, n);
+  }
+  
+  void
+  print_sink::put (char c)
+  {
+    if (this->out)
+      this->out->put (c);
+    else
+      this->str->push_back (c);
+  }
+  
+  
+  
+  namespace {
+    
+    /*
+     * A container whose elements are being printed.
+     */
+    struct print_frame
+    {
+      rho_value v;
+      rho_value cur; // lists: the rest of the list
+      long idx;      // position of the next element
+      long count;    // number of elements printed so far
+      bool in_entry; // maps: the key of the entry at :idx: has been printed
+    };
+    
+    class value_printer
+    {
+      print_sink& out;
+      virtual_machine& vm;
+      long max_elems;
+      int max_depth;
+      std::vector<print_frame> stk;
+    
+    public:
+      value_printer (print_sink& out, virtual_machine& vm,
+                     const print_limits *lim)
+        : out (out), vm (vm)
+      {
+        this->max_elems = lim ? lim->max_elems : 0;
+        this->max_depth = lim ? lim->max_depth : 0;
+      }
+    
+    public:
+      void
+      print (rho_value v)
+      {
+        this->begin (v);
+        while (!this->stk.empty ())
+          this->step ();
+      }
+    
+    private:
+      inline void write (const char *s) { this->out.write (s, std::strlen (s)); }
+      inline void write (const std::string& s) { this->out.write (s); }
+      
+      inline bool
+      elems_exceeded (long count) const
+        { return this->max_elems > 0 && count >= this->max_elems; }
+      
+      void
+      push (rho_value v, const char *open)
+      {
+        this->write (open);
+        
+        print_frame f;
+        f.v = v;
+        f.cur = v;
+        f.idx = 0;
+        f.count = 0;
+        f.in_entry = false;
+        this->stk.push_back (f);
+      }
+      
+      void
+      pop (const char *close)
+      {
+        this->write (close);
+        this->stk.pop_back ();
+      }
+      
+      void write_string (const char *str, long len);
+      void write_integer (mpz_srcptr n);
+      void write_array (rho_value v);
+      void write_matrix (rho_value v);
+      
+      void begin (rho_value v);
+      void step ();
+    };
+    
+    
+    
+    void
+    value_printer::write_string (const char *str, long len)
+    {
+      this->out.put ('"');
+      
+      // runs of characters that need no escaping are written in one go.
+      long run = 0;
+      for (long i = 0; i < len; ++i)
+        {
+          const char *esc;
+          switch (str[i])
+            {
+            case '"': esc = "\\\""; break;
+            case '\n': esc = "\\n"; break;
+            case '\r': esc = "\\r"; break;
+            case '\t': esc = "\\t"; break;
+            case '\\': esc = "\\\\"; break;
+            case '\0': esc = "\\0"; break;
+            
+            default:
+              continue;
+            }
+          
+          this->out.write (str + run, i - run);
+          this->write (esc);
+          run = i + 1;
+        }
+      
+      this->out.write (str + run, len - run);
+      this->out.put ('"');
+    }
+    
+    void
+    value_printer::write_integer (mpz_srcptr n)
+    {
+      // room for the digits, a sign and the terminator.
+      char sbuf[64];
+      size_t size = mpz_sizeinbase (n, 10) + 2;
+      std::vector<char> hbuf;
+      char *buf = sbuf;
+      if (size > sizeof sbuf)
+        {
+          hbuf.resize (size);
+          buf = hbuf.data ();
+        }
+      
+      mpz_get_str (buf, 10, n);
+      this->write (buf);
+    }
+    
+    void
+    value_printer::write_array (rho_value v)
+    {
+      this->write ((v.type == RHO_F64VEC) ? "f64vec[" : "i64vec[");
+      
+      int prec10 = this->vm.get_base10_prec ();
+      auto& arr = v.val.gc->val.arr;
+      for (long i = 0; i < arr.len; ++i)
+        {
+          if (i > 0)
+            this->write (", ");
+          if (this->elems_exceeded (i))
+            {
+              this->write ("...");
+              break;
+            }
+          
+          if (v.type == RHO_F64VEC)
+            this->write (float_to_str (arr.f64[i], prec10));
+          else
+            this->write (std::to_string (arr.i64[i]));
+        }
+      
+      this->write ("]");
+    }
+    
+    void
+    value_printer::write_matrix (rho_value v)
+    {
+      this->write ("matrix[");
+      
+      int prec10 = this->vm.get_base10_prec ();
+      auto& mat = v.val.gc->val.mat;
+      for (int i = 0; i < mat.rows; ++i)
+        {
+          if (i > 0)
+            this->write (", ");
+          if (this->elems_exceeded (i))
+            {
+              this->write ("...");
+              break;
+            }
+          
+          this->write ("[");
+          for (int j = 0; j < mat.cols; ++j)
+            {
+              if (j > 0)
+                this->write (", ");
+              if (this->elems_exceeded (j))
+                {
+                  this->write ("...");
+                  break;
+                }
+              
+              this->write (float_to_str (mat.data[(long)i * mat.cols + j],
+                                         prec10));
+            }
+          this->write ("]");
+        }
+      
+      this->write ("]");
+    }
+    
+    
+    
+    /*
+     * Prints a value that has no elements, or writes the opening of a
+     * container and pushes it onto the stack, to have its elements printed
+     * by step().
+     */
+    void
+    value_printer::begin (rho_value v)
+    {
+      switch (v.type)
+        {
+        case RHO_CONS:
+        case RHO_VEC:
+        case RHO_MAP:
+        case RHO_RECORD:
+        case RHO_PVEC:
+          if (this->max_depth > 0 && (int)this->stk.size () >= this->max_depth)
+            {
+              this->write ("...");
+              return;
+            }
+          break;
+        
+        default: ;
+        }
+      
+      switch (v.type)
+        {
+        case RHO_NIL:
+          this->write ("nil");
+          break;
+        
+        case RHO_EMPTY_LIST:
+          this->write ("'()");
+          break;
+        
+        case RHO_BOOL:
+          this->write (v.val.b ? "true" : "false");
+          break;
+        
+        case RHO_ATOM:
+          this->write (this->vm.get_atom_name (v.val.i32));
+          break;
+        
+        case RHO_INTEGER:
+          this->write_integer (v.val.gc->val.i);
+          break;
+        
+        case RHO_FLOAT:
+          this->write (float_to_str (v.val.gc->val.f,
+                                     this->vm.get_base10_prec ()));
+          break;
+        
+        case RHO_DOUBLE:
+          this->write (float_to_str (v.val.f64, this->vm.get_base10_prec ()));
+          break;
+        
+        case RHO_FUN:
+          {
+            char buf[64];
+            std::snprintf (buf, sizeof buf, "<function %p>", (void *)v.val.gc);
+            this->write (buf);
+          }
+          break;
+        
+        case RHO_STR:
+          this->write_string (rho_str_chars (v.val.gc), v.val.gc->val.s.len);
+          break;
+        
+        case RHO_F64VEC:
+        case RHO_I64VEC:
+          this->write_array (v);
+          break;
+        
+        case RHO_MATRIX:
+          this->write_matrix (v);
+          break;
+        
+        case RHO_POLY:
+          this->write ("poly[");
+          this->write (poly_to_str (*v.val.gc->val.poly));
+          this->write ("]");
+          break;
+        
+        case RHO_EXPR:
+          this->write (expr_to_str (v.val.gc));
+          break;
+        
+        case RHO_PROMISE:
+          if (v.val.gc->val.pr.forced)
+            this->push (v, "<promise: ");
+          else
+            this->write ("<promise>");
+          break;
+        
+        case RHO_COROUTINE:
+          this->write ("<coroutine>");
+          break;
+        
+        case RHO_FILE:
+          this->write ("<file: ");
+          this->write (v.val.gc->val.file->get_path ());
+          this->write (">");
+          break;
+        
+        case RHO_CONS:
+          this->push (v, "'(");
+          break;
+        
+        case RHO_VEC:
+          this->push (v, "[");
+          break;
+        
+        case RHO_MAP:
+          if (v.val.gc->val.map->size () == 0)
+            this->write ("[=>]");
+          else
+            this->push (v, "[");
+          break;
+        
+        case RHO_RECORD:
+          // printed as the type's tag followed by the fields: #point(1, 2)
+          this->write (this->vm.get_atom_name (v.val.gc->val.rec.tag));
+          this->push (v, "(");
+          break;
+        
+        case RHO_PVEC:
+          // printed as the call that builds it: pvec([1, 2, 3])
+          this->push (v, v.val.gc->val.pvec->is_transient ()
+            ? "pvec_transient([" : "pvec([");
+          break;
+        
+        default:
+          throw std::runtime_error ("rho_value_print: unhandled value type");
+        }
+    }
+    
+    /*
+     * Prints the next element of the container on top of the stack, or
+     * closes the container if there are none left.
+     *
+     * begin() may push onto the stack, so it is always called last, after
+     * the frame has been updated.
+     */
+    void
+    value_printer::step ()
+    {
+      auto& f = this->stk.back ();
+      switch (f.v.type)
+        {
+        case RHO_CONS:
+          if (f.cur.type == RHO_CONS)
+            {
+              if (this->elems_exceeded (f.count))
+                {
+                  this->pop (" ...)");
+                  return;
+                }
+              if (f.count ++ > 0)
+                this->out.put (' ');
+              
+              auto elem = f.cur.val.gc->val.p.fst;
+              f.cur = f.cur.val.gc->val.p.snd;
+              this->begin (elem);
+            }
+          else if (f.cur.type == RHO_EMPTY_LIST)
+            this->pop (")");
+          else
+            {
+              // improper list
+              auto elem = f.cur;
+              f.cur.type = RHO_EMPTY_LIST;
+              this->write (" . ");
+              this->begin (elem);
+            }
+          break;
+        
+        case RHO_VEC:
+        case RHO_RECORD:
+          {
+            bool vec = (f.v.type == RHO_VEC);
+            auto vals = vec ? f.v.val.gc->val.vec.vals : f.v.val.gc->val.rec.vals;
+            long len = vec ? f.v.val.gc->val.vec.len : f.v.val.gc->val.rec.len;
+            if (f.idx == len)
+              {
+                this->pop (vec ? "]" : ")");
+                return;
+              }
+            
+            if (f.idx > 0)
+              this->write (", ");
+            if (this->elems_exceeded (f.idx))
+              {
+                this->pop (vec ? "...]" : "...)");
+                return;
+              }
+            
+            this->begin (vals[f.idx ++]);
+          }
+          break;
+        
+        case RHO_PVEC:
+          {
+            auto& pv = *f.v.val.gc->val.pvec;
+            if (f.idx == pv.size ())
+              {
+                this->pop ("])");
+                return;
+              }
+            
+            if (f.idx > 0)
+              this->write (", ");
+            if (this->elems_exceeded (f.idx))
+              {
+                this->pop ("...])");
+                return;
+              }
+            
+            this->begin (pv.get (f.idx ++));
+          }
+          break;
+        
+        case RHO_MAP:
+          {
+            auto& m = *f.v.val.gc->val.map;
+            if (f.in_entry)
+              {
+                this->write (" => ");
+                f.in_entry = false;
+                this->begin (m.slot (f.idx ++).val);
+                break;
+              }
+            
+            while (f.idx < m.capacity () && !rho_map::is_live (m.slot (f.idx)))
+              ++ f.idx;
+            if (f.idx == m.capacity ())
+              {
+                this->pop ("]");
+                return;
+              }
+            
+            if (f.count > 0)
+              this->write (", ");
+            if (this->elems_exceeded (f.count))
+              {
+                this->pop ("...]");
+                return;
+              }
+            
+            ++ f.count;
+            f.in_entry = true;
+            this->begin (m.slot (f.idx).key);
+          }
+          break;
+        
+        case RHO_PROMISE:
+          if (f.idx ++ == 0)
+            this->begin (f.v.val.gc->val.pr.val);
+          else
+            this->pop (">");
+          break;
+        
+        default:
+          throw std::runtime_error ("rho_value_print: unhandled container");
+        }
+    }
+  }
+  
+  
+  
+  void
+  rho_value_print (rho_value& v, print_sink& out, virtual_machine& vm,
+                   const print_limits *lim)
+  {
+    value_printer printer { out, vm, lim };
+    printer.print (v);
+  }
+  
+  /*
+   * Returns a textual representation of the specified Rho value.
+   */
+  std::string
+  rho_value_str (rho_value& v, virtual_machine& vm)
+  {
+    std::string res;
+    print_sink out { res };
+    rho_value_print (v, out, vm);
+    return res;
+  }
+}
@@ -0,0 +1,359 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/pvec.hpp"
+#include <cstring>
+
+
+namespace rho {
+  
+  static pvec_node*
+  _alloc_node (int level)
+  {
+    auto node = new pvec_node;
+    node->refs = 1;
+    node->mark = 0;
+    if (level == 0)
+      for (int i = 0; i < PVEC_WIDTH; ++i)
+        node->vals[i] = rho_value_make_nil ();
+    else
+      for (int i = 0; i < PVEC_WIDTH; ++i)
+        node->kids[i] = nullptr;
+    return node;
+  }
+  
+  static inline pvec_node*
+  _retain (pvec_node *node)
+  {
+    if (node)
+      ++ node->refs;
+    return node;
+  }
+  
+  static void
+  _release (pvec_node *node, int level)
+  {
+    if (!node || -- node->refs > 0)
+      return;
+    
+    if (level > 0)
+      for (int i = 0; i < PVEC_WIDTH && node->kids[i]; ++i)
+        _release (node->kids[i], level - PVEC_BITS);
+    delete node;
+  }
+  
+  static pvec_node*
+  _copy_node (pvec_node *node, int level)
+  {
+    auto copy = new pvec_node;
+    copy->refs = 1;
+    copy->mark = 0;
+    if (level == 0)
+      std::memcpy (copy->vals, node->vals, sizeof node->vals);
+    else
+      for (int i = 0; i < PVEC_WIDTH; ++i)
+        copy->kids[i] = _retain (node->kids[i]);
+    return copy;
+  }
+  
+  /*
+   * Returns a chain of single-child branches leading down to the given leaf.
+   */
+  static pvec_node*
+  _new_path (int level, pvec_node *leaf)
+  {
+    if (level == 0)
+      return leaf;
+    
+    auto node = _alloc_node (level);
+    node->kids[0] = _new_path (level - PVEC_BITS, leaf);
+    return node;
+  }
+  
+  
+  
+  rho_pvec::rho_pvec ()
+  {
+    this->cnt = 0;
+    this->off = 0;
+    this->shift = PVEC_BITS;
+    this->root = nullptr;
+    this->tail = nullptr;
+    this->transient = false;
+  }
+  
+  rho_pvec::rho_pvec (const rho_pvec& other)
+  {
+    this->cnt = other.cnt;
+    this->off = other.off;
+    this->shift = other.shift;
+    this->root = _retain (other.root);
+    this->tail = _retain (other.tail);
+    this->transient = false;
+  }
+  
+  rho_pvec::~rho_pvec ()
+  {
+    _release (this->root, this->shift);
+    _release (this->tail, 0);
+  }
+  
+  
+  
+  pvec_node*
+  rho_pvec::leaf_for (long idx) const
+  {
+    if (idx >= this->tail_offset ())
+      return this->tail;
+    
+    auto node = this->root;
+    for (int level = this->shift; level > 0; level -= PVEC_BITS)
+      node = node->kids[(idx >> level) & PVEC_MASK];
+    return node;
+  }
+  
+  const rho_value&
+  rho_pvec::get (long idx) const
+  {
+    idx += this->off;
+    return this->leaf_for (idx)->vals[idx & PVEC_MASK];
+  }
+  
+  
+  
+  /*
+   * Returns a node that can be written to in place of the given one: the
+   * node itself if nothing else references it, or a copy otherwise.
+   */
+  pvec_node*
+  rho_pvec::own (pvec_node *node, int level)
+  {
+    if (node->refs == 1)
+      return node;
+    
+    auto copy = _copy_node (node, level);
+    -- node->refs;
+    return copy;
+  }
+  
+  pvec_node*
+  rho_pvec::set_node (pvec_node *node, int level, long idx,
+                      const rho_value& val)
+  {
+    node = this->own (node, level);
+    if (level == 0)
+      node->vals[idx & PVEC_MASK] = val;
+    else
+      {
+        int sub = (idx >> level) & PVEC_MASK;
+        node->kids[sub] = this->set_node (node->kids[sub], level - PVEC_BITS,
+                                          idx, val);
+      }
+    
+    return node;
+  }
+  
+  void
+  rho_pvec::set (long idx, const rho_value& val)
+  {
+    idx += this->off;
+    long tail_off = this->tail_offset ();
+    if (idx >= tail_off)
+      {
+        this->tail = this->own (this->tail, 0);
+        this->tail->vals[idx - tail_off] = val;
+      }
+    else
+      this->root = this->set_node (this->root, this->shift, idx, val);
+  }
+  
+  
+  
+  /*
+   * Hangs a full leaf off the rightmost path of the trie, where the element
+   * at index cnt - 1 belongs.
+   */
+  pvec_node*
+  rho_pvec::push_tail (pvec_node *node, int level, pvec_node *leaf)
+  {
+    node = this->own (node, level);
+    
+    int sub = ((this->cnt - 1) >> level) & PVEC_MASK;
+    if (level == PVEC_BITS)
+      node->kids[sub] = leaf;
+    else if (node->kids[sub])
+      node->kids[sub] = this->push_tail (node->kids[sub], level - PVEC_BITS,
+                                         leaf);
+    else
+      node->kids[sub] = _new_path (level - PVEC_BITS, leaf);
+    
+    return node;
+  }
+  
+  void
+  rho_pvec::push (const rho_value& val)
+  {
+    long tail_len = this->cnt - this->tail_offset ();
+    if (this->tail && tail_len < PVEC_WIDTH)
+      {
+        this->tail = this->own (this->tail, 0);
+        this->tail->vals[tail_len] = val;
+        ++ this->cnt;
+        return;
+      }
+    
+    if (this->tail)
+      {
+        // the tail is full, move it into the trie.
+        if (!this->root)
+          {
+            this->root = _alloc_node (PVEC_BITS);
+            this->root->kids[0] = this->tail;
+          }
+        else if ((this->cnt >> PVEC_BITS) > (1L << this->shift))
+          {
+            // no room left under the root, grow the trie by one level.
+            auto node = _alloc_node (this->shift + PVEC_BITS);
+            node->kids[0] = this->root;
+            node->kids[1] = _new_path (this->shift, this->tail);
+            this->root = node;
+            this->shift += PVEC_BITS;
+          }
+        else
+          this->root = this->push_tail (this->root, this->shift, this->tail);
+      }
+    
+    this->tail = _alloc_node (0);
+    this->tail->vals[0] = val;
+    ++ this->cnt;
+  }
+  
+  void
+  rho_pvec::pop ()
+  {
+    long tail_len = this->cnt - this->tail_offset ();
+    if (tail_len > 1)
+      {
+        this->tail = this->own (this->tail, 0);
+        this->tail->vals[tail_len - 1] = rho_value_make_nil ();
+        -- this->cnt;
+      }
+    else
+      this->take (this->cnt - 1);
+    
+    if (this->cnt == this->off)
+      this->clear ();
+  }
+  
+  
+  
+  /*
+   * Returns a trie holding the first :count: (a positive multiple of the
+   * leaf size) elements of the given one.
+   */
+  pvec_node*
+  rho_pvec::take_node (pvec_node *node, int level, long count)
+  {
+    if (level == 0)
+      return _retain (node);
+    
+    auto res = _alloc_node (level);
+    int last = ((count - 1) >> level) & PVEC_MASK;
+    for (int i = 0; i < last; ++i)
+      res->kids[i] = _retain (node->kids[i]);
+    res->kids[last] = this->take_node (node->kids[last], level - PVEC_BITS,
+                                       count - ((long)last << level));
+    return res;
+  }
+  
+  /*
+   * Drops all elements past the first :count: ones.
+   */
+  void
+  rho_pvec::take (long count)
+  {
+    if (count == this->cnt)
+      return;
+    
+    if (count == 0)
+      {
+        _release (this->root, this->shift);
+        _release (this->tail, 0);
+        this->root = this->tail = nullptr;
+        this->shift = PVEC_BITS;
+        this->cnt = 0;
+        return;
+      }
+    
+    long tail_off = this->tail_offset ();
+    long new_tail_off = (count - 1) & ~(long)PVEC_MASK;
+    
+    // the new tail is a fresh copy of the leaf the last element lives in,
+    // with the elements past the end cleared out.
+    auto leaf = _copy_node (this->leaf_for (count - 1), 0);
+    for (long i = count - new_tail_off; i < PVEC_WIDTH; ++i)
+      leaf->vals[i] = rho_value_make_nil ();
+    _release (this->tail, 0);
+    this->tail = leaf;
+    
+    if (new_tail_off < tail_off)
+      {
+        pvec_node *root = nullptr;
+        int shift = PVEC_BITS;
+        if (new_tail_off > 0)
+          {
+            root = this->take_node (this->root, this->shift, new_tail_off);
+            shift = this->shift;
+            
+            // drop levels that are left with a single child.
+            while (shift > PVEC_BITS && !root->kids[1])
+              {
+                auto child = _retain (root->kids[0]);
+                _release (root, shift);
+                root = child;
+                shift -= PVEC_BITS;
+              }
+          }
+        
+        _release (this->root, this->shift);
+        this->root = root;
+        this->shift = shift;
+      }
+    
+    this->cnt = count;
+  }
+  
+  void
+  rho_pvec::slice (long start, long end)
+  {
+    this->take (this->off + end);
+    this->off += start;
+    if (this->cnt == this->off)
+      this->clear ();
+  }
+  
+  /* 
+   * Empties the vector, dropping whatever it kept alive before its offset.
+   */
+  void
+  rho_pvec::clear ()
+  {
+    this->take (0);
+    this->off = 0;
+  }
+}
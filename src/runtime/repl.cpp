@@ -23,6 +23,7 @@
 #include "parse/parser.hpp"
 #include "compiler/compiler.hpp"
 #include "linker/linker.hpp"
+#include "runtime/io.hpp"
 #include <boost/filesystem.hpp>
 #include <iostream>
 #include <sstream>
@@ -42,6 +43,12 @@ namespace rho {
     this->run_num = 0;
     this->next_glob = 0;
     this->next_mod = 1;
+    
+    // keep an accidental print of a huge structure from flooding the
+    // terminal.
+    auto& lim = this->vm.get_print_limits ();
+    lim.max_elems = REPL_PRINT_MAX_ELEMS;
+    lim.max_depth = REPL_PRINT_MAX_DEPTH;
   }
   
   rho_repl::~rho_repl ()
@@ -259,6 +266,7 @@ namespace rho {
     // run
     ++ this->run_num;
     this->vm.run (*prg.get ());
+    this->vm.get_output ().flush ();
     //auto res = this->vm.run (*prg.get ());
     //std::cout << " => " << rho_value_str (res, this->vm) << std::endl << std::endl;
     this->vm.pop_value ();
@@ -405,6 +413,8 @@ namespace rho {
     auto atoms = ast_tools::extract_atom_defs (p);
     for (auto& atom : atoms)
       this->comp.add_known_atom (atom);
+    for (auto& rec : ast_tools::extract_record_defs (p))
+      this->comp.add_known_record (rec.first, rec.second);
     
     for (auto p : lnk.get_atoms ())
       this->atoms[p.first] = p.second;
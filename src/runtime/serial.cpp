@@ -0,0 +1,1380 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/serial.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/gc/gc.hpp"
+#include "runtime/io.hpp"
+#include "runtime/map.hpp"
+#include "runtime/pvec.hpp"
+#include "runtime/memo.hpp"
+#include "runtime/expr.hpp"
+#include "util/poly.hpp"
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+
+namespace rho {
+  
+#define SERIAL_MAGIC    "RHOV"
+#define SERIAL_VERSION  1
+  
+  namespace {
+    
+    enum serial_tag: unsigned char
+    {
+      SER_NIL,
+      SER_TRUE,
+      SER_FALSE,
+      SER_EMPTY_LIST,
+      SER_INT,      // zigzag varint
+      SER_BIGINT,   // sign, byte count, magnitude (least significant first)
+      SER_FLOAT,    // precision, kind, [exponent, mantissa]
+      SER_DOUBLE,
+      SER_ATOM,
+      SER_STR,
+      SER_LIST,     // cell count, the elements, then the tail
+      SER_VEC,
+      SER_F64VEC,
+      SER_I64VEC,
+      SER_MATRIX,
+      SER_POLY,
+      SER_MAP,
+      SER_RECORD,
+      SER_PVEC,
+      SER_REF,      // an object that has already been written, by id
+      SER_FUN,      // code offset, memo cache settings, environment
+      SER_UPVAL,
+      SER_PROMISE,
+      SER_EXPR,     // node count, the nodes (arguments first)
+    };
+    
+    enum serial_float_kind: unsigned char
+    {
+      SER_FLOAT_NUM,
+      SER_FLOAT_NAN,
+      SER_FLOAT_INF,
+      SER_FLOAT_NEG_INF,
+      SER_FLOAT_ZERO,
+      SER_FLOAT_NEG_ZERO,
+    };
+    
+    
+    
+    /*
+     * An object whose children are being written (or read).  A list frame
+     * covers a whole run of cells, so that long lists do not need a frame
+     * per cell.
+     */
+    struct serial_frame
+    {
+      gc_value *obj;
+      long idx;       // index of the next child
+      long n;         // number of children
+      gc_value *cell; // lists: the cell whose car comes next
+      rho_value key;  // loading maps: the key whose value comes next
+    };
+    
+    
+    
+    /*
+     * Maps the objects written so far to their ids.  An open-addressing
+     * table keyed by address, since every cell of a long list ends up in it.
+     * Ids are handed out in the order objects are written in, which is also
+     * the order the loader creates them in.
+     */
+    class id_table
+    {
+      struct entry
+      {
+        gc_value *obj;
+        long id;
+      };
+      
+      entry *slots;
+      long cap;
+      long len;
+      
+    public:
+      id_table ()
+      {
+        this->cap = 1024;
+        this->len = 0;
+        this->slots = new entry [this->cap] ();
+      }
+      
+      ~id_table ()
+        { delete[] this->slots; }
+      
+      id_table (const id_table&) = delete;
+      id_table& operator= (const id_table&) = delete;
+      
+    public:
+      /*
+       * Returns the id of the object if it is already in the table, and
+       * otherwise adds it with the given id and returns -1.
+       */
+      long
+      insert (gc_value *obj, long id)
+      {
+        if (2 * (this->len + 1) > this->cap)
+          this->grow ();
+        
+        auto& e = this->slots[this->probe (obj)];
+        if (e.obj)
+          return e.id;
+        
+        e.obj = obj;
+        e.id = id;
+        ++ this->len;
+        return -1;
+      }
+      
+      /*
+       * Returns the id of the object, or -1 if it has not been written.
+       */
+      long
+      find (gc_value *obj) const
+      {
+        auto& e = this->slots[this->probe (obj)];
+        return e.obj ? e.id : -1;
+      }
+      
+    private:
+      inline long
+      probe (gc_value *obj) const
+      {
+        long mask = this->cap - 1;
+        long i = (long)(((std::uintptr_t)obj >> 4) * 0x9E3779B97F4A7C15ULL
+          >> 20) & mask;
+        while (this->slots[i].obj && this->slots[i].obj != obj)
+          i = (i + 1) & mask;
+        return i;
+      }
+      
+      void
+      grow ()
+      {
+        auto old = this->slots;
+        long old_cap = this->cap;
+        
+        this->cap *= 2;
+        this->slots = new entry [this->cap] ();
+        for (long i = 0; i < old_cap; ++i)
+          if (old[i].obj)
+            this->slots[this->probe (old[i].obj)] = old[i];
+        delete[] old;
+      }
+    };
+    
+    
+    
+    class value_saver
+    {
+      output_stream& out;
+      virtual_machine& vm;
+      const serial_code *code;
+      id_table ids;
+      long next_id;
+      std::unordered_map<int, long> atoms;
+      std::unordered_map<int, long> expr_names;
+      std::vector<serial_frame> stack;
+      mpz_t tmp;
+      
+    public:
+      value_saver (output_stream& out, virtual_machine& vm,
+                   const serial_code *code)
+        : out (out), vm (vm), code (code), next_id (0)
+        { mpz_init (this->tmp); }
+      
+      ~value_saver ()
+        { mpz_clear (this->tmp); }
+      
+    public:
+      void
+      save (rho_value& v)
+      {
+        this->out.write (SERIAL_MAGIC, 4);
+        this->out.put (SERIAL_VERSION);
+        
+        this->visit (v);
+        while (!this->stack.empty ())
+          {
+            auto& f = this->stack.back ();
+            rho_value child;
+            if (!this->next_child (f, child))
+              {
+                this->stack.pop_back ();
+                continue;
+              }
+            
+            this->visit (child);
+          }
+      }
+      
+    private:
+      void
+      write_varint (unsigned long x)
+      {
+        while (x >= 0x80)
+          {
+            this->out.put ((char)(x | 0x80));
+            x >>= 7;
+          }
+        this->out.put ((char)x);
+      }
+      
+      inline void
+      write_svarint (long x)
+      {
+        this->write_varint (((unsigned long)x << 1)
+          ^ (unsigned long)(x >> 63));
+      }
+      
+      void
+      write_int (mpz_srcptr z)
+      {
+        if (mpz_fits_slong_p (z))
+          {
+            this->out.put (SER_INT);
+            this->write_svarint (mpz_get_si (z));
+            return;
+          }
+        
+        size_t count = (mpz_sizeinbase (z, 2) + 7) / 8;
+        std::vector<char> bytes (count);
+        mpz_export (bytes.data (), &count, -1, 1, 0, 0, z);
+        
+        this->out.put (SER_BIGINT);
+        this->out.put (mpz_sgn (z) < 0);
+        this->write_varint (count);
+        this->out.write (bytes.data (), (long)count);
+      }
+      
+      void
+      write_float (mpfr_srcptr f)
+      {
+        this->out.put (SER_FLOAT);
+        this->write_varint (mpfr_get_prec (f));
+        
+        if (mpfr_nan_p (f))
+          this->out.put (SER_FLOAT_NAN);
+        else if (mpfr_inf_p (f))
+          this->out.put ((mpfr_sgn (f) < 0) ? SER_FLOAT_NEG_INF
+                                            : SER_FLOAT_INF);
+        else if (mpfr_zero_p (f))
+          this->out.put (mpfr_signbit (f) ? SER_FLOAT_NEG_ZERO
+                                          : SER_FLOAT_ZERO);
+        else
+          {
+            // the value is exactly mantissa * 2^exp.
+            long exp = mpfr_get_z_2exp (this->tmp, f);
+            this->out.put (SER_FLOAT_NUM);
+            this->write_svarint (exp);
+            this->write_int (this->tmp);
+          }
+      }
+      
+      /*
+       * Writes the name identified by :key: in :names: (atoms, or the names
+       * used in expressions).  A name is written the first time it appears,
+       * and later occurrences refer back to it.
+       */
+      void
+      write_name (std::unordered_map<int, long>& names, int key,
+                  const std::string& name)
+      {
+        auto itr = names.find (key);
+        if (itr != names.end ())
+          {
+            this->write_varint (itr->second + 1);
+            return;
+          }
+        
+        long idx = (long)names.size ();
+        names[key] = idx;
+        
+        this->write_varint (0);
+        this->write_varint (name.length ());
+        this->out.write (name);
+      }
+      
+      inline void
+      write_atom (int atom)
+      {
+        this->write_name (this->atoms, atom, this->vm.get_atom_name (atom));
+      }
+      
+      /*
+       * Writes the nodes of the expression DAG below :g: that have not been
+       * written yet, arguments before the nodes that use them, so that the
+       * loader can intern each node as soon as it is read.  Expressions are
+       * immutable and acyclic, so this never runs into a node that is still
+       * being written.
+       */
+      void
+      write_expr (gc_value *g)
+      {
+        long id = this->ids.find (g);
+        if (id != -1)
+          {
+            this->out.put (SER_REF);
+            this->write_varint (id);
+            return;
+          }
+        
+        std::vector<gc_value *> nodes;
+        std::vector<std::pair<gc_value *, std::size_t>> work { { g, 0 } };
+        while (!work.empty ())
+          {
+            auto e = work.back ().first;
+            auto& args = e->val.expr->args;
+            if (work.back ().second < args.size ())
+              {
+                auto a = args[work.back ().second ++];
+                if (this->ids.find (a) == -1)
+                  work.push_back ({ a, 0 });
+                continue;
+              }
+            
+            this->ids.insert (e, this->next_id ++);
+            nodes.push_back (e);
+            work.pop_back ();
+          }
+        
+        auto& tbl = this->vm.get_exprs ();
+        this->out.put (SER_EXPR);
+        this->write_varint (nodes.size ());
+        for (auto e : nodes)
+          {
+            auto n = e->val.expr;
+            this->out.put ((char)n->op);
+            switch (n->op)
+              {
+              case EXPR_NUM:
+                this->write_int (n->num);
+                break;
+              
+              case EXPR_SYM:
+                this->write_name (this->expr_names, n->name,
+                                  tbl.get_name (n->name));
+                break;
+              
+              case EXPR_PVAR:
+                this->write_varint (n->name);
+                break;
+              
+              case EXPR_FN:
+                this->write_name (this->expr_names, n->name,
+                                  tbl.get_name (n->name));
+                // fall through
+              
+              default:
+                this->write_varint (n->args.size ());
+                for (auto a : n->args)
+                  this->write_varint (this->ids.find (a));
+                break;
+              }
+          }
+      }
+      
+      void
+      push_frame (gc_value *g, long n)
+      {
+        serial_frame f;
+        f.obj = g;
+        f.idx = 0;
+        f.n = n;
+        f.cell = g;
+        this->stack.push_back (f);
+      }
+      
+      /*
+       * Writes the value, or its header if it is a container (the elements
+       * follow through the frame that is pushed for it).
+       */
+      void
+      visit (rho_value& v)
+      {
+        switch (v.type)
+          {
+          case RHO_NIL:
+            this->out.put (SER_NIL);
+            return;
+          
+          case RHO_BOOL:
+            this->out.put (v.val.b ? SER_TRUE : SER_FALSE);
+            return;
+          
+          case RHO_EMPTY_LIST:
+            this->out.put (SER_EMPTY_LIST);
+            return;
+          
+          case RHO_INTEGER:
+            this->write_int (v.val.gc->val.i);
+            return;
+          
+          case RHO_FLOAT:
+            this->write_float (v.val.gc->val.f);
+            return;
+          
+          case RHO_DOUBLE:
+            this->out.put (SER_DOUBLE);
+            this->out.write ((const char *)&v.val.f64, sizeof (double));
+            return;
+          
+          case RHO_ATOM:
+            this->out.put (SER_ATOM);
+            this->write_atom (v.val.i32);
+            return;
+          
+          case RHO_FUN:
+            if (!this->code)
+              throw vm_error ("save: cannot save a function");
+            break;
+          
+          case RHO_COROUTINE:
+            throw vm_error ("save: cannot save a coroutine");
+          case RHO_FILE:
+            throw vm_error ("save: cannot save a file");
+          
+          case RHO_EXPR:
+            this->write_expr (v.val.gc);
+            return;
+          
+          case RHO_INTERNAL:
+          case RHO_PVAR:
+            throw vm_error ("save: cannot save a value of this type");
+          
+          default:
+            break;
+          }
+        
+        // an object that has been written before, including one whose
+        // elements are still being written (a cycle), is referred back to.
+        auto g = v.val.gc;
+        long id = this->ids.insert (g, this->next_id);
+        if (id != -1)
+          {
+            this->out.put (SER_REF);
+            this->write_varint (id);
+            return;
+          }
+        ++ this->next_id;
+        
+        switch (v.type)
+          {
+          case RHO_STR:
+            {
+              auto str = rho_str_chars (g);
+              this->out.put (SER_STR);
+              this->write_varint (g->val.s.len);
+              this->out.write (str, g->val.s.len);
+            }
+            break;
+          
+          case RHO_F64VEC:
+          case RHO_I64VEC:
+            {
+              auto& arr = g->val.arr;
+              this->out.put ((v.type == RHO_F64VEC) ? SER_F64VEC : SER_I64VEC);
+              this->write_varint (arr.len);
+              this->out.write ((const char *)arr.f64, arr.len * 8);
+            }
+            break;
+          
+          case RHO_MATRIX:
+            {
+              auto& mat = g->val.mat;
+              this->out.put (SER_MATRIX);
+              this->write_varint (mat.rows);
+              this->write_varint (mat.cols);
+              this->out.write ((const char *)mat.data,
+                               (long)mat.rows * mat.cols * sizeof (double));
+            }
+            break;
+          
+          case RHO_POLY:
+            {
+              auto& p = *g->val.poly;
+              this->out.put (SER_POLY);
+              this->write_varint (p.size ());
+              for (long i = 0; i < p.size (); ++i)
+                this->write_int (p[i]);
+            }
+            break;
+          
+          case RHO_CONS:
+            {
+              // every cell of the run gets an id, and the run stops at the
+              // first cell that has been written before.
+              long n = 1;
+              for (auto cur = g->val.p.snd;
+                   cur.type == RHO_CONS
+                     && this->ids.insert (cur.val.gc, this->next_id) == -1;
+                   cur = cur.val.gc->val.p.snd)
+                {
+                  ++ this->next_id;
+                  ++ n;
+                }
+              
+              this->out.put (SER_LIST);
+              this->write_varint (n);
+              this->push_frame (g, n + 1);
+            }
+            break;
+          
+          case RHO_VEC:
+            {
+              this->out.put (SER_VEC);
+              this->write_varint (g->val.vec.len);
+              this->push_frame (g, g->val.vec.len);
+            }
+            break;
+          
+          case RHO_RECORD:
+            {
+              this->out.put (SER_RECORD);
+              this->write_atom (g->val.rec.tag);
+              this->write_varint (g->val.rec.len);
+              this->push_frame (g, g->val.rec.len);
+            }
+            break;
+          
+          case RHO_MAP:
+            {
+              this->out.put (SER_MAP);
+              this->write_varint (g->val.map->size ());
+              this->push_frame (g, 2 * g->val.map->capacity ());
+            }
+            break;
+          
+          case RHO_PVEC:
+            {
+              auto& pv = *g->val.pvec;
+              this->out.put (SER_PVEC);
+              this->out.put (pv.is_transient ());
+              this->write_varint (pv.size ());
+              this->push_frame (g, pv.size ());
+            }
+            break;
+          
+          case RHO_FUN:
+            {
+              auto& fn = g->val.fn;
+              if (fn.cp < this->code->base
+                  || fn.cp >= this->code->base + this->code->size)
+                throw vm_error ("save: function is not part of the saved code");
+              
+              // a memo cache is saved empty.
+              this->out.put (SER_FUN);
+              this->write_varint (fn.cp - this->code->base);
+              this->out.put (fn.memo != nullptr);
+              if (fn.memo)
+                {
+                  this->write_varint (fn.memo->capacity ());
+                  this->out.put (fn.memo->get_flags ());
+                }
+              this->write_varint (fn.env_len);
+              this->push_frame (g, fn.env_len);
+            }
+            break;
+          
+          case RHO_UPVAL:
+            // saved closed.
+            this->out.put (SER_UPVAL);
+            this->push_frame (g, 1);
+            break;
+          
+          case RHO_PROMISE:
+            this->out.put (SER_PROMISE);
+            this->out.put (g->val.pr.forced);
+            this->push_frame (g, 1);
+            break;
+          
+          default:
+            throw vm_error ("save: cannot save a value of this type");
+          }
+      }
+      
+      /*
+       * Fetches the next child of the frame's object.  Returns false once
+       * there are no more.
+       */
+      bool
+      next_child (serial_frame& f, rho_value& child)
+      {
+        auto g = f.obj;
+        switch (g->type)
+          {
+          case RHO_CONS:
+            if (f.idx == f.n)
+              return false;
+            if (f.idx == f.n - 1)
+              child = f.cell->val.p.snd;   // the tail
+            else
+              {
+                child = f.cell->val.p.fst;
+                if (f.idx < f.n - 2)
+                  f.cell = f.cell->val.p.snd.val.gc;
+              }
+            ++ f.idx;
+            return true;
+          
+          case RHO_VEC:
+            if (f.idx == f.n)
+              return false;
+            child = g->val.vec.vals[f.idx ++];
+            return true;
+          
+          case RHO_RECORD:
+            if (f.idx == f.n)
+              return false;
+            child = g->val.rec.vals[f.idx ++];
+            return true;
+          
+          case RHO_PVEC:
+            if (f.idx == f.n)
+              return false;
+            child = g->val.pvec->get (f.idx ++);
+            return true;
+          
+          case RHO_FUN:
+            if (f.idx == f.n)
+              return false;
+            child = g->val.fn.env[f.idx ++];
+            return true;
+          
+          case RHO_UPVAL:
+            if (f.idx ++ == 1)
+              return false;
+            child = (g->val.uv.sp == -1) ? g->val.uv.val
+                                         : this->vm.get_upvalue_slot (g);
+            return true;
+          
+          case RHO_PROMISE:
+            if (f.idx ++ == 1)
+              return false;
+            child = g->val.pr.val;
+            return true;
+          
+          case RHO_MAP:
+            {
+              // :idx: counts keys and values: slot idx/2, key first.
+              auto& m = *g->val.map;
+              while (f.idx < f.n)
+                {
+                  auto& s = m.slot (f.idx >> 1);
+                  if (!rho_map::is_live (s))
+                    {
+                      f.idx += 2;
+                      continue;
+                    }
+                  
+                  child = (f.idx & 1) ? s.val : s.key;
+                  ++ f.idx;
+                  return true;
+                }
+              return false;
+            }
+          
+          default:
+            return false;
+          }
+      }
+    };
+    
+    
+    
+    class value_loader
+    {
+      input_stream& in;
+      virtual_machine& vm;
+      const serial_code *code;
+      garbage_collector& gc;
+      std::vector<gc_value *> objs; // by id
+      std::vector<int> atoms;
+      std::unordered_map<std::string, int> atom_vals;
+      std::vector<int> expr_names;
+      std::vector<serial_frame> stack;
+      serial_frame pending; // frame of the container read last
+      
+      // map entries, which are only inserted once everything has been read
+      // (a key may be a list that is still being filled in).
+      struct map_entry
+      {
+        gc_value *map;
+        rho_value key;
+        rho_value val;
+      };
+      std::vector<map_entry> entries;
+      
+    public:
+      value_loader (input_stream& in, virtual_machine& vm,
+                    const serial_code *code)
+        : in (in), vm (vm), code (code), gc (vm.get_gc ())
+        { this->pending.n = 0; }
+      
+    public:
+      rho_value
+      load ()
+      {
+        char magic[5];
+        this->in.read (magic, 5);
+        if (std::memcmp (magic, SERIAL_MAGIC, 4) != 0)
+          throw vm_error ("load: `" + this->in.get_path ()
+            + "' is not a saved value");
+        if (magic[4] != SERIAL_VERSION)
+          throw vm_error ("load: `" + this->in.get_path ()
+            + "' was saved by an incompatible version");
+        
+        rho_value root = this->read_value ();
+        this->push_pending ();
+        while (!this->stack.empty ())
+          {
+            auto v = this->read_value ();
+            
+            auto& f = this->stack.back ();
+            this->put (f, v);
+            if (++ f.idx == f.n)
+              this->stack.pop_back ();
+            
+            // the new value's own elements come next.
+            this->push_pending ();
+          }
+        
+        for (auto& e : this->entries)
+          e.map->val.map->set (e.key, e.val);
+        
+        return root;
+      }
+      
+    private:
+      static void
+      malformed ()
+        { throw vm_error ("load: malformed data"); }
+      
+      unsigned long
+      read_varint ()
+      {
+        unsigned long x = 0;
+        for (int shift = 0; ; shift += 7)
+          {
+            if (shift >= 64)
+              malformed ();
+            
+            unsigned char c = this->in.get ();
+            x |= (unsigned long)(c & 0x7F) << shift;
+            if (!(c & 0x80))
+              return x;
+          }
+      }
+      
+      inline long
+      read_svarint ()
+      {
+        unsigned long x = this->read_varint ();
+        return (long)(x >> 1) ^ -(long)(x & 1);
+      }
+      
+      inline long
+      read_length ()
+      {
+        unsigned long x = this->read_varint ();
+        if (x > (unsigned long)1 << 48)
+          malformed ();
+        return (long)x;
+      }
+      
+      void
+      read_int (mpz_ptr z, unsigned char tag)
+      {
+        switch (tag)
+          {
+          case SER_INT:
+            mpz_set_si (z, this->read_svarint ());
+            break;
+          
+          case SER_BIGINT:
+            {
+              bool neg = this->in.get ();
+              long count = this->read_length ();
+              std::vector<char> bytes (count);
+              this->in.read (bytes.data (), count);
+              mpz_import (z, count, -1, 1, 0, 0, bytes.data ());
+              if (neg)
+                mpz_neg (z, z);
+            }
+            break;
+          
+          default:
+            malformed ();
+          }
+      }
+      
+      inline void
+      read_int (mpz_ptr z)
+        { this->read_int (z, this->in.get ()); }
+      
+      /*
+       * Reads a name written by value_saver::write_name().  :ids: holds what
+       * the names read so far resolved to, and new names are resolved
+       * through :resolve:.
+       */
+      template<typename F>
+      int
+      read_name (std::vector<int>& ids, F resolve)
+      {
+        long k = this->read_length ();
+        if (k > 0)
+          {
+            if (k > (long)ids.size ())
+              malformed ();
+            return ids[k - 1];
+          }
+        
+        std::string name (this->read_length (), '\0');
+        this->in.read (&name[0], (long)name.length ());
+        
+        int id = resolve (name);
+        ids.push_back (id);
+        return id;
+      }
+      
+      int
+      read_atom ()
+      {
+        return this->read_name (this->atoms, [this] (const std::string& name) {
+          if (this->atom_vals.empty ())
+            {
+              auto& names = this->vm.get_atoms ();
+              for (int i = 0; i < (int)names.size (); ++i)
+                this->atom_vals[names[i]] = i;
+            }
+          
+          auto itr = this->atom_vals.find (name);
+          if (itr == this->atom_vals.end ())
+            throw vm_error ("load: unknown atom `" + name + "'");
+          return itr->second;
+        });
+      }
+      
+      /*
+       * Registers a newly created object.  The GC is disabled throughout,
+       * so nothing needs to stay protected.
+       */
+      inline void
+      add (rho_value& v)
+      {
+        gc_unprotect (v);
+        this->objs.push_back (v.val.gc);
+      }
+      
+      /*
+       * Sets up the frame through which the elements of the object added
+       * last are read.
+       */
+      inline void
+      set_pending (gc_value *g, long n)
+      {
+        this->pending.obj = g;
+        this->pending.idx = 0;
+        this->pending.n = n;
+        this->pending.cell = g;
+      }
+      
+      inline void
+      push_pending ()
+      {
+        if (this->pending.n > 0)
+          this->stack.push_back (this->pending);
+        this->pending.n = 0;
+      }
+      
+      /*
+       * Reads a value.  For a container, this only creates it, and leaves
+       * the frame through which its elements are filled in pending.
+       */
+      rho_value
+      read_value ()
+      {
+        unsigned char tag = this->in.get ();
+        switch (tag)
+          {
+          case SER_NIL:
+            return rho_value_make_nil ();
+          
+          case SER_TRUE:
+            return rho_value_make_bool (true);
+          
+          case SER_FALSE:
+            return rho_value_make_bool (false);
+          
+          case SER_EMPTY_LIST:
+            {
+              auto v = rho_value_make_empty_list (this->gc);
+              gc_unprotect (v);
+              return v;
+            }
+          
+          case SER_INT:
+            {
+              long x = this->read_svarint ();
+              if (x >= 0 && x <= VM_SMALL_INT_MAX)
+                return this->vm.get_prealloced_int ((int)x);
+              
+              auto v = rho_value_make_int (this->gc);
+              gc_unprotect (v);
+              mpz_set_si (v.val.gc->val.i, x);
+              return v;
+            }
+          
+          case SER_BIGINT:
+            {
+              auto v = rho_value_make_int (this->gc);
+              gc_unprotect (v);
+              this->read_int (v.val.gc->val.i, tag);
+              return v;
+            }
+          
+          case SER_FLOAT:
+            return this->read_float ();
+          
+          case SER_DOUBLE:
+            {
+              double d;
+              this->in.read ((char *)&d, sizeof d);
+              return rho_value_make_double (d);
+            }
+          
+          case SER_ATOM:
+            return rho_value_make_atom (this->read_atom ());
+          
+          case SER_REF:
+            {
+              // the object may still be being filled in (a cycle).
+              unsigned long id = this->read_varint ();
+              if (id >= this->objs.size ())
+                malformed ();
+              
+              rho_value v;
+              v.type = this->objs[id]->type;
+              v.val.gc = this->objs[id];
+              return v;
+            }
+          
+          case SER_STR:
+            {
+              long len = this->read_length ();
+              std::string str (len, '\0');
+              this->in.read (&str[0], len);
+              auto v = rho_value_make_string (str.data (), len, this->gc);
+              this->add (v);
+              return v;
+            }
+          
+          case SER_F64VEC:
+          case SER_I64VEC:
+            {
+              bool f64 = (tag == SER_F64VEC);
+              long len = this->read_length ();
+              auto v = f64 ? rho_value_make_f64vec (len, this->gc)
+                           : rho_value_make_i64vec (len, this->gc);
+              this->add (v);
+              this->in.read ((char *)v.val.gc->val.arr.f64, len * 8);
+              return v;
+            }
+          
+          case SER_MATRIX:
+            {
+              long rows = this->read_length ();
+              long cols = this->read_length ();
+              if (rows > 0x7FFFFFFF || cols > 0x7FFFFFFF)
+                malformed ();
+              
+              auto v = rho_value_make_matrix ((int)rows, (int)cols, this->gc);
+              this->add (v);
+              this->in.read ((char *)v.val.gc->val.mat.data,
+                             rows * cols * (long)sizeof (double));
+              return v;
+            }
+          
+          case SER_POLY:
+            {
+              long n = this->read_length ();
+              zpoly p (n);
+              for (long i = 0; i < n; ++i)
+                this->read_int (p[i]);
+              
+              auto v = rho_value_make_poly (std::move (p), this->gc);
+              this->add (v);
+              return v;
+            }
+          
+          case SER_LIST:
+            {
+              // the cells are created up front, in id order.
+              long n = this->read_length ();
+              if (n == 0)
+                malformed ();
+              
+              auto nil = rho_value_make_nil ();
+              auto head = rho_value_make_cons (nil, nil, this->gc);
+              this->add (head);
+              auto cur = head.val.gc;
+              for (long i = 1; i < n; ++i)
+                {
+                  auto c = rho_value_make_cons (nil, nil, this->gc);
+                  this->add (c);
+                  cur->val.p.snd = c;
+                  cur = c.val.gc;
+                }
+              
+              this->set_pending (head.val.gc, n + 1);
+              return head;
+            }
+          
+          case SER_VEC:
+            {
+              long len = this->read_length ();
+              auto v = rho_value_make_vec (len, this->gc);
+              this->add (v);
+              this->set_pending (v.val.gc, len);
+              return v;
+            }
+          
+          case SER_RECORD:
+            {
+              int tag = this->read_atom ();
+              long len = this->read_length ();
+              if (len > 0x7FFFFFFF)
+                malformed ();
+              
+              auto v = rho_value_make_record (tag, (int)len, this->gc);
+              this->add (v);
+              this->set_pending (v.val.gc, len);
+              return v;
+            }
+          
+          case SER_MAP:
+            {
+              long size = this->read_length ();
+              auto v = rho_value_make_map (size, this->gc);
+              this->add (v);
+              this->set_pending (v.val.gc, 2 * size);
+              return v;
+            }
+          
+          case SER_PVEC:
+            {
+              bool transient = this->in.get ();
+              long len = this->read_length ();
+              auto v = rho_value_make_pvec (new rho_pvec (), this->gc);
+              this->add (v);
+              v.val.gc->val.pvec->set_transient (transient);
+              this->set_pending (v.val.gc, len);
+              return v;
+            }
+          
+          case SER_FUN:
+            {
+              unsigned long off = this->read_varint ();
+              if (!this->code || off >= (unsigned long)this->code->size)
+                malformed ();
+              if (this->code->funs
+                  && !std::binary_search (this->code->funs->begin (),
+                                          this->code->funs->end (), (long)off))
+                malformed ();
+              
+              memo_cache *memo = nullptr;
+              if (this->in.get ())
+                {
+                  long cap = this->read_length ();
+                  memo = new memo_cache (cap, this->in.get ());
+                }
+              
+              long env_len = this->read_length ();
+              if (env_len > 0x7FFFFFFF)
+                {
+                  delete memo;
+                  malformed ();
+                }
+              
+              auto v = rho_value_make_function (this->code->base + off,
+                                                (int)env_len, this->gc);
+              this->add (v);
+              v.val.gc->val.fn.memo = memo;
+              this->set_pending (v.val.gc, env_len);
+              return v;
+            }
+          
+          case SER_UPVAL:
+            {
+              auto v = rho_value_make_upvalue (this->gc);
+              this->add (v);
+              v.val.gc->val.uv.sp = -1;
+              this->set_pending (v.val.gc, 1);
+              return v;
+            }
+          
+          case SER_PROMISE:
+            {
+              bool forced = this->in.get ();
+              auto nil = rho_value_make_nil ();
+              auto v = rho_value_make_promise (nil, this->gc);
+              this->add (v);
+              v.val.gc->val.pr.forced = forced;
+              this->set_pending (v.val.gc, 1);
+              return v;
+            }
+          
+          case SER_EXPR:
+            return this->read_expr ();
+          
+          default:
+            malformed ();
+            return rho_value_make_nil ();
+          }
+      }
+      
+      /*
+       * Reads the nodes written by value_saver::write_expr(), interning each
+       * one through the VM's expression table, and returns the last.
+       */
+      rho_value
+      read_expr ()
+      {
+        auto& tbl = this->vm.get_exprs ();
+        auto intern = [&tbl] (const std::string& name) {
+          return tbl.intern (name);
+        };
+        
+        long count = this->read_length ();
+        if (count == 0)
+          malformed ();
+        
+        rho_value v;
+        v.type = RHO_EXPR;
+        std::vector<gc_value *> args;
+        mpz_t num;
+        mpz_init (num);
+        try
+          {
+            for (long i = 0; i < count; ++i)
+              {
+                unsigned char op = this->in.get ();
+                int name = -1;
+                switch (op)
+                  {
+                  case EXPR_NUM:
+                    this->read_int (num);
+                    v.val.gc = tbl.make_num (num);
+                    break;
+                  
+                  case EXPR_SYM:
+                    name = this->read_name (this->expr_names, intern);
+                    v.val.gc = tbl.make_sym (name);
+                    break;
+                  
+                  case EXPR_PVAR:
+                    {
+                      unsigned long idx = this->read_varint ();
+                      if (idx > 0x7FFFFFFF)
+                        malformed ();
+                      v.val.gc = tbl.make_pvar ((int)idx);
+                    }
+                    break;
+                  
+                  case EXPR_FN:
+                    name = this->read_name (this->expr_names, intern);
+                    // fall through
+                  
+                  case EXPR_ADD:
+                  case EXPR_MUL:
+                  case EXPR_POW:
+                    {
+                      // arguments are written before the nodes using them.
+                      long nargs = this->read_length ();
+                      if (op == EXPR_POW && nargs != 2)
+                        malformed ();
+                      
+                      args.clear ();
+                      for (long j = 0; j < nargs; ++j)
+                        {
+                          unsigned long id = this->read_varint ();
+                          if (id >= this->objs.size ()
+                              || this->objs[id]->type != RHO_EXPR)
+                            malformed ();
+                          args.push_back (this->objs[id]);
+                        }
+                      
+                      if (op == EXPR_FN)
+                        v.val.gc = tbl.make_fn (name, args);
+                      else
+                        v.val.gc = tbl.make_op ((expr_op)op, args);
+                    }
+                    break;
+                  
+                  default:
+                    malformed ();
+                  }
+                
+                this->add (v);
+              }
+          }
+        catch (const vm_error&)
+          {
+            mpz_clear (num);
+            throw;
+          }
+        
+        mpz_clear (num);
+        return v;
+      }
+      
+      rho_value
+      read_float ()
+      {
+        long prec = this->read_length ();
+        if (prec < MPFR_PREC_MIN || prec > MPFR_PREC_MAX)
+          malformed ();
+        
+        auto v = rho_value_make_float ((unsigned int)prec, this->gc);
+        gc_unprotect (v);
+        auto f = v.val.gc->val.f;
+        switch (this->in.get ())
+          {
+          case SER_FLOAT_NAN: mpfr_set_nan (f); break;
+          case SER_FLOAT_INF: mpfr_set_inf (f, 1); break;
+          case SER_FLOAT_NEG_INF: mpfr_set_inf (f, -1); break;
+          case SER_FLOAT_ZERO: mpfr_set_zero (f, 1); break;
+          case SER_FLOAT_NEG_ZERO: mpfr_set_zero (f, -1); break;
+          
+          case SER_FLOAT_NUM:
+            {
+              long exp = this->read_svarint ();
+              mpz_t m;
+              mpz_init (m);
+              try
+                {
+                  this->read_int (m);
+                }
+              catch (const vm_error&)
+                {
+                  mpz_clear (m);
+                  throw;
+                }
+              
+              mpfr_set_z_2exp (f, m, exp, MPFR_RNDN);
+              mpz_clear (m);
+            }
+            break;
+          
+          default:
+            malformed ();
+          }
+        
+        return v;
+      }
+      
+      /*
+       * Stores the frame's next child.
+       */
+      void
+      put (serial_frame& f, rho_value& v)
+      {
+        auto g = f.obj;
+        switch (g->type)
+          {
+          case RHO_CONS:
+            if (f.idx == f.n - 1)
+              f.cell->val.p.snd = v;   // the tail
+            else
+              {
+                f.cell->val.p.fst = v;
+                if (f.idx < f.n - 2)
+                  f.cell = f.cell->val.p.snd.val.gc;
+              }
+            break;
+          
+          case RHO_VEC:
+            g->val.vec.vals[f.idx] = v;
+            g->val.vec.len = f.idx + 1;
+            break;
+          
+          case RHO_RECORD:
+            g->val.rec.vals[f.idx] = v;
+            break;
+          
+          case RHO_PVEC:
+            g->val.pvec->push (v);
+            break;
+          
+          case RHO_FUN:
+            g->val.fn.env[f.idx] = v;
+            break;
+          
+          case RHO_UPVAL:
+            g->val.uv.val = v;
+            break;
+          
+          case RHO_PROMISE:
+            g->val.pr.val = v;
+            break;
+          
+          case RHO_MAP:
+            if (f.idx & 1)
+              this->entries.push_back ({ g, f.key, v });
+            else
+              f.key = v;
+            break;
+          
+          default:
+            break;
+          }
+      }
+    };
+  }
+  
+  
+  
+  void
+  rho_value_save (rho_value& v, output_stream& out, virtual_machine& vm,
+                  const serial_code *code)
+  {
+    value_saver saver { out, vm, code };
+    saver.save (v);
+  }
+  
+  rho_value
+  rho_value_load (input_stream& in, virtual_machine& vm,
+                  const serial_code *code)
+  {
+    // objects are only reachable from the loader's tables until the load
+    // completes.
+    gc_disable_guard guard (vm.get_gc ());
+    
+    value_loader loader { in, vm, code };
+    auto v = loader.load ();
+    gc_protect (v);
+    return v;
+  }
+}
@@ -0,0 +1,545 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/textread.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/gc/gc.hpp"
+#include "runtime/io.hpp"
+#include "util/simd.hpp"
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+
+namespace rho {
+  
+#define TEXT_CHUNK_SIZE   (1 << 20)
+  
+  namespace {
+    
+    /* 
+     * Splits a stream into pieces ending at either of two delimiters, and
+     * refills its buffer from the stream as it goes.
+     */
+    class text_scanner
+    {
+      input_stream& in;
+      std::vector<char> buf;
+      long pos;
+      long len;
+      bool eof;
+      
+    public:
+      text_scanner (input_stream& in)
+        : in (in), buf (TEXT_CHUNK_SIZE)
+      {
+        this->pos = 0;
+        this->len = 0;
+        this->eof = false;
+      }
+      
+      /* 
+       * Points :p: and :n: at the text up to the next :a: or :b:, and sets
+       * :delim: to the delimiter found (or to 0 if the end of the file was
+       * reached first).  The text is valid until the next call.  Returns
+       * false once everything has been consumed.
+       */
+      bool
+      next (char a, char b, const char *& p, long& n, char& delim)
+      {
+        long scan = this->pos;
+        for (;;)
+          {
+            char *data = this->buf.data ();
+            long i = simd_find_byte2 (data + scan, this->len - scan, a, b);
+            if (i != -1)
+              {
+                p = data + this->pos;
+                n = scan + i - this->pos;
+                delim = data[scan + i];
+                this->pos = scan + i + 1;
+                return true;
+              }
+            
+            if (this->eof)
+              {
+                if (this->pos == this->len)
+                  return false;
+                
+                p = data + this->pos;
+                n = this->len - this->pos;
+                delim = 0;
+                this->pos = this->len;
+                return true;
+              }
+            
+            long scanned = this->len - this->pos;
+            this->refill ();
+            scan = this->pos + scanned;
+          }
+      }
+      
+      /* 
+       * Skips spaces and tabs (other than :sep:), and then an opening quote
+       * if there is one.  Returns true if there was.
+       */
+      bool
+      skip_quote (char sep)
+      {
+        for (;;)
+          {
+            if (this->pos == this->len && !this->refill ())
+              return false;
+            
+            char c = this->buf[this->pos];
+            if ((c == ' ' || c == '\t') && c != sep)
+              ++ this->pos;
+            else if (c == '"')
+              {
+                ++ this->pos;
+                return true;
+              }
+            else
+              return false;
+          }
+      }
+      
+      /* 
+       * Reads the rest of a quoted field (after its opening quote) into
+       * :out:, with doubled quotes turned back into single ones.  The field
+       * may span separators and line breaks.  Then acts like next() for the
+       * text between the closing quote and the next :a: or :b:.  Returns
+       * false if the closing quote is missing.
+       */
+      bool
+      next_quoted (char a, char b, std::string& out, const char *& p,
+                   long& n, char& delim)
+      {
+        out.clear ();
+        for (;;)
+          {
+            if (this->pos == this->len && !this->refill ())
+              return false;
+            
+            char *data = this->buf.data ();
+            auto q = (char *)std::memchr (data + this->pos, '"',
+                                          this->len - this->pos);
+            if (!q)
+              {
+                out.append (data + this->pos, this->len - this->pos);
+                this->pos = this->len;
+                continue;
+              }
+            
+            out.append (data + this->pos, q - (data + this->pos));
+            this->pos = q - data + 1;
+            
+            if (this->pos == this->len)
+              this->refill ();
+            if (this->pos < this->len && this->buf[this->pos] == '"')
+              {
+                out.push_back ('"');
+                ++ this->pos;
+                continue;
+              }
+            break;
+          }
+        
+        if (!this->next (a, b, p, n, delim))
+          {
+            n = 0;
+            delim = 0;
+          }
+        return true;
+      }
+      
+    private:
+      /* 
+       * Moves the unconsumed text to the front of the buffer, and reads more
+       * after it.  Returns false if nothing more could be read.
+       */
+      bool
+      refill ()
+      {
+        if (this->eof)
+          return false;
+        
+        char *data = this->buf.data ();
+        long keep = this->len - this->pos;
+        if (this->pos > 0)
+          std::memmove (data, data + this->pos, keep);
+        if (keep == (long)this->buf.size ())
+          this->buf.resize (this->buf.size () * 2);
+        this->pos = 0;
+        this->len = keep;
+        
+        long r = this->in.read_some (this->buf.data () + this->len,
+                                     (long)this->buf.size () - this->len);
+        if (r == 0)
+          this->eof = true;
+        this->len += r;
+        return r > 0;
+      }
+    };
+  }
+  
+  
+  
+  static inline bool
+  _is_space (char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+  
+  static const double _pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  
+  /* 
+   * Parses [p, end) as a decimal integer.  Returns 1 if it is one and fits
+   * in :x:, 2 if it is one but does not fit, and 0 if it is not an integer.
+   */
+  static int
+  _parse_int (const char *p, const char *end, long long& x)
+  {
+    bool neg = false;
+    if (p < end && (*p == '+' || *p == '-'))
+      neg = (*p ++ == '-');
+    if (p == end)
+      return 0;
+    
+    unsigned long long v = 0;
+    bool big = false;
+    for (; p < end; ++p)
+      {
+        unsigned c = (unsigned char)*p - '0';
+        if (c > 9)
+          return 0;
+        if (v > (~0ULL - c) / 10)
+          big = true;
+        else
+          v = v * 10 + c;
+      }
+    
+    if (big || v > (neg ? (1ULL << 63) : (1ULL << 63) - 1))
+      return 2;
+    x = neg ? (long long)(0 - v) : (long long)v;
+    return 1;
+  }
+  
+  /* 
+   * Parses [p, end) as a double.  Returns false if it is not one.
+   * 
+   * Numbers with at most 15 significant digits and a small exponent are
+   * converted exactly with a single multiplication or division (both the
+   * mantissa and the power of ten are exact doubles, so the result is
+   * correctly rounded); strtod takes care of everything else.
+   */
+  static bool
+  _parse_double (const char *p, const char *end, double& d)
+  {
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '+' || *s == '-'))
+      neg = (*s ++ == '-');
+    
+    unsigned long long m = 0;
+    int ndigits = 0;
+    int exp = 0;
+    bool any = false;
+    bool exact = true;
+    for (; s < end && (unsigned)(*s - '0') <= 9; ++s)
+      {
+        any = true;
+        if (ndigits < 19)
+          {
+            m = m * 10 + (*s - '0');
+            if (m)
+              ++ ndigits;
+          }
+        else
+          {
+            ++ exp;
+            exact &= (*s == '0');
+          }
+      }
+    if (s < end && *s == '.')
+      for (++ s; s < end && (unsigned)(*s - '0') <= 9; ++s)
+        {
+          any = true;
+          if (ndigits < 19)
+            {
+              m = m * 10 + (*s - '0');
+              if (m)
+                ++ ndigits;
+              -- exp;
+            }
+          else
+            exact &= (*s == '0');
+        }
+    if (any && s < end && (*s == 'e' || *s == 'E'))
+      {
+        ++ s;
+        bool eneg = false;
+        if (s < end && (*s == '+' || *s == '-'))
+          eneg = (*s ++ == '-');
+        if (s == end)
+          return false;
+        
+        int e = 0;
+        for (; s < end && (unsigned)(*s - '0') <= 9; ++s)
+          if (e < 100000)
+            e = e * 10 + (*s - '0');
+        exp += eneg ? -e : e;
+      }
+    
+    if (any && s == end && exact && ndigits <= 15
+        && exp >= -22 && exp <= 22)
+      {
+        d = (double)m;
+        d = (exp < 0) ? d / _pow10[-exp] : d * _pow10[exp];
+        if (neg)
+          d = -d;
+        return true;
+      }
+    
+    // anything else (long mantissas, large exponents, inf and nan), but not
+    // the hexadecimal floats that strtod also accepts.
+    for (s = p; s < end; ++s)
+      if (*s == 'x' || *s == 'X')
+        return false;
+    std::string str (p, end);
+    char *last;
+    d = std::strtod (str.c_str (), &last);
+    return last != str.c_str () && *last == '\0';
+  }
+  
+  /* 
+   * Parses a field of a row.  The result is protected.
+   */
+  static rho_value
+  _parse_field (const char *p, long n, virtual_machine& vm)
+  {
+    const char *end = p + n;
+    while (p < end && _is_space (*p))
+      ++ p;
+    while (end > p && _is_space (end[-1]))
+      -- end;
+    if (p == end)
+      return rho_value_make_nil ();
+    
+    long long x;
+    switch (_parse_int (p, end, x))
+      {
+      case 1:
+        if (x >= 0 && x <= VM_SMALL_INT_MAX)
+          return vm.get_prealloced_int ((int)x);
+        return rho_value_make_int64 (x, vm.get_gc ());
+      
+      case 2:
+        {
+          // GMP does not accept a leading plus sign.
+          std::string s ((*p == '+') ? p + 1 : p, end);
+          auto v = rho_value_make_int (vm.get_gc ());
+          mpz_set_str (v.val.gc->val.i, s.c_str (), 10);
+          return v;
+        }
+      }
+    
+    double d;
+    if (_parse_double (p, end, d))
+      return rho_value_make_double (d);
+    
+    return rho_value_make_string (p, end - p, vm.get_gc ());
+  }
+  
+  
+  
+  rho_value
+  rho_read_numbers (const std::string& path, rho_type type,
+                    virtual_machine& vm)
+  {
+    std::unique_ptr<input_stream> in { input_stream::open (path) };
+    text_scanner sc (*in);
+    bool f64 = (type == RHO_F64VEC);
+    std::vector<double> fv;
+    std::vector<long long> iv;
+    
+    const char *p;
+    long n;
+    char delim;
+    long line = 0;
+    while (sc.next ('\n', '\n', p, n, delim))
+      {
+        ++ line;
+        const char *end = p + n;
+        for (;;)
+          {
+            while (p < end && (_is_space (*p) || *p == ','))
+              ++ p;
+            if (p == end)
+              break;
+            
+            const char *q = p;
+            while (q < end && !_is_space (*q) && *q != ',')
+              ++ q;
+            
+            bool ok;
+            if (f64)
+              {
+                double d = 0;
+                ok = _parse_double (p, q, d);
+                fv.push_back (d);
+              }
+            else
+              {
+                long long x = 0;
+                int r = _parse_int (p, q, x);
+                if (r == 2)
+                  throw vm_error ("read_numbers: integer out of range on line "
+                    + std::to_string (line) + " of `" + path + "'");
+                ok = (r == 1);
+                iv.push_back (x);
+              }
+            
+            if (!ok)
+              throw vm_error ("read_numbers: expected a number on line "
+                + std::to_string (line) + " of `" + path + "'");
+            p = q;
+          }
+      }
+    
+    if (f64)
+      {
+        auto res = rho_value_make_f64vec ((long)fv.size (), vm.get_gc ());
+        std::copy (fv.begin (), fv.end (), res.val.gc->val.arr.f64);
+        return res;
+      }
+    
+    auto res = rho_value_make_i64vec ((long)iv.size (), vm.get_gc ());
+    std::copy (iv.begin (), iv.end (), res.val.gc->val.arr.i64);
+    return res;
+  }
+  
+  
+  
+  rho_value
+  rho_read_csv (const std::string& path, char sep, rho_value *fn,
+                virtual_machine& vm)
+  {
+    std::unique_ptr<input_stream> in { input_stream::open (path) };
+    text_scanner sc (*in);
+    auto& gc = vm.get_gc ();
+    
+    // the rows (and the row being read) are kept on the VM's stack, so that
+    // fields can be unprotected as soon as they are stored, and so that
+    // collections triggered by :fn: see them.
+    vm_root rows { vm, rho_value_make_nil () };
+    vm_root row { vm, rho_value_make_nil () };
+    long count = 0;
+    
+    auto append = [] (rho_value& vec, rho_value x) {
+      auto g = vec.val.gc;
+      rho_vec_reserve (g, g->val.vec.len + 1);
+      g->val.vec.vals[g->val.vec.len ++] = x;
+      gc_unprotect (x);
+    };
+    
+    // hands a complete row over to the caller's function, or appends it to
+    // the result.
+    auto finish_row = [&] () {
+      if (fn)
+        vm.call (*fn, row.get ());
+      else
+        append (rows.get (), row.get ());
+      
+      row.set (rho_value_make_nil ());
+      ++ count;
+    };
+    
+    if (!fn)
+      {
+        rows.set (rho_value_make_vec (16, gc));
+        gc_unprotect (rows.get ());
+      }
+    
+    const char *p;
+    long n;
+    char delim;
+    std::string quoted;
+    for (;;)
+      {
+        bool is_quoted = sc.skip_quote (sep);
+        if (is_quoted)
+          {
+            if (!sc.next_quoted (sep, '\n', quoted, p, n, delim))
+              throw vm_error ("read_csv: unterminated quoted field in `"
+                + path + "'");
+            for (long i = 0; i < n; ++i)
+              if (!_is_space (p[i]))
+                throw vm_error ("read_csv: unexpected text after a quoted "
+                  "field in `" + path + "'");
+          }
+        else if (!sc.next (sep, '\n', p, n, delim))
+          break;
+        
+        bool last = (delim != sep);
+        if (row.get ().type == RHO_NIL)
+          {
+            // skip blank lines
+            if (last && !is_quoted)
+              {
+                long i = 0;
+                while (i < n && _is_space (p[i]))
+                  ++ i;
+                if (i == n)
+                  continue;
+              }
+            
+            row.set (rho_value_make_vec (8, gc));
+            gc_unprotect (row.get ());
+          }
+        
+        // quoted fields are kept exactly as written.
+        if (is_quoted)
+          append (row.get (), rho_value_make_string (quoted.data (),
+                    (long)quoted.length (), gc));
+        else
+          append (row.get (), _parse_field (p, n, vm));
+        if (last)
+          finish_row ();
+      }
+    
+    // the last line ended with a separator, and so with an empty field.
+    if (row.get ().type != RHO_NIL)
+      {
+        append (row.get (), rho_value_make_nil ());
+        finish_row ();
+      }
+    
+    if (fn)
+      return rho_value_make_int64 (count, gc);
+    
+    // fresh results are returned protected (see native_fn).
+    gc_protect (rows.get ());
+    return rows.get ();
+  }
+}
@@ -20,10 +20,21 @@
 #include "runtime/gc/gc.hpp"
 #include "runtime/vm.hpp"
 #include "util/float.hpp"
+#include "util/poly.hpp"
+#include "runtime/expr.hpp"
+#include "runtime/coroutine.hpp"
+#include "runtime/map.hpp"
+#include "runtime/pvec.hpp"
+#include "runtime/memo.hpp"
+#include "runtime/io.hpp"
+#include "runtime/printer.hpp"
 #include <stdexcept>
 #include <sstream>
 #include <cstring>
+#include <cmath>
 #include <vector>
+#include <algorithm>
+#include <sys/mman.h>
 
 #include <iostream> // DEBUG
 
@@ -46,6 +57,7 @@ namespace rho {
       case RHO_NIL:
       case RHO_BOOL:
       case RHO_ATOM:
+      case RHO_DOUBLE:
         return false;
       
       case RHO_UPVAL:
@@ -56,6 +68,17 @@ namespace rho {
       case RHO_CONS:
       case RHO_STR:
       case RHO_FLOAT:
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+      case RHO_MATRIX:
+      case RHO_POLY:
+      case RHO_EXPR:
+      case RHO_PROMISE:
+      case RHO_COROUTINE:
+      case RHO_MAP:
+      case RHO_RECORD:
+      case RHO_PVEC:
+      case RHO_FILE:
         return true;
       }
     
@@ -64,6 +87,22 @@ namespace rho {
   
   
   
+  /* 
+   * Frees a vector's buffer, or drops its reference to the buffer if it is
+   * shared with slices.
+   */
+  static void
+  _release_vec_buffer (rho_value *vals, vec_store *store)
+  {
+    if (!store)
+      delete[] vals;
+    else if (-- store->refs == 0)
+      {
+        delete[] store->data;
+        delete store;
+      }
+  }
+  
   /* 
    * Reclaims memory used by the specified Rho value (but does not free the
    * value itself).
@@ -88,6 +127,8 @@ namespace rho {
       case RHO_BOOL:
       case RHO_UPVAL:
       case RHO_ATOM:
+      case RHO_DOUBLE:
+      case RHO_PROMISE:
         break;
       
       case RHO_INTEGER:
@@ -99,176 +140,71 @@ namespace rho {
         break;
       
       case RHO_VEC:
-        delete[] v->val.vec.vals;
+        _release_vec_buffer (v->val.vec.vals, v->val.vec.store);
         break;
       
-      case RHO_FUN:
-        delete[] v->val.fn.env;
+      case RHO_F64VEC:
+        if (v->val.arr.mapped)
+          munmap (v->val.arr.f64, v->val.arr.mapped);
+        else
+          delete[] v->val.arr.f64;
         break;
       
-      case RHO_STR:
-        delete[] v->val.s.str;
-        break;
-      }
-  }
-  
-  
-  
-  /*
-   * Applies gc_unprotect() recursively.
-   */
-  void
-  gc_unprotect_rec (rho_value& v)
-  {
-    gc_unprotect (v);
-    
-    switch (v.type)
-      {
-      case RHO_NIL:
-      case RHO_BOOL:
-      case RHO_EMPTY_LIST:
-      case RHO_PVAR:
-      case RHO_INTEGER:
-      case RHO_INTERNAL:
-      case RHO_ATOM:
-      case RHO_STR:
-      case RHO_FLOAT:
+      case RHO_I64VEC:
+        if (v->val.arr.mapped)
+          munmap (v->val.arr.i64, v->val.arr.mapped);
+        else
+          delete[] v->val.arr.i64;
         break;
       
-      case RHO_UPVAL:
-        gc_unprotect_rec (v.val.gc->val.uv.val);
+      case RHO_MATRIX:
+        delete[] v->val.mat.data;
         break;
       
-      case RHO_FUN:
-        // TODO
+      case RHO_POLY:
+        delete v->val.poly;
         break;
       
-      case RHO_CONS:
-        gc_unprotect_rec (v.val.gc->val.p.fst);
-        gc_unprotect_rec (v.val.gc->val.p.snd);
+      case RHO_EXPR:
+        {
+          auto n = v->val.expr;
+          if (n->table)
+            n->table->remove (v);
+          if (n->op == EXPR_NUM)
+            mpz_clear (n->num);
+          delete n;
+        }
         break;
       
-      case RHO_VEC:
-        for (int i = 0; i < v.val.gc->val.vec.len; ++i)
-          gc_unprotect_rec (v.val.gc->val.vec.vals[i]);
+      case RHO_COROUTINE:
+        delete[] v->val.co->stack;
+        delete v->val.co;
         break;
-      }
-  }
-  
-  
-  
-  static std::string
-  _escape_string (const char *str, long len)
-  {
-    std::string res;
-    res.push_back ('"');
-    
-    for (long i = 0; i < len; ++i)
-      {
-        switch (str[i])
-          {
-          case '"': res.append ("\\\""); break;
-          case '\n': res.append ("\\n"); break;
-          case '\r': res.append ("\\r"); break;
-          case '\t': res.append ("\\t"); break;
-          case '\\': res.append ("\\\\"); break;
-          case '\0': res.append ("\\0"); break;
-          
-          default:
-            res.push_back (str[i]);
-          }
-      }
-    
-    res.push_back ('"');
-    return res;
-  }
-  
-  /* 
-   * Returns a textual representation of the specified Rho value.
-   */
-  std::string
-  rho_value_str (rho_value& v, virtual_machine& vm)
-  {
-    switch (v.type)
-      {
-      case RHO_NIL:
-        return "nil";
-      
-      case RHO_EMPTY_LIST:
-        return "'()";
-      
-      case RHO_BOOL:
-        return v.val.b ? "true" : "false";
       
-      case RHO_ATOM:
-        return vm.get_atom_name (v.val.i32);
+      case RHO_MAP:
+        delete v->val.map;
+        break;
       
-      case RHO_CONS:
-        {
-          std::ostringstream ss;
-          ss << "'(" << rho_value_str (v.val.gc->val.p.fst, vm);
-          
-          auto curr = v.val.gc->val.p.snd;
-          while (curr.type == RHO_CONS)
-            {
-              ss << " " << rho_value_str (curr.val.gc->val.p.fst, vm);
-              curr = curr.val.gc->val.p.snd;
-            }
-          if (curr.type == RHO_EMPTY_LIST)
-            ss << ")";
-          else
-            ss << " . " << rho_value_str (curr, vm) << ")";
-          
-          return ss.str ();
-        }
+      case RHO_RECORD:
+        delete[] v->val.rec.vals;
+        break;
       
-      case RHO_INTEGER:
-        {
-          auto str = mpz_get_str (NULL, 10, v.val.gc->val.i);
-          std::string s = str;
-          
-          void (*freefunc) (void *, size_t);
-          mp_get_memory_functions (NULL, NULL, &freefunc);
-          freefunc (str, s.length () + 1);
-          
-          return s;
-        }
+      case RHO_PVEC:
+        delete v->val.pvec;
+        break;
       
-      case RHO_FLOAT:
-        {
-          int prec10 = vm.get_base10_prec ();
-          return float_to_str (v.val.gc->val.f, prec10);
-        }
+      case RHO_FILE:
+        delete v->val.file;
+        break;
       
       case RHO_FUN:
-        {
-          std::ostringstream ss;
-          ss << "<function " << (void *)v.val.gc << ">";
-          return ss.str ();
-        }
-      
-      case RHO_VEC:
-        {
-          std::ostringstream ss;
-          ss << "[";
-          
-          auto& vec = v.val.gc->val.vec;
-          for (long i = 0; i < vec.len; ++i)
-            {
-              ss << rho_value_str (vec.vals[i], vm);
-              if (i != vec.len - 1)
-                ss << ", ";
-            }
-          
-          ss << "]";
-          return ss.str ();
-        }
+        delete[] v->val.fn.env;
+        delete v->val.fn.memo;
+        break;
       
       case RHO_STR:
-        return _escape_string (v.val.gc->val.s.str, v.val.gc->val.s.len);
-      
-      default:
-        throw std::runtime_error ("rho_value_str: unhandled value type");
+        delete[] v->val.s.str;
+        break;
       }
   }
   
@@ -316,6 +252,20 @@ namespace rho {
     return v;
   }
   
+  rho_value
+  rho_value_make_int64 (long long val, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_INTEGER;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_INTEGER;
+    mpz_init_set_si (g->val.i, (long)val);
+    
+    v.val.gc = g;
+    return v;
+  }
+  
   rho_value
   rho_value_make_vec (long cap, garbage_collector& gc)
   {
@@ -329,11 +279,63 @@ namespace rho {
     vec.vals = new rho_value [cap];
     vec.cap = cap;
     vec.len = 0;
+    vec.store = nullptr;
     
     v.val.gc = g;
     return v;
   }
   
+  rho_value
+  rho_value_make_vec_slice (rho_value& src, long start, long end,
+                            garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_VEC;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_VEC;
+    
+    auto& sv = src.val.gc->val.vec;
+    if (!sv.store)
+      {
+        sv.store = new vec_store;
+        sv.store->refs = 1;
+        sv.store->data = sv.vals;
+      }
+    
+    // the slice can never grow in place, since the elements past its end
+    // belong to someone else.
+    auto& vec = g->val.vec;
+    vec.vals = sv.vals + start;
+    vec.len = vec.cap = end - start;
+    vec.store = sv.store;
+    ++ vec.store->refs;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  void
+  rho_vec_reserve (gc_value *v, long cap)
+  {
+    auto& vec = v->val.vec;
+    bool shared = vec.store && vec.store->refs > 1;
+    if (cap <= vec.cap && !shared)
+      return;
+    
+    long new_cap = vec.cap;
+    if (cap > vec.cap)
+      new_cap = std::max (cap, vec.cap * 2);
+    
+    auto vals = new rho_value [new_cap];
+    std::copy (vec.vals, vec.vals + vec.len, vals);
+    
+    _release_vec_buffer (vec.vals, vec.store);
+    vec.vals = vals;
+    vec.cap = new_cap;
+    vec.store = nullptr;
+  }
+  
   rho_value
   rho_value_make_function (const unsigned char *cp, int env_len,
                            garbage_collector& gc)
@@ -345,6 +347,7 @@ namespace rho {
     g->type = RHO_FUN;
     g->val.fn.cp = cp;
     g->val.fn.env_len = env_len;
+    g->val.fn.memo = nullptr;
     g->val.fn.env = new rho_value [env_len];
     for (int i = 0; i < env_len; ++i)
       g->val.fn.env[i].type = RHO_NIL;
@@ -405,6 +408,78 @@ namespace rho {
     g->val.s.str = new char [len + 1];
     std::memcpy (g->val.s.str, str, len);
     g->val.s.str[len] = '\0';
+    g->val.s.left = g->val.s.right = nullptr;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  
+  
+  // concatenations no longer than this are copied out instead of forming a
+  // rope.
+#define STR_ROPE_MIN  64
+  
+  void
+  rho_str_flatten (gc_value *s)
+  {
+    auto& rs = s->val.s;
+    if (rs.str)
+      return;
+    
+    char *buf = new char [rs.len + 1];
+    long pos = 0;
+    
+    // ropes built by appending in a loop are as deep as they are long, so
+    // walk the leaves with an explicit stack rather than recursively.
+    std::vector<gc_value *> stk { s };
+    while (!stk.empty ())
+      {
+        auto n = stk.back ();
+        stk.pop_back ();
+        
+        auto& ns = n->val.s;
+        if (ns.str)
+          {
+            std::memcpy (buf + pos, ns.str, ns.len);
+            pos += ns.len;
+          }
+        else
+          {
+            stk.push_back (ns.right);
+            stk.push_back (ns.left);
+          }
+      }
+    
+    buf[rs.len] = '\0';
+    rs.str = buf;
+    rs.left = rs.right = nullptr;
+  }
+  
+  rho_value
+  rho_str_concat (rho_value& lhs, rho_value& rhs, garbage_collector& gc)
+  {
+    auto& s1 = lhs.val.gc->val.s;
+    auto& s2 = rhs.val.gc->val.s;
+    long len = s1.len + s2.len;
+    
+    if (len <= STR_ROPE_MIN)
+      {
+        char buf[STR_ROPE_MIN];
+        std::memcpy (buf, rho_str_chars (lhs.val.gc), s1.len);
+        std::memcpy (buf + s1.len, rho_str_chars (rhs.val.gc), s2.len);
+        return rho_value_make_string (buf, len, gc);
+      }
+    
+    rho_value v;
+    v.type = RHO_STR;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_STR;
+    g->val.s.str = nullptr;
+    g->val.s.len = len;
+    g->val.s.left = lhs.val.gc;
+    g->val.s.right = rhs.val.gc;
     
     v.val.gc = g;
     return v;
@@ -439,31 +514,202 @@ namespace rho {
     return v;
   }
   
+  rho_value
+  rho_value_make_f64vec (long len, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_F64VEC;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_F64VEC;
+    g->val.arr.f64 = new double [len] ();
+    g->val.arr.len = len;
+    g->val.arr.mapped = 0;
+    
+    v.val.gc = g;
+    return v;
+  }
   
+  rho_value
+  rho_value_make_i64vec (long len, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_I64VEC;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_I64VEC;
+    g->val.arr.i64 = new long long [len] ();
+    g->val.arr.len = len;
+    g->val.arr.mapped = 0;
+    
+    v.val.gc = g;
+    return v;
+  }
   
-  static std::string
-  _format_string (gc_value *str, rho_value& args_, virtual_machine& vm)
+  rho_value
+  rho_value_make_mapped_array (rho_type type, void *data, long len, long size,
+                               garbage_collector& gc)
   {
-    std::ostringstream ss;
+    rho_value v;
+    v.type = type;
     
-    std::vector<rho_value> args;
-    if (args_.type == RHO_CONS)
-      {
-        auto p = args_;
-        while (p.val.gc->val.p.snd.type == RHO_CONS)
-          {
-            args.push_back (p.val.gc->val.p.fst);
-            p = p.val.gc->val.p.snd;
-          }
-        args.push_back (p.val.gc->val.p.fst);
-      }
+    auto g = gc.alloc_protected ();
+    g->type = type;
+    if (type == RHO_F64VEC)
+      g->val.arr.f64 = (double *)data;
     else
-      args.push_back (args_);
+      g->val.arr.i64 = (long long *)data;
+    g->val.arr.len = len;
+    g->val.arr.mapped = size;
     
-    auto& s = str->val.s;
-    for (long i = 0; i < s.len; ++i)
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_matrix (int rows, int cols, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_MATRIX;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_MATRIX;
+    g->val.mat.data = new double [(long)rows * cols] ();
+    g->val.mat.rows = rows;
+    g->val.mat.cols = cols;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_poly (zpoly&& p, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_POLY;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_POLY;
+    g->val.poly = new zpoly (std::move (p));
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_promise (rho_value& fn, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_PROMISE;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_PROMISE;
+    g->val.pr.val = fn;
+    g->val.pr.forced = false;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_map (long cap, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_MAP;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_MAP;
+    g->val.map = new rho_map (cap);
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_record (int tag, int len, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_RECORD;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_RECORD;
+    
+    auto& rec = g->val.rec;
+    rec.vals = new rho_value [len];
+    rec.len = len;
+    rec.tag = tag;
+    for (int i = 0; i < len; ++i)
+      rec.vals[i] = rho_value_make_nil ();
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_pvec (rho_pvec *pv, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_PVEC;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_PVEC;
+    g->val.pvec = pv;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  rho_value
+  rho_value_make_file (output_stream *file, garbage_collector& gc)
+  {
+    rho_value v;
+    v.type = RHO_FILE;
+    
+    auto g = gc.alloc_protected ();
+    g->type = RHO_FILE;
+    g->val.file = file;
+    
+    v.val.gc = g;
+    return v;
+  }
+  
+  
+  
+  // format program instructions:
+#define FMT_END     0
+#define FMT_TEXT    1   // int length, characters
+#define FMT_ARG     2   // int index (-1 for all arguments), flags
+  
+#define FMT_FLAG_ESCAPE   1
+  
+  static void
+  _put_int (std::string& prog, int v)
+  {
+    prog.append ((const char *)&v, 4);
+  }
+  
+  static void
+  _flush_text (std::string& prog, std::string& text)
+  {
+    if (text.empty ())
+      return;
+    
+    prog.push_back (FMT_TEXT);
+    _put_int (prog, (int)text.length ());
+    prog.append (text);
+    text.clear ();
+  }
+  
+  void
+  rho_format_compile (const char *str, long len, std::string& prog)
+  {
+    std::string body, text;
+    int need = 0;
+    int text_len = 0;
+    
+    for (long i = 0; i < len; ++i)
       {
-        if (s.str[i] == '{')
+        if (str[i] == '{')
           {
             ++ i;
             
@@ -471,31 +717,31 @@ namespace rho {
             bool escape_str = false;
             
             int idx = 0;
-            while (i < s.len)
+            while (i < len)
               {
-                if (s.str[i] >= '0' && s.str[i] <= '9')
+                if (str[i] >= '0' && str[i] <= '9')
                   {
-                    idx = (idx * 10) + (s.str[i] - '0');
+                    idx = (idx * 10) + (str[i] - '0');
                     ++ i;
                   }
-                else if (s.str[i] == '*')
+                else if (str[i] == '*')
                   {
                     idx = -1;
                     ++ i;
                     
-                    if (i == s.len || (s.str[i] != '}' && s.str[i] != ':'))
+                    if (i == len || (str[i] != '}' && str[i] != ':'))
                       throw vm_error ("invalid format string");
                   }
-                else if (s.str[i] == '}')
+                else if (str[i] == '}')
                   break;
-                else if (s.str[i] == ':')
+                else if (str[i] == ':')
                   {
                     // parse flags
                     
                     ++ i;
-                    while (i < s.len)
+                    while (i < len)
                       {
-                        switch (s.str[i++])
+                        switch (str[i++])
                           {
                           case 'E': escape_str = true; break;
                           
@@ -508,47 +754,264 @@ namespace rho {
                     
                   flags_done:
                     
-                    if (i == s.len || s.str[i] != '}')
+                    if (i == len || str[i] != '}')
                       throw vm_error ("invalid format string");
                     break;
                   }
                 else
                   throw vm_error ("invalid format string");
               }
-            if (i == s.len || s.str[i] != '}')
+            if (i == len || str[i] != '}')
               throw vm_error ("invalid format string");
             
-            if (idx >= (int)args.size ())
-              throw vm_error ("index out of range in format string");
-            
-            auto arg = (idx == -1) ? args_ : args[idx];
-            if (arg.type == RHO_STR)
-              ss << (escape_str
-                ? _escape_string (arg.val.gc->val.s.str, arg.val.gc->val.s.len)
-                : arg.val.gc->val.s.str);
-            else
-              ss << rho_value_str (arg, vm);
+            text_len += text.length ();
+            _flush_text (body, text);
+            body.push_back (FMT_ARG);
+            _put_int (body, idx);
+            body.push_back (escape_str ? FMT_FLAG_ESCAPE : 0);
+            need = _max (need, idx + 1);
           }
-        else if (s.str[i] == '\\')
+        else if (str[i] == '\\')
           {
-            if (++i == s.len)
+            if (++i == len)
               throw vm_error ("invalid format string");
             
-            switch (s.str[i])
+            switch (str[i])
               {
-              case 'n': ss << '\n'; break;
-              case 't': ss << '\t'; break;
-              case 'b': ss << '\b'; break;
-              case 'r': ss << '\n'; break;
+              case 'n': text.push_back ('\n'); break;
+              case 't': text.push_back ('\t'); break;
+              case 'b': text.push_back ('\b'); break;
+              case 'r': text.push_back ('\n'); break;
               
-              default: ss << s.str[i]; break;
+              default: text.push_back (str[i]); break;
               }
           }
         else
-          ss << s.str[i];
+          text.push_back (str[i]);
+      }
+    
+    text_len += text.length ();
+    _flush_text (body, text);
+    body.push_back (FMT_END);
+    
+    _put_int (prog, need);
+    _put_int (prog, text_len);
+    prog.append (body);
+  }
+  
+  long
+  rho_format_check (const unsigned char *prog, long avail)
+  {
+    if (avail < 8)
+      return -1;
+    int need, n;
+    std::memcpy (&need, prog, 4);
+    std::memcpy (&n, prog + 4, 4);
+    if (need < 0 || n < 0)
+      return -1;
+    
+    long i = 8;
+    while (i < avail)
+      switch (prog[i++])
+        {
+        case FMT_TEXT:
+          if (avail - i < 4)
+            return -1;
+          std::memcpy (&n, prog + i, 4);
+          if (n < 0 || avail - i - 4 < n)
+            return -1;
+          i += 4 + n;
+          break;
+        
+        case FMT_ARG:
+          if (avail - i < 5)
+            return -1;
+          std::memcpy (&n, prog + i, 4);
+          if (n < -1 || n >= need)
+            return -1;
+          i += 5;
+          break;
+        
+        case FMT_END:
+          return i;
+        
+        default:
+          return -1;
+        }
+    
+    return -1;
+  }
+  
+  rho_value
+  rho_format_run (const unsigned char *& prog, rho_value& args_,
+                  virtual_machine& vm)
+  {
+    int need = *(int *)prog;
+    int text_len = *(int *)(prog + 4);
+    prog += 8;
+    
+    // only the arguments the program refers to are looked at, and most
+    // format strings refer to just a few.
+    rho_value small[8];
+    std::vector<rho_value> big;
+    rho_value *args = small;
+    if (need > 8)
+      {
+        big.resize (need);
+        args = big.data ();
       }
     
-    return ss.str ();
+    int argc = 0;
+    if (args_.type == RHO_CONS)
+      for (rho_value p = args_; p.type == RHO_CONS && argc < need;
+           p = p.val.gc->val.p.snd)
+        args[argc++] = p.val.gc->val.p.fst;
+    else if (need > 0)
+      args[argc++] = args_;
+    if (argc < need)
+      throw vm_error ("index out of range in format string");
+    
+    std::string out;
+    out.reserve (text_len + 16 * need);
+    for (;;)
+      switch (*prog++)
+        {
+        case FMT_TEXT:
+          {
+            int n = *(int *)prog;
+            out.append ((const char *)prog + 4, n);
+            prog += 4 + n;
+          }
+          break;
+        
+        case FMT_ARG:
+          {
+            int idx = *(int *)prog;
+            int flags = prog[4];
+            prog += 5;
+            
+            // strings are printed in quotes only when escaped.
+            auto& arg = (idx == -1) ? args_ : args[idx];
+            if (arg.type == RHO_STR && !(flags & FMT_FLAG_ESCAPE))
+              out.append (rho_str_chars (arg.val.gc), arg.val.gc->val.s.len);
+            else
+              {
+                print_sink sink { out };
+                rho_value_print (arg, sink, vm);
+              }
+          }
+          break;
+        
+        case FMT_END:
+          return rho_value_make_string (out.c_str (), out.length (),
+                                        vm.get_gc ());
+        }
+  }
+  
+  
+  
+  enum arith_op
+  {
+    AOP_ADD,
+    AOP_SUB,
+    AOP_MUL,
+    AOP_DIV,
+    AOP_POW,
+    AOP_MOD,
+  };
+  
+  static bool
+  _get_double (rho_value& v, double& out)
+  {
+    switch (v.type)
+      {
+      case RHO_DOUBLE:
+        out = v.val.f64;
+        return true;
+      
+      case RHO_INTEGER:
+        out = mpz_get_d (v.val.gc->val.i);
+        return true;
+      
+      default:
+        return false;
+      }
+  }
+  
+  static void
+  _mpfr_arith (mpfr_t dest, mpfr_t a, mpfr_t b, arith_op op)
+  {
+    switch (op)
+      {
+      case AOP_ADD: mpfr_add (dest, a, b, MPFR_RNDN); break;
+      case AOP_SUB: mpfr_sub (dest, a, b, MPFR_RNDN); break;
+      case AOP_MUL: mpfr_mul (dest, a, b, MPFR_RNDN); break;
+      case AOP_DIV: mpfr_div (dest, a, b, MPFR_RNDN); break;
+      case AOP_POW: mpfr_pow (dest, a, b, MPFR_RNDN); break;
+      case AOP_MOD: mpfr_fmod (dest, a, b, MPFR_RNDN); break;
+      }
+  }
+  
+  /* 
+   * Arithmetic involving an expression produces an expression.  Pattern
+   * variables are included so that patterns such as `u * (v + w)' can be
+   * written using ordinary operators.
+   */
+  static inline bool
+  _is_symbolic (rho_value& v)
+    { return v.type == RHO_EXPR || v.type == RHO_PVAR; }
+  
+  /* 
+   * Performs an arithmetic operation in which at least one of the operands is
+   * an unboxed double.
+   * 
+   * Doubles combined with integers or other doubles produce a double.
+   * Doubles combined with MPFR floats are promoted to the (higher) precision
+   * of the MPFR operand.
+   */
+  static rho_value
+  _double_arith (rho_value& lhs, rho_value& rhs, arith_op op,
+                 virtual_machine& vm)
+  {
+    if (lhs.type == RHO_FLOAT || rhs.type == RHO_FLOAT)
+      {
+        auto& other = (lhs.type == RHO_FLOAT) ? rhs : lhs;
+        auto& fv = (lhs.type == RHO_FLOAT) ? lhs : rhs;
+        if (other.type != RHO_DOUBLE)
+          return rho_value_make_nil ();
+        
+        int prec = mpfr_get_prec (fv.val.gc->val.f);
+        auto res = rho_value_make_float (prec, vm.get_gc ());
+        auto& dest = res.val.gc->val.f;
+        
+        mpfr_t tmp;
+        mpfr_init2 (tmp, FLOAT_DOUBLE_PREC);
+        mpfr_set_d (tmp, other.val.f64, MPFR_RNDN);
+        
+        if (lhs.type == RHO_FLOAT)
+          _mpfr_arith (dest, lhs.val.gc->val.f, tmp, op);
+        else
+          _mpfr_arith (dest, tmp, rhs.val.gc->val.f, op);
+        
+        mpfr_clear (tmp);
+        return res;
+      }
+    
+    double a, b;
+    if (!_get_double (lhs, a) || !_get_double (rhs, b))
+      return rho_value_make_nil ();
+    
+    switch (op)
+      {
+      case AOP_ADD: return rho_value_make_double (a + b);
+      case AOP_SUB: return rho_value_make_double (a - b);
+      case AOP_MUL: return rho_value_make_double (a * b);
+      case AOP_DIV: return rho_value_make_double (a / b);
+      case AOP_POW: return rho_value_make_double (std::pow (a, b));
+      case AOP_MOD: return rho_value_make_double (std::fmod (a, b));
+      }
+    
+    return rho_value_make_nil ();
   }
   
   
@@ -556,6 +1019,11 @@ namespace rho {
   rho_value
   rho_value_add (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if (_is_symbolic (lhs) || _is_symbolic (rhs))
+      return expr_add (lhs, rhs, vm);
+    if (lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+      return _double_arith (lhs, rhs, AOP_ADD, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -618,6 +1086,11 @@ namespace rho {
           }
         break;
       
+      case RHO_STR:
+        if (rhs.type == RHO_STR)
+          return rho_str_concat (lhs, rhs, vm.get_gc ());
+        return rho_value_make_nil ();
+      
       default:
         return rho_value_make_nil ();
       }
@@ -626,6 +1099,11 @@ namespace rho {
   rho_value
   rho_value_sub (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if (_is_symbolic (lhs) || _is_symbolic (rhs))
+      return expr_sub (lhs, rhs, vm);
+    if (lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+      return _double_arith (lhs, rhs, AOP_SUB, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -696,6 +1174,11 @@ namespace rho {
   rho_value
   rho_value_mul (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if (_is_symbolic (lhs) || _is_symbolic (rhs))
+      return expr_mul (lhs, rhs, vm);
+    if (lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+      return _double_arith (lhs, rhs, AOP_MUL, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -766,6 +1249,11 @@ namespace rho {
   rho_value
   rho_value_div (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if (_is_symbolic (lhs) || _is_symbolic (rhs))
+      return expr_div (lhs, rhs, vm);
+    if (lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+      return _double_arith (lhs, rhs, AOP_DIV, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -836,6 +1324,11 @@ namespace rho {
   rho_value
   rho_value_pow (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if (_is_symbolic (lhs) || _is_symbolic (rhs))
+      return expr_pow (lhs, rhs, vm);
+    if (lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+      return _double_arith (lhs, rhs, AOP_POW, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -906,6 +1399,10 @@ namespace rho {
   rho_value
   rho_value_mod (rho_value& lhs, rho_value& rhs, virtual_machine& vm)
   {
+    if ((lhs.type == RHO_DOUBLE || rhs.type == RHO_DOUBLE)
+        && lhs.type != RHO_STR)
+      return _double_arith (lhs, rhs, AOP_MOD, vm);
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -977,9 +1474,13 @@ namespace rho {
       
       case RHO_STR:
         {
-          auto str = _format_string (lhs.val.gc, rhs, vm);
-          auto res = rho_value_make_string (str.c_str (), str.length (), vm.get_gc ());
-          return res;
+          // format strings that are literal are compiled once, by the
+          // compiler; this handles the rest.
+          std::string prog;
+          rho_format_compile (rho_str_chars (lhs.val.gc),
+                              lhs.val.gc->val.s.len, prog);
+          auto ptr = (const unsigned char *)prog.data ();
+          return rho_format_run (ptr, rhs, vm);
         }
         break;
       
@@ -990,9 +1491,84 @@ namespace rho {
   
   
   
+  /* 
+   * Compares two numeric values (integers, unboxed doubles or MPFR floats).
+   * Returns false if either of the values is not a number.
+   */
+  static bool
+  _numeric_cmp (rho_value& lhs, rho_value& rhs, int& res)
+  {
+    switch (lhs.type)
+      {
+      case RHO_INTEGER:
+        switch (rhs.type)
+          {
+          case RHO_INTEGER:
+            res = mpz_cmp (lhs.val.gc->val.i, rhs.val.gc->val.i);
+            return true;
+          
+          case RHO_DOUBLE:
+            res = mpz_cmp_d (lhs.val.gc->val.i, rhs.val.f64);
+            return true;
+          
+          case RHO_FLOAT:
+            res = -mpfr_cmp_z (rhs.val.gc->val.f, lhs.val.gc->val.i);
+            return true;
+          
+          default:
+            return false;
+          }
+      
+      case RHO_DOUBLE:
+        switch (rhs.type)
+          {
+          case RHO_INTEGER:
+            res = -mpz_cmp_d (rhs.val.gc->val.i, lhs.val.f64);
+            return true;
+          
+          case RHO_DOUBLE:
+            res = (lhs.val.f64 > rhs.val.f64) - (lhs.val.f64 < rhs.val.f64);
+            return true;
+          
+          case RHO_FLOAT:
+            res = -mpfr_cmp_d (rhs.val.gc->val.f, lhs.val.f64);
+            return true;
+          
+          default:
+            return false;
+          }
+      
+      case RHO_FLOAT:
+        switch (rhs.type)
+          {
+          case RHO_INTEGER:
+            res = mpfr_cmp_z (lhs.val.gc->val.f, rhs.val.gc->val.i);
+            return true;
+          
+          case RHO_DOUBLE:
+            res = mpfr_cmp_d (lhs.val.gc->val.f, rhs.val.f64);
+            return true;
+          
+          case RHO_FLOAT:
+            res = mpfr_cmp (lhs.val.gc->val.f, rhs.val.gc->val.f);
+            return true;
+          
+          default:
+            return false;
+          }
+      
+      default:
+        return false;
+      }
+  }
+  
   bool
   rho_value_cmp_eq (rho_value& lhs, rho_value& rhs)
   {
+    int c;
+    if (_numeric_cmp (lhs, rhs, c))
+      return c == 0;
+    
     switch (lhs.type)
       {
       case RHO_BOOL:
@@ -1039,7 +1615,9 @@ namespace rho {
             {
               auto& s1 = lhs.val.gc->val.s;
               auto& s2 = rhs.val.gc->val.s;
-              return s1.len == s2.len && std::memcpy (s1.str, s2.str, s1.len) == 0;
+              return s1.len == s2.len
+                && std::memcmp (rho_str_chars (lhs.val.gc),
+                                rho_str_chars (rhs.val.gc), s1.len) == 0;
             }
           
           default:
@@ -1058,6 +1636,18 @@ namespace rho {
           }
         break;
       
+      // expressions are hash-consed
+      case RHO_EXPR:
+        return rhs.type == RHO_EXPR && lhs.val.gc == rhs.val.gc;
+      
+      case RHO_PROMISE:
+      case RHO_COROUTINE:
+      case RHO_MAP:
+      case RHO_RECORD:
+      case RHO_PVEC:
+      case RHO_FILE:
+        return rhs.type == lhs.type && lhs.val.gc == rhs.val.gc;
+      
       default:
         return false;
       }
@@ -1072,6 +1662,10 @@ namespace rho {
   bool
   rho_value_cmp_lt (rho_value& lhs, rho_value& rhs)
   {
+    int c;
+    if (_numeric_cmp (lhs, rhs, c))
+      return c < 0;
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -1094,6 +1688,10 @@ namespace rho {
   bool
   rho_value_cmp_lte (rho_value& lhs, rho_value& rhs)
   {
+    int c;
+    if (_numeric_cmp (lhs, rhs, c))
+      return c <= 0;
+    
     switch (lhs.type)
       {
       case RHO_INTEGER:
@@ -1146,6 +1744,9 @@ namespace rho {
       case RHO_FLOAT:
         return mpfr_sgn (v.val.gc->val.f) == 0;
       
+      case RHO_DOUBLE:
+        return v.val.f64 == 0.0;
+      
       default:
         return false;
       }
@@ -1164,6 +1765,17 @@ namespace rho {
       case RHO_UPVAL:
       case RHO_VEC:
       case RHO_STR:
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+      case RHO_MATRIX:
+      case RHO_POLY:
+      case RHO_EXPR:
+      case RHO_PROMISE:
+      case RHO_COROUTINE:
+      case RHO_MAP:
+      case RHO_RECORD:
+      case RHO_PVEC:
+      case RHO_FILE:
         return lhs.val.gc == rhs.val.gc;
       
       case RHO_ATOM:
@@ -1178,6 +1790,9 @@ namespace rho {
       case RHO_FLOAT:
         return mpfr_cmp (lhs.val.gc->val.f, rhs.val.gc->val.f) == 0;
       
+      case RHO_DOUBLE:
+        return lhs.val.f64 == rhs.val.f64;
+      
       case RHO_INTERNAL:
         return lhs.val.i64 == rhs.val.i64;
       
@@ -1195,13 +1810,19 @@ namespace rho {
   
   
   static bool
-  _match (rho_value& pat, rho_value& val, rho_value *stack, int& idx)
+  _match (rho_value& pat, rho_value& val, rho_value *stack, int& idx,
+          virtual_machine& vm)
   {
     if (pat.type == RHO_PVAR)
       {
         stack[idx++] = val;
         return true;
       }
+    else if (pat.type == RHO_INTEGER && val.type == RHO_EXPR)
+      {
+        auto n = val.val.gc->val.expr;
+        return n->op == EXPR_NUM && mpz_cmp (pat.val.gc->val.i, n->num) == 0;
+      }
     else if (pat.type != val.type)
       return false;
     
@@ -1216,6 +1837,9 @@ namespace rho {
       case RHO_FLOAT:
         return mpfr_cmp (pat.val.gc->val.f, val.val.gc->val.f) == 0;
       
+      case RHO_DOUBLE:
+        return pat.val.f64 == val.val.f64;
+      
       case RHO_BOOL:
         return pat.val.b == val.val.b;
       
@@ -1223,7 +1847,9 @@ namespace rho {
         {
           auto& s1 = pat.val.gc->val.s;
           auto& s2 = val.val.gc->val.s;
-          return s1.len == s2.len && std::memcpy (s1.str, s2.str, s1.len) == 0;
+          return s1.len == s2.len
+            && std::memcmp (rho_str_chars (pat.val.gc),
+                            rho_str_chars (val.val.gc), s1.len) == 0;
         }
       
       case RHO_NIL:
@@ -1231,15 +1857,44 @@ namespace rho {
         return true;
       
       case RHO_CONS:
-        return _match (pat.val.gc->val.p.fst, val.val.gc->val.p.fst, stack, idx)
-          && _match (pat.val.gc->val.p.snd, val.val.gc->val.p.snd, stack, idx);
+        return _match (pat.val.gc->val.p.fst, val.val.gc->val.p.fst, stack, idx, vm)
+          && _match (pat.val.gc->val.p.snd, val.val.gc->val.p.snd, stack, idx, vm);
+      
+      case RHO_RECORD:
+        {
+          auto& pr = pat.val.gc->val.rec;
+          auto& vr = val.val.gc->val.rec;
+          if (pr.tag != vr.tag || pr.len != vr.len)
+            return false;
+          for (int i = 0; i < pr.len; ++i)
+            if (!_match (pr.vals[i], vr.vals[i], stack, idx, vm))
+              return false;
+          return true;
+        }
+      
+      case RHO_EXPR:
+        {
+          // pattern variables inside expressions know their own index
+          auto pn = pat.val.gc->val.expr;
+          idx += pn->npvars;
+          return expr_match (pat.val.gc, val.val.gc, stack, vm);
+        }
        
       case RHO_VEC:
+      case RHO_F64VEC:
+      case RHO_I64VEC:
+      case RHO_MATRIX:
+      case RHO_POLY:
+      case RHO_MAP:
+      case RHO_PVEC:
         // TODO
         return false;
        
       case RHO_PVAR:
       case RHO_FUN:
+      case RHO_PROMISE:
+      case RHO_COROUTINE:
+      case RHO_FILE:
       case RHO_INTERNAL:
       case RHO_UPVAL:
         return false;
@@ -1252,10 +1907,11 @@ namespace rho {
    * Attempts to match the specified value against the given pattern.
    */
   bool
-  rho_value_match (rho_value& pat, rho_value& val, rho_value *stack)
+  rho_value_match (rho_value& pat, rho_value& val, rho_value *stack,
+                   virtual_machine& vm)
   {
     int idx = 0;
-    return _match (pat, val, stack, idx);
+    return _match (pat, val, stack, idx, vm);
   }
 }
 
@@ -0,0 +1,683 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "runtime/verifier.hpp"
+#include "runtime/vm.hpp"
+#include "runtime/builtins.hpp"
+#include "runtime/value.hpp"
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+
+namespace rho {
+  
+  // no well-formed program comes anywhere near this.
+#define VERIFY_MAX_DEPTH  (1 << 24)
+  
+  namespace {
+    
+    // a micro-frame opened by push_microframe, and the depth of the stack
+    // below it.
+    struct vmframe
+    {
+      int parent;
+      int start;
+    };
+    
+    
+    class verifier
+    {
+      const unsigned char *code;
+      long size;
+      
+      // the state of the stack before each instruction.  The depth is -1
+      // until the instruction is reached, and the owner is the function the
+      // instruction belongs to (-1 for top-level code).
+      std::vector<int> depth;
+      std::vector<int> mframe;
+      std::vector<int> owner;
+      
+      std::vector<vmframe> mframes;
+      std::vector<long> work;
+      
+      std::vector<long> entries;
+      std::vector<int> fdepths;
+      std::vector<int> globals;
+      int top_depth;
+      
+    public:
+      verifier (const unsigned char *code, long size)
+        : code (code), size (size), depth (size, -1), mframe (size),
+          owner (size)
+      {
+        this->top_depth = 0;
+      }
+      
+    public:
+      code_info
+      run ()
+      {
+        if (this->size == 0)
+          throw vm_error ("invalid bytecode: no code");
+        
+        this->reach (0, 0, 0, -1, -1);
+        while (!this->work.empty ())
+          {
+            long off = this->work.back ();
+            this->work.pop_back ();
+            this->step (off);
+          }
+        
+        code_info info;
+        info.top_depth = this->top_depth;
+        info.max_frame = 0;
+        info.globals = std::move (this->globals);
+        
+        std::vector<std::pair<long, int>> funs;
+        for (size_t i = 0; i < this->entries.size (); ++i)
+          funs.emplace_back (this->entries[i], this->fdepths[i]);
+        std::sort (funs.begin (), funs.end ());
+        for (auto& f : funs)
+          {
+            info.funs.push_back (f.first);
+            info.depths.push_back (f.second);
+            info.max_frame = std::max (info.max_frame, f.second);
+          }
+        
+        return info;
+      }
+      
+    private:
+      [[noreturn]] static void
+      fail (long off, const std::string& msg)
+      {
+        throw vm_error ("invalid bytecode at offset " + std::to_string (off)
+          + ": " + msg);
+      }
+      
+      static int
+      get_int (const unsigned char *p)
+      {
+        int v;
+        std::memcpy (&v, p, 4);
+        return v;
+      }
+      
+      static unsigned
+      get_u16 (const unsigned char *p)
+      {
+        unsigned short v;
+        std::memcpy (&v, p, 2);
+        return v;
+      }
+      
+      
+      
+      /* 
+       * Records the state the stack is in when the instruction at :to: is
+       * reached from the one at :from:, and queues the instruction if it
+       * has not been reached before.
+       */
+      void
+      reach (long from, long to, int d, int mf, int fn)
+      {
+        if (to < 0 || to >= this->size)
+          fail (from, "jump outside of the code");
+        
+        if (this->depth[to] == -1)
+          {
+            this->depth[to] = d;
+            this->mframe[to] = mf;
+            this->owner[to] = fn;
+            this->work.push_back (to);
+          }
+        else if (this->owner[to] != fn)
+          fail (from, "jump into the code of another function");
+        else if (this->depth[to] != d || this->mframe[to] != mf)
+          fail (from, "the stack differs between paths that meet at offset "
+            + std::to_string (to));
+      }
+      
+      void
+      use_global (const unsigned char *p)
+      {
+        unsigned page = get_u16 (p), idx = get_u16 (p + 2);
+        if (this->globals.size () <= page)
+          this->globals.resize (page + 1, 0);
+        this->globals[page] = std::max (this->globals[page], (int)idx + 1);
+      }
+      
+      /* 
+       * Queues the function that starts at :entry:, created by the
+       * instruction at :from:.
+       */
+      void
+      add_fun (long from, long entry)
+      {
+        if (entry < 0 || entry >= this->size)
+          fail (from, "function starts outside of the code");
+        
+        if (this->depth[entry] == -1)
+          {
+            int id = (int)this->entries.size ();
+            this->entries.push_back (entry);
+            this->fdepths.push_back (6);
+            this->reach (from, entry, 6, -1, id);
+          }
+        else
+          {
+            int fn = this->owner[entry];
+            if (fn == -1 || this->entries[fn] != entry)
+              fail (from, "function starts inside other code");
+          }
+      }
+      
+      
+      
+      void
+      step (long off)
+      {
+        int d = this->depth[off];
+        int mf = this->mframe[off];
+        int fn = this->owner[off];
+        int base = (fn == -1) ? 0 : 6;
+        
+        const unsigned char *p = this->code + off;
+        long avail = this->size - off;
+        
+        long len = 1;       // length of the instruction
+        int pops = 0;       // values the instruction needs on the stack
+        int pushes = 0;     // values left in their place
+        bool frame = false; // whether it uses the function's frame
+        bool falls = true;  // whether the next instruction can follow it
+        bool jumps = false; // whether it may jump to :target:
+        long target = 0;
+        int jdepth = -1;    // stack depth at the target, if not the same
+        int nmf = mf;
+        
+#define NEED(n)                                     \
+        if (avail < (n))                            \
+          fail (off, "truncated instruction");      \
+        len = (n);
+        
+        switch (p[0])
+          {
+          // nop
+          case 0x00:
+            break;
+          
+          // push_int32, push_atom, push_pvar, breakpoint
+          case 0x01: case 0x84: case 0x60: case 0xF0:
+            NEED(5);
+            pushes = 1;
+            break;
+          
+          // push_nil, push_empty_list, push_true, push_false
+          case 0x02: case 0x50: case 0x82: case 0x83:
+            pushes = 1;
+            break;
+          
+          // dup_n
+          case 0x0B:
+            {
+              NEED(5);
+              int idx = get_int (p + 1);
+              if (idx < 1 || idx > d - base)
+                fail (off, "dup_n index out of range");
+              pushes = 1;
+            }
+            break;
+          
+          // dup
+          case 0x0C:
+            pops = 1;
+            pushes = 2;
+            break;
+          
+          // pop
+          case 0x0D:
+            pops = 1;
+            break;
+          
+          // swap
+          case 0x0E:
+            pops = pushes = 2;
+            break;
+          
+          // pop_n
+          case 0x0F:
+            NEED(2);
+            pops = p[1];
+            break;
+          
+          // binary operators, comparisons, cons
+          case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15:
+          case 0x16: case 0x17:
+          case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35:
+          case 0x51:
+            pops = 2;
+            pushes = 1;
+            break;
+          
+          // not, car, cdr, mk_promise
+          case 0x18: case 0x52: case 0x53: case 0x58:
+            pops = pushes = 1;
+            break;
+          
+          // format
+          case 0x19:
+            {
+              long n = rho_format_check (p + 1, avail - 1);
+              if (n == -1)
+                fail (off, "malformed format program");
+              len = 1 + n;
+              pops = pushes = 1;
+            }
+            break;
+          
+          // get_arg_pack, get_fun
+          case 0x20: case 0x2C:
+            frame = true;
+            pushes = 1;
+            break;
+          
+          // mk_fn
+          case 0x21:
+            NEED(5);
+            this->add_fun (off, off + 5 + (long)get_int (p + 1));
+            pushes = 1;
+            break;
+          
+          // call
+          case 0x22:
+            frame = true;
+            // fall through
+          
+          // call0
+          case 0x2E:
+            NEED(2);
+            pops = p[1] + 1;
+            pushes = 1;
+            break;
+          
+          // ret, tail_call
+          case 0x23: case 0x2B:
+            frame = true;
+            pops = 1;
+            falls = false;
+            break;
+          
+          // mk_closure
+          case 0x24:
+            {
+              NEED(6);
+              int upvalc = p[1];
+              this->add_fun (off, off + 6 + (long)get_int (p + 2));
+              
+              long i = 6;
+              for (int j = 0; j < upvalc; ++j)
+                {
+                  if (i >= avail)
+                    fail (off, "truncated instruction");
+                  switch (p[i++])
+                    {
+                    case 0x20:
+                      break;
+                    
+                    case 0x26:
+                      if (i++ >= avail)
+                        fail (off, "truncated instruction");
+                      break;
+                    
+                    case 0x28:
+                      if (i >= avail)
+                        fail (off, "truncated instruction");
+                      if (6 + p[i++] >= d)
+                        fail (off, "captured local out of range");
+                      break;
+                    
+                    default:
+                      fail (off, "invalid upvalue in mk_closure");
+                    }
+                }
+              
+              len = i;
+              frame = true;
+              pushes = 1;
+            }
+            break;
+          
+          // get_free, get_arg
+          case 0x25: case 0x26:
+            NEED(2);
+            frame = true;
+            pushes = 1;
+            break;
+          
+          // set_free, set_arg
+          case 0x2A: case 0x27:
+            NEED(2);
+            frame = true;
+            pops = 1;
+            break;
+          
+          // get_local
+          case 0x28:
+            NEED(2);
+            if (6 + p[1] >= d)
+              fail (off, "local out of range");
+            frame = true;
+            pushes = 1;
+            break;
+          
+          // set_local
+          case 0x29:
+            NEED(2);
+            if (6 + p[1] >= d - 1)
+              fail (off, "local out of range");
+            frame = true;
+            pops = 1;
+            break;
+          
+          // close, pack_args
+          case 0x2D: case 0x2F:
+            NEED(2);
+            frame = true;
+            break;
+          
+          // cmp_eq_many
+          case 0x36:
+            NEED(5);
+            pops = get_int (p + 1);
+            if (pops < 1)
+              fail (off, "cmp_eq_many needs at least one value");
+            pushes = 1;
+            break;
+          
+          // jmp
+          case 0x40:
+            NEED(5);
+            jumps = true;
+            target = off + 5 + (long)get_int (p + 1);
+            falls = false;
+            break;
+          
+          // jt, jf
+          case 0x41: case 0x42:
+            NEED(5);
+            jumps = true;
+            target = off + 5 + (long)get_int (p + 1);
+            pops = 1;
+            break;
+          
+          // force: either jumps with the forced value in place of the
+          // promise, or pushes the promise and its function for the call
+          // that follows.
+          case 0x59:
+            NEED(5);
+            jumps = true;
+            target = off + 5 + (long)get_int (p + 1);
+            jdepth = d;
+            pops = 1;
+            pushes = 3;
+            break;
+          
+          // fulfil
+          case 0x5A:
+            pops = 2;
+            break;
+          
+          // match
+          case 0x61:
+            NEED(5);
+            if (get_int (p + 1) < 0)
+              fail (off, "local out of range");
+            frame = true;
+            pops = 2;
+            pushes = 1;
+            break;
+          
+          // builtin
+          case 0x70:
+            {
+              NEED(4);
+              auto native = rho_native_get ((int)get_u16 (p + 1));
+              int argc = p[3];
+              if (!native)
+                fail (off, "invalid builtin index");
+              if (argc < native->min_args
+                  || (native->max_args != -1 && argc > native->max_args))
+                fail (off, std::string ("wrong number of arguments to `")
+                  + native->name + "'");
+              pops = argc;
+              pushes = 1;
+            }
+            break;
+          
+          // push_sint
+          case 0x80:
+            NEED(3);
+            if (get_u16 (p + 1) > VM_SMALL_INT_MAX)
+              fail (off, "small integer out of range");
+            pushes = 1;
+            break;
+          
+          // push_nils
+          case 0x81:
+            NEED(2);
+            pushes = p[1];
+            break;
+          
+          // push_cstr
+          case 0x85:
+            {
+              auto end = (const unsigned char *)std::memchr (p + 1, 0,
+                                                             avail - 1);
+              if (!end)
+                fail (off, "unterminated string");
+              len = end - p + 1;
+              pushes = 1;
+            }
+            break;
+          
+          // push_float
+          case 0x86:
+            NEED(9);
+            frame = true;
+            pushes = 1;
+            break;
+          
+          // mk_vec
+          case 0x90:
+            NEED(3);
+            pops = (int)get_u16 (p + 1);
+            pushes = 1;
+            break;
+          
+          // vec_get_hard
+          case 0x91:
+            NEED(3);
+            pops = pushes = 1;
+            break;
+          
+          // vec_get
+          case 0x92:
+            pops = 2;
+            pushes = 1;
+            break;
+          
+          // vec_set
+          case 0x93:
+            pops = 3;
+            break;
+          
+          // mk_map
+          case 0x94:
+            NEED(3);
+            pops = 2 * (int)get_u16 (p + 1);
+            pushes = 1;
+            break;
+          
+          // alloc_globals
+          case 0xA0:
+            NEED(5);
+            break;
+          
+          // get_global
+          case 0xA1:
+            NEED(5);
+            this->use_global (p + 1);
+            pushes = 1;
+            break;
+          
+          // set_global
+          case 0xA2:
+            NEED(5);
+            this->use_global (p + 1);
+            pops = 1;
+            break;
+          
+          // def_atom
+          case 0xA3:
+            {
+              NEED(5);
+              auto end = (const unsigned char *)std::memchr (p + 5, 0,
+                                                             avail - 5);
+              if (!end)
+                fail (off, "unterminated string");
+              len = end - p + 1;
+            }
+            break;
+          
+          // push_microframe
+          case 0xB0:
+            frame = true;
+            pops = 1;
+            pushes = 3;
+            nmf = (int)this->mframes.size ();
+            this->mframes.push_back ({ mf, d - 1 });
+            break;
+          
+          // pop_microframe: everything above the micro-frame's start is
+          // replaced by the value on top.
+          case 0xB1:
+            if (mf == -1)
+              fail (off, "pop_microframe without a micro-frame");
+            if (d < this->mframes[mf].start + 4)
+              fail (off, "stack underflow");
+            frame = true;
+            pops = d - this->mframes[mf].start;
+            pushes = 1;
+            nmf = this->mframes[mf].parent;
+            break;
+          
+          // resume
+          case 0xC0:
+            pops = 2;
+            pushes = 1;
+            break;
+          
+          // yield
+          case 0xC1:
+            pops = pushes = 1;
+            break;
+          
+          // memo_init
+          case 0xD0:
+            NEED(6);
+            pops = pushes = 1;
+            break;
+          
+          // memo_enter
+          case 0xD1:
+            frame = true;
+            pushes = 1;
+            break;
+          
+          // memo_leave
+          case 0xD2:
+            NEED(2);
+            if (6 + p[1] >= d)
+              fail (off, "local out of range");
+            frame = true;
+            pops = pushes = 1;
+            break;
+          
+          // mk_record
+          case 0xE0:
+            NEED(6);
+            pops = p[5];
+            pushes = 1;
+            break;
+          
+          // get_field, set_field
+          case 0xE1: case 0xE2:
+            NEED(2);
+            NEED(2 + 5 * (long)p[1]);
+            pops = (p[0] == 0xE1) ? 1 : 2;
+            pushes = (p[0] == 0xE1) ? 1 : 0;
+            break;
+          
+          // exit
+          case 0xFF:
+            pops = pushes = 1;
+            falls = false;
+            break;
+          
+          default:
+            fail (off, "invalid opcode");
+          }
+        
+#undef NEED
+        
+        if (frame && fn == -1)
+          fail (off, "instruction used outside of a function");
+        if (d - pops < base)
+          fail (off, "stack underflow");
+        
+        int nd = d - pops + pushes;
+        if (nd > VERIFY_MAX_DEPTH)
+          fail (off, "stack grows too deep");
+        if (fn == -1)
+          this->top_depth = std::max (this->top_depth, nd);
+        else
+          this->fdepths[fn] = std::max (this->fdepths[fn], nd);
+        
+        if (jumps)
+          this->reach (off, target, (jdepth == -1) ? nd : jdepth, mf, fn);
+        if (falls)
+          {
+            if (off + len >= this->size)
+              fail (off, "execution runs past the end of the code");
+            this->reach (off, off + len, nd, nmf, fn);
+          }
+      }
+    };
+  }
+  
+  
+  
+  code_info
+  verify_code (const unsigned char *code, long size)
+  {
+    verifier v (code, size);
+    return v.run ();
+  }
+}
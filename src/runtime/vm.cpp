@@ -19,8 +19,15 @@
 #include "runtime/vm.hpp"
 #include "runtime/gc/gc.hpp"
 #include "runtime/builtins.hpp"
+#include "runtime/expr.hpp"
+#include "runtime/map.hpp"
+#include "runtime/pvec.hpp"
+#include "runtime/memo.hpp"
+#include "runtime/io.hpp"
 #include "util/float.hpp"
 #include <cstring>
+#include <algorithm>
+#include <unistd.h>
 
 #include <iostream> // DEBUG
 
@@ -32,12 +39,27 @@ namespace rho {
     this->stack = new rho_value [stack_size];
     this->sp = 0;
     this->bp = 0;
+    this->main_stack = this->stack;
+    this->main_stack_size = stack_size;
+    this->stack_cap = stack_size;
+    this->frame_reserve = 0;
+    this->curr_co = nullptr;
+    this->native_depth = 0;
+    this->code = nullptr;
+    this->code_size = 0;
     
     this->gc = garbage_collector::create (gc_name, *this);
+    this->exprs = new expr_table (*this);
+    this->out = new output_stream (STDOUT_FILENO, false, "<stdout>");
+    this->plim.max_elems = 0;
+    this->plim.max_depth = 0;
     
+    // the preallocated integers are part of the GC's root set, so they must
+    // hold valid values before the first allocation.
     this->ints = new rho_value [VM_SMALL_INT_MAX + 1];
     for (int i = 0; i <= VM_SMALL_INT_MAX; ++i)
-      //this->ints[i] = rho_value_make_nil ();
+      this->ints[i] = rho_value_make_nil ();
+    for (int i = 0; i <= VM_SMALL_INT_MAX; ++i)
       this->ints[i] = rho_value_make_int (i, *this->gc);
   }
   
@@ -50,11 +72,16 @@ namespace rho {
         gp.vals[i].type = RHO_NIL;
     
     for (int i = 0; i <= VM_SMALL_INT_MAX; ++i)
-      gc_unprotect (this->ints[i]);
+      {
+        gc_unprotect (this->ints[i]);
+        this->ints[i].type = RHO_NIL;
+      }
     
     this->gc->collect ();
     
     delete this->gc;
+    delete this->exprs;
+    delete this->out;
     delete[] this->stack;
     delete[] this->ints;
     
@@ -84,14 +111,276 @@ namespace rho {
   
   
   
+  // a coroutine's function returns here (co_return).
+  static const unsigned char _co_return_code[] = { 0xC2 };
+  
   /* 
-   * Executes the specified Rho program.
+   * Creates a coroutine that will call the specified function when first
+   * resumed.
+   */
+  rho_value
+  virtual_machine::make_coroutine (rho_value& fn)
+  {
+    if (fn.type != RHO_FUN)
+      throw vm_error ("coroutine: expected a function");
+    
+    auto co = new coroutine ();
+    co->state = CO_FRESH;
+    co->fn = fn;
+    co->caller = nullptr;
+    co->depth = 0;
+    
+    auto stk = co->stack = new rho_value [VM_COROUTINE_STACK_SIZE];
+    
+    // the segment starts with a copy of the current micro-frame
+    int start = GET_INTERNAL (stack[bp + 4]);
+    stk[0] = MK_INTERNAL (0);
+    stk[1] = stack[start + 1];
+    stk[2] = stack[start + 2];
+    
+    // followed by a frame for the function, as though it had been called
+    // with no arguments.
+    stk[3] = fn;
+    stk[4] = MK_INTERNAL (0);                 // previous bp
+    stk[5] = MK_INTERNAL (_co_return_code);   // return address
+    stk[6] = fn;                              // env
+    stk[7] = MK_INTERNAL (0);                 // argument count
+    stk[8] = MK_INTERNAL (0);                 // micro-frame pointer
+    stk[9] = rho_value_make_nil ();           // argument pack
+    co->bp = 4;
+    co->sp = 10;
+    co->ptr = fn.val.gc->val.fn.cp;
+    
+    rho_value v;
+    v.type = RHO_COROUTINE;
+    v.val.gc = this->gc->alloc_protected ();
+    v.val.gc->type = RHO_COROUTINE;
+    v.val.gc->val.co = co;
+    return v;
+  }
+  
+  
+  
+  /* 
+   * Verifies and executes the specified Rho program.
    * Returns the top-most value in the VM's stack on completion.
    */
   rho_value
   virtual_machine::run (program& prg)
   {
-    auto code = prg.get_code ();
+    auto info = verify_code (prg.get_code (), (long)prg.get_code_size ());
+    if (sp + info.top_depth > this->stack_cap)
+      throw vm_error ("stack overflow");
+    this->admit (info);
+    
+    this->code = prg.get_code ();
+    this->code_size = (long)prg.get_code_size ();
+    return this->exec (prg.get_code ());
+  }
+  
+  
+  
+  /* 
+   * Prepares the machine for running verified code.
+   */
+  void
+  virtual_machine::admit (const code_info& info)
+  {
+    this->frame_reserve = std::max (this->frame_reserve, info.max_frame);
+    
+    // pages only ever grow past what some verified code needs, so global
+    // accesses are always in range.
+    auto& need = info.globals;
+    if (this->glob_need.size () < need.size ())
+      this->glob_need.resize (need.size (), 0);
+    if (this->gpages.size () < need.size ())
+      this->gpages.resize (need.size ());
+    for (size_t i = 0; i < need.size (); ++i)
+      {
+        int size = this->glob_need[i] = std::max (this->glob_need[i], need[i]);
+        auto& gp = this->gpages[i];
+        if (gp.size >= size)
+          continue;
+        
+        auto vals = new rho_value [size];
+        for (int j = 0; j < size; ++j)
+          vals[j] = (j < gp.size) ? gp.vals[j] : rho_value_make_nil ();
+        delete[] gp.vals;
+        gp.vals = vals;
+        gp.size = size;
+      }
+  }
+  
+  
+  
+  // functions called from native code return here.
+  static const unsigned char _native_return_code[] = { 0xFF };
+  
+  /* 
+   * Calls the specified Rho function and returns its result.
+   */
+  rho_value
+  virtual_machine::call_closure (rho_value fn, int argc, const rho_value *args)
+  {
+    if (fn.type != RHO_FUN)
+      throw vm_error ("attempting to call a non-function");
+    if (sp + argc + 1 + this->frame_reserve > this->stack_cap)
+      throw vm_error ("stack overflow");
+    
+    auto saved_stack = this->stack;
+    int saved_sp = sp;
+    int saved_bp = bp;
+    auto saved_co = this->curr_co;
+    
+    // set up a frame the same way the call instruction does
+    for (int i = argc - 1; i >= 0; --i)
+      stack[sp ++] = args[i];
+    stack[sp ++] = fn;
+    
+    int pbp = bp;
+    bp = sp;
+    stack[sp ++] = MK_INTERNAL (pbp);
+    stack[sp ++] = MK_INTERNAL (_native_return_code);
+    stack[sp ++] = fn;
+    stack[sp ++] = MK_INTERNAL (argc);
+    stack[sp ++] = MK_INTERNAL (GET_INTERNAL (stack[pbp + 4]));
+    stack[sp ++] = rho_value_make_nil ();
+    
+    ++ this->native_depth;
+    rho_value res;
+    try
+      {
+        res = this->exec (fn.val.gc->val.fn.cp);
+      }
+    catch (...)
+      {
+        // coroutines resumed by the callee can never be continued now.
+        for (auto co = this->curr_co; co && co != saved_co;
+             co = co->val.co->caller)
+          co->val.co->state = CO_DEAD;
+        
+        this->stack = saved_stack;
+        sp = saved_sp;
+        bp = saved_bp;
+        this->curr_co = saved_co;
+        this->stack_cap = saved_co ? VM_COROUTINE_STACK_SIZE
+                                   : this->main_stack_size;
+        -- this->native_depth;
+        throw;
+      }
+    -- this->native_depth;
+    
+    // the return instruction leaves the result where the function was.
+    -- sp;
+    return res;
+  }
+  
+  
+  
+  rho_value
+  virtual_machine::call_native (int index, int argc, const rho_value *args)
+  {
+    auto native = rho_native_get (index);
+    if (!native)
+      throw vm_error ("invalid builtin index");
+    if (sp + argc > this->stack_cap)
+      throw vm_error ("stack overflow");
+    
+    int base = sp;
+    for (int i = 0; i < argc; ++i)
+      stack[sp ++] = args[i];
+    
+    rho_value res;
+    try
+      {
+        res = native->fn (&stack[base], argc, *this);
+      }
+    catch (...)
+      {
+        sp = base;
+        throw;
+      }
+    
+    sp = base;
+    gc_unprotect (res);
+    return res;
+  }
+  
+  
+  
+  rho_value
+  virtual_machine::run_function (rho_value fn, const unsigned char *code,
+                                 long code_size, const code_info& info)
+  {
+    if (sp + 9 > this->stack_cap)
+      throw vm_error ("stack overflow");
+    this->admit (info);
+    
+    this->code = code;
+    this->code_size = code_size;
+    
+    // the function is called from a frame like the one a program's top-level
+    // code runs in, with a micro-frame of default precision right above it.
+    int base = sp;
+    int saved_bp = bp;
+    bp = base;
+    stack[sp ++] = MK_INTERNAL (saved_bp);        // previous bp
+    stack[sp ++] = MK_INTERNAL (_native_return_code);
+    stack[sp ++] = fn;                            // env
+    stack[sp ++] = MK_INTERNAL (0);               // argument count
+    stack[sp ++] = MK_INTERNAL (base + 6);        // micro-frame pointer
+    stack[sp ++] = rho_value_make_nil ();         // argument pack
+    stack[sp ++] = MK_INTERNAL (base + 6);
+    stack[sp ++] = MK_INTERNAL (prec_base10_to_effective_bits (10));
+    stack[sp ++] = MK_INTERNAL (10);
+    
+    rho_value res;
+    try
+      {
+        res = this->call_closure (fn, 0, nullptr);
+      }
+    catch (...)
+      {
+        sp = base;
+        bp = saved_bp;
+        throw;
+      }
+    
+    sp = base;
+    bp = saved_bp;
+    return res;
+  }
+  
+  
+  
+  /* 
+   * Decodes the field table of a get_field/set_field instruction, which lists
+   * the record types that have the accessed field as (tag, index) pairs, and
+   * returns the index of the field in the specified record.
+   */
+  static int
+  _find_field (rho_value& rec, const unsigned char *& ptr,
+               virtual_machine& vm)
+  {
+    int count = *ptr++;
+    const unsigned char *tbl = ptr;
+    ptr += count * 5;
+    
+    if (rec.type != RHO_RECORD)
+      throw vm_error ("field access on a value that is not a record");
+    
+    int tag = rec.val.gc->val.rec.tag;
+    for (int i = 0; i < count; ++i, tbl += 5)
+      if (*(int *)tbl == tag)
+        return tbl[4];
+    
+    throw vm_error ("record " + vm.get_atom_name (tag)
+      + " has no field by that name");
+  }
+  
+  rho_value
+  virtual_machine::exec (const unsigned char *code)
+  {
     auto ptr = code;
     
     for (;;)
@@ -224,6 +513,12 @@ namespace rho {
             stack[sp - 1] = rho_value_make_bool (rho_value_cmp_zero (stack[sp - 1]));
             break;
           
+          // format
+          case 0x19:
+            stack[sp - 1] = rho_format_run (ptr, stack[sp - 1], *this);
+            gc_unprotect (stack[sp - 1]);
+            break;
+          
           
           
         //----------------------------------------------------------------------
@@ -249,7 +544,13 @@ namespace rho {
           // call
           case 0x22:
             {
+              // the verifier bounds how deep any function takes the stack,
+              // so this is the only check a call needs.
+              if (sp + this->frame_reserve > this->stack_cap)
+                throw vm_error ("stack overflow");
               auto cl = stack[sp - 1];
+              if (cl.type != RHO_FUN)
+                throw vm_error ("attempting to call a non-function");
               
               // push previous bp
               int pbp = bp;
@@ -343,7 +644,7 @@ namespace rho {
                   for (auto uv_ : this->gc->get_upvalues ())
                     {
                       auto& uv = uv_->val.uv;
-                      if (uv.sp == idx)
+                      if (uv.sp == idx && uv.co == this->curr_co)
                         {
                           target.type = RHO_UPVAL;
                           target.val.gc = uv_;
@@ -356,6 +657,7 @@ namespace rho {
                     {
                       target = rho_value_make_upvalue (*this->gc);
                       target.val.gc->val.uv.sp = idx;
+                      target.val.gc->val.uv.co = this->curr_co;
                       gc_unprotect (target);
                     }
                 }
@@ -372,7 +674,7 @@ namespace rho {
               if (upv.val.gc->val.uv.sp == -1)
                 stack[sp ++] = upv.val.gc->val.uv.val;
               else
-                stack[sp ++] = stack[upv.val.gc->val.uv.sp];
+                stack[sp ++] = this->get_upvalue_slot (upv.val.gc);
             }
           break;
           
@@ -416,7 +718,7 @@ namespace rho {
               if (upv.val.gc->val.uv.sp == -1)
                 upv.val.gc->val.uv.val = stack[-- sp];
               else
-                stack[upv.val.gc->val.uv.sp] = stack[-- sp];
+                this->get_upvalue_slot (upv.val.gc) = stack[-- sp];
             }
           break;
           
@@ -424,6 +726,8 @@ namespace rho {
           case 0x2B:
             {
               auto cl = stack[-- sp];
+              if (cl.type != RHO_FUN)
+                throw vm_error ("attempting to call a non-function");
               stack[bp + 2] = cl;
               
               unsigned char argc = GET_INTERNAL (stack[bp + 3]);
@@ -447,18 +751,25 @@ namespace rho {
               int argc = (int)GET_INTERNAL (stack[bp + 3]);
               
               auto& upvals = this->gc->get_upvalues ();
-              for (auto uv_ : upvals)
+              for (auto itr = upvals.begin (); itr != upvals.end (); )
                 {
-                  auto& uv = uv_->val.uv;
+                  auto& uv = (*itr)->val.uv;
                   
                   // we start from bp + 5 because the argument pack
                   // (if it exists) is stored there.
-                  if ((uv.sp >= bp + 5 && uv.sp < bp + 6 + local_count)
-                    || (uv.sp > bp - 2 - argc && uv.sp <= bp - 2))
+                  if (uv.co == this->curr_co
+                    && ((uv.sp >= bp + 5 && uv.sp < bp + 6 + local_count)
+                      || (uv.sp > bp - 2 - argc && uv.sp <= bp - 2)))
                     {
                       uv.val = stack[uv.sp];
                       uv.sp = -1;
+                      
+                      // closed upvalues are only reachable through the
+                      // closures that use them.
+                      itr = upvals.erase (itr);
                     }
+                  else
+                    ++ itr;
                 }
             }
             break;
@@ -466,7 +777,11 @@ namespace rho {
          // call0
          case 0x2E:
           {
+            if (sp + this->frame_reserve > this->stack_cap)
+              throw vm_error ("stack overflow");
             auto cl = stack[sp - 1];
+            if (cl.type != RHO_FUN)
+              throw vm_error ("attempting to call a non-function");
               
             // push previous bp
             int pbp = bp;
@@ -637,6 +952,68 @@ namespace rho {
         
         
         
+        //----------------------------------------------------------------------
+        // promises
+        //----------------------------------------------------------------------
+          
+          // mk_promise
+          case 0x58:
+            stack[sp - 1] = rho_value_make_promise (stack[sp - 1], *this->gc);
+            gc_unprotect (stack[sp - 1]);
+            break;
+          
+          // force
+          case 0x59:
+            {
+              const unsigned char *end = ptr + 4 + *(int *)ptr;
+              ptr += 4;
+              
+              // find the end of the chain of forced promises
+              rho_value v = stack[sp - 1];
+              rho_value res = v;
+              while (res.type == RHO_PROMISE && res.val.gc->val.pr.forced)
+                res = res.val.gc->val.pr.val;
+              
+              // path compression: make every forced promise along the chain
+              // point directly at its end.
+              while (v.type == RHO_PROMISE && v.val.gc->val.pr.forced)
+                {
+                  rho_value next = v.val.gc->val.pr.val;
+                  v.val.gc->val.pr.val = res;
+                  v = next;
+                }
+              
+              if (res.type != RHO_PROMISE)
+                {
+                  stack[sp - 1] = res;
+                  ptr = end;
+                }
+              else
+                {
+                  // call the promise's function, and let fulfil store the
+                  // result.
+                  stack[sp ++] = res;
+                  stack[sp ++] = res.val.gc->val.pr.val;
+                }
+            }
+            break;
+          
+          // fulfil
+          case 0x5A:
+            {
+              auto& pr = stack[sp - 2].val.gc->val.pr;
+              if (!pr.forced)
+                {
+                  // the function may have forced the promise itself
+                  pr.val = stack[sp - 1];
+                  pr.forced = true;
+                }
+              sp -= 2;
+            }
+            break;
+        
+        
+        
           
           
           
@@ -662,7 +1039,7 @@ namespace rho {
             ptr += 4;
             
             auto res = rho_value_match (stack[sp - 1], stack[sp - 2],
-              stack + bp + 6 + loff);
+              stack + bp + 6 + loff, *this);
             -- sp;
             stack[sp - 1] = rho_value_make_bool (res);
           }
@@ -681,22 +1058,13 @@ namespace rho {
               ptr += 2;
               unsigned char argc = *ptr++;
               
-              switch (index)
-                {
-                // print:
-                case 0:
-                  stack[sp - argc] = rho_builtin_print (stack[sp - 1], *this);
-                  ++ sp;
-                  break;
-                
-                // len:
-                case 1:
-                  stack[sp - argc] = rho_builtin_len (stack[sp - 1], *this);
-                  ++ sp;
-                  break;
-                }
+              // the index was checked by the verifier.
+              auto native = rho_native_get (index);
+              rho_value res = native->fn (&stack[sp - argc], argc, *this);
               
               sp -= argc;
+              stack[sp ++] = res;
+              gc_unprotect (res);
             }
             break;
           
@@ -754,6 +1122,14 @@ namespace rho {
               int mf = GET_INTERNAL (stack[bp + 4]);
               unsigned int prec = GET_INTERNAL(stack[mf + 1]);
               
+              if (prec <= FLOAT_DOUBLE_PREC)
+                {
+                  // low precision, use an unboxed double
+                  stack[sp ++] = rho_value_make_double (*(double *)ptr);
+                  ptr += 8;
+                  break;
+                }
+              
               auto v = rho_value_make_float (*(double *)ptr, prec, *this->gc);
               ptr += 8;
               
@@ -799,6 +1175,15 @@ namespace rho {
           // vec_get
           case 0x92:
             {
+              if (stack[sp - 2].type == RHO_MAP)
+                {
+                  // missing keys read as nil.
+                  auto val = stack[sp - 2].val.gc->val.map->find (stack[sp - 1]);
+                  -- sp;
+                  stack[sp - 1] = val ? *val : rho_value_make_nil ();
+                  break;
+                }
+              
               if (stack[sp - 1].type != RHO_INTEGER)
                 throw vm_error ("index must be an integer");
               auto& idx = stack[sp - 1].val.gc;
@@ -817,6 +1202,57 @@ namespace rho {
                   }
                   break;
                 
+                case RHO_RECORD:
+                  {
+                    auto& rec = stack[sp - 2].val.gc->val.rec;
+                    if (i < 0 || i >= rec.len)
+                      throw vm_error ("index out of range");
+                    
+                    -- sp;
+                    stack[sp - 1] = rec.vals[i];
+                  }
+                  break;
+                
+                case RHO_PVEC:
+                  {
+                    auto& pv = *stack[sp - 2].val.gc->val.pvec;
+                    if (i < 0 || i >= pv.size ())
+                      throw vm_error ("index out of range");
+                    
+                    -- sp;
+                    stack[sp - 1] = pv.get (i);
+                  }
+                  break;
+                
+                case RHO_F64VEC:
+                  {
+                    auto& arr = stack[sp - 2].val.gc->val.arr;
+                    if (i < 0 || i >= arr.len)
+                      throw vm_error ("index out of range");
+                    
+                    -- sp;
+                    stack[sp - 1] = rho_value_make_double (arr.f64[i]);
+                  }
+                  break;
+                
+                case RHO_I64VEC:
+                  {
+                    auto& arr = stack[sp - 2].val.gc->val.arr;
+                    if (i < 0 || i >= arr.len)
+                      throw vm_error ("index out of range");
+                    
+                    long long x = arr.i64[i];
+                    -- sp;
+                    if (x >= 0 && x <= VM_SMALL_INT_MAX)
+                      stack[sp - 1] = this->ints[x];
+                    else
+                      {
+                        stack[sp - 1] = rho_value_make_int64 (x, *this->gc);
+                        gc_unprotect (stack[sp - 1]);
+                      }
+                  }
+                  break;
+                
                 case RHO_CONS:
                   {
                     -- sp;
@@ -846,6 +1282,14 @@ namespace rho {
           // vec_set
           case 0x93:
             {
+              if (stack[sp - 3].type == RHO_MAP)
+                {
+                  stack[sp - 3].val.gc->val.map->set (stack[sp - 2],
+                                                      stack[sp - 1]);
+                  sp -= 3;
+                  break;
+                }
+              
               if (stack[sp - 2].type != RHO_INTEGER)
                 throw vm_error ("index must be an integer");
               auto& idx = stack[sp - 2].val.gc;
@@ -859,11 +1303,70 @@ namespace rho {
                     if (i < 0 || i >= vec.len)
                       throw vm_error ("index out of range");
                     
+                    rho_vec_make_writable (stack[sp - 3].val.gc);
                     vec.vals[i] = stack[sp - 1];
                     sp -= 3;
                   }
                   break;
                 
+                case RHO_RECORD:
+                  {
+                    auto& rec = stack[sp - 3].val.gc->val.rec;
+                    if (i < 0 || i >= rec.len)
+                      throw vm_error ("index out of range");
+                    
+                    rec.vals[i] = stack[sp - 1];
+                    sp -= 3;
+                  }
+                  break;
+                
+                case RHO_PVEC:
+                  {
+                    // only transients can be updated in place.
+                    auto& pv = *stack[sp - 3].val.gc->val.pvec;
+                    if (!pv.is_transient ())
+                      throw vm_error ("cannot assign into a persistent vector");
+                    if (i < 0 || i >= pv.size ())
+                      throw vm_error ("index out of range");
+                    
+                    pv.set (i, stack[sp - 1]);
+                    sp -= 3;
+                  }
+                  break;
+                
+                case RHO_F64VEC:
+                  {
+                    auto& arr = stack[sp - 3].val.gc->val.arr;
+                    if (i < 0 || i >= arr.len)
+                      throw vm_error ("index out of range");
+                    
+                    auto& v = stack[sp - 1];
+                    switch (v.type)
+                      {
+                      case RHO_DOUBLE: arr.f64[i] = v.val.f64; break;
+                      case RHO_INTEGER: arr.f64[i] = mpz_get_d (v.val.gc->val.i); break;
+                      case RHO_FLOAT: arr.f64[i] = mpfr_get_d (v.val.gc->val.f, MPFR_RNDN); break;
+                      default:
+                        throw vm_error ("f64vec elements must be numbers");
+                      }
+                    sp -= 3;
+                  }
+                  break;
+                
+                case RHO_I64VEC:
+                  {
+                    auto& arr = stack[sp - 3].val.gc->val.arr;
+                    if (i < 0 || i >= arr.len)
+                      throw vm_error ("index out of range");
+                    
+                    auto& v = stack[sp - 1];
+                    if (v.type != RHO_INTEGER || !mpz_fits_slong_p (v.val.gc->val.i))
+                      throw vm_error ("i64vec elements must be 64-bit integers");
+                    arr.i64[i] = mpz_get_si (v.val.gc->val.i);
+                    sp -= 3;
+                  }
+                  break;
+                
                 case RHO_CONS:
                   {
                     auto& c = stack[sp - 3].val.gc->val.p;
@@ -891,6 +1394,25 @@ namespace rho {
             }
             break;
           
+          // mk_map
+          case 0x94:
+            {
+              int count = *((unsigned short *)ptr);
+              ptr += 2;
+              
+              // the keys and values are pushed in pairs, key first.
+              auto v = rho_value_make_map (count, *this->gc);
+              auto& m = *v.val.gc->val.map;
+              for (int i = 0; i < count; ++i)
+                m.set (stack[sp - 2 * count + 2 * i],
+                       stack[sp - 2 * count + 2 * i + 1]);
+              sp -= 2 * count;
+              
+              stack[sp ++] = v;
+              gc_unprotect (v);
+            }
+            break;
+          
         
         
         //----------------------------------------------------------------------
@@ -903,6 +1425,8 @@ namespace rho {
               unsigned pidx = *((unsigned short *)ptr);
               unsigned count = *((unsigned short *)(ptr + 2));
               ptr += 4;
+              if (pidx < this->glob_need.size ())
+                count = std::max (count, (unsigned)this->glob_need[pidx]);
               
               glob_page page;
               page.vals = new rho_value[count];
@@ -916,6 +1440,7 @@ namespace rho {
                 {
                   if (this->gpages.size () <= pidx)
                     this->gpages.resize (pidx + 1);
+                  delete[] this->gpages[pidx].vals;
                   this->gpages[pidx] = page;
                 }
             }
@@ -976,7 +1501,7 @@ namespace rho {
               if (stack[sp].type != RHO_INTEGER)
                 throw vm_error ("push_microframe: precision must be specified using an integer");
               unsigned int prec10 = mpz_get_ui (stack[sp].val.gc->val.i);
-              unsigned int prec2 = prec_base10_to_bits (prec10);
+              unsigned int prec2 = prec_base10_to_effective_bits (prec10);
               
               auto start = sp;
               
@@ -1009,6 +1534,207 @@ namespace rho {
           
           
           
+        //----------------------------------------------------------------------
+        // coroutines
+        //----------------------------------------------------------------------
+          
+          // resume
+          case 0xC0:
+            {
+              auto cv = stack[sp - 1];
+              auto val = stack[sp - 2];
+              sp -= 2;
+              
+              if (cv.type != RHO_COROUTINE)
+                throw vm_error ("resume: expected a coroutine");
+              auto& co = *cv.val.gc->val.co;
+              if (co.state == CO_RUNNING)
+                throw vm_error ("resume: coroutine is already running");
+              else if (co.state == CO_DEAD)
+                throw vm_error ("resume: coroutine has finished");
+              else if (co.state == CO_FRESH
+                  && co.bp + this->frame_reserve > VM_COROUTINE_STACK_SIZE)
+                throw vm_error ("stack overflow");
+              
+              co.caller_stack = stack;
+              co.caller_sp = sp;
+              co.caller_bp = bp;
+              co.caller_ptr = ptr;
+              co.caller = this->curr_co;
+              co.depth = this->native_depth;
+              this->curr_co = cv.val.gc;
+              
+              stack = co.stack;
+              sp = co.sp;
+              bp = co.bp;
+              ptr = co.ptr;
+              this->stack_cap = VM_COROUTINE_STACK_SIZE;
+              
+              // the resumed yield evaluates to the passed value
+              if (co.state == CO_SUSPENDED)
+                stack[sp ++] = val;
+              co.state = CO_RUNNING;
+            }
+            break;
+          
+          // yield
+          case 0xC1:
+          // co_return
+          case 0xC2:
+            {
+              bool finished = (ptr[-1] == 0xC2);
+              if (!this->curr_co)
+                throw vm_error ("yield: not inside a coroutine");
+              
+              auto& co = *this->curr_co->val.co;
+              if (co.depth != this->native_depth)
+                throw vm_error ("yield: cannot yield from within a callback "
+                                "called by a builtin");
+              auto val = stack[-- sp];
+              
+              if (!finished)
+                {
+                  co.sp = sp;
+                  co.bp = bp;
+                  co.ptr = ptr;
+                  co.state = CO_SUSPENDED;
+                }
+              else
+                {
+                  // every frame has returned, so there are no open upvalues
+                  // left in the segment.
+                  co.state = CO_DEAD;
+                  co.fn = rho_value_make_nil ();
+                  delete[] co.stack;
+                  co.stack = nullptr;
+                  co.sp = 0;
+                }
+              
+              stack = co.caller_stack;
+              sp = co.caller_sp;
+              bp = co.caller_bp;
+              ptr = co.caller_ptr;
+              this->curr_co = co.caller;
+              co.caller = nullptr;
+              this->stack_cap = this->curr_co ? VM_COROUTINE_STACK_SIZE
+                                              : this->main_stack_size;
+              
+              stack[sp ++] = val;
+            }
+            break;
+        
+        
+        
+        //----------------------------------------------------------------------
+        // memoization
+        //----------------------------------------------------------------------
+          
+          // memo_init
+          case 0xD0:
+            {
+              unsigned cap = *(unsigned *)ptr;
+              ptr += 4;
+              unsigned char flags = *ptr++;
+              
+              if (stack[sp - 1].type != RHO_FUN)
+                throw vm_error ("memo_init: expected a function");
+              auto& fn = stack[sp - 1].val.gc->val.fn;
+              delete fn.memo;
+              fn.memo = new memo_cache (cap, flags);
+            }
+            break;
+          
+          // memo_enter
+          case 0xD1:
+            {
+              auto memo = stack[bp + 2].val.gc->val.fn.memo;
+              int argc = (int)GET_INTERNAL (stack[bp + 3]);
+              const rho_value *args = &stack[bp - 2];
+              
+              auto hit = memo->find (args, argc,
+                                     memo_cache::hash_args (args, argc));
+              if (hit)
+                {
+                  // return the cached result (as ret does).
+                  auto retv = *hit;
+                  ptr = (const unsigned char *)GET_INTERNAL (stack[bp + 1]);
+                  int pbp = bp;
+                  bp = (int)GET_INTERNAL (stack[bp]);
+                  sp = pbp;
+                  
+                  sp -= argc;
+                  stack[sp - 1] = retv;
+                  break;
+                }
+              
+              // keep the arguments in the slot past the locals, so that the
+              // result can be recorded under them even if the function
+              // assigns to its parameters.
+              auto key = rho_value_make_vec (argc, *this->gc);
+              auto& vec = key.val.gc->val.vec;
+              for (int i = 0; i < argc; ++i)
+                vec.vals[i] = stack[bp - 1 - argc + i];
+              vec.len = argc;
+              
+              stack[sp ++] = key;
+              gc_unprotect (key);
+            }
+            break;
+          
+          // memo_leave
+          case 0xD2:
+            {
+              unsigned char local_count = *ptr++;
+              auto memo = stack[bp + 2].val.gc->val.fn.memo;
+              memo->insert (stack[bp + 6 + local_count], stack[sp - 1]);
+            }
+            break;
+        
+        
+        
+        //----------------------------------------------------------------------
+        // records
+        //----------------------------------------------------------------------
+          
+          // mk_record
+          case 0xE0:
+            {
+              int tag = *(int *)ptr;
+              ptr += 4;
+              int count = *ptr++;
+              
+              auto rec = rho_value_make_record (tag, count, *this->gc);
+              auto vals = rec.val.gc->val.rec.vals;
+              for (int i = 0; i < count; ++i)
+                vals[i] = stack[sp - count + i];
+              sp -= count;
+              
+              stack[sp ++] = rec;
+              gc_unprotect (rec);
+            }
+            break;
+          
+          // get_field
+          case 0xE1:
+            {
+              auto& rec = stack[sp - 1];
+              int idx = _find_field (rec, ptr, *this);
+              stack[sp - 1] = rec.val.gc->val.rec.vals[idx];
+            }
+            break;
+          
+          // set_field
+          case 0xE2:
+            {
+              auto& rec = stack[sp - 2];
+              int idx = _find_field (rec, ptr, *this);
+              rec.val.gc->val.rec.vals[idx] = stack[sp - 1];
+              sp -= 2;
+            }
+            break;
+        
+        
+        
         //----------------------------------------------------------------------
         // other
         //----------------------------------------------------------------------
@@ -1047,12 +1773,28 @@ namespace rho {
   void
   virtual_machine::reset ()
   {
+    // abandon any coroutines that were running when an error occurred
+    for (auto co = this->curr_co; co; co = co->val.co->caller)
+      co->val.co->state = CO_DEAD;
+    this->stack = this->main_stack;
+    this->stack_cap = this->main_stack_size;
+    this->curr_co = nullptr;
+    this->native_depth = 0;
     this->sp = 0;
     this->gc->collect ();
   }
   
   
   
+  /* 
+   * Pushes a value onto the stack.
+   */
+  void
+  virtual_machine::push_value (rho_value v)
+  {
+    this->stack[this->sp ++] = v;
+  }
+  
   /* 
    * Pops the top-most value off the stack.
    */    
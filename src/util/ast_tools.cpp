@@ -46,6 +46,7 @@ namespace rho {
         case AST_BOOL:
         case AST_ATOM:
         case AST_ATOM_DEF:
+        case AST_RECORD_DEF:
         case AST_EMPTY_STMT:
         case AST_STRING:
         case AST_USING:
@@ -170,6 +171,17 @@ namespace rho {
           }
           break;
         
+        case AST_MAP:
+          {
+            auto cn = std::static_pointer_cast<ast_map> (node);
+            for (auto& e : cn->get_entries ())
+              {
+                _traverse_dfs_node (e.first, fn);
+                _traverse_dfs_node (e.second, fn);
+              }
+          }
+          break;
+        
         case AST_SUBSCRIPT:
           {
             auto cn = std::static_pointer_cast<ast_subscript> (node);
@@ -178,6 +190,11 @@ namespace rho {
           }
           break;
         
+        case AST_FIELD:
+          _traverse_dfs_node (
+            std::static_pointer_cast<ast_field> (node)->get_expr (), fn);
+          break;
+        
         case AST_NAMESPACE:
           {
             auto cn = std::static_pointer_cast<ast_namespace> (node);
@@ -203,6 +220,16 @@ namespace rho {
             _traverse_dfs_node (cn->get_body (), fn);
           }
           break;
+        
+        case AST_DELAY:
+          _traverse_dfs_node (
+            std::static_pointer_cast<ast_delay> (node)->get_fun (), fn);
+          break;
+        
+        case AST_YIELD:
+          _traverse_dfs_node (
+            std::static_pointer_cast<ast_yield> (node)->get_expr (), fn);
+          break;
         }
     }
     
@@ -361,6 +388,44 @@ namespace rho {
     
     
     
+    static void
+    _record_defs_search (const std::vector<std::shared_ptr<ast_stmt>>& stmts,
+      std::vector<std::pair<std::string, std::vector<std::string>>>& recs,
+      const std::string& curr_ns)
+    {
+      for (auto s : stmts)
+        {
+          if (s->get_type () == AST_RECORD_DEF)
+            {
+              auto rd = std::static_pointer_cast<ast_record_def> (s);
+              recs.emplace_back (
+                curr_ns.empty () ? rd->get_name ()
+                                 : curr_ns + ":" + rd->get_name (),
+                rd->get_fields ());
+            }
+          else if (s->get_type () == AST_NAMESPACE)
+            {
+              auto ns = std::static_pointer_cast<ast_namespace> (s);
+              _record_defs_search (ns->get_body ()->get_stmts (), recs,
+                curr_ns.empty () ? ns->get_name ()
+                                 : curr_ns + ":" + ns->get_name ());
+            }
+        }
+    }
+    
+    /* 
+     * Extracts top-level record definitions from the specified AST program.
+     */
+    std::vector<std::pair<std::string, std::vector<std::string>>>
+    extract_record_defs (std::shared_ptr<ast_program> node)
+    {
+      std::vector<std::pair<std::string, std::vector<std::string>>> recs;
+      _record_defs_search (node->get_stmts (), recs, "");
+      return recs;
+    }
+    
+    
+    
     /* 
      * Extracts all identifier ocurrences from the specified AST node.
      */
@@ -18,6 +18,7 @@
 
 #include "util/float.hpp"
 #include <cmath>
+#include <cstdio>
 #include <sstream>
 
 
@@ -40,6 +41,22 @@ namespace rho {
     return bits;
   }
   
+  /* 
+   * Returns the effective precision (in bits) of floating point numbers with
+   * :digits: decimal digits after the decimal point.
+   * Precisions that can be handled by a double collapse into FLOAT_DOUBLE_PREC.
+   */
+  int
+  prec_base10_to_effective_bits (int digits)
+  {
+    if (digits <= FLOAT_DOUBLE_DIGITS)
+      return FLOAT_DOUBLE_PREC;
+    
+    // anything longer goes to MPFR, along with the guard bits that
+    // prec_base10_to_bits() adds.
+    return prec_base10_to_bits (digits);
+  }
+  
   
   
   static void
@@ -73,5 +90,15 @@ namespace rho {
     _sanitize_float_str (str);
     return str;
   }
+  
+  std::string
+  float_to_str (double f, int prec10)
+  {
+    char buf[512];
+    std::snprintf (buf, sizeof buf, "%.*f", prec10, f);
+    
+    std::string str (buf);
+    _sanitize_float_str (str);
+    return str;
+  }
 }
-
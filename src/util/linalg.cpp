@@ -0,0 +1,208 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/linalg.hpp"
+#include "util/simd.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+
+namespace rho {
+  
+  // block sizes used by the matrix multiplication.
+  // a (GEMM_BLOCK_K x GEMM_BLOCK_N) panel of B is kept hot in the cache while
+  // GEMM_BLOCK_M rows of A sweep over it.
+#define GEMM_BLOCK_M    64
+#define GEMM_BLOCK_K    128
+#define GEMM_BLOCK_N    512
+  
+  // products with fewer multiply-adds than this are computed by a single
+  // thread.
+#define GEMM_PARALLEL_THRESHOLD   (1L << 21)
+  
+  
+  
+  /* 
+   * Computes rows [row_start, row_end) of C = A * B.
+   */
+  static void
+  _gemm_rows (const double *a, const double *b, double *c, int k, int n,
+              int row_start, int row_end)
+  {
+    std::memset (c + (long)row_start * n, 0,
+                 sizeof (double) * (long)(row_end - row_start) * n);
+    
+    for (int ii = row_start; ii < row_end; ii += GEMM_BLOCK_M)
+      {
+        int ie = std::min (ii + GEMM_BLOCK_M, row_end);
+        for (int kk = 0; kk < k; kk += GEMM_BLOCK_K)
+          {
+            int ke = std::min (kk + GEMM_BLOCK_K, k);
+            for (int jj = 0; jj < n; jj += GEMM_BLOCK_N)
+              {
+                int jn = std::min (GEMM_BLOCK_N, n - jj);
+                for (int i = ii; i < ie; ++i)
+                  {
+                    double *crow = c + (long)i * n + jj;
+                    const double *arow = a + (long)i * k;
+                    for (int p = kk; p < ke; ++p)
+                      simd_f64_axpy (crow, arow[p], b + (long)p * n + jj, jn);
+                  }
+              }
+          }
+      }
+  }
+  
+  void
+  linalg_gemm (const double *a, const double *b, double *c,
+               int m, int k, int n)
+  {
+    long work = (long)m * k * n;
+    int nthreads = (int)std::thread::hardware_concurrency ();
+    if (nthreads > m / GEMM_BLOCK_M)
+      nthreads = m / GEMM_BLOCK_M;
+    
+    if (work < GEMM_PARALLEL_THRESHOLD || nthreads <= 1)
+      {
+        _gemm_rows (a, b, c, k, n, 0, m);
+        return;
+      }
+    
+    // split rows between threads in multiples of the block size
+    int blocks = (m + GEMM_BLOCK_M - 1) / GEMM_BLOCK_M;
+    int per_thread = (blocks + nthreads - 1) / nthreads;
+    
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t)
+      {
+        int start = t * per_thread * GEMM_BLOCK_M;
+        int end = std::min (m, start + per_thread * GEMM_BLOCK_M);
+        if (start >= end)
+          break;
+        threads.emplace_back (_gemm_rows, a, b, c, k, n, start, end);
+      }
+    
+    for (auto& th : threads)
+      th.join ();
+  }
+  
+  
+  
+#define TRANSPOSE_BLOCK   32
+  
+  void
+  linalg_transpose (const double *src, double *dest, int rows, int cols)
+  {
+    for (int ii = 0; ii < rows; ii += TRANSPOSE_BLOCK)
+      for (int jj = 0; jj < cols; jj += TRANSPOSE_BLOCK)
+        {
+          int ie = std::min (ii + TRANSPOSE_BLOCK, rows);
+          int je = std::min (jj + TRANSPOSE_BLOCK, cols);
+          for (int i = ii; i < ie; ++i)
+            for (int j = jj; j < je; ++j)
+              dest[(long)j * rows + i] = src[(long)i * cols + j];
+        }
+  }
+  
+  
+  
+  bool
+  linalg_lu (double *a, int n, int *perm, int& sign)
+  {
+    for (int i = 0; i < n; ++i)
+      perm[i] = i;
+    sign = 1;
+    
+    for (int k = 0; k < n; ++k)
+      {
+        // find pivot
+        int p = k;
+        double max = std::fabs (a[(long)k * n + k]);
+        for (int i = k + 1; i < n; ++i)
+          {
+            double v = std::fabs (a[(long)i * n + k]);
+            if (v > max)
+              {
+                max = v;
+                p = i;
+              }
+          }
+        
+        if (max == 0.0)
+          return false;
+        
+        if (p != k)
+          {
+            std::swap_ranges (a + (long)k * n, a + (long)(k + 1) * n,
+                              a + (long)p * n);
+            std::swap (perm[k], perm[p]);
+            sign = -sign;
+          }
+        
+        // eliminate below the pivot, row by row
+        const double *krow = a + (long)k * n;
+        double pivot = krow[k];
+        for (int i = k + 1; i < n; ++i)
+          {
+            double *irow = a + (long)i * n;
+            double f = irow[k] / pivot;
+            irow[k] = f;
+            simd_f64_axpy (irow + k + 1, -f, krow + k + 1, n - k - 1);
+          }
+      }
+    
+    return true;
+  }
+  
+  void
+  linalg_lu_solve (const double *lu, const int *perm, int n,
+                   double *b, int nrhs)
+  {
+    // apply permutation
+    std::vector<double> pb ((long)n * nrhs);
+    for (int i = 0; i < n; ++i)
+      std::memcpy (&pb[(long)i * nrhs], b + (long)perm[i] * nrhs,
+                   sizeof (double) * nrhs);
+    
+    // forward substitution (L has a unit diagonal)
+    for (int i = 0; i < n; ++i)
+      {
+        double *brow = &pb[(long)i * nrhs];
+        for (int k = 0; k < i; ++k)
+          simd_f64_axpy (brow, -lu[(long)i * n + k], &pb[(long)k * nrhs], nrhs);
+      }
+    
+    // back substitution
+    for (int i = n - 1; i >= 0; --i)
+      {
+        double *brow = &pb[(long)i * nrhs];
+        for (int k = i + 1; k < n; ++k)
+          simd_f64_axpy (brow, -lu[(long)i * n + k], &pb[(long)k * nrhs], nrhs);
+        
+        double d = lu[(long)i * n + i];
+        for (int j = 0; j < nrhs; ++j)
+          brow[j] /= d;
+      }
+    
+    std::memcpy (b, pb.data (), sizeof (double) * (long)n * nrhs);
+  }
+}
+
@@ -0,0 +1,886 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/poly.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <utility>
+#include <vector>
+#include <map>
+
+
+namespace rho {
+  
+  // operands with fewer coefficients than this are multiplied using the
+  // schoolbook method.
+#define KARATSUBA_THRESHOLD   32
+  
+  // operands with small coefficients and at least this many terms are
+  // multiplied using multi-modular number theoretic transforms.  the threshold
+  // grows with coefficient size (see poly_mul).
+#define NTT_THRESHOLD         64
+  
+  // divide-and-conquer division is used when both the quotient and the
+  // divisor have at least this many coefficients.
+#define DIV_DC_THRESHOLD      48
+  
+  
+  
+  zpoly::zpoly ()
+    : cs (nullptr), n (0)
+    { }
+  
+  zpoly::zpoly (long len)
+    : cs (len ? new __mpz_struct [len] : nullptr), n (len)
+  {
+    for (long i = 0; i < len; ++i)
+      mpz_init (this->cs + i);
+  }
+  
+  zpoly::zpoly (const zpoly& other)
+    : cs (other.n ? new __mpz_struct [other.n] : nullptr), n (other.n)
+  {
+    for (long i = 0; i < this->n; ++i)
+      mpz_init_set (this->cs + i, other.cs + i);
+  }
+  
+  zpoly::zpoly (zpoly&& other)
+    : cs (other.cs), n (other.n)
+  {
+    other.cs = nullptr;
+    other.n = 0;
+  }
+  
+  zpoly::~zpoly ()
+  {
+    for (long i = 0; i < this->n; ++i)
+      mpz_clear (this->cs + i);
+    delete[] this->cs;
+  }
+  
+  zpoly&
+  zpoly::operator= (zpoly other)
+  {
+    std::swap (this->cs, other.cs);
+    std::swap (this->n, other.n);
+    return *this;
+  }
+  
+  
+  
+  /* 
+   * Changes the amount of coefficients stored in the polynomial.
+   * New coefficients are set to zero.
+   */
+  void
+  zpoly::resize (long len)
+  {
+    if (len == this->n)
+      return;
+    
+    auto ncs = len ? new __mpz_struct [len] : nullptr;
+    long keep = std::min (len, this->n);
+    
+    // mpz structures can be relocated by a plain copy
+    for (long i = 0; i < keep; ++i)
+      ncs[i] = this->cs[i];
+    for (long i = keep; i < len; ++i)
+      mpz_init (ncs + i);
+    for (long i = keep; i < this->n; ++i)
+      mpz_clear (this->cs + i);
+    
+    delete[] this->cs;
+    this->cs = ncs;
+    this->n = len;
+  }
+  
+  /* 
+   * Strips zero leading coefficients.
+   */
+  void
+  zpoly::normalize ()
+  {
+    while (this->n > 0 && mpz_sgn (this->cs + (this->n - 1)) == 0)
+      mpz_clear (this->cs + (-- this->n));
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// addition and subtraction
+//------------------------------------------------------------------------------
+  
+  zpoly
+  poly_add (const zpoly& a, const zpoly& b)
+  {
+    zpoly res (std::max (a.size (), b.size ()));
+    for (long i = 0; i < res.size (); ++i)
+      {
+        if (i < a.size () && i < b.size ())
+          mpz_add (res[i], a[i], b[i]);
+        else if (i < a.size ())
+          mpz_set (res[i], a[i]);
+        else
+          mpz_set (res[i], b[i]);
+      }
+    
+    res.normalize ();
+    return res;
+  }
+  
+  zpoly
+  poly_sub (const zpoly& a, const zpoly& b)
+  {
+    zpoly res (std::max (a.size (), b.size ()));
+    for (long i = 0; i < res.size (); ++i)
+      {
+        if (i < a.size () && i < b.size ())
+          mpz_sub (res[i], a[i], b[i]);
+        else if (i < a.size ())
+          mpz_set (res[i], a[i]);
+        else
+          mpz_neg (res[i], b[i]);
+      }
+    
+    res.normalize ();
+    return res;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// schoolbook and Karatsuba multiplication
+//------------------------------------------------------------------------------
+  
+  /* 
+   * res[0 .. na + nb - 2] += a * b
+   */
+  static void
+  _mul_basecase_add (mpz_ptr res, mpz_srcptr a, long na, mpz_srcptr b, long nb)
+  {
+    for (long i = 0; i < na; ++i)
+      {
+        if (mpz_sgn (a + i) == 0)
+          continue;
+        for (long j = 0; j < nb; ++j)
+          mpz_addmul (res + i + j, a + i, b + j);
+      }
+  }
+  
+  /* 
+   * res[0 .. 2n - 2] += a * b, where both operands have n coefficients.
+   */
+  static void
+  _kara_add (mpz_ptr res, mpz_srcptr a, mpz_srcptr b, long n)
+  {
+    if (n < KARATSUBA_THRESHOLD)
+      {
+        _mul_basecase_add (res, a, n, b, n);
+        return;
+      }
+    
+    // split into a = a0 + a1*x^m, b = b0 + b1*x^m
+    long m = n / 2;
+    long h = n - m;
+    
+    zpoly z0 (2*m - 1), z1 (2*h - 1), z2 (2*h - 1);
+    _kara_add (z0.data (), a, b, m);
+    _kara_add (z2.data (), a + m, b + m, h);
+    
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    zpoly sa (h), sb (h);
+    for (long i = 0; i < h; ++i)
+      {
+        mpz_set (sa[i], a + m + i);
+        mpz_set (sb[i], b + m + i);
+        if (i < m)
+          {
+            mpz_add (sa[i], sa[i], a + i);
+            mpz_add (sb[i], sb[i], b + i);
+          }
+      }
+    _kara_add (z1.data (), sa.data (), sb.data (), h);
+    for (long i = 0; i < z0.size (); ++i)
+      mpz_sub (z1[i], z1[i], z0[i]);
+    for (long i = 0; i < z2.size (); ++i)
+      mpz_sub (z1[i], z1[i], z2[i]);
+    
+    for (long i = 0; i < z0.size (); ++i)
+      mpz_add (res + i, res + i, z0[i]);
+    for (long i = 0; i < z1.size (); ++i)
+      mpz_add (res + m + i, res + m + i, z1[i]);
+    for (long i = 0; i < z2.size (); ++i)
+      mpz_add (res + 2*m + i, res + 2*m + i, z2[i]);
+  }
+  
+  /* 
+   * res[0 .. na + nb - 2] += a * b
+   * Unbalanced operands are handled by splitting the longer one into chunks
+   * the size of the shorter one.
+   */
+  static void
+  _mul_add (mpz_ptr res, mpz_srcptr a, long na, mpz_srcptr b, long nb)
+  {
+    if (na < nb)
+      {
+        std::swap (a, b);
+        std::swap (na, nb);
+      }
+    
+    if (nb < KARATSUBA_THRESHOLD)
+      {
+        _mul_basecase_add (res, a, na, b, nb);
+        return;
+      }
+    
+    for (long off = 0; off < na; off += nb)
+      {
+        long len = std::min (nb, na - off);
+        if (len == nb)
+          _kara_add (res + off, a + off, b, nb);
+        else
+          _mul_add (res + off, b, nb, a + off, len);
+      }
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// multi-modular NTT multiplication
+//------------------------------------------------------------------------------
+  
+  typedef unsigned long long u64;
+  typedef unsigned __int128 u128;
+  
+  static inline u64
+  _mulmod (u64 a, u64 b, u64 p)
+    { return (u64)((u128)a * b % p); }
+  
+  static u64
+  _powmod (u64 b, u64 e, u64 p)
+  {
+    u64 r = 1;
+    b %= p;
+    while (e)
+      {
+        if (e & 1)
+          r = _mulmod (r, b, p);
+        b = _mulmod (b, b, p);
+        e >>= 1;
+      }
+    return r;
+  }
+  
+  /* 
+   * Deterministic Miller-Rabin for 64-bit integers.
+   */
+  static bool
+  _is_prime (u64 n)
+  {
+    static const u64 bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    if (n < 2)
+      return false;
+    for (u64 b : bases)
+      if (n % b == 0)
+        return n == b;
+    
+    u64 d = n - 1;
+    int s = 0;
+    while ((d & 1) == 0)
+      {
+        d >>= 1;
+        ++ s;
+      }
+    
+    for (u64 b : bases)
+      {
+        u64 x = _powmod (b, d, n);
+        if (x == 1 || x == n - 1)
+          continue;
+        
+        bool composite = true;
+        for (int i = 1; i < s; ++i)
+          {
+            x = _mulmod (x, x, n);
+            if (x == n - 1)
+              {
+                composite = false;
+                break;
+              }
+          }
+        if (composite)
+          return false;
+      }
+    
+    return true;
+  }
+  
+  
+  struct ntt_prime
+  {
+    u64 p;
+    u64 root; // primitive 2^k-th root of unity
+  };
+  
+  // all NTT primes are smaller than 2^NTT_PRIME_BITS, and at least
+  // 2^(NTT_PRIME_BITS - 1).
+#define NTT_PRIME_BITS    62
+  
+  /* 
+   * Returns at least :count: primes of the form c*2^k + 1, along with a
+   * primitive 2^k-th root of unity modulo each of them.
+   * Primes are generated on demand and cached.
+   */
+  static std::vector<ntt_prime>
+  _ntt_primes (int k, int count)
+  {
+    static std::map<int, std::vector<ntt_prime>> cache;
+    auto& primes = cache[k];
+    
+    u64 step = 1ULL << k;
+    u64 c = primes.empty ()
+      ? ((1ULL << NTT_PRIME_BITS) - 1) / step
+      : (primes.back ().p - 1) / step - 1;
+    u64 c_min = (1ULL << (NTT_PRIME_BITS - 1)) / step;
+    
+    while ((int)primes.size () < count)
+      {
+        if (c <= c_min)
+          throw std::runtime_error ("poly_mul: ran out of NTT primes");
+        
+        u64 p = c * step + 1;
+        -- c;
+        if (!_is_prime (p))
+          continue;
+        
+        // any quadratic non-residue g yields a primitive 2^k-th root of unity
+        // g^((p - 1) / 2^k), since its 2^(k-1)th power is g^((p-1)/2) = -1.
+        for (u64 g = 2; ; ++g)
+          if (_powmod (g, (p - 1) / 2, p) == p - 1)
+            {
+              primes.push_back ({ p, _powmod (g, (p - 1) >> k, p) });
+              break;
+            }
+      }
+    
+    return std::vector<ntt_prime> (primes.begin (), primes.begin () + count);
+  }
+  
+  /* 
+   * In-place iterative NTT of length n (a power of two), given a primitive
+   * n-th root of unity.
+   */
+  static void
+  _ntt (std::vector<u64>& a, u64 p, u64 root)
+  {
+    long n = a.size ();
+    for (long i = 1, j = 0; i < n; ++i)
+      {
+        long bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+          j ^= bit;
+        j ^= bit;
+        if (i < j)
+          std::swap (a[i], a[j]);
+      }
+    
+    std::vector<u64> ws (n / 2);
+    for (long len = 2; len <= n; len <<= 1)
+      {
+        long half = len >> 1;
+        u64 wlen = _powmod (root, n / len, p);
+        ws[0] = 1;
+        for (long j = 1; j < half; ++j)
+          ws[j] = _mulmod (ws[j - 1], wlen, p);
+        
+        for (long i = 0; i < n; i += len)
+          for (long j = 0; j < half; ++j)
+            {
+              u64 u = a[i + j];
+              u64 v = _mulmod (a[i + j + half], ws[j], p);
+              a[i + j] = (u + v >= p) ? (u + v - p) : (u + v);
+              a[i + j + half] = (u >= v) ? (u - v) : (u + p - v);
+            }
+      }
+  }
+  
+  static long
+  _max_bits (const zpoly& p)
+  {
+    long bits = 0;
+    for (long i = 0; i < p.size (); ++i)
+      bits = std::max (bits, (long)mpz_sizeinbase (p[i], 2));
+    return bits;
+  }
+  
+  static int
+  _ceil_log2 (long n)
+  {
+    int k = 0;
+    while ((1L << k) < n)
+      ++ k;
+    return k;
+  }
+  
+  static zpoly
+  _mul_ntt (const zpoly& a, const zpoly& b)
+  {
+    long nres = a.size () + b.size () - 1;
+    int k = _ceil_log2 (nres);
+    long len = 1L << k;
+    
+    // the product's coefficients are bounded in absolute value by
+    // min(na, nb) * max|a_i| * max|b_i|; the CRT modulus must exceed twice
+    // that to recover signed values.
+    long bound = _max_bits (a) + _max_bits (b)
+      + _ceil_log2 (std::min (a.size (), b.size ())) + 2;
+    int count = (int)((bound + NTT_PRIME_BITS - 2) / (NTT_PRIME_BITS - 1));
+    auto primes = _ntt_primes (k, count);
+    
+    std::vector<u64> residues ((long)count * nres);
+    std::vector<u64> fa (len), fb (len);
+    for (int t = 0; t < count; ++t)
+      {
+        u64 p = primes[t].p;
+        std::fill (fa.begin (), fa.end (), 0);
+        std::fill (fb.begin (), fb.end (), 0);
+        for (long i = 0; i < a.size (); ++i)
+          fa[i] = mpz_fdiv_ui (a[i], p);
+        for (long i = 0; i < b.size (); ++i)
+          fb[i] = mpz_fdiv_ui (b[i], p);
+        
+        _ntt (fa, p, primes[t].root);
+        _ntt (fb, p, primes[t].root);
+        for (long i = 0; i < len; ++i)
+          fa[i] = _mulmod (fa[i], fb[i], p);
+        
+        // inverse transform
+        _ntt (fa, p, _powmod (primes[t].root, p - 2, p));
+        u64 inv_len = _powmod (len % p, p - 2, p);
+        for (long i = 0; i < nres; ++i)
+          residues[(long)t * nres + i] = _mulmod (fa[i], inv_len, p);
+      }
+    
+    // Garner's algorithm: inv[t][s] = p_s^-1 mod p_t
+    std::vector<u64> inv ((long)count * count);
+    for (int t = 0; t < count; ++t)
+      for (int s = 0; s < t; ++s)
+        inv[t * count + s] = _powmod (primes[s].p % primes[t].p,
+                                      primes[t].p - 2, primes[t].p);
+    
+    mpz_t m, half;
+    mpz_init_set_ui (m, 1);
+    for (int t = 0; t < count; ++t)
+      mpz_mul_ui (m, m, primes[t].p);
+    mpz_init (half);
+    mpz_fdiv_q_2exp (half, m, 1);
+    
+    zpoly res (nres);
+    std::vector<u64> v (count);
+    for (long i = 0; i < nres; ++i)
+      {
+        for (int t = 0; t < count; ++t)
+          {
+            u64 p = primes[t].p;
+            u64 x = residues[(long)t * nres + i];
+            for (int s = 0; s < t; ++s)
+              {
+                u64 vs = v[s] % p;
+                x = (x >= vs) ? (x - vs) : (x + p - vs);
+                x = _mulmod (x, inv[t * count + s], p);
+              }
+            v[t] = x;
+          }
+        
+        // x = v0 + p0*(v1 + p1*(v2 + ...))
+        auto c = res[i];
+        mpz_set_ui (c, v[count - 1]);
+        for (int s = count - 2; s >= 0; --s)
+          {
+            mpz_mul_ui (c, c, primes[s].p);
+            mpz_add_ui (c, c, v[s]);
+          }
+        if (mpz_cmp (c, half) > 0)
+          mpz_sub (c, c, m);
+      }
+    
+    mpz_clear (m);
+    mpz_clear (half);
+    return res;
+  }
+  
+  
+  
+  /* 
+   * Multiplies two polynomials.
+   * Depending on the sizes of the operands, this uses either schoolbook
+   * multiplication, Karatsuba's algorithm, or multi-modular NTT
+   * multiplication.
+   */
+  zpoly
+  poly_mul (const zpoly& a, const zpoly& b)
+  {
+    if (a.is_zero () || b.is_zero ())
+      return zpoly ();
+    
+    // the cost of reducing coefficients modulo each prime and of CRT
+    // reconstruction is quadratic in the coefficients' size, so NTTs only pay
+    // off for long enough polynomials.
+    long n = std::min (a.size (), b.size ());
+    if (n >= NTT_THRESHOLD && n >= NTT_THRESHOLD *
+        std::max (1L, std::max (_max_bits (a), _max_bits (b)) / 128))
+      {
+        auto res = _mul_ntt (a, b);
+        res.normalize ();
+        return res;
+      }
+    
+    zpoly res (a.size () + b.size () - 1);
+    _mul_add (res.data (), a.data (), a.size (), b.data (), b.size ());
+    res.normalize ();
+    return res;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// division
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Returns p div x^k.
+   */
+  static zpoly
+  _shift_right (const zpoly& p, long k)
+  {
+    if (k >= p.size ())
+      return zpoly ();
+    
+    zpoly res (p.size () - k);
+    for (long i = 0; i < res.size (); ++i)
+      mpz_set (res[i], p[i + k]);
+    return res;
+  }
+  
+  /* 
+   * Classical long division.
+   */
+  static bool
+  _divrem_classical (const zpoly& a, const zpoly& b, zpoly& q, zpoly& r)
+  {
+    long db = b.degree ();
+    r = a;
+    q = zpoly (a.degree () - db + 1);
+    
+    mpz_t c;
+    mpz_init (c);
+    for (long i = a.degree (); i >= db; --i)
+      {
+        if (mpz_sgn (r[i]) == 0)
+          continue;
+        if (!mpz_divisible_p (r[i], b.lc ()))
+          {
+            mpz_clear (c);
+            return false;
+          }
+        
+        mpz_divexact (c, r[i], b.lc ());
+        mpz_set (q[i - db], c);
+        for (long j = 0; j <= db; ++j)
+          mpz_submul (r[i - db + j], c, b[j]);
+      }
+    mpz_clear (c);
+    
+    q.normalize ();
+    r.normalize ();
+    return true;
+  }
+  
+  /* 
+   * Computes the quotient of a divided by b using a divide-and-conquer
+   * scheme, so that most of the work is done by fast multiplication.
+   * 
+   * This relies on two facts: the quotient of (a div x^k) by b is exactly
+   * the quotient of a by b divided by x^k; and a quotient of degree d only
+   * depends on the top d+1 coefficients of the divisor.
+   */
+  static bool
+  _quo_dc (zpoly a, zpoly b, zpoly& q)
+  {
+    long m = a.degree () - b.degree ();
+    if (m < 0)
+      {
+        q = zpoly ();
+        return true;
+      }
+    
+    // drop divisor coefficients that do not affect the quotient
+    if (b.degree () > m)
+      {
+        long s = b.degree () - m;
+        a = _shift_right (a, s);
+        b = _shift_right (b, s);
+      }
+    
+    if (m < DIV_DC_THRESHOLD || b.degree () < DIV_DC_THRESHOLD)
+      {
+        zpoly r;
+        return _divrem_classical (a, b, q, r);
+      }
+    
+    // high part of the quotient
+    long k = (m + 1) / 2;
+    zpoly qh;
+    if (!_quo_dc (_shift_right (a, k), b, qh))
+      return false;
+    
+    // a <- a - qh*b*x^k
+    auto t = poly_mul (qh, b);
+    for (long i = 0; i < t.size (); ++i)
+      mpz_sub (a[i + k], a[i + k], t[i]);
+    a.normalize ();
+    
+    // low part
+    zpoly ql;
+    if (!_quo_dc (std::move (a), b, ql))
+      return false;
+    
+    q = zpoly (k + qh.size ());
+    for (long i = 0; i < ql.size (); ++i)
+      mpz_swap (q[i], ql[i]);
+    for (long i = 0; i < qh.size (); ++i)
+      mpz_swap (q[i + k], qh[i]);
+    q.normalize ();
+    return true;
+  }
+  
+  /* 
+   * Computes q and r such that a = q*b + r, deg(r) < deg(b).
+   * Returns false if the quotient does not have integer coefficients.
+   * Large divisions are carried out using a divide-and-conquer scheme on top
+   * of fast multiplication.
+   */
+  bool
+  poly_divrem (const zpoly& a, const zpoly& b, zpoly& q, zpoly& r)
+  {
+    if (b.is_zero ())
+      throw std::domain_error ("poly_divrem: division by zero");
+    
+    if (a.degree () < b.degree ())
+      {
+        q = zpoly ();
+        r = a;
+        return true;
+      }
+    
+    long m = a.degree () - b.degree ();
+    if (m < DIV_DC_THRESHOLD || b.degree () < DIV_DC_THRESHOLD)
+      return _divrem_classical (a, b, q, r);
+    
+    if (!_quo_dc (a, b, q))
+      return false;
+    r = poly_sub (a, poly_mul (q, b));
+    return true;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// GCD
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Stores the GCD of the polynomial's coefficients in :res:.
+   */
+  void
+  poly_content (mpz_t res, const zpoly& p)
+  {
+    mpz_set_ui (res, 0);
+    for (long i = 0; i < p.size (); ++i)
+      {
+        mpz_gcd (res, res, p[i]);
+        if (mpz_cmp_ui (res, 1) == 0)
+          break;
+      }
+  }
+  
+  /* 
+   * Returns the primitive part of the polynomial (with a positive leading
+   * coefficient).
+   */
+  static zpoly
+  _primitive_part (const zpoly& p)
+  {
+    if (p.is_zero ())
+      return p;
+    
+    mpz_t c;
+    mpz_init (c);
+    poly_content (c, p);
+    if (mpz_sgn (p.lc ()) < 0)
+      mpz_neg (c, c);
+    
+    zpoly res (p.size ());
+    for (long i = 0; i < p.size (); ++i)
+      mpz_divexact (res[i], p[i], c);
+    
+    mpz_clear (c);
+    return res;
+  }
+  
+  /* 
+   * Computes the pseudo-remainder of a divided by b, that is, the remainder
+   * of lc(b)^(deg(a) - deg(b) + 1) * a divided by b.
+   */
+  static zpoly
+  _prem (const zpoly& a, const zpoly& b)
+  {
+    zpoly r = a;
+    long db = b.degree ();
+    
+    mpz_t c;
+    mpz_init (c);
+    while (!r.is_zero () && r.degree () >= db)
+      {
+        long s = r.degree ();
+        mpz_set (c, r.lc ());
+        
+        // r <- lc(b)*r - c * x^(s - db) * b
+        for (long i = 0; i < r.size (); ++i)
+          mpz_mul (r[i], r[i], b.lc ());
+        for (long j = 0; j <= db; ++j)
+          mpz_submul (r[s - db + j], c, b[j]);
+        
+        r.normalize ();
+      }
+    mpz_clear (c);
+    
+    return r;
+  }
+  
+  /* 
+   * Computes the greatest common divisor of two polynomials, using the
+   * primitive PRS algorithm.  The result has a positive leading coefficient.
+   */
+  zpoly
+  poly_gcd (const zpoly& a, const zpoly& b)
+  {
+    if (a.is_zero () && b.is_zero ())
+      return zpoly ();
+    
+    mpz_t c, cb;
+    mpz_init (c);
+    mpz_init (cb);
+    poly_content (c, a);
+    poly_content (cb, b);
+    mpz_gcd (c, c, cb);
+    mpz_clear (cb);
+    
+    zpoly x = _primitive_part (a);
+    zpoly y = _primitive_part (b);
+    if (x.degree () < y.degree ())
+      std::swap (x, y);
+    
+    while (!y.is_zero ())
+      {
+        auto r = _prem (x, y);
+        x = std::move (y);
+        y = _primitive_part (r);
+      }
+    
+    // x is now the GCD of the primitive parts
+    for (long i = 0; i < x.size (); ++i)
+      mpz_mul (x[i], x[i], c);
+    
+    mpz_clear (c);
+    return x;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  /* 
+   * Evaluates the polynomial at :x: using Horner's method.
+   */
+  void
+  poly_eval (mpz_t res, const zpoly& p, mpz_srcptr x)
+  {
+    mpz_set_ui (res, 0);
+    for (long i = p.size () - 1; i >= 0; --i)
+      {
+        mpz_mul (res, res, x);
+        mpz_add (res, res, p[i]);
+      }
+  }
+  
+  double
+  poly_eval (const zpoly& p, double x)
+  {
+    double res = 0.0;
+    for (long i = p.size () - 1; i >= 0; --i)
+      res = res * x + mpz_get_d (p[i]);
+    return res;
+  }
+  
+  
+  
+  /* 
+   * Returns a textual representation of the polynomial in terms of x.
+   */
+  std::string
+  poly_to_str (const zpoly& p)
+  {
+    if (p.is_zero ())
+      return "0";
+    
+    std::ostringstream ss;
+    bool first = true;
+    for (long i = p.size () - 1; i >= 0; --i)
+      {
+        int sgn = mpz_sgn (p[i]);
+        if (sgn == 0)
+          continue;
+        
+        if (first)
+          ss << ((sgn < 0) ? "-" : "");
+        else
+          ss << ((sgn < 0) ? " - " : " + ");
+        first = false;
+        
+        if (i == 0 || mpz_cmpabs_ui (p[i], 1) != 0)
+          {
+            char *str = mpz_get_str (NULL, 10, p[i]);
+            ss << ((sgn < 0) ? str + 1 : str);
+            
+            void (*freefunc) (void *, size_t);
+            mp_get_memory_functions (NULL, NULL, &freefunc);
+            freefunc (str, std::char_traits<char>::length (str) + 1);
+          }
+        
+        if (i == 1)
+          ss << "x";
+        else if (i > 1)
+          ss << "x^" << i;
+      }
+    
+    return ss.str ();
+  }
+}
+
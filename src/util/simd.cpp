@@ -0,0 +1,884 @@
+/*
+ * Rho - A sandbox for mathematics.
+ * Copyright (C) 2015-2016 Jacob Zhitomirsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/simd.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define RHO_SIMD_X86
+# include <immintrin.h>
+#endif
+
+
+namespace rho {
+  
+  namespace {
+    
+    /* 
+     * Table of kernel implementations, filled in according to the features
+     * supported by the host CPU.
+     */
+    struct kernel_table
+    {
+      void (*f64_add) (double *, const double *, const double *, long);
+      void (*f64_mul) (double *, const double *, const double *, long);
+      void (*f64_fma) (double *, const double *, const double *,
+                       const double *, long);
+      void (*f64_axpy) (double *, double, const double *, long);
+      double (*f64_dot) (const double *, const double *, long);
+      double (*f64_sum) (const double *, long);
+      double (*f64_min) (const double *, long);
+      double (*f64_max) (const double *, long);
+      
+      void (*i64_add) (long long *, const long long *, const long long *, long);
+      long long (*i64_sum) (const long long *, long);
+      long long (*i64_min) (const long long *, long);
+      long long (*i64_max) (const long long *, long);
+      
+      long (*str_find) (const char *, long, const char *, long);
+      long (*find_byte2) (const char *, long, char, char);
+    };
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// scalar kernels
+//------------------------------------------------------------------------------
+  
+  static void
+  _f64_add_scalar (double *dest, const double *a, const double *b, long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = a[i] + b[i];
+  }
+  
+  static void
+  _f64_mul_scalar (double *dest, const double *a, const double *b, long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = a[i] * b[i];
+  }
+  
+  static void
+  _f64_fma_scalar (double *dest, const double *a, const double *b,
+                   const double *c, long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = a[i] * b[i] + c[i];
+  }
+  
+  static void
+  _f64_axpy_scalar (double *y, double alpha, const double *x, long n)
+  {
+    for (long i = 0; i < n; ++i)
+      y[i] += alpha * x[i];
+  }
+  
+  static double
+  _f64_dot_scalar (const double *a, const double *b, long n)
+  {
+    double r = 0.0;
+    for (long i = 0; i < n; ++i)
+      r += a[i] * b[i];
+    return r;
+  }
+  
+  static double
+  _f64_sum_scalar (const double *a, long n)
+  {
+    double r = 0.0;
+    for (long i = 0; i < n; ++i)
+      r += a[i];
+    return r;
+  }
+  
+  static double
+  _f64_min_scalar (const double *a, long n)
+  {
+    double r = a[0];
+    for (long i = 1; i < n; ++i)
+      if (a[i] < r)
+        r = a[i];
+    return r;
+  }
+  
+  static double
+  _f64_max_scalar (const double *a, long n)
+  {
+    double r = a[0];
+    for (long i = 1; i < n; ++i)
+      if (a[i] > r)
+        r = a[i];
+    return r;
+  }
+  
+  
+  /* 
+   * Integer arithmetic wraps around on overflow, so it is carried out using
+   * unsigned integers.
+   */
+  typedef unsigned long long u64;
+  
+  static void
+  _i64_add_scalar (long long *dest, const long long *a, const long long *b,
+                   long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = (long long)((u64)a[i] + (u64)b[i]);
+  }
+  
+  static long long
+  _i64_sum_scalar (const long long *a, long n)
+  {
+    u64 r = 0;
+    for (long i = 0; i < n; ++i)
+      r += (u64)a[i];
+    return (long long)r;
+  }
+  
+  static long long
+  _i64_min_scalar (const long long *a, long n)
+  {
+    long long r = a[0];
+    for (long i = 1; i < n; ++i)
+      if (a[i] < r)
+        r = a[i];
+    return r;
+  }
+  
+  static long long
+  _i64_max_scalar (const long long *a, long n)
+  {
+    long long r = a[0];
+    for (long i = 1; i < n; ++i)
+      if (a[i] > r)
+        r = a[i];
+    return r;
+  }
+  
+  /* 
+   * Returns the index of the first occurrence of :needle: at or past :from:
+   * in :hay:, or -1.  :needle: is not empty.
+   */
+  static long
+  _str_find_from (const char *hay, long n, const char *needle, long m,
+                  long from)
+  {
+    for (long i = from; i + m <= n; ++i)
+      {
+        auto p = (const char *)std::memchr (hay + i, needle[0], n - m + 1 - i);
+        if (!p)
+          return -1;
+        i = p - hay;
+        if (std::memcmp (p + 1, needle + 1, m - 1) == 0)
+          return i;
+      }
+    
+    return -1;
+  }
+  
+  static long
+  _str_find_scalar (const char *hay, long n, const char *needle, long m)
+  {
+    return _str_find_from (hay, n, needle, m, 0);
+  }
+  
+  static long
+  _find_byte2_from (const char *s, long n, char a, char b, long from)
+  {
+    for (long i = from; i < n; ++i)
+      if (s[i] == a || s[i] == b)
+        return i;
+    return -1;
+  }
+  
+  static long
+  _find_byte2_scalar (const char *s, long n, char a, char b)
+  {
+    return _find_byte2_from (s, n, a, b, 0);
+  }
+  
+  
+  
+#ifdef RHO_SIMD_X86
+//------------------------------------------------------------------------------
+// SSE2 kernels
+//------------------------------------------------------------------------------
+  
+  __attribute__ ((target ("sse2"))) static void
+  _f64_add_sse2 (double *dest, const double *a, const double *b, long n)
+  {
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd (dest + i,
+        _mm_add_pd (_mm_loadu_pd (a + i), _mm_loadu_pd (b + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] + b[i];
+  }
+  
+  __attribute__ ((target ("sse2"))) static void
+  _f64_mul_sse2 (double *dest, const double *a, const double *b, long n)
+  {
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd (dest + i,
+        _mm_mul_pd (_mm_loadu_pd (a + i), _mm_loadu_pd (b + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] * b[i];
+  }
+  
+  __attribute__ ((target ("sse2"))) static void
+  _f64_fma_sse2 (double *dest, const double *a, const double *b,
+                 const double *c, long n)
+  {
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd (dest + i,
+        _mm_add_pd (_mm_mul_pd (_mm_loadu_pd (a + i), _mm_loadu_pd (b + i)),
+                    _mm_loadu_pd (c + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] * b[i] + c[i];
+  }
+  
+  __attribute__ ((target ("sse2"))) static void
+  _f64_axpy_sse2 (double *y, double alpha, const double *x, long n)
+  {
+    __m128d va = _mm_set1_pd (alpha);
+    
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd (y + i,
+        _mm_add_pd (_mm_loadu_pd (y + i), _mm_mul_pd (va, _mm_loadu_pd (x + i))));
+    for (; i < n; ++i)
+      y[i] += alpha * x[i];
+  }
+  
+  __attribute__ ((target ("sse2"))) static double
+  _hsum_sse2 (__m128d v)
+  {
+    return _mm_cvtsd_f64 (_mm_add_sd (v, _mm_unpackhi_pd (v, v)));
+  }
+  
+  __attribute__ ((target ("sse2"))) static double
+  _f64_dot_sse2 (const double *a, const double *b, long n)
+  {
+    __m128d acc0 = _mm_setzero_pd ();
+    __m128d acc1 = _mm_setzero_pd ();
+    
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+        acc0 = _mm_add_pd (acc0,
+          _mm_mul_pd (_mm_loadu_pd (a + i), _mm_loadu_pd (b + i)));
+        acc1 = _mm_add_pd (acc1,
+          _mm_mul_pd (_mm_loadu_pd (a + i + 2), _mm_loadu_pd (b + i + 2)));
+      }
+    
+    double r = _hsum_sse2 (_mm_add_pd (acc0, acc1));
+    for (; i < n; ++i)
+      r += a[i] * b[i];
+    return r;
+  }
+  
+  __attribute__ ((target ("sse2"))) static double
+  _f64_sum_sse2 (const double *a, long n)
+  {
+    __m128d acc0 = _mm_setzero_pd ();
+    __m128d acc1 = _mm_setzero_pd ();
+    
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+        acc0 = _mm_add_pd (acc0, _mm_loadu_pd (a + i));
+        acc1 = _mm_add_pd (acc1, _mm_loadu_pd (a + i + 2));
+      }
+    
+    double r = _hsum_sse2 (_mm_add_pd (acc0, acc1));
+    for (; i < n; ++i)
+      r += a[i];
+    return r;
+  }
+  
+  __attribute__ ((target ("sse2"))) static double
+  _f64_min_sse2 (const double *a, long n)
+  {
+    if (n < 2)
+      return _f64_min_scalar (a, n);
+    
+    __m128d m = _mm_loadu_pd (a);
+    long i = 2;
+    for (; i + 2 <= n; i += 2)
+      m = _mm_min_pd (m, _mm_loadu_pd (a + i));
+    
+    double r = _mm_cvtsd_f64 (_mm_min_sd (m, _mm_unpackhi_pd (m, m)));
+    for (; i < n; ++i)
+      if (a[i] < r)
+        r = a[i];
+    return r;
+  }
+  
+  __attribute__ ((target ("sse2"))) static double
+  _f64_max_sse2 (const double *a, long n)
+  {
+    if (n < 2)
+      return _f64_max_scalar (a, n);
+    
+    __m128d m = _mm_loadu_pd (a);
+    long i = 2;
+    for (; i + 2 <= n; i += 2)
+      m = _mm_max_pd (m, _mm_loadu_pd (a + i));
+    
+    double r = _mm_cvtsd_f64 (_mm_max_sd (m, _mm_unpackhi_pd (m, m)));
+    for (; i < n; ++i)
+      if (a[i] > r)
+        r = a[i];
+    return r;
+  }
+  
+  __attribute__ ((target ("sse2"))) static void
+  _i64_add_sse2 (long long *dest, const long long *a, const long long *b,
+                 long n)
+  {
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_si128 ((__m128i *)(dest + i),
+        _mm_add_epi64 (_mm_loadu_si128 ((const __m128i *)(a + i)),
+                       _mm_loadu_si128 ((const __m128i *)(b + i))));
+    for (; i < n; ++i)
+      dest[i] = (long long)((u64)a[i] + (u64)b[i]);
+  }
+  
+  __attribute__ ((target ("sse2"))) static long long
+  _i64_sum_sse2 (const long long *a, long n)
+  {
+    __m128i acc = _mm_setzero_si128 ();
+    
+    long i = 0;
+    for (; i + 2 <= n; i += 2)
+      acc = _mm_add_epi64 (acc, _mm_loadu_si128 ((const __m128i *)(a + i)));
+    
+    long long lanes[2];
+    _mm_storeu_si128 ((__m128i *)lanes, acc);
+    u64 r = (u64)lanes[0] + (u64)lanes[1];
+    for (; i < n; ++i)
+      r += (u64)a[i];
+    return (long long)r;
+  }
+  
+  /* 
+   * Substring search compares the first and last bytes of the needle
+   * against 16 (or 32) consecutive positions at once, and only checks the
+   * bytes in between at positions where both match.
+   */
+  __attribute__ ((target ("sse2"))) static long
+  _str_find_sse2 (const char *hay, long n, const char *needle, long m)
+  {
+    const __m128i first = _mm_set1_epi8 (needle[0]);
+    const __m128i last = _mm_set1_epi8 (needle[m - 1]);
+    
+    long i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16)
+      {
+        __m128i bf = _mm_loadu_si128 ((const __m128i *)(hay + i));
+        __m128i bl = _mm_loadu_si128 ((const __m128i *)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8 (
+          _mm_and_si128 (_mm_cmpeq_epi8 (bf, first),
+                         _mm_cmpeq_epi8 (bl, last)));
+        while (mask)
+          {
+            int bit = __builtin_ctz (mask);
+            if (m <= 2 || std::memcmp (hay + i + bit + 1, needle + 1,
+                                       m - 2) == 0)
+              return i + bit;
+            mask &= mask - 1;
+          }
+      }
+    
+    return _str_find_from (hay, n, needle, m, i);
+  }
+  
+  __attribute__ ((target ("sse2"))) static long
+  _find_byte2_sse2 (const char *s, long n, char a, char b)
+  {
+    const __m128i va = _mm_set1_epi8 (a);
+    const __m128i vb = _mm_set1_epi8 (b);
+    
+    long i = 0;
+    for (; i + 16 <= n; i += 16)
+      {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(s + i));
+        unsigned mask = _mm_movemask_epi8 (
+          _mm_or_si128 (_mm_cmpeq_epi8 (x, va), _mm_cmpeq_epi8 (x, vb)));
+        if (mask)
+          return i + __builtin_ctz (mask);
+      }
+    
+    return _find_byte2_from (s, n, a, b, i);
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+// AVX2 + FMA kernels
+//------------------------------------------------------------------------------
+  
+#define RHO_AVX2 __attribute__ ((target ("avx2,fma")))
+  
+  RHO_AVX2 static void
+  _f64_add_avx2 (double *dest, const double *a, const double *b, long n)
+  {
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd (dest + i,
+        _mm256_add_pd (_mm256_loadu_pd (a + i), _mm256_loadu_pd (b + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] + b[i];
+  }
+  
+  RHO_AVX2 static void
+  _f64_mul_avx2 (double *dest, const double *a, const double *b, long n)
+  {
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd (dest + i,
+        _mm256_mul_pd (_mm256_loadu_pd (a + i), _mm256_loadu_pd (b + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] * b[i];
+  }
+  
+  RHO_AVX2 static void
+  _f64_fma_avx2 (double *dest, const double *a, const double *b,
+                 const double *c, long n)
+  {
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd (dest + i,
+        _mm256_fmadd_pd (_mm256_loadu_pd (a + i), _mm256_loadu_pd (b + i),
+                         _mm256_loadu_pd (c + i)));
+    for (; i < n; ++i)
+      dest[i] = a[i] * b[i] + c[i];
+  }
+  
+  RHO_AVX2 static void
+  _f64_axpy_avx2 (double *y, double alpha, const double *x, long n)
+  {
+    __m256d va = _mm256_set1_pd (alpha);
+    
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+      {
+        _mm256_storeu_pd (y + i,
+          _mm256_fmadd_pd (va, _mm256_loadu_pd (x + i), _mm256_loadu_pd (y + i)));
+        _mm256_storeu_pd (y + i + 4,
+          _mm256_fmadd_pd (va, _mm256_loadu_pd (x + i + 4),
+                           _mm256_loadu_pd (y + i + 4)));
+      }
+    for (; i < n; ++i)
+      y[i] += alpha * x[i];
+  }
+  
+  RHO_AVX2 static double
+  _hsum_avx2 (__m256d v)
+  {
+    __m128d lo = _mm256_castpd256_pd128 (v);
+    __m128d hi = _mm256_extractf128_pd (v, 1);
+    lo = _mm_add_pd (lo, hi);
+    return _mm_cvtsd_f64 (_mm_add_sd (lo, _mm_unpackhi_pd (lo, lo)));
+  }
+  
+  RHO_AVX2 static double
+  _f64_dot_avx2 (const double *a, const double *b, long n)
+  {
+    // two independent accumulators to hide the latency of the FMA unit
+    __m256d acc0 = _mm256_setzero_pd ();
+    __m256d acc1 = _mm256_setzero_pd ();
+    
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+      {
+        acc0 = _mm256_fmadd_pd (_mm256_loadu_pd (a + i),
+                                _mm256_loadu_pd (b + i), acc0);
+        acc1 = _mm256_fmadd_pd (_mm256_loadu_pd (a + i + 4),
+                                _mm256_loadu_pd (b + i + 4), acc1);
+      }
+    
+    double r = _hsum_avx2 (_mm256_add_pd (acc0, acc1));
+    for (; i < n; ++i)
+      r += a[i] * b[i];
+    return r;
+  }
+  
+  RHO_AVX2 static double
+  _f64_sum_avx2 (const double *a, long n)
+  {
+    __m256d acc0 = _mm256_setzero_pd ();
+    __m256d acc1 = _mm256_setzero_pd ();
+    
+    long i = 0;
+    for (; i + 8 <= n; i += 8)
+      {
+        acc0 = _mm256_add_pd (acc0, _mm256_loadu_pd (a + i));
+        acc1 = _mm256_add_pd (acc1, _mm256_loadu_pd (a + i + 4));
+      }
+    
+    double r = _hsum_avx2 (_mm256_add_pd (acc0, acc1));
+    for (; i < n; ++i)
+      r += a[i];
+    return r;
+  }
+  
+  RHO_AVX2 static double
+  _f64_min_avx2 (const double *a, long n)
+  {
+    if (n < 4)
+      return _f64_min_scalar (a, n);
+    
+    __m256d m = _mm256_loadu_pd (a);
+    long i = 4;
+    for (; i + 4 <= n; i += 4)
+      m = _mm256_min_pd (m, _mm256_loadu_pd (a + i));
+    
+    double lanes[4];
+    _mm256_storeu_pd (lanes, m);
+    double r = _f64_min_scalar (lanes, 4);
+    for (; i < n; ++i)
+      if (a[i] < r)
+        r = a[i];
+    return r;
+  }
+  
+  RHO_AVX2 static double
+  _f64_max_avx2 (const double *a, long n)
+  {
+    if (n < 4)
+      return _f64_max_scalar (a, n);
+    
+    __m256d m = _mm256_loadu_pd (a);
+    long i = 4;
+    for (; i + 4 <= n; i += 4)
+      m = _mm256_max_pd (m, _mm256_loadu_pd (a + i));
+    
+    double lanes[4];
+    _mm256_storeu_pd (lanes, m);
+    double r = _f64_max_scalar (lanes, 4);
+    for (; i < n; ++i)
+      if (a[i] > r)
+        r = a[i];
+    return r;
+  }
+  
+  RHO_AVX2 static void
+  _i64_add_avx2 (long long *dest, const long long *a, const long long *b,
+                 long n)
+  {
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_si256 ((__m256i *)(dest + i),
+        _mm256_add_epi64 (_mm256_loadu_si256 ((const __m256i *)(a + i)),
+                          _mm256_loadu_si256 ((const __m256i *)(b + i))));
+    for (; i < n; ++i)
+      dest[i] = (long long)((u64)a[i] + (u64)b[i]);
+  }
+  
+  RHO_AVX2 static long long
+  _i64_sum_avx2 (const long long *a, long n)
+  {
+    __m256i acc = _mm256_setzero_si256 ();
+    
+    long i = 0;
+    for (; i + 4 <= n; i += 4)
+      acc = _mm256_add_epi64 (acc,
+        _mm256_loadu_si256 ((const __m256i *)(a + i)));
+    
+    long long lanes[4];
+    _mm256_storeu_si256 ((__m256i *)lanes, acc);
+    u64 r = (u64)lanes[0] + (u64)lanes[1] + (u64)lanes[2] + (u64)lanes[3];
+    for (; i < n; ++i)
+      r += (u64)a[i];
+    return (long long)r;
+  }
+  
+  RHO_AVX2 static long long
+  _i64_min_avx2 (const long long *a, long n)
+  {
+    if (n < 4)
+      return _i64_min_scalar (a, n);
+    
+    __m256i m = _mm256_loadu_si256 ((const __m256i *)a);
+    long i = 4;
+    for (; i + 4 <= n; i += 4)
+      {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(a + i));
+        m = _mm256_blendv_epi8 (m, v, _mm256_cmpgt_epi64 (m, v));
+      }
+    
+    long long lanes[4];
+    _mm256_storeu_si256 ((__m256i *)lanes, m);
+    long long r = _i64_min_scalar (lanes, 4);
+    for (; i < n; ++i)
+      if (a[i] < r)
+        r = a[i];
+    return r;
+  }
+  
+  RHO_AVX2 static long long
+  _i64_max_avx2 (const long long *a, long n)
+  {
+    if (n < 4)
+      return _i64_max_scalar (a, n);
+    
+    __m256i m = _mm256_loadu_si256 ((const __m256i *)a);
+    long i = 4;
+    for (; i + 4 <= n; i += 4)
+      {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(a + i));
+        m = _mm256_blendv_epi8 (m, v, _mm256_cmpgt_epi64 (v, m));
+      }
+    
+    long long lanes[4];
+    _mm256_storeu_si256 ((__m256i *)lanes, m);
+    long long r = _i64_max_scalar (lanes, 4);
+    for (; i < n; ++i)
+      if (a[i] > r)
+        r = a[i];
+    return r;
+  }
+  
+  RHO_AVX2 static long
+  _str_find_avx2 (const char *hay, long n, const char *needle, long m)
+  {
+    const __m256i first = _mm256_set1_epi8 (needle[0]);
+    const __m256i last = _mm256_set1_epi8 (needle[m - 1]);
+    
+    long i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32)
+      {
+        __m256i bf = _mm256_loadu_si256 ((const __m256i *)(hay + i));
+        __m256i bl = _mm256_loadu_si256 ((const __m256i *)(hay + i + m - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8 (
+          _mm256_and_si256 (_mm256_cmpeq_epi8 (bf, first),
+                            _mm256_cmpeq_epi8 (bl, last)));
+        while (mask)
+          {
+            int bit = __builtin_ctz (mask);
+            if (m <= 2 || std::memcmp (hay + i + bit + 1, needle + 1,
+                                       m - 2) == 0)
+              return i + bit;
+            mask &= mask - 1;
+          }
+      }
+    
+    return _str_find_from (hay, n, needle, m, i);
+  }
+  
+  RHO_AVX2 static long
+  _find_byte2_avx2 (const char *s, long n, char a, char b)
+  {
+    const __m256i va = _mm256_set1_epi8 (a);
+    const __m256i vb = _mm256_set1_epi8 (b);
+    
+    long i = 0;
+    for (; i + 32 <= n; i += 32)
+      {
+        __m256i x = _mm256_loadu_si256 ((const __m256i *)(s + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8 (
+          _mm256_or_si256 (_mm256_cmpeq_epi8 (x, va),
+                           _mm256_cmpeq_epi8 (x, vb)));
+        if (mask)
+          return i + __builtin_ctz (mask);
+      }
+    
+    return _find_byte2_from (s, n, a, b, i);
+  }
+  
+#undef RHO_AVX2
+#endif
+  
+  
+  
+//------------------------------------------------------------------------------
+// dispatch
+//------------------------------------------------------------------------------
+  
+  static kernel_table
+  _select_kernels ()
+  {
+    kernel_table t;
+    t.f64_add = &_f64_add_scalar;
+    t.f64_mul = &_f64_mul_scalar;
+    t.f64_fma = &_f64_fma_scalar;
+    t.f64_axpy = &_f64_axpy_scalar;
+    t.f64_dot = &_f64_dot_scalar;
+    t.f64_sum = &_f64_sum_scalar;
+    t.f64_min = &_f64_min_scalar;
+    t.f64_max = &_f64_max_scalar;
+    t.i64_add = &_i64_add_scalar;
+    t.i64_sum = &_i64_sum_scalar;
+    t.i64_min = &_i64_min_scalar;
+    t.i64_max = &_i64_max_scalar;
+    t.str_find = &_str_find_scalar;
+    t.find_byte2 = &_find_byte2_scalar;
+    
+#ifdef RHO_SIMD_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("sse2"))
+      {
+        t.f64_add = &_f64_add_sse2;
+        t.f64_mul = &_f64_mul_sse2;
+        t.f64_fma = &_f64_fma_sse2;
+        t.f64_axpy = &_f64_axpy_sse2;
+        t.f64_dot = &_f64_dot_sse2;
+        t.f64_sum = &_f64_sum_sse2;
+        t.f64_min = &_f64_min_sse2;
+        t.f64_max = &_f64_max_sse2;
+        t.i64_add = &_i64_add_sse2;
+        t.i64_sum = &_i64_sum_sse2;
+        t.str_find = &_str_find_sse2;
+        t.find_byte2 = &_find_byte2_sse2;
+      }
+    
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+      {
+        t.f64_add = &_f64_add_avx2;
+        t.f64_mul = &_f64_mul_avx2;
+        t.f64_fma = &_f64_fma_avx2;
+        t.f64_axpy = &_f64_axpy_avx2;
+        t.f64_dot = &_f64_dot_avx2;
+        t.f64_sum = &_f64_sum_avx2;
+        t.f64_min = &_f64_min_avx2;
+        t.f64_max = &_f64_max_avx2;
+        t.i64_add = &_i64_add_avx2;
+        t.i64_sum = &_i64_sum_avx2;
+        t.i64_min = &_i64_min_avx2;
+        t.i64_max = &_i64_max_avx2;
+        t.str_find = &_str_find_avx2;
+        t.find_byte2 = &_find_byte2_avx2;
+      }
+#endif
+    
+    return t;
+  }
+  
+  static const kernel_table&
+  _kernels ()
+  {
+    static const kernel_table t = _select_kernels ();
+    return t;
+  }
+  
+  
+  
+//------------------------------------------------------------------------------
+  
+  void
+  simd_f64_add (double *dest, const double *a, const double *b, long n)
+    { _kernels ().f64_add (dest, a, b, n); }
+  
+  void
+  simd_f64_mul (double *dest, const double *a, const double *b, long n)
+    { _kernels ().f64_mul (dest, a, b, n); }
+  
+  void
+  simd_f64_fma (double *dest, const double *a, const double *b,
+                const double *c, long n)
+    { _kernels ().f64_fma (dest, a, b, c, n); }
+  
+  void
+  simd_f64_axpy (double *y, double alpha, const double *x, long n)
+    { _kernels ().f64_axpy (y, alpha, x, n); }
+  
+  double
+  simd_f64_dot (const double *a, const double *b, long n)
+    { return _kernels ().f64_dot (a, b, n); }
+  
+  double
+  simd_f64_sum (const double *a, long n)
+    { return _kernels ().f64_sum (a, n); }
+  
+  double
+  simd_f64_min (const double *a, long n)
+    { return _kernels ().f64_min (a, n); }
+  
+  double
+  simd_f64_max (const double *a, long n)
+    { return _kernels ().f64_max (a, n); }
+  
+  
+  void
+  simd_i64_add (long long *dest, const long long *a, const long long *b,
+                long n)
+    { _kernels ().i64_add (dest, a, b, n); }
+  
+  /* 
+   * There is no packed 64-bit multiply below AVX-512, so the multiplication
+   * kernels are left to the compiler's auto-vectorizer.
+   */
+  
+  void
+  simd_i64_mul (long long *dest, const long long *a, const long long *b,
+                long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = (long long)((u64)a[i] * (u64)b[i]);
+  }
+  
+  void
+  simd_i64_fma (long long *dest, const long long *a, const long long *b,
+                const long long *c, long n)
+  {
+    for (long i = 0; i < n; ++i)
+      dest[i] = (long long)((u64)a[i] * (u64)b[i] + (u64)c[i]);
+  }
+  
+  long long
+  simd_i64_dot (const long long *a, const long long *b, long n)
+  {
+    u64 r = 0;
+    for (long i = 0; i < n; ++i)
+      r += (u64)a[i] * (u64)b[i];
+    return (long long)r;
+  }
+  
+  long long
+  simd_i64_sum (const long long *a, long n)
+    { return _kernels ().i64_sum (a, n); }
+  
+  long long
+  simd_i64_min (const long long *a, long n)
+    { return _kernels ().i64_min (a, n); }
+  
+  long long
+  simd_i64_max (const long long *a, long n)
+    { return _kernels ().i64_max (a, n); }
+  
+  long
+  simd_str_find (const char *hay, long n, const char *needle, long m)
+  {
+    if (m == 0)
+      return 0;
+    if (m > n)
+      return -1;
+    return _kernels ().str_find (hay, n, needle, m);
+  }
+  
+  long
+  simd_find_byte2 (const char *s, long n, char a, char b)
+    { return _kernels ().find_byte2 (s, n, a, b); }
+}
+